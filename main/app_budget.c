@@ -0,0 +1,177 @@
+#include "app_budget.h"
+#include <string.h>
+
+#define DAY_S (24 * 60 * 60)
+// Consecutive provider errors that open the breaker
+#define BREAKER_THRESHOLD 3
+#define BREAKER_BASE_S (5 * 60)
+#define BREAKER_MAX_S (2 * 60 * 60)
+#define RATE_LIMIT_OPEN_S (2 * 60)
+// Devices that ran out of quota come back spread over this window after
+// midnight UTC instead of all at 00:00:00
+#define DAY_START_SPREAD_S (15 * 60)
+
+static uint32_t next_rand(app_budget_t *b) {
+  uint32_t x = b->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  b->rng = x;
+  return x;
+}
+
+static void roll_day(app_budget_t *b, int64_t now_s) {
+  uint32_t day = (uint32_t)(now_s / DAY_S);
+  if (day != b->day) {
+    b->day = day;
+    b->used = 0;
+    b->polls = 0;
+  }
+}
+
+static int64_t day_end(const app_budget_t *b) {
+  return (int64_t)(b->day + 1) * DAY_S;
+}
+
+// Decorrelated jitter: the next period is random between the base and three
+// times the last one, so a fleet tripped by the same outage drifts apart
+static void trip(app_budget_t *b, int64_t now_s, uint32_t min_s) {
+  uint32_t hi = b->open_s * 3;
+  if (hi <= BREAKER_BASE_S)
+    hi = BREAKER_BASE_S + 1;
+  uint32_t open = BREAKER_BASE_S + next_rand(b) % (hi - BREAKER_BASE_S);
+  if (open > BREAKER_MAX_S)
+    open = BREAKER_MAX_S;
+  if (open < min_s)
+    open = min_s;
+  b->open_s = open;
+  b->open_until_s = now_s + open;
+  b->state = APP_BREAKER_OPEN;
+}
+
+void app_budget_init(app_budget_t *b, uint32_t daily_limit, uint32_t seed) {
+  memset(b, 0, sizeof(*b));
+  b->daily_limit = daily_limit;
+  b->rng = seed ? seed : 0x9E3779B9u;
+}
+
+void app_budget_restore(app_budget_t *b, const app_budget_record_t *rec) {
+  b->day = rec->day;
+  b->used = rec->used;
+  b->polls = rec->polls;
+}
+
+void app_budget_save(const app_budget_t *b, app_budget_record_t *rec) {
+  rec->day = b->day;
+  rec->used = b->used;
+  rec->polls = b->polls;
+}
+
+bool app_budget_should_persist(const app_budget_t *b,
+                               const app_budget_record_t *saved,
+                               int64_t saved_s, int64_t now_s) {
+  if (b->day != saved->day)
+    return true;
+  if (b->used == saved->used && b->polls == saved->polls)
+    return false;
+  // A lockout lost to a power cut would spend calls the provider refuses
+  if (b->used >= b->daily_limit && saved->used < b->daily_limit)
+    return true;
+  return now_s - saved_s >= APP_BUDGET_PERSIST_S;
+}
+
+bool app_budget_allow(app_budget_t *b, int64_t now_s) {
+  roll_day(b, now_s);
+  if (b->state == APP_BREAKER_OPEN) {
+    if (now_s < b->open_until_s)
+      return false;
+    b->state = APP_BREAKER_HALF_OPEN;
+  }
+  return b->used < b->daily_limit;
+}
+
+void app_budget_on_result(app_budget_t *b, int64_t now_s, uint32_t calls,
+                          app_fetch_err_t err) {
+  roll_day(b, now_s);
+  b->used += calls;
+  if (calls)
+    b->polls++;
+
+  switch (err) {
+  case APP_FETCH_OK:
+    b->state = APP_BREAKER_CLOSED;
+    b->provider_errors = 0;
+    b->open_s = 0;
+    break;
+  case APP_FETCH_NETWORK:
+    // Not the provider's fault, the scheduler backs off on its own
+    break;
+  case APP_FETCH_PROVIDER:
+    b->provider_errors++;
+    if (b->state == APP_BREAKER_HALF_OPEN ||
+        b->provider_errors >= BREAKER_THRESHOLD)
+      trip(b, now_s, 0);
+    break;
+  case APP_FETCH_RATE_LIMIT:
+    b->provider_errors++;
+    trip(b, now_s, RATE_LIMIT_OPEN_S);
+    break;
+  case APP_FETCH_QUOTA:
+    // The provider's count wins over ours
+    if (b->used < b->daily_limit)
+      b->used = b->daily_limit;
+    b->state = APP_BREAKER_OPEN;
+    b->open_until_s = day_end(b) + next_rand(b) % DAY_START_SPREAD_S;
+    break;
+  }
+}
+
+uint32_t app_budget_next_delay_s(app_budget_t *b, int64_t now_s,
+                                 uint32_t delay_s) {
+  roll_day(b, now_s);
+  int64_t wait = delay_s;
+
+  if (b->state == APP_BREAKER_OPEN && b->open_until_s - now_s > wait)
+    wait = b->open_until_s - now_s;
+
+  uint32_t remaining = app_budget_remaining(b, now_s);
+  // Average calls per poll so far today, a poll runs several endpoint jobs
+  uint32_t per_poll = b->polls ? (b->used + b->polls - 1) / b->polls : 1;
+  if (per_poll == 0)
+    per_poll = 1;
+  uint32_t polls_left = remaining / per_poll;
+  int64_t left_s = day_end(b) - now_s;
+  int64_t spread = polls_left
+                       ? left_s / polls_left
+                       : left_s + next_rand(b) % DAY_START_SPREAD_S;
+  if (spread > wait)
+    wait = spread;
+  return (uint32_t)wait;
+}
+
+uint32_t app_budget_remaining(const app_budget_t *b, int64_t now_s) {
+  if ((uint32_t)(now_s / DAY_S) != b->day)
+    return b->daily_limit;
+  return b->used < b->daily_limit ? b->daily_limit - b->used : 0;
+}
+
+bool app_budget_blocked(const app_budget_t *b, int64_t now_s) {
+  if (b->state == APP_BREAKER_OPEN && now_s < b->open_until_s)
+    return true;
+  return app_budget_remaining(b, now_s) == 0;
+}
+
+const char *app_budget_err_name(app_fetch_err_t err) {
+  switch (err) {
+  case APP_FETCH_OK:
+    return "ok";
+  case APP_FETCH_NETWORK:
+    return "network";
+  case APP_FETCH_PROVIDER:
+    return "provider";
+  case APP_FETCH_RATE_LIMIT:
+    return "rate-limit";
+  default:
+    return "quota";
+  }
+}
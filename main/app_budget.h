@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// How a poll ended, from the provider's point of view
+typedef enum {
+  APP_FETCH_OK,
+  APP_FETCH_NETWORK,    // DNS, connect, TLS or timeout: nothing reached the API
+  APP_FETCH_PROVIDER,   // bad key, 5xx, malformed body
+  APP_FETCH_RATE_LIMIT, // 429, too many requests per minute
+  APP_FETCH_QUOTA,      // daily quota used up on the provider side
+} app_fetch_err_t;
+
+typedef enum {
+  APP_BREAKER_CLOSED,
+  APP_BREAKER_OPEN,      // no requests until open_until_s
+  APP_BREAKER_HALF_OPEN, // one probe poll allowed
+} app_breaker_state_t;
+
+// Daily API call budget plus a circuit breaker for provider errors. Pure
+// logic on wall-clock seconds, the day rolls over at 00:00 UTC like the
+// provider's quota.
+typedef struct {
+  uint32_t daily_limit;
+  uint32_t day; // UTC day number of the counters below
+  uint32_t used;
+  uint32_t polls;
+
+  app_breaker_state_t state;
+  uint32_t provider_errors; // consecutive
+  int64_t open_until_s;
+  uint32_t open_s; // last open period, grows with decorrelated jitter
+  uint32_t rng;
+} app_budget_t;
+
+// The persisted part of the budget, see app_budget_save/restore
+typedef struct {
+  uint32_t day;
+  uint32_t used;
+  uint32_t polls;
+} app_budget_record_t;
+
+void app_budget_init(app_budget_t *b, uint32_t daily_limit, uint32_t seed);
+void app_budget_restore(app_budget_t *b, const app_budget_record_t *rec);
+void app_budget_save(const app_budget_t *b, app_budget_record_t *rec);
+
+// Whether the budget is worth a flash write over `saved`, written at
+// `saved_s`: on a new day, once the quota is used up, or when calls made
+// since have waited APP_BUDGET_PERSIST_S. Any clock works for the last two
+// arguments, the device passes seconds since boot.
+#define APP_BUDGET_PERSIST_S (60 * 60)
+bool app_budget_should_persist(const app_budget_t *b,
+                               const app_budget_record_t *saved,
+                               int64_t saved_s, int64_t now_s);
+
+// Whether a poll may go out now. A half-open breaker lets one probe through.
+bool app_budget_allow(app_budget_t *b, int64_t now_s);
+
+// Records a finished poll: `calls` requests that reached the provider and
+// the worst error among them.
+void app_budget_on_result(app_budget_t *b, int64_t now_s, uint32_t calls,
+                          app_fetch_err_t err);
+
+// Stretches the scheduler's `delay_s` so the rest of today's budget lasts
+// until the UTC day ends, and holds polls while the breaker is open.
+uint32_t app_budget_next_delay_s(app_budget_t *b, int64_t now_s,
+                                 uint32_t delay_s);
+
+uint32_t app_budget_remaining(const app_budget_t *b, int64_t now_s);
+// True while the breaker is open or today's quota is used up
+bool app_budget_blocked(const app_budget_t *b, int64_t now_s);
+const char *app_budget_err_name(app_fetch_err_t err);
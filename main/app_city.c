@@ -0,0 +1,374 @@
+#include "app_city.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "app_city";
+
+// Must match tools/gen_city_index.py
+#define CITY_LABEL "cities"
+#define CITY_MAGIC "CIDX"
+#define CITY_VERSION 2
+
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  uint16_t block;
+  uint32_t count;
+  uint32_t records_off;
+  uint32_t strings_off;
+  uint32_t strings_len;
+  uint32_t key_off[3]; // by app_city_key_t
+  uint32_t total_len;
+  uint32_t crc; // of everything after the header
+  uint32_t geo_off;
+  uint8_t reserved[16];
+} city_header_t;
+
+typedef struct {
+  uint32_t id;
+  uint32_t name_zh;
+  uint32_t name_en;
+  uint32_t adm1;
+  uint32_t adm2;
+  int32_t lat; // 1e-5 degrees
+  int32_t lon;
+} city_record_t;
+
+// Records are sorted by cell, cell i holds first[i] .. first[i + 1] - 1
+typedef struct {
+  int32_t lat0; // south west corner
+  int32_t lon0;
+  uint32_t cell;
+  uint16_t rows;
+  uint16_t cols;
+  uint32_t first[];
+} city_grid_t;
+
+_Static_assert(sizeof(city_header_t) == 64, "header layout");
+_Static_assert(sizeof(city_record_t) == 28, "record layout");
+_Static_assert(sizeof(city_grid_t) == 16, "grid layout");
+
+static const uint8_t *s_base;
+static const city_header_t *s_hdr;
+static const city_grid_t *s_grid;
+static esp_partition_mmap_handle_t s_map;
+
+static uint32_t rd32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    uint8_t b = *(*p)++;
+    out |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *v = out;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool app_city_init(void) {
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CITY_LABEL);
+  if (!part) {
+    ESP_LOGW(TAG, "No \"%s\" partition, city lookup disabled", CITY_LABEL);
+    return false;
+  }
+  const void *ptr;
+  if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr,
+                         &s_map) != ESP_OK)
+    return false;
+
+  const city_header_t *h = ptr;
+  if (memcmp(h->magic, CITY_MAGIC, 4) != 0 || h->version != CITY_VERSION ||
+      h->total_len > part->size || h->total_len < sizeof(*h) ||
+      esp_rom_crc32_le(0, (const uint8_t *)ptr + sizeof(*h),
+                       h->total_len - sizeof(*h)) != h->crc) {
+    ESP_LOGW(TAG, "City index missing or corrupt, flash it with idf.py flash");
+    esp_partition_munmap(s_map);
+    return false;
+  }
+  s_base = ptr;
+  s_hdr = h;
+  s_grid = (const city_grid_t *)(s_base + h->geo_off);
+  ESP_LOGI(TAG, "%lu cities mapped", (unsigned long)h->count);
+  return true;
+}
+
+bool app_city_ready(void) { return s_hdr != NULL; }
+
+size_t app_city_count(void) { return s_hdr ? s_hdr->count : 0; }
+
+static const char *str_at(uint32_t off) {
+  return off < s_hdr->strings_len ? (const char *)s_base + s_hdr->strings_off +
+                                        off
+                                  : "";
+}
+
+static const city_record_t *record_at(uint32_t index) {
+  return (const city_record_t *)(s_base + s_hdr->records_off) + index;
+}
+
+static bool get_record(uint32_t index, app_city_t *out) {
+  if (index >= s_hdr->count)
+    return false;
+  const city_record_t *r = record_at(index);
+  out->id = str_at(r->id);
+  out->name_zh = str_at(r->name_zh);
+  out->name_en = str_at(r->name_en);
+  out->adm1 = str_at(r->adm1);
+  out->adm2 = str_at(r->adm2);
+  out->lat = r->lat;
+  out->lon = r->lon;
+  return true;
+}
+
+// Decodes the entry at c->p into c->key and c->record
+static bool read_entry(app_city_cursor_t *c) {
+  uint32_t shared, len;
+  if (c->p >= c->end || !get_varint(&c->p, c->end, &shared) ||
+      !get_varint(&c->p, c->end, &len) || shared > c->key_len ||
+      shared + len >= APP_CITY_KEY_MAX || len > (uint32_t)(c->end - c->p))
+    return false;
+  memcpy(c->key + shared, c->p, len);
+  c->key_len = shared + len;
+  c->key[c->key_len] = '\0';
+  c->p += len;
+  return get_varint(&c->p, c->end, &c->record);
+}
+
+// Compares the first key of a block with the prefix
+static int cmp_block(const uint8_t *block, const uint8_t *end,
+                     const app_city_cursor_t *c) {
+  uint32_t shared, len;
+  if (!get_varint(&block, end, &shared) || !get_varint(&block, end, &len) ||
+      len > (uint32_t)(end - block))
+    return 1;
+  int r = memcmp(block, c->prefix, len < c->prefix_len ? len : c->prefix_len);
+  return r ? r : (int)len - (int)c->prefix_len;
+}
+
+void app_city_find(app_city_cursor_t *c, app_city_key_t key,
+                   const char *prefix) {
+  memset(c, 0, sizeof(*c));
+  if (!s_hdr || key > APP_CITY_BY_ZH)
+    return;
+  size_t n = strlen(prefix);
+  if (n >= APP_CITY_KEY_MAX)
+    return;
+  for (size_t i = 0; i < n; i++) {
+    char ch = prefix[i];
+    c->prefix[i] = key == APP_CITY_BY_EN && ch >= 'A' && ch <= 'Z'
+                       ? ch - 'A' + 'a'
+                       : ch;
+  }
+  c->prefix_len = n;
+
+  const uint8_t *sec = s_base + s_hdr->key_off[key];
+  uint32_t blocks = rd32(sec);
+  const uint8_t *offs = sec + 8;
+  const uint8_t *data = offs + 4 * blocks;
+  c->end = data + rd32(sec + 4);
+  if (blocks == 0)
+    return;
+
+  // Last block whose first key sorts before the prefix, matches may start
+  // at its tail
+  uint32_t lo = 0, hi = blocks;
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+    if (cmp_block(data + rd32(offs + 4 * mid), c->end, c) < 0)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  c->p = data + rd32(offs + 4 * lo);
+}
+
+bool app_city_next(app_city_cursor_t *c, app_city_t *out) {
+  while (c->p && read_entry(c)) {
+    int r = memcmp(c->key, c->prefix,
+                   c->key_len < c->prefix_len ? c->key_len : c->prefix_len);
+    if (r < 0 || (r == 0 && c->key_len < c->prefix_len))
+      continue; // before the range
+    if (r > 0)
+      break; // past it
+    return get_record(c->record, out);
+  }
+  c->p = NULL;
+  return false;
+}
+
+bool app_city_lookup(const char *text, app_city_t *out) {
+  app_city_cursor_t c;
+  for (app_city_key_t key = APP_CITY_BY_ID; key <= APP_CITY_BY_ZH; key++) {
+    app_city_find(&c, key, text);
+    // Keys are sorted, an exact match comes first
+    if (app_city_next(&c, out) && c.key_len == c.prefix_len)
+      return true;
+  }
+  return false;
+}
+
+void app_city_json_begin(app_city_json_t *j, const char *q, int limit) {
+  memset(j, 0, sizeof(*j));
+  j->limit = limit < 1 || limit > APP_CITY_JSON_LIMIT_MAX
+                 ? APP_CITY_JSON_LIMIT_DEFAULT
+                 : limit;
+  if (!q[0])
+    return; // no cursor, an empty array
+  // Digits look up IDs, ASCII letters pinyin, anything else Chinese
+  app_city_key_t key = APP_CITY_BY_ZH;
+  if (isdigit((unsigned char)q[0]))
+    key = APP_CITY_BY_ID;
+  else if (isalpha((unsigned char)q[0]))
+    key = APP_CITY_BY_EN;
+  app_city_find(&j->c, key, q);
+}
+
+// Appends `v` JSON escaped, the list has no control characters
+static size_t json_str(char *out, size_t pos, size_t cap, const char *v) {
+  if (pos < cap)
+    out[pos++] = '"';
+  for (; *v && pos + 2 < cap; v++) {
+    if (*v == '"' || *v == '\\')
+      out[pos++] = '\\';
+    out[pos++] = *v;
+  }
+  if (pos < cap)
+    out[pos++] = '"';
+  return pos;
+}
+
+size_t app_city_json_next(app_city_json_t *j, char *buf, size_t cap) {
+  if (j->done)
+    return 0;
+  size_t pos = 0;
+  if (!j->open) {
+    buf[pos++] = '[';
+    j->open = true;
+  }
+  app_city_t city;
+  // Room for an entry and the closing bracket before taking a city
+  while (pos + APP_CITY_JSON_ENTRY_MAX + 1 <= cap) {
+    if (j->n >= j->limit || !app_city_next(&j->c, &city)) {
+      buf[pos++] = ']';
+      j->done = true;
+      break;
+    }
+    const char *names[] = {"id", "name", "en", "adm1", "adm2"};
+    const char *values[] = {city.id, city.name_zh, city.name_en, city.adm1,
+                            city.adm2};
+    pos += snprintf(buf + pos, cap - pos, "%s{", j->n++ ? "," : "");
+    for (size_t i = 0; i < 5; i++) {
+      pos += snprintf(buf + pos, cap - pos, "%s\"%s\":", i ? "," : "",
+                      names[i]);
+      pos = json_str(buf, pos, cap, values[i]);
+    }
+    buf[pos++] = '}';
+  }
+  return pos;
+}
+
+// Row of a latitude, clamped to the grid
+static int grid_index(int32_t v, int32_t v0, int n) {
+  int64_t i = ((int64_t)v - v0) / (int32_t)s_grid->cell;
+  if (v < v0)
+    i = 0;
+  return i >= n ? n - 1 : (int)i;
+}
+
+// Column of a longitude on the grid continued around the globe, past the
+// last column where there are no cities
+static int grid_col(int32_t lon, int period) {
+  int64_t d = ((int64_t)lon - s_grid->lon0) % 36000000;
+  if (d < 0)
+    d += 36000000;
+  return (int)(d / s_grid->cell) % period;
+}
+
+// Equirectangular: plenty at city spacing, and cheap
+static float dist2(const city_record_t *r, int32_t lat, int32_t lon,
+                   float lon_scale) {
+  float dlat = (float)(r->lat - lat);
+  int32_t d = r->lon - lon;
+  if (d > 18000000)
+    d -= 36000000;
+  else if (d < -18000000)
+    d += 36000000;
+  float dlon = (float)d * lon_scale;
+  return dlat * dlat + dlon * dlon;
+}
+
+size_t app_city_nearest(int32_t lat, int32_t lon, app_city_near_t *out,
+                        size_t n) {
+  if (!s_hdr || n == 0)
+    return 0;
+  if (n > APP_CITY_NEAR_MAX)
+    n = APP_CITY_NEAR_MAX;
+  const city_grid_t *g = s_grid;
+  float lon_scale = cosf((float)lat * (float)(M_PI / 180 / 100000));
+  // Columns wrap at the antimeridian, a ring reaches half way round
+  int period = (int)(36000000 / g->cell);
+  int half = period / 2;
+  int cy = grid_index(lat, g->lat0, g->rows);
+  int cx = grid_col(lon, period);
+
+  // Best so far, nearest first
+  uint32_t best[APP_CITY_NEAR_MAX];
+  float best_d2[APP_CITY_NEAR_MAX];
+  size_t found = 0;
+  int max_r = g->rows > half ? g->rows : half;
+  // Rings short of the grid's columns are empty
+  int r0 = 0;
+  if (cx >= g->cols) {
+    int west = cx - (g->cols - 1), east = period - cx;
+    r0 = west < east ? west : east;
+  }
+  for (int r = r0; r <= max_r; r++) {
+    // Ring r around the query's cell
+    for (int y = cy - r; y <= cy + r; y++) {
+      if (y < 0 || y >= g->rows)
+        continue;
+      int step = y == cy - r || y == cy + r ? 1 : 2 * r;
+      for (int dx = -r; dx <= r; dx += step) {
+        if (dx <= -half || dx > half)
+          continue; // the other way round is nearer
+        int x = (cx + dx + period) % period;
+        if (x >= g->cols)
+          continue;
+        uint32_t cell = (uint32_t)y * g->cols + x;
+        for (uint32_t i = g->first[cell]; i < g->first[cell + 1]; i++) {
+          float d2 = dist2(record_at(i), lat, lon, lon_scale);
+          if (found == n && d2 >= best_d2[n - 1])
+            continue;
+          size_t k = found < n ? found++ : n - 1;
+          for (; k > 0 && best_d2[k - 1] > d2; k--) {
+            best[k] = best[k - 1];
+            best_d2[k] = best_d2[k - 1];
+          }
+          best[k] = i;
+          best_d2[k] = d2;
+        }
+      }
+    }
+    // Cells beyond ring r are at least r cells away on one axis, longitude
+    // either way round
+    float reach = (float)r * g->cell * lon_scale;
+    if (found == n && best_d2[n - 1] <= reach * reach)
+      break;
+  }
+  for (size_t k = 0; k < found; k++) {
+    get_record(best[k], &out[k].city);
+    out[k].meters = (uint32_t)(sqrtf(best_d2[k]) * 1.11195f); // per 1e-5 deg
+  }
+  return found;
+}
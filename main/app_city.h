@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Offline city list, built from China-City-List-latest.csv by
+// tools/gen_city_index.py and memory-mapped from the "cities" partition.
+// Strings point into flash and stay valid for the life of the firmware.
+
+#define APP_CITY_KEY_MAX 48
+
+typedef struct {
+  const char *id; // QWeather Location ID
+  const char *name_zh;
+  const char *name_en; // pinyin for Chinese cities
+  const char *adm1;    // province, Chinese
+  const char *adm2;    // prefecture, Chinese
+  int32_t lat;         // 1e-5 degrees
+  int32_t lon;
+} app_city_t;
+
+typedef enum {
+  APP_CITY_BY_ID,
+  APP_CITY_BY_EN, // ignores ASCII case
+  APP_CITY_BY_ZH,
+} app_city_key_t;
+
+// Walks the cities whose key starts with a prefix, in key order. This and
+// the mapping are all the RAM a search takes.
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+  char key[APP_CITY_KEY_MAX];
+  uint8_t key_len;
+  char prefix[APP_CITY_KEY_MAX];
+  uint8_t prefix_len;
+  uint32_t record;
+} app_city_cursor_t;
+
+// Maps and checks the index. False without the partition or with a bad
+// image, lookups then find nothing.
+bool app_city_init(void);
+bool app_city_ready(void);
+size_t app_city_count(void);
+
+void app_city_find(app_city_cursor_t *c, app_city_key_t key,
+                   const char *prefix);
+bool app_city_next(app_city_cursor_t *c, app_city_t *out);
+
+// Exact match on Location ID, then English name, then Chinese name
+bool app_city_lookup(const char *text, app_city_t *out);
+
+// The portal's /cities?q=<prefix>&limit=n as a JSON array, a chunk at a
+// time from the mapped index so a request needs no heap. The first
+// character of q picks the key: a digit the Location ID, an ASCII letter
+// pinyin, anything else the Chinese name.
+#define APP_CITY_JSON_LIMIT_DEFAULT 10 // for a limit outside 1 .. MAX
+#define APP_CITY_JSON_LIMIT_MAX 30
+// One entry, fields are shorter than APP_CITY_KEY_MAX and escape to at
+// most twice that
+#define APP_CITY_JSON_ENTRY_MAX (5 * (2 * APP_CITY_KEY_MAX + 12))
+
+typedef struct {
+  app_city_cursor_t c;
+  int limit;
+  int n;
+  bool open;
+  bool done;
+} app_city_json_t;
+
+void app_city_json_begin(app_city_json_t *j, const char *q, int limit);
+// Fills `buf` with whole entries, `cap` at least APP_CITY_JSON_ENTRY_MAX
+// + 2. Returns the length, 0 once the array is closed.
+size_t app_city_json_next(app_city_json_t *j, char *buf, size_t cap);
+
+#define APP_CITY_NEAR_MAX 16
+
+typedef struct {
+  app_city_t city;
+  uint32_t meters;
+} app_city_near_t;
+
+// Up to `n` (at most APP_CITY_NEAR_MAX) cities closest to a point in 1e-5
+// degrees, nearest first. A grid of 1 degree cells keeps it to a few
+// dozen distance checks.
+size_t app_city_nearest(int32_t lat, int32_t lon, app_city_near_t *out,
+                        size_t n);
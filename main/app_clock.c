@@ -0,0 +1,198 @@
+#include "app_clock.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "app_clock";
+
+#define CLOCK_CHARS "0123456789:-"
+#define CLOCK_CHAR_COUNT (sizeof(CLOCK_CHARS) - 1)
+#define CLOCK_TEXT_MAX 8
+
+typedef struct {
+  lv_color_t *px; // s_rows rows of w pixels
+  lv_coord_t w;   // advance width
+} sprite_t;
+
+static sprite_t s_sprites[CLOCK_CHAR_COUNT];
+static bool s_ready;     // sprites rasterized
+static lv_coord_t s_top; // first line row any glyph covers
+static lv_coord_t s_rows;
+static const lv_font_t *s_font;
+static lv_color_t s_color;
+static char s_text[CLOCK_TEXT_MAX];
+
+static const sprite_t *sprite_for(char ch) {
+  const char *p = ch ? strchr(CLOCK_CHARS, ch) : NULL;
+  return p ? &s_sprites[p - CLOCK_CHARS] : NULL;
+}
+
+static lv_coord_t char_width(char ch) {
+  if (s_ready) {
+    const sprite_t *sp = sprite_for(ch);
+    return sp ? sp->w : 0;
+  }
+  return lv_font_get_glyph_width(s_font, ch, 0);
+}
+
+// Top of the glyph box, from the top of the line as LVGL places letters
+static lv_coord_t glyph_top(const lv_font_glyph_dsc_t *g) {
+  return s_font->line_height - s_font->base_line - g->box_h - g->ofs_y;
+}
+
+static void free_sprites(void) {
+  for (size_t i = 0; i < CLOCK_CHAR_COUNT; i++) {
+    heap_caps_free(s_sprites[i].px);
+    s_sprites[i].px = NULL;
+  }
+}
+
+// Blends each glyph's alpha bitmap onto `bg` once, as lv_draw_letter
+// would on every redraw
+static bool rasterize(lv_color_t bg) {
+  lv_font_glyph_dsc_t g;
+  lv_coord_t top = s_font->line_height, bottom = 0;
+  for (size_t i = 0; i < CLOCK_CHAR_COUNT; i++) {
+    if (!lv_font_get_glyph_dsc(s_font, &g, CLOCK_CHARS[i], 0) ||
+        8 % g.bpp != 0)
+      return false;
+    top = LV_MIN(top, glyph_top(&g));
+    bottom = LV_MAX(bottom, glyph_top(&g) + g.box_h);
+  }
+  s_top = LV_MAX(top, 0);
+  s_rows = LV_MIN(bottom, s_font->line_height) - s_top;
+
+  for (size_t i = 0; i < CLOCK_CHAR_COUNT; i++) {
+    char ch = CLOCK_CHARS[i];
+    sprite_t *sp = &s_sprites[i];
+    lv_font_get_glyph_dsc(s_font, &g, ch, 0);
+    sp->w = g.adv_w;
+    size_t count = (size_t)sp->w * s_rows;
+    sp->px = heap_caps_malloc_prefer(count * sizeof(lv_color_t), 2,
+                                     MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    if (!sp->px)
+      return false;
+    for (size_t k = 0; k < count; k++)
+      sp->px[k] = bg;
+
+    // MSB first, rows not padded
+    const uint8_t *bmp = lv_font_get_glyph_bitmap(s_font, ch);
+    uint32_t mask = (1u << g.bpp) - 1;
+    lv_coord_t y0 = glyph_top(&g) - s_top;
+    for (lv_coord_t y = 0; bmp && y < g.box_h; y++) {
+      lv_coord_t row = y0 + y;
+      for (lv_coord_t x = 0; x < g.box_w; x++) {
+        uint32_t bit = (uint32_t)(y * g.box_w + x) * g.bpp;
+        uint32_t v = (bmp[bit >> 3] >> (8 - g.bpp - (bit & 7))) & mask;
+        lv_coord_t col = g.ofs_x + x;
+        // Overhang past the advance would paint over the next sprite
+        if (v && col >= 0 && col < sp->w && row >= 0 && row < s_rows)
+          sp->px[row * sp->w + col] =
+              lv_color_mix(s_color, bg, v * 255 / mask);
+      }
+    }
+  }
+  return true;
+}
+
+// Copies the part of a sprite inside the clip area into the draw buffer
+static void blit(lv_draw_ctx_t *ctx, const sprite_t *sp, lv_coord_t x,
+                 lv_coord_t y) {
+  lv_area_t area = {x, y, x + sp->w - 1, y + s_rows - 1};
+  lv_area_t clip;
+  if (!_lv_area_intersect(&clip, &area, ctx->clip_area))
+    return;
+  lv_coord_t buf_w = lv_area_get_width(ctx->buf_area);
+  lv_color_t *dst = (lv_color_t *)ctx->buf +
+                    (clip.y1 - ctx->buf_area->y1) * buf_w +
+                    (clip.x1 - ctx->buf_area->x1);
+  const lv_color_t *src = sp->px + (clip.y1 - y) * sp->w + (clip.x1 - x);
+  size_t len = lv_area_get_width(&clip) * sizeof(lv_color_t);
+  for (lv_coord_t row = clip.y1; row <= clip.y2; row++) {
+    memcpy(dst, src, len);
+    dst += buf_w;
+    src += sp->w;
+  }
+}
+
+static void draw_cb(lv_event_t *e) {
+  lv_obj_t *obj = lv_event_get_target(e);
+  lv_draw_ctx_t *ctx = lv_event_get_draw_ctx(e);
+  lv_point_t pos = {obj->coords.x1, obj->coords.y1};
+  // While a screen fades in, the sprites' baked in background would cover
+  // what shows through: blend the glyphs at that opacity instead
+  lv_opa_t opa = lv_obj_get_style_opa_recursive(obj, LV_PART_MAIN);
+  bool sprites = s_ready && opa >= LV_OPA_COVER;
+  lv_draw_label_dsc_t dsc;
+  if (!sprites) {
+    lv_draw_label_dsc_init(&dsc);
+    dsc.font = s_font;
+    dsc.color = s_color;
+    dsc.opa = opa;
+  }
+  for (const char *c = s_text; *c; c++) {
+    if (sprites)
+      blit(ctx, sprite_for(*c), pos.x, pos.y + s_top);
+    else
+      lv_draw_letter(ctx, &dsc, &pos, *c);
+    pos.x += char_width(*c);
+  }
+}
+
+lv_obj_t *app_clock_create(lv_obj_t *parent, const lv_font_t *font,
+                           lv_color_t color, lv_color_t bg) {
+  s_font = font;
+  s_color = color;
+  s_ready = rasterize(bg);
+  if (!s_ready) {
+    free_sprites();
+    ESP_LOGW(TAG, "No clock sprites, drawing glyphs");
+  }
+
+  lv_obj_t *obj = lv_obj_create(parent);
+  lv_obj_remove_style_all(obj);
+  lv_obj_clear_flag(obj, LV_OBJ_FLAG_CLICKABLE | LV_OBJ_FLAG_SCROLLABLE);
+  lv_obj_set_size(obj, 0, font->line_height);
+  lv_obj_add_event_cb(obj, draw_cb, LV_EVENT_DRAW_MAIN, NULL);
+  return obj;
+}
+
+void app_clock_set_text(lv_obj_t *clock, const char *text) {
+  char next[CLOCK_TEXT_MAX] = {0};
+  for (size_t i = 0, n = 0; text[i] && n < CLOCK_TEXT_MAX - 1; i++) {
+    if (sprite_for(text[i]))
+      next[n++] = text[i];
+  }
+  if (strcmp(next, s_text) == 0)
+    return;
+
+  // Same advances: the other characters stay put, only changed cells
+  // are drawn and flushed
+  bool same_layout = strlen(next) == strlen(s_text);
+  for (size_t i = 0; same_layout && next[i]; i++)
+    same_layout = char_width(next[i]) == char_width(s_text[i]);
+
+  if (same_layout) {
+    lv_coord_t x = clock->coords.x1;
+    for (size_t i = 0; next[i]; i++) {
+      lv_coord_t w = char_width(next[i]);
+      if (next[i] != s_text[i]) {
+        lv_area_t cell = {x, clock->coords.y1, x + w - 1, clock->coords.y2};
+        if (s_ready) {
+          cell.y1 += s_top;
+          cell.y2 = cell.y1 + s_rows - 1;
+        }
+        lv_obj_invalidate_area(clock, &cell);
+      }
+      x += w;
+    }
+  } else {
+    lv_coord_t w = 0;
+    for (size_t i = 0; next[i]; i++)
+      w += char_width(next[i]);
+    // Characters move, also when the total width stays the same
+    lv_obj_invalidate(clock);
+    lv_obj_set_width(clock, w); // keeps the alignment
+  }
+  memcpy(s_text, next, sizeof(s_text));
+}
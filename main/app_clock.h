@@ -0,0 +1,15 @@
+#pragma once
+
+#include "lvgl.h"
+
+// Large clock widget. The glyphs it can show ("0-9", ':' and '-') are
+// rasterized once into RGB565 sprites already blended onto the
+// background, drawing is a copy into LVGL's draw buffer. Laid out like a
+// label of the same font. Draws the glyphs instead while the clock is not
+// opaque (a screen fading in), or if there is no memory for the sprites.
+
+// `bg` must be the flat color behind the clock
+lv_obj_t *app_clock_create(lv_obj_t *parent, const lv_font_t *font,
+                           lv_color_t color, lv_color_t bg);
+// Redraws only the characters that changed while the layout holds
+void app_clock_set_text(lv_obj_t *clock, const char *text);
@@ -0,0 +1,112 @@
+#include "app_config.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "app_config";
+
+#define MAX_SUBSCRIBERS 4
+
+typedef struct {
+  app_config_cb_t cb;
+  void *arg;
+} subscriber_t;
+
+// Readers copy under s_lock, a few hundred bytes with interrupts off. Flash
+// writes happen before, under s_write_mux only.
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static app_config_t s_cfg;
+static bool s_valid = false;
+static uint32_t s_version = 0;
+static SemaphoreHandle_t s_write_mux = NULL;
+static subscriber_t s_subs[MAX_SUBSCRIBERS];
+static int s_sub_count = 0;
+
+static uint32_t diff(const app_config_t *a, const app_config_t *b) {
+  uint32_t changed = 0;
+  if (strcmp(a->ssid, b->ssid) != 0 || strcmp(a->password, b->password) != 0)
+    changed |= APP_CONFIG_WIFI;
+  if (strcmp(a->location, b->location) != 0)
+    changed |= APP_CONFIG_LOCATION;
+  if (a->is_fahrenheit != b->is_fahrenheit)
+    changed |= APP_CONFIG_UNIT;
+  if (a->extra_count != b->extra_count)
+    changed |= APP_CONFIG_CITIES;
+  for (int i = 0; i < a->extra_count && !(changed & APP_CONFIG_CITIES); i++) {
+    if (strcmp(a->extra[i], b->extra[i]) != 0)
+      changed |= APP_CONFIG_CITIES;
+  }
+  return changed;
+}
+
+void app_config_init(void) {
+  if (s_write_mux)
+    return;
+  s_write_mux = xSemaphoreCreateMutex();
+  app_config_t cfg = {0};
+  bool valid = app_store_load_config(&cfg);
+  portENTER_CRITICAL(&s_lock);
+  s_cfg = valid ? cfg : (app_config_t){0};
+  s_valid = valid;
+  s_version = 1;
+  portEXIT_CRITICAL(&s_lock);
+  ESP_LOGI(TAG, "Config %s", valid ? "loaded" : "not set yet");
+}
+
+bool app_config_get(app_config_t *cfg, uint32_t *version) {
+  portENTER_CRITICAL(&s_lock);
+  *cfg = s_cfg;
+  bool valid = s_valid;
+  if (version)
+    *version = s_version;
+  portEXIT_CRITICAL(&s_lock);
+  return valid;
+}
+
+uint32_t app_config_version(void) {
+  portENTER_CRITICAL(&s_lock);
+  uint32_t version = s_version;
+  portEXIT_CRITICAL(&s_lock);
+  return version;
+}
+
+bool app_config_set(const app_config_t *cfg) {
+  xSemaphoreTake(s_write_mux, portMAX_DELAY);
+  if (!app_store_save_config(cfg)) {
+    xSemaphoreGive(s_write_mux);
+    ESP_LOGE(TAG, "Failed to save config");
+    return false;
+  }
+  // Only writers change s_cfg, reading it here needs no lock
+  uint32_t changed = s_valid ? diff(&s_cfg, cfg) : ~0u;
+  subscriber_t subs[MAX_SUBSCRIBERS];
+  portENTER_CRITICAL(&s_lock);
+  s_cfg = *cfg;
+  s_valid = true;
+  if (changed)
+    s_version++;
+  int count = s_sub_count;
+  memcpy(subs, s_subs, sizeof(subs));
+  portEXIT_CRITICAL(&s_lock);
+  xSemaphoreGive(s_write_mux);
+
+  if (changed) {
+    ESP_LOGI(TAG, "Config version %lu, changed 0x%lx",
+             (unsigned long)app_config_version(), (unsigned long)changed);
+    for (int i = 0; i < count; i++)
+      subs[i].cb(changed, subs[i].arg);
+  }
+  return true;
+}
+
+bool app_config_subscribe(app_config_cb_t cb, void *arg) {
+  bool ok = false;
+  portENTER_CRITICAL(&s_lock);
+  if (s_sub_count < MAX_SUBSCRIBERS) {
+    s_subs[s_sub_count++] = (subscriber_t){cb, arg};
+    ok = true;
+  }
+  portEXIT_CRITICAL(&s_lock);
+  return ok;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "app_store.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// What differs between two config versions
+typedef enum {
+  APP_CONFIG_WIFI = 1 << 0,     // ssid or password
+  APP_CONFIG_LOCATION = 1 << 1, // primary location
+  APP_CONFIG_UNIT = 1 << 2,
+  APP_CONFIG_CITIES = 1 << 3, // extra locations
+} app_config_change_t;
+
+// Runs in the writer's task after a change was published. Keep it short,
+// e.g. wake the task that acts on it.
+typedef void (*app_config_cb_t)(uint32_t changed, void *arg);
+
+// In-RAM copy of app_config_t, loaded from NVS once at boot. Readers get a
+// consistent copy without touching flash.
+void app_config_init(void);
+
+// Copies the current config and, if `version` is not NULL, its version.
+// Never waits on flash or on a writer. Returns false (and a zeroed config)
+// until a config has been saved.
+bool app_config_get(app_config_t *cfg, uint32_t *version);
+uint32_t app_config_version(void);
+
+// Persists `cfg`, then publishes it and notifies the subscribers of what
+// changed. Writers are serialized.
+bool app_config_set(const app_config_t *cfg);
+
+bool app_config_subscribe(app_config_cb_t cb, void *arg);
@@ -0,0 +1,315 @@
+#include "app_dns.h"
+#include "app_metrics.h"
+#include "app_store.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *TAG = "app_dns";
+
+#define DNS_CACHE_MAX 4
+#define DNS_HOST_LEN 64
+#define DNS_PORT 53
+#define DNS_TIMEOUT_MS 1500
+#define DNS_TRIES 2
+// Clamp odd TTLs: 0 would mean a lookup per request, days would pin a dead
+// address after a provider migration
+#define DNS_TTL_MIN_S 60
+#define DNS_TTL_MAX_S (24 * 60 * 60)
+// When no TTL is available (getaddrinfo fallback)
+#define DNS_TTL_DEFAULT_S 300
+// After a failed refresh the stale address is served this long before the
+// next attempt
+#define DNS_RETRY_S 60
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_CNAME 5
+#define DNS_CLASS_IN 1
+
+typedef struct {
+  char host[DNS_HOST_LEN];
+  uint32_t addr;    // network byte order, 0 = empty slot
+  int64_t expires;  // wall-clock seconds
+  int64_t retry_at; // no refresh before this after a failure
+} dns_entry_t;
+
+static dns_entry_t s_cache[DNS_CACHE_MAX];
+static SemaphoreHandle_t s_dns_mux = NULL;
+
+static dns_entry_t *find_entry(const char *host) {
+  for (int i = 0; i < DNS_CACHE_MAX; i++) {
+    if (s_cache[i].addr && strcmp(s_cache[i].host, host) == 0)
+      return &s_cache[i];
+  }
+  return NULL;
+}
+
+static dns_entry_t *new_entry(const char *host) {
+  // Evict the entry closest to expiry
+  dns_entry_t *slot = &s_cache[0];
+  for (int i = 0; i < DNS_CACHE_MAX; i++) {
+    if (!s_cache[i].addr) {
+      slot = &s_cache[i];
+      break;
+    }
+    if (s_cache[i].expires < slot->expires)
+      slot = &s_cache[i];
+  }
+  memset(slot, 0, sizeof(*slot));
+  strncpy(slot->host, host, sizeof(slot->host) - 1);
+  return slot;
+}
+
+static bool get_dns_server(uint32_t *addr) {
+  esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  esp_netif_dns_info_t dns;
+  if (!netif || esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns) !=
+                    ESP_OK ||
+      dns.ip.type != ESP_IPADDR_TYPE_V4 || dns.ip.u_addr.ip4.addr == 0)
+    return false;
+  *addr = dns.ip.u_addr.ip4.addr;
+  return true;
+}
+
+static size_t build_query(uint8_t *buf, size_t len, uint16_t id,
+                          const char *host) {
+  if (strlen(host) + 18 > len)
+    return 0;
+  memset(buf, 0, 12);
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = 0x01; // RD
+  buf[5] = 1;    // QDCOUNT
+  size_t n = 12;
+  // "a.b.c" -> 1a1b1c0
+  while (*host) {
+    size_t label = strcspn(host, ".");
+    if (label == 0 || label > 63)
+      return 0;
+    buf[n++] = label;
+    memcpy(buf + n, host, label);
+    n += label;
+    host += label;
+    if (*host == '.')
+      host++;
+  }
+  buf[n++] = 0;
+  buf[n++] = 0;
+  buf[n++] = DNS_TYPE_A;
+  buf[n++] = 0;
+  buf[n++] = DNS_CLASS_IN;
+  return n;
+}
+
+// Skips a possibly compressed name, returns the offset after it or 0
+static size_t skip_name(const uint8_t *buf, size_t len, size_t pos) {
+  while (pos < len) {
+    uint8_t l = buf[pos];
+    if (l == 0)
+      return pos + 1;
+    if ((l & 0xc0) == 0xc0)
+      return pos + 2 <= len ? pos + 2 : 0;
+    pos += l + 1;
+  }
+  return 0;
+}
+
+// First A record of the answer. The TTL is the smallest along the CNAME chain,
+// since any link of it may change when it expires. Only a reply to `query`
+// counts: same transaction ID and the question echoed back unchanged.
+static bool parse_response(const uint8_t *buf, size_t len,
+                           const uint8_t *query, size_t qlen, uint32_t *addr,
+                           uint32_t *ttl) {
+  if (len < qlen || buf[0] != query[0] || buf[1] != query[1] ||
+      !(buf[2] & 0x80) || (buf[3] & 0x0f) != 0)
+    return false;
+  int qd = (buf[4] << 8) | buf[5];
+  int an = (buf[6] << 8) | buf[7];
+  if (qd != 1 || memcmp(buf + 12, query + 12, qlen - 12) != 0)
+    return false;
+
+  size_t pos = qlen;
+
+  uint32_t min_ttl = UINT32_MAX;
+  for (int i = 0; i < an; i++) {
+    pos = skip_name(buf, len, pos);
+    if (!pos || pos + 10 > len)
+      return false;
+    uint16_t type = (buf[pos] << 8) | buf[pos + 1];
+    uint16_t cls = (buf[pos + 2] << 8) | buf[pos + 3];
+    uint32_t rttl = ((uint32_t)buf[pos + 4] << 24) | (buf[pos + 5] << 16) |
+                    (buf[pos + 6] << 8) | buf[pos + 7];
+    uint16_t rdlen = (buf[pos + 8] << 8) | buf[pos + 9];
+    pos += 10;
+    if (pos + rdlen > len)
+      return false;
+    if (cls == DNS_CLASS_IN && (type == DNS_TYPE_A || type == DNS_TYPE_CNAME) &&
+        rttl < min_ttl)
+      min_ttl = rttl;
+    if (cls == DNS_CLASS_IN && type == DNS_TYPE_A && rdlen == 4) {
+      memcpy(addr, buf + pos, 4);
+      *ttl = min_ttl;
+      return true;
+    }
+    pos += rdlen;
+  }
+  return false;
+}
+
+// One A query straight to the configured server. lwIP's resolver keeps the
+// TTL to itself, so the cache asks on its own.
+static bool query_server(const char *host, uint32_t *addr, uint32_t *ttl) {
+  uint32_t server;
+  if (!get_dns_server(&server))
+    return false;
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0)
+    return false;
+  struct timeval tv = {.tv_sec = DNS_TIMEOUT_MS / 1000,
+                       .tv_usec = (DNS_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  struct sockaddr_in to = {
+      .sin_family = AF_INET,
+      .sin_port = htons(DNS_PORT),
+      .sin_addr.s_addr = server,
+  };
+
+  uint8_t query[DNS_HOST_LEN + 18];
+  uint8_t buf[512];
+  bool ok = false;
+  for (int attempt = 0; attempt < DNS_TRIES && !ok; attempt++) {
+    uint16_t id = esp_random() & 0xffff;
+    size_t qlen = build_query(query, sizeof(query), id, host);
+    if (qlen == 0 || sendto(sock, query, qlen, 0, (struct sockaddr *)&to,
+                            sizeof(to)) < 0)
+      break;
+    int n;
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    // Anyone can aim a datagram at the port: skip what did not come from
+    // the server or does not answer this query, until the timeout
+    while (!ok && (n = recvfrom(sock, buf, sizeof(buf), 0,
+                                (struct sockaddr *)&from, &from_len)) > 0) {
+      if (from_len == sizeof(from) && from.sin_family == AF_INET &&
+          from.sin_addr.s_addr == server && from.sin_port == htons(DNS_PORT))
+        ok = parse_response(buf, n, query, qlen, addr, ttl);
+      else
+        ESP_LOGD(TAG, "Ignoring datagram from %s", inet_ntoa(from.sin_addr));
+      from_len = sizeof(from);
+    }
+  }
+  close(sock);
+  return ok;
+}
+
+// System resolver as a second opinion, e.g. when plain UDP to the server is
+// filtered. No TTL comes back, a default is assumed.
+static bool query_system(const char *host, uint32_t *addr, uint32_t *ttl) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *ai = NULL;
+  if (getaddrinfo(host, NULL, &hints, &ai) != 0 || !ai)
+    return false;
+  *addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
+  *ttl = DNS_TTL_DEFAULT_S;
+  freeaddrinfo(ai);
+  return true;
+}
+
+static void save_cache(void) {
+  app_store_save_blob("dns_cache", s_cache, sizeof(s_cache));
+}
+
+// Called with s_dns_mux held
+static bool refresh(const char *host, dns_entry_t *e) {
+  uint32_t addr = 0, ttl = 0;
+  int64_t start = esp_timer_get_time();
+  bool ok = query_server(host, &addr, &ttl) || query_system(host, &addr, &ttl);
+  app_metrics_record(APP_PHASE_DNS, esp_timer_get_time() - start);
+
+  time_t now = time(NULL);
+  if (!ok) {
+    if (e) {
+      e->retry_at = now + DNS_RETRY_S;
+      ESP_LOGW(TAG, "Resolving %s failed, keeping last known address",
+               host);
+    } else {
+      ESP_LOGE(TAG, "Resolving %s failed", host);
+    }
+    return false;
+  }
+
+  if (ttl < DNS_TTL_MIN_S)
+    ttl = DNS_TTL_MIN_S;
+  if (ttl > DNS_TTL_MAX_S)
+    ttl = DNS_TTL_MAX_S;
+  bool changed = !e || e->addr != addr;
+  if (!e)
+    e = new_entry(host);
+  e->addr = addr;
+  e->expires = now + ttl;
+  e->retry_at = 0;
+  char ip[16];
+  inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+  ESP_LOGI(TAG, "%s -> %s, ttl %lu s", host, ip, (unsigned long)ttl);
+  // Expiry alone does not need to survive a reboot, only the address does
+  if (changed)
+    save_cache();
+  return true;
+}
+
+static bool needs_refresh(const dns_entry_t *e, int64_t at) {
+  return !e || (e->expires <= at && e->retry_at <= at);
+}
+
+void app_dns_init(void) {
+  if (s_dns_mux)
+    return;
+  s_dns_mux = xSemaphoreCreateMutex();
+  size_t len = sizeof(s_cache);
+  if (!app_store_load_blob("dns_cache", s_cache, &len) ||
+      len != sizeof(s_cache)) {
+    memset(s_cache, 0, sizeof(s_cache));
+    return;
+  }
+  for (int i = 0; i < DNS_CACHE_MAX; i++) {
+    s_cache[i].host[DNS_HOST_LEN - 1] = '\0';
+    s_cache[i].retry_at = 0;
+  }
+}
+
+bool app_dns_lookup(const char *host, char *ip, size_t len) {
+  if (strlen(host) >= DNS_HOST_LEN)
+    return false;
+
+  xSemaphoreTake(s_dns_mux, portMAX_DELAY);
+  dns_entry_t *e = find_entry(host);
+  if (needs_refresh(e, time(NULL))) {
+    refresh(host, e);
+    e = find_entry(host);
+  }
+  bool ok = e != NULL;
+  if (ok)
+    inet_ntop(AF_INET, &e->addr, ip, len);
+  xSemaphoreGive(s_dns_mux);
+  return ok;
+}
+
+void app_dns_prefetch(const char *host, uint32_t within_s) {
+  if (strlen(host) >= DNS_HOST_LEN)
+    return;
+
+  xSemaphoreTake(s_dns_mux, portMAX_DELAY);
+  dns_entry_t *e = find_entry(host);
+  if (needs_refresh(e, time(NULL) + within_s))
+    refresh(host, e);
+  xSemaphoreGive(s_dns_mux);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// IPv4 address cache for the API hosts. Entries honor the record TTL, survive
+// reboots in NVS and are kept as last-known-good after they expire: when the
+// resolver is down, the old address is still worth a connection attempt.
+void app_dns_init(void);
+
+// Writes the dotted-quad address of `host` into `ip`. Served from the cache
+// while fresh, resolved otherwise. Returns false only when the host was never
+// resolved and the resolver fails.
+bool app_dns_lookup(const char *host, char *ip, size_t len);
+
+// Re-resolves `host` now if its entry expires within `within_s` seconds, so
+// the next lookup does not wait on the network.
+void app_dns_prefetch(const char *host, uint32_t within_s);
@@ -1,9 +1,12 @@
 #include "app_hal.h"
 #include "app_net.h"
+#include "app_snapshot.h"
 #include "app_store.h"
+#include "app_weather.h"
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 #include "driver/spi_master.h"
+#include "esp_heap_caps.h"
 #include "esp_lcd_panel_io.h"
 #include "esp_lcd_panel_ops.h"
 #include "esp_lcd_panel_st7789.h"
@@ -14,6 +17,7 @@
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "iot_button.h"
+#include <string.h>
 
 static const char *TAG = "app_hal";
 static SemaphoreHandle_t s_lvgl_mux = NULL;
@@ -32,6 +36,22 @@ static SemaphoreHandle_t s_lvgl_mux = NULL;
 #define LCD_H 240
 #define LCD_X_GAP 52
 #define LCD_Y_GAP 40
+#define LCD_BAND_ROWS 40
+
+// The boot snapshot stays up until the clock is live or this long at most
+#define SPLASH_HOLD_MS 15000
+// Lets LVGL finish the redraw a snapshot request was made for
+#define SNAPSHOT_SETTLE_US (500 * 1000)
+
+// Copy of what the panel shows, in panel byte order, for snapshots
+static uint16_t *s_shadow;
+// LVGL renders but does not flush while the boot snapshot is on screen
+static bool s_splash_hold;
+static SemaphoreHandle_t s_trans_done;
+static int64_t s_snapshot_at; // 0: none requested
+// Flash writes for snapshots happen here, below the UI and network tasks
+static TaskHandle_t s_snapshot_task;
+static volatile bool s_snapshot_busy; // staged frame not written yet
 
 static void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area,
                           lv_color_t *color_map) {
@@ -46,11 +66,49 @@ static void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area,
   }
 #endif
 
-  esp_lcd_panel_draw_bitmap(panel, area->x1, area->y1, area->x2 + 1,
-                            area->y2 + 1, color_map);
+  if (s_shadow) {
+    int w = area->x2 - area->x1 + 1;
+    const uint16_t *src = (const uint16_t *)color_map;
+    for (int y = area->y1; y <= area->y2; y++, src += w)
+      memcpy(&s_shadow[y * LCD_W + area->x1], src, w * sizeof(uint16_t));
+  }
+  if (!s_splash_hold) {
+    esp_lcd_panel_draw_bitmap(panel, area->x1, area->y1, area->x2 + 1,
+                              area->y2 + 1, color_map);
+    app_hal_stats_flush(area);
+  }
   lv_disp_flush_ready(drv);
 }
 
+static bool color_trans_done_cb(esp_lcd_panel_io_handle_t io,
+                                esp_lcd_panel_io_event_data_t *edata,
+                                void *user_ctx) {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(s_trans_done, &woken);
+  return woken == pdTRUE;
+}
+
+// The band buffer is reused for the next band, wait for its DMA to finish
+static void splash_draw(int y0, int y1, const uint16_t *px, void *arg) {
+  esp_lcd_panel_handle_t panel = arg;
+  esp_lcd_panel_draw_bitmap(panel, 0, y0, LCD_W, y1, px);
+  xSemaphoreTake(s_trans_done, pdMS_TO_TICKS(100));
+}
+
+static void splash_timeout_cb(lv_timer_t *timer) { app_hal_splash_done(); }
+
+void app_hal_splash_done(void) {
+  if (!s_splash_hold)
+    return;
+  s_splash_hold = false;
+  lv_obj_invalidate(lv_scr_act());
+}
+
+void app_hal_snapshot_request(void) {
+  if (s_shadow && !s_snapshot_at)
+    s_snapshot_at = esp_timer_get_time() + SNAPSHOT_SETTLE_US;
+}
+
 static void lvgl_tick_cb(void *arg) { lv_tick_inc(1); }
 
 void app_hal_lvgl_lock(void) {
@@ -85,27 +143,58 @@ static void button_press_up_cb(void *arg, void *usr_data) {
   if (press_duration >= 8000) {
     ESP_LOGE(TAG, "BOOT held for 8s: Factory Reset");
     app_store_factory_reset();
+    app_snapshot_clear();
     esp_restart();
   } else if (press_duration >= 5000) {
     ESP_LOGW(TAG, "BOOT held for 5s: Enter Provisioning");
     app_net_start_provisioning();
+  } else if (press_duration < 1000) {
+    ESP_LOGI(TAG, "BOOT short press: Refresh weather");
+    app_weather_update(NULL, NULL);
   }
 }
 
 static void lvgl_task(void *arg) {
   while (1) {
     app_hal_lvgl_lock();
+    int64_t start = esp_timer_get_time();
     uint32_t task_delay = lv_timer_handler();
+    int64_t now = esp_timer_get_time();
+    app_hal_stats_render(start, now);
+    bool snapshot = s_snapshot_at && now >= s_snapshot_at && !s_splash_hold;
+    if (snapshot && s_snapshot_busy) {
+      // The last one is still being written, look again shortly
+      s_snapshot_at = now + SNAPSHOT_SETTLE_US;
+      snapshot = false;
+    }
+    if (snapshot)
+      s_snapshot_at = 0;
     app_hal_lvgl_unlock();
+    // Only this task flushes, so the shadow holds still while it is
+    // encoded. Erasing and programming flash would stall the UI for up to a
+    // second, the snapshot task does that.
+    if (snapshot && app_snapshot_stage(s_shadow, LCD_W, LCD_H)) {
+      s_snapshot_busy = true;
+      xTaskNotifyGive(s_snapshot_task);
+    }
     if (task_delay > 500)
       task_delay = 500;
     vTaskDelay(pdMS_TO_TICKS(task_delay > 0 ? task_delay : 5));
   }
 }
 
+static void snapshot_task(void *arg) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    app_snapshot_write();
+    s_snapshot_busy = false;
+  }
+}
+
 void app_hal_init(void) {
   ESP_LOGI(TAG, "Initializing HAL (Display, Input)...");
   s_lvgl_mux = xSemaphoreCreateMutex();
+  s_trans_done = xSemaphoreCreateBinary();
 
   /* 1. Power Config */
   gpio_set_direction(TFT_POWER, GPIO_MODE_OUTPUT);
@@ -135,7 +224,7 @@ void app_hal_init(void) {
       .sclk_io_num = TFT_SCLK,
       .quadwp_io_num = -1,
       .quadhd_io_num = -1,
-      .max_transfer_sz = LCD_W * 40 * sizeof(lv_color_t),
+      .max_transfer_sz = LCD_W * LCD_BAND_ROWS * sizeof(lv_color_t),
   };
   ESP_ERROR_CHECK(spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO));
 
@@ -148,6 +237,7 @@ void app_hal_init(void) {
       .lcd_param_bits = 8,
       .spi_mode = 0,
       .trans_queue_depth = 10,
+      .on_color_trans_done = color_trans_done_cb,
   };
   ESP_ERROR_CHECK(esp_lcd_new_panel_io_spi((esp_lcd_spi_bus_handle_t)SPI2_HOST,
                                            &io_cfg, &io_handle));
@@ -166,14 +256,29 @@ void app_hal_init(void) {
   ESP_ERROR_CHECK(esp_lcd_panel_set_gap(panel_handle, LCD_X_GAP, LCD_Y_GAP));
   ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
 
-  /* 4. LVGL Init */
-  lv_init();
   static lv_color_t *buf1 = NULL;
   static lv_color_t *buf2 = NULL;
-  buf1 = heap_caps_malloc(LCD_W * 40 * sizeof(lv_color_t), MALLOC_CAP_DMA);
-  buf2 = heap_caps_malloc(LCD_W * 40 * sizeof(lv_color_t), MALLOC_CAP_DMA);
+  buf1 = heap_caps_malloc(LCD_W * LCD_BAND_ROWS * sizeof(lv_color_t),
+                          MALLOC_CAP_DMA);
+  buf2 = heap_caps_malloc(LCD_W * LCD_BAND_ROWS * sizeof(lv_color_t),
+                          MALLOC_CAP_DMA);
+
+  /* 4. 开机画面：上次保存的界面截图，LVGL 启动前直接推送到屏幕 */
+  app_snapshot_init();
+  s_shadow = heap_caps_calloc(LCD_W * LCD_H, sizeof(uint16_t),
+                              MALLOC_CAP_SPIRAM);
+  int64_t splash_start = esp_timer_get_time();
+  s_splash_hold =
+      app_snapshot_show(LCD_W, LCD_H, (uint16_t *)buf1, LCD_BAND_ROWS,
+                        splash_draw, panel_handle);
+  if (s_splash_hold)
+    ESP_LOGI(TAG, "Boot snapshot shown in %lu us",
+             (unsigned long)(esp_timer_get_time() - splash_start));
+
+  /* 5. LVGL Init */
+  lv_init();
   static lv_disp_draw_buf_t draw_buf;
-  lv_disp_draw_buf_init(&draw_buf, buf1, buf2, LCD_W * 40);
+  lv_disp_draw_buf_init(&draw_buf, buf1, buf2, LCD_W * LCD_BAND_ROWS);
 
   static lv_disp_drv_t disp_drv;
   lv_disp_drv_init(&disp_drv);
@@ -189,10 +294,15 @@ void app_hal_init(void) {
   esp_timer_handle_t tick_timer;
   ESP_ERROR_CHECK(esp_timer_create(&tick_timer_args, &tick_timer));
   ESP_ERROR_CHECK(esp_timer_start_periodic(tick_timer, 1000));
+  if (s_splash_hold) {
+    lv_timer_t *t = lv_timer_create(splash_timeout_cb, SPLASH_HOLD_MS, NULL);
+    lv_timer_set_repeat_count(t, 1);
+  }
 
   xTaskCreatePinnedToCore(lvgl_task, "lvgl", 8192, NULL, 5, NULL, 1);
+  xTaskCreate(snapshot_task, "app_snapshot", 3072, NULL, 1, &s_snapshot_task);
 
-  /* 5. BOOT Button */
+  /* 6. BOOT Button */
   button_config_t gpio_btn_cfg = {
       .type = BUTTON_TYPE_GPIO,
       .long_press_time = 0,
@@ -9,3 +9,24 @@ void app_hal_lvgl_lock(void);
 void app_hal_lvgl_unlock(void);
 
 void app_hal_set_backlight(int percent); // 0-100
+
+// Hands the panel from the boot snapshot over to LVGL. Call with the LVGL
+// lock held, once the screen has live content.
+void app_hal_splash_done(void);
+// Saves what the panel shows as the next boot snapshot, shortly after the
+// pending redraw. Call with the LVGL lock held.
+void app_hal_snapshot_request(void);
+
+typedef struct {
+  uint32_t flushes;      // areas sent to the panel since boot
+  uint64_t pixels;       // pixels in them
+  uint32_t pixels_per_s; // over the last second
+  uint32_t peak_per_s;
+  uint64_t render_us; // time in lv_timer_handler(), flushing included
+} app_hal_display_stats_t;
+
+void app_hal_get_display_stats(app_hal_display_stats_t *stats);
+// Counted by the flush callback and the LVGL task, with the LVGL lock
+// held. In app_hal_stats.c, apart from the panel driver.
+void app_hal_stats_flush(const lv_area_t *area);
+void app_hal_stats_render(int64_t start_us, int64_t end_us);
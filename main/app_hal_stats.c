@@ -0,0 +1,36 @@
+#include "app_hal.h"
+
+// Redraw cost, updated under the LVGL lock
+static app_hal_display_stats_t s_disp;
+static uint64_t s_window_px; // s_disp.pixels when the window started
+static int64_t s_window_start;
+
+void app_hal_stats_flush(const lv_area_t *area) {
+  s_disp.flushes++;
+  s_disp.pixels += (uint32_t)(area->x2 - area->x1 + 1) *
+                   (uint32_t)(area->y2 - area->y1 + 1);
+}
+
+// Pixels per second over whole-second windows
+static void update_rate(int64_t now) {
+  if (now - s_window_start < 1000 * 1000)
+    return;
+  uint32_t rate =
+      (s_disp.pixels - s_window_px) * 1000000 / (now - s_window_start);
+  s_disp.pixels_per_s = rate;
+  if (rate > s_disp.peak_per_s)
+    s_disp.peak_per_s = rate;
+  s_window_px = s_disp.pixels;
+  s_window_start = now;
+}
+
+void app_hal_stats_render(int64_t start_us, int64_t end_us) {
+  s_disp.render_us += end_us - start_us;
+  update_rate(end_us);
+}
+
+void app_hal_get_display_stats(app_hal_display_stats_t *stats) {
+  app_hal_lvgl_lock();
+  *stats = s_disp;
+  app_hal_lvgl_unlock();
+}
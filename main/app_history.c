@@ -0,0 +1,335 @@
+#include "app_history.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "app_history";
+
+// Append-only log in a ring of flash sectors. Slot 0 of each sector holds a
+// header with a sequence number and the time of its first record, the other
+// slots hold one record each. Sectors are recycled in ring order, so every
+// sector is erased once per revolution and wear stays even.
+//
+// Crash safety: a sector whose erase or header write was cut off has no
+// valid header and is skipped. A torn record fails its CRC and is skipped,
+// the next append goes to the slot after it.
+#define HISTORY_LABEL "history"
+#define HISTORY_MAGIC 0x54534948 // "HIST"
+#define HISTORY_VERSION 1
+#define SECTOR_SIZE 4096
+#define SLOT_SIZE sizeof(app_history_rec_t)
+#define SLOTS_PER_SECTOR (SECTOR_SIZE / SLOT_SIZE)
+#define SLOT_S (15 * 60)
+// Records read per flash access during scans and queries
+#define READ_CHUNK 16
+#define MAX_SECTORS 128
+
+_Static_assert(sizeof(app_history_rec_t) == 16, "record must fill a slot");
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t first_time;
+  uint8_t version;
+  uint8_t reserved[2];
+  uint8_t crc;
+} sector_header_t;
+
+_Static_assert(sizeof(sector_header_t) == SLOT_SIZE, "header fills slot 0");
+
+static const esp_partition_t *s_part;
+static SemaphoreHandle_t s_mux;
+static uint32_t s_sectors;
+// Sparse time index: one entry per sector, seq 0 marks an unused sector
+static uint32_t s_seq[MAX_SECTORS];
+static uint32_t s_first[MAX_SECTORS];
+static int s_head = -1; // sector being appended to
+static uint32_t s_head_slot;
+static uint32_t s_last_time;
+static app_history_stats_t s_stats;
+
+static uint8_t rec_crc(const app_history_rec_t *rec) {
+  return esp_rom_crc8_le(0, (const uint8_t *)rec,
+                         offsetof(app_history_rec_t, crc));
+}
+
+static uint8_t header_crc(const sector_header_t *h) {
+  return esp_rom_crc8_le(0, (const uint8_t *)h,
+                         offsetof(sector_header_t, crc));
+}
+
+static bool is_erased(const void *slot) {
+  const uint8_t *p = slot;
+  for (size_t i = 0; i < SLOT_SIZE; i++) {
+    if (p[i] != 0xFF)
+      return false;
+  }
+  return true;
+}
+
+static size_t slot_addr(uint32_t sector, uint32_t slot) {
+  return (size_t)sector * SECTOR_SIZE + (size_t)slot * SLOT_SIZE;
+}
+
+// Finds the first free slot of the head sector and the newest record time
+static void scan_head(void) {
+  app_history_rec_t buf[READ_CHUNK];
+  s_head_slot = 1;
+  s_last_time = s_first[s_head];
+  for (uint32_t slot = 1; slot < SLOTS_PER_SECTOR; slot += READ_CHUNK) {
+    uint32_t n = SLOTS_PER_SECTOR - slot;
+    if (n > READ_CHUNK)
+      n = READ_CHUNK;
+    if (esp_partition_read(s_part, slot_addr(s_head, slot), buf,
+                           n * SLOT_SIZE) != ESP_OK)
+      return;
+    for (uint32_t i = 0; i < n; i++) {
+      if (is_erased(&buf[i]))
+        return;
+      s_head_slot = slot + i + 1;
+      if (buf[i].crc == rec_crc(&buf[i]) && buf[i].time > s_last_time)
+        s_last_time = buf[i].time;
+    }
+  }
+}
+
+void app_history_init(void) {
+  s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                    ESP_PARTITION_SUBTYPE_ANY, HISTORY_LABEL);
+  if (!s_part) {
+    ESP_LOGW(TAG, "No \"%s\" partition, history disabled", HISTORY_LABEL);
+    return;
+  }
+  s_sectors = s_part->size / SECTOR_SIZE;
+  if (s_sectors > MAX_SECTORS)
+    s_sectors = MAX_SECTORS;
+  if (!s_mux)
+    s_mux = xSemaphoreCreateMutex();
+  // The index is rebuilt from flash, also when init runs again
+  memset(s_seq, 0, sizeof(s_seq));
+  memset(s_first, 0, sizeof(s_first));
+  s_head = -1;
+  s_head_slot = 0;
+  s_last_time = 0;
+  memset(&s_stats, 0, sizeof(s_stats));
+
+  uint32_t top = 0;
+  for (uint32_t i = 0; i < s_sectors; i++) {
+    sector_header_t h;
+    if (esp_partition_read(s_part, slot_addr(i, 0), &h, sizeof(h)) !=
+            ESP_OK ||
+        h.magic != HISTORY_MAGIC || h.crc != header_crc(&h) ||
+        h.version != HISTORY_VERSION)
+      continue;
+    s_seq[i] = h.seq;
+    s_first[i] = h.first_time;
+    if (h.seq > top) {
+      top = h.seq;
+      s_head = i;
+    }
+  }
+  if (s_head >= 0)
+    scan_head();
+  ESP_LOGI(TAG, "%lu sectors, head %d slot %lu",
+           (unsigned long)s_sectors, s_head, (unsigned long)s_head_slot);
+}
+
+// Erases the sector after the head, dropping its records if the ring went
+// around, and makes it the head
+static bool open_sector(uint32_t first_time) {
+  uint32_t next = s_head < 0 ? 0 : (s_head + 1) % s_sectors;
+  uint32_t seq = s_head < 0 ? 1 : s_seq[s_head] + 1;
+  s_seq[next] = 0;
+  if (esp_partition_erase_range(s_part, slot_addr(next, 0), SECTOR_SIZE) !=
+      ESP_OK)
+    return false;
+  s_stats.erases++;
+
+  sector_header_t h = {
+      .magic = HISTORY_MAGIC,
+      .seq = seq,
+      .first_time = first_time,
+      .version = HISTORY_VERSION,
+      .reserved = {0xFF, 0xFF},
+  };
+  h.crc = header_crc(&h);
+  s_stats.bytes_written += sizeof(h);
+  if (esp_partition_write(s_part, slot_addr(next, 0), &h, sizeof(h)) !=
+      ESP_OK)
+    return false;
+  s_seq[next] = seq;
+  s_first[next] = first_time;
+  s_head = next;
+  s_head_slot = 1;
+  return true;
+}
+
+bool app_history_append(const app_history_rec_t *in) {
+  if (!s_part)
+    return false;
+  app_history_rec_t rec = *in;
+  memset(rec.reserved, 0xFF, sizeof(rec.reserved));
+  rec.crc = rec_crc(&rec);
+
+  xSemaphoreTake(s_mux, portMAX_DELAY);
+  // Keeps the log sorted by time, which the index relies on
+  bool ok = s_head < 0 || rec.time / SLOT_S > s_last_time / SLOT_S;
+  if (ok) {
+    int64_t start = esp_timer_get_time();
+    if (s_head < 0 || s_head_slot >= SLOTS_PER_SECTOR)
+      ok = open_sector(rec.time);
+    if (ok) {
+      ok = esp_partition_write(s_part, slot_addr(s_head, s_head_slot), &rec,
+                               sizeof(rec)) == ESP_OK;
+      // A failed write may have left bits behind, never reuse the slot
+      s_head_slot++;
+      s_stats.bytes_written += sizeof(rec);
+    }
+    if (ok) {
+      s_last_time = rec.time;
+      s_stats.appends++;
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    if (us > s_stats.max_write_us)
+      s_stats.max_write_us = us;
+  }
+  xSemaphoreGive(s_mux);
+  return ok;
+}
+
+size_t app_history_query(uint32_t from, uint32_t to, app_history_cb_t cb,
+                         void *arg) {
+  if (!s_part || from > to)
+    return 0;
+  xSemaphoreTake(s_mux, portMAX_DELAY);
+  // Sectors in time order, oldest first
+  uint16_t order[MAX_SECTORS];
+  size_t count = 0;
+  for (uint32_t k = 1; s_head >= 0 && k <= s_sectors; k++) {
+    uint32_t i = (s_head + k) % s_sectors;
+    if (s_seq[i])
+      order[count++] = i;
+  }
+
+  // Last sector starting at or before `from`, earlier ones end before it
+  size_t lo = 0, hi = count;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (s_first[order[mid]] <= from)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  size_t passed = 0;
+  bool more = true;
+  app_history_rec_t buf[READ_CHUNK];
+  for (size_t k = lo; more && k < count && s_first[order[k]] <= to; k++) {
+    uint32_t sector = order[k];
+    uint32_t end = sector == (uint32_t)s_head ? s_head_slot : SLOTS_PER_SECTOR;
+    for (uint32_t slot = 1; more && slot < end; slot += READ_CHUNK) {
+      uint32_t n = end - slot;
+      if (n > READ_CHUNK)
+        n = READ_CHUNK;
+      if (esp_partition_read(s_part, slot_addr(sector, slot), buf,
+                             n * SLOT_SIZE) != ESP_OK)
+        break;
+      for (uint32_t i = 0; i < n; i++) {
+        if (buf[i].crc != rec_crc(&buf[i]) || buf[i].time < from)
+          continue;
+        if (buf[i].time > to) {
+          more = false;
+          break;
+        }
+        passed++;
+        if (!cb(&buf[i], arg)) {
+          more = false;
+          break;
+        }
+      }
+    }
+  }
+  xSemaphoreGive(s_mux);
+  return passed;
+}
+
+void app_history_get_stats(app_history_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!s_part)
+    return;
+  xSemaphoreTake(s_mux, portMAX_DELAY);
+  *stats = s_stats;
+  stats->sectors = s_sectors;
+  stats->lifetime_erases = s_head >= 0 ? s_seq[s_head] : 0;
+  xSemaphoreGive(s_mux);
+}
+
+// Temperatures per unit, merged into the newest record's unit at the end
+typedef struct {
+  uint32_t count;
+  int32_t sum;
+  int32_t min;
+  int32_t max;
+} temp_acc_t;
+
+typedef struct {
+  app_history_summary_t *out;
+  temp_acc_t temp[2]; // Celsius, Fahrenheit
+  uint32_t humidity_sum;
+} summary_acc_t;
+
+static bool summarize_cb(const app_history_rec_t *rec, void *arg) {
+  summary_acc_t *acc = arg;
+  bool f = rec->flags & APP_HISTORY_FAHRENHEIT;
+  temp_acc_t *t = &acc->temp[f];
+  if (t->count == 0 || rec->temp < t->min)
+    t->min = rec->temp;
+  if (t->count == 0 || rec->temp > t->max)
+    t->max = rec->temp;
+  t->sum += rec->temp;
+  t->count++;
+  acc->humidity_sum += rec->humidity;
+  acc->out->flags = rec->flags & APP_HISTORY_FAHRENHEIT;
+  acc->out->count++;
+  return true;
+}
+
+static int32_t div_round(int32_t a, int32_t b) {
+  return a >= 0 ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+// `sum` of `n` temperatures, converted to the other unit
+static int32_t convert_sum(int32_t sum, uint32_t n, bool to_f) {
+  if (to_f)
+    return div_round(sum * 9, 5) + 32 * (int32_t)n;
+  return div_round((sum - 32 * (int32_t)n) * 5, 9);
+}
+
+bool app_history_summarize(uint32_t from, uint32_t to,
+                           app_history_summary_t *out) {
+  summary_acc_t acc = {.out = out};
+  memset(out, 0, sizeof(*out));
+  app_history_query(from, to, summarize_cb, &acc);
+  if (out->count == 0)
+    return false;
+  bool f = out->flags & APP_HISTORY_FAHRENHEIT;
+  temp_acc_t t = acc.temp[f];
+  const temp_acc_t *other = &acc.temp[!f];
+  if (other->count) {
+    int32_t lo = convert_sum(other->min, 1, f);
+    int32_t hi = convert_sum(other->max, 1, f);
+    t.min = t.count && t.min < lo ? t.min : lo;
+    t.max = t.count && t.max > hi ? t.max : hi;
+    t.sum += convert_sum(other->sum, other->count, f);
+  }
+  out->temp_min = (int8_t)t.min;
+  out->temp_max = (int8_t)t.max;
+  out->temp_avg = (int8_t)(t.sum / (int32_t)out->count);
+  out->humidity_avg = (uint8_t)(acc.humidity_sum / out->count);
+  return true;
+}
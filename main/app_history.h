@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define APP_HISTORY_FAHRENHEIT 0x01 // temperatures are in Fahrenheit
+#define APP_HISTORY_NO_AQI 0xFFFF
+
+// One observation, exactly as stored: 16 bytes, so a flash slot and an
+// encrypted-flash block line up
+typedef struct {
+  uint32_t time; // Unix seconds
+  int8_t temp;
+  int8_t feels_like;
+  uint8_t humidity;   // %
+  uint8_t wind_speed; // km/h, capped at 255
+  uint16_t aqi;       // APP_HISTORY_NO_AQI if unknown
+  uint16_t icon;      // QWeather icon code
+  uint8_t flags;
+  uint8_t reserved[2];
+  uint8_t crc; // set by app_history_append
+} app_history_rec_t;
+
+typedef struct {
+  uint32_t count;
+  int8_t temp_min;
+  int8_t temp_max;
+  int8_t temp_avg;
+  uint8_t humidity_avg;
+  uint8_t flags; // APP_HISTORY_FAHRENHEIT as in the newest record
+} app_history_summary_t;
+
+typedef struct {
+  uint32_t appends;       // since boot
+  uint32_t bytes_written; // since boot, headers included
+  uint32_t erases;        // since boot
+  // Sector erases over the partition's life, from the sequence numbers.
+  // Ring order spreads them, so each sector has seen about this / sectors.
+  uint32_t lifetime_erases;
+  uint32_t sectors;
+  uint32_t max_write_us; // slowest append since boot, erase included
+} app_history_stats_t;
+
+// Return false to stop the query
+typedef bool (*app_history_cb_t)(const app_history_rec_t *rec, void *arg);
+
+// Mounts the "history" partition and finds the append position. Without the
+// partition, e.g. on a device flashed with an older partition table, appends
+// and queries do nothing.
+void app_history_init(void);
+
+// Appends an observation. At most one per 15 minute slot is kept, later
+// ones in the same slot and ones older than the last are dropped.
+bool app_history_append(const app_history_rec_t *rec);
+
+// Calls `cb` for each record in [from, to], oldest first, with the log
+// locked. Only the sectors overlapping the range are read. Returns the
+// number of records passed to `cb`.
+size_t app_history_query(uint32_t from, uint32_t to, app_history_cb_t cb,
+                         void *arg);
+
+void app_history_get_stats(app_history_stats_t *stats);
+
+// Min, max and average over [from, to], in the unit of the newest record:
+// records logged before a unit change are converted. False if there are
+// no records.
+bool app_history_summarize(uint32_t from, uint32_t to,
+                           app_history_summary_t *out);
@@ -0,0 +1,440 @@
+#include "app_http.h"
+#include "app_dns.h"
+#include "app_metrics.h"
+#include "esp_crt_bundle.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include <string.h>
+#include <strings.h>
+
+static const char *TAG = "app_http";
+
+#define HTTP_MAX_HOSTS 3
+#define HTTP_ORIGIN_LEN 64
+#define HTTP_URL_LEN 320
+#define HTTP_RX_CHUNK 1024
+#define HTTP_TIMEOUT_MS 10000
+// Most servers drop idle keep-alive connections after about a minute. Past
+// this age a fresh connection (with session resumption) is cheaper than a
+// write into a dead socket followed by a timeout.
+#define HTTP_IDLE_CLOSE_MS (50 * 1000)
+
+typedef struct {
+  char origin[HTTP_ORIGIN_LEN]; // "https://host:port"
+  char host[HTTP_ORIGIN_LEN];   // name only, for DNS, SNI and certificate
+  char ip[16];                  // address dialed, from app_dns
+  esp_http_client_handle_t client;
+  int64_t last_used_us;
+  bool connected;
+  bool has_session; // a handshake completed, later dials offer its ticket
+  bool new_conn;    // set by HTTP_EVENT_ON_CONNECTED during open
+  bool must_close;  // server asked for it, or the body was not drained
+  bool pinned;      // verifying against the pinned CA file, not the bundle
+  app_http_result_t *res; // response headers of the request in flight
+  SemaphoreHandle_t lock;  // one request at a time per host
+  int refs;                // requests holding or waiting for `lock`
+  char *rx;                // receive buffer
+} http_host_t;
+
+static http_host_t s_hosts[HTTP_MAX_HOSTS];
+static app_http_stats_t s_stats;
+// Guards the host table and stats. Requests to different hosts run in
+// parallel, each under its host's own lock.
+static SemaphoreHandle_t s_http_mux = NULL;
+
+#ifdef CONFIG_WEATHER_TLS_PINNED_CA
+extern const char api_ca_pem_start[] asm("_binary_api_ca_pem_start");
+// Set once a pinned verification failed, the bundle is used until reboot
+static bool s_bundle_only = false;
+#endif
+
+static uint32_t elapsed_ms(int64_t since_us) {
+  return (uint32_t)((esp_timer_get_time() - since_us) / 1000);
+}
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
+  http_host_t *h = evt->user_data;
+  switch (evt->event_id) {
+  case HTTP_EVENT_ON_CONNECTED:
+    h->new_conn = true;
+    break;
+  case HTTP_EVENT_ON_HEADER:
+    if (strcasecmp(evt->header_key, "Connection") == 0 &&
+        strcasecmp(evt->header_value, "close") == 0)
+      h->must_close = true;
+    else if (h->res && strcasecmp(evt->header_key, "ETag") == 0)
+      strncpy(h->res->etag, evt->header_value, sizeof(h->res->etag) - 1);
+    else if (h->res && strcasecmp(evt->header_key, "Last-Modified") == 0)
+      strncpy(h->res->last_modified, evt->header_value,
+              sizeof(h->res->last_modified) - 1);
+    break;
+  case HTTP_EVENT_DISCONNECTED:
+    h->connected = false;
+    break;
+  default:
+    break;
+  }
+  return ESP_OK;
+}
+
+static bool url_origin(const char *url, char *origin, size_t len) {
+  const char *p = strstr(url, "://");
+  if (!p)
+    return false;
+  p += 3;
+  size_t n = (p - url) + strcspn(p, "/?");
+  if (n >= len)
+    return false;
+  memcpy(origin, url, n);
+  origin[n] = '\0';
+  return true;
+}
+
+static void host_close(http_host_t *h) {
+  if (h->client && h->connected)
+    esp_http_client_close(h->client);
+  h->connected = false;
+}
+
+static bool host_init_client(http_host_t *h, const char *url) {
+  esp_http_client_config_t config = {
+      .url = url,
+      // URLs are rewritten to the cached address, verify against the name
+      .common_name = h->host,
+      .timeout_ms = HTTP_TIMEOUT_MS,
+      .keep_alive_enable = true,
+      .event_handler = http_event_handler,
+      .user_data = h,
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+      .save_client_session = true,
+#endif
+  };
+#ifdef CONFIG_WEATHER_TLS_PINNED_CA
+  h->pinned = !s_bundle_only;
+  if (h->pinned)
+    config.cert_pem = api_ca_pem_start;
+  else
+#endif
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+  h->client = esp_http_client_init(&config);
+  return h->client != NULL;
+}
+
+// After a certificate verification failure on the pinned CA file, rebuilds
+// the client on the full bundle. Returns false if there is nothing to fall
+// back to.
+static bool host_fallback_to_bundle(http_host_t *h, const char *url) {
+#ifdef CONFIG_WEATHER_TLS_PINNED_CA
+  int tls_code = 0, tls_flags = 0;
+  esp_http_client_get_and_clear_last_tls_error(h->client, &tls_code,
+                                               &tls_flags);
+  if (!h->pinned || tls_flags == 0)
+    return false;
+
+  ESP_LOGW(TAG, "%s failed pinned CA verification (flags 0x%x), using the "
+                "full bundle until reboot",
+           h->origin, tls_flags);
+  s_bundle_only = true;
+  xSemaphoreTake(s_http_mux, portMAX_DELAY);
+  s_stats.trust_fallbacks++;
+  xSemaphoreGive(s_http_mux);
+  host_close(h);
+  esp_http_client_cleanup(h->client);
+  h->has_session = false;
+  return host_init_client(h, url);
+#else
+  return false;
+#endif
+}
+
+static http_host_t *host_get(const char *url) {
+  char origin[HTTP_ORIGIN_LEN];
+  if (!url_origin(url, origin, sizeof(origin)))
+    return NULL;
+
+  http_host_t *lru = NULL;
+  for (int i = 0; i < HTTP_MAX_HOSTS; i++) {
+    http_host_t *h = &s_hosts[i];
+    if (h->client && strcmp(h->origin, origin) == 0)
+      return h;
+    if (h->refs == 0 &&
+        (!lru || !h->client ||
+         (lru->client && h->last_used_us < lru->last_used_us)))
+      lru = h;
+  }
+  if (!lru)
+    return NULL; // every slot busy with another host
+
+  if (lru->client) {
+    ESP_LOGI(TAG, "Evicting client for %s", lru->origin);
+    host_close(lru);
+    esp_http_client_cleanup(lru->client);
+  }
+  SemaphoreHandle_t lock = lru->lock;
+  char *rx = lru->rx;
+  memset(lru, 0, sizeof(*lru));
+  lru->lock = lock;
+  lru->rx = rx;
+  strcpy(lru->origin, origin);
+  const char *name = strstr(origin, "://") + 3;
+  memcpy(lru->host, name, strcspn(name, ":"));
+
+  if (!host_init_client(lru, url)) {
+    lru->origin[0] = '\0';
+    return NULL;
+  }
+  return lru;
+}
+
+// Rewrites `url` to dial the address app_dns has for the host. New
+// connections take the current cache entry, a kept-alive one stays on the
+// address it was opened with. Returns false to let the client resolve itself.
+static bool url_with_ip(http_host_t *h, const char *url, char *out,
+                        size_t len) {
+  struct in_addr literal;
+  if (inet_pton(AF_INET, h->host, &literal) == 1)
+    return false;
+  if (!h->connected && !app_dns_lookup(h->host, h->ip, sizeof(h->ip)))
+    h->ip[0] = '\0';
+  if (!h->ip[0])
+    return false;
+
+  const char *name = strstr(h->origin, "://") + 3;
+  int n = snprintf(out, len, "%.*s%s%s%s", (int)(name - h->origin), h->origin,
+                   h->ip, name + strlen(h->host), url + strlen(h->origin));
+  return n > 0 && (size_t)n < len;
+}
+
+static void set_optional_header(esp_http_client_handle_t client,
+                                const char *key, const char *value) {
+  if (value && value[0])
+    esp_http_client_set_header(client, key, value);
+  else
+    esp_http_client_delete_header(client, key);
+}
+
+// Internal heap is what TLS competes for. The peak is only visible when the
+// handshake pushed the heap below its lifetime low-water mark; otherwise the
+// memory still held afterwards is the best lower bound available.
+static void log_handshake(http_host_t *h, const app_http_result_t *res,
+                          size_t free_before, size_t low_before) {
+  size_t free_after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  size_t low_after = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  size_t held = free_before > free_after ? free_before - free_after : 0;
+  size_t peak = low_after < low_before ? free_before - low_after : held;
+  xSemaphoreTake(s_http_mux, portMAX_DELAY);
+  if (peak > s_stats.handshake_heap_peak)
+    s_stats.handshake_heap_peak = peak;
+  xSemaphoreGive(s_http_mux);
+  ESP_LOGI(TAG, "%s handshake (%s, %s): %lu ms, heap peak %s%u B, held %u B",
+           h->origin, app_http_conn_name(res->conn),
+           h->pinned ? "pinned CA" : "bundle", (unsigned long)res->open_ms,
+           low_after < low_before ? "" : ">= ", (unsigned)peak,
+           (unsigned)held);
+}
+
+static esp_err_t do_request(http_host_t *h, const app_http_req_t *req,
+                            app_http_result_t *res, bool *body_started) {
+  char *rx = h->rx;
+  int64_t start = esp_timer_get_time();
+  h->new_conn = false;
+  h->must_close = false;
+
+  char url[HTTP_URL_LEN];
+  if (url_with_ip(h, req->url, url, sizeof(url))) {
+    esp_http_client_set_url(h->client, url);
+    // set_url points Host at the address, the server needs the name
+    esp_http_client_set_header(h->client, "Host",
+                               strstr(h->origin, "://") + 3);
+  } else {
+    esp_http_client_set_url(h->client, req->url);
+  }
+  esp_http_client_set_header(h->client, "Accept-Encoding",
+                             req->accept_encoding ? req->accept_encoding
+                                                  : "identity");
+  // Headers stick to the client handle, clear validators of the last request
+  set_optional_header(h->client, "If-None-Match", req->if_none_match);
+  set_optional_header(h->client, "If-Modified-Since", req->if_modified_since);
+
+  // After url_with_ip(): a lookup there is DNS time, not connect time
+  int64_t connect_start = esp_timer_get_time();
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  size_t low_before = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  esp_err_t err = esp_http_client_open(h->client, 0);
+  if (err != ESP_OK)
+    return err;
+  h->connected = true;
+  if (!h->new_conn)
+    res->conn = APP_HTTP_CONN_REUSED;
+  else
+    res->conn = h->has_session ? APP_HTTP_CONN_TICKET : APP_HTTP_CONN_FULL;
+  res->open_ms = elapsed_ms(connect_start);
+  if (h->new_conn) {
+    app_metrics_record(APP_PHASE_CONNECT,
+                       esp_timer_get_time() - connect_start);
+    log_handshake(h, res, free_before, low_before);
+  }
+
+  int64_t t = esp_timer_get_time();
+  if (esp_http_client_fetch_headers(h->client) < 0)
+    return ESP_FAIL;
+  res->status = esp_http_client_get_status_code(h->client);
+  app_metrics_record(APP_PHASE_TTFB, esp_timer_get_time() - t);
+
+  // Body time is pure transfer: the consumer's inflate/parse is subtracted
+  int64_t body_start = esp_timer_get_time();
+  int64_t consumer_us = 0;
+  int read_len;
+  while ((read_len = esp_http_client_read(h->client, rx, HTTP_RX_CHUNK)) >
+         0) {
+    *body_started = true;
+    res->body_bytes += read_len;
+    t = esp_timer_get_time();
+    bool ok = !req->on_body || req->on_body(req->ctx, rx, read_len);
+    consumer_us += esp_timer_get_time() - t;
+    if (!ok) {
+      h->must_close = true;
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  if (read_len < 0)
+    return ESP_FAIL;
+  if (res->body_bytes > 0)
+    app_metrics_record(APP_PHASE_BODY,
+                       esp_timer_get_time() - body_start - consumer_us);
+  if (!esp_http_client_is_complete_data_received(h->client))
+    h->must_close = true;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  if (strncmp(h->origin, "https:", 6) == 0)
+    h->has_session = true;
+#endif
+  res->total_ms = elapsed_ms(start);
+  return ESP_OK;
+}
+
+void app_http_init(void) {
+  app_dns_init();
+  if (s_http_mux)
+    return;
+  s_http_mux = xSemaphoreCreateMutex();
+  for (int i = 0; i < HTTP_MAX_HOSTS; i++) {
+    s_hosts[i].lock = xSemaphoreCreateMutex();
+    s_hosts[i].rx = heap_caps_malloc_prefer(HTTP_RX_CHUNK, 2, MALLOC_CAP_SPIRAM,
+                                            MALLOC_CAP_DEFAULT);
+  }
+}
+
+esp_err_t app_http_get(const app_http_req_t *req, app_http_result_t *res) {
+  memset(res, 0, sizeof(*res));
+
+  xSemaphoreTake(s_http_mux, portMAX_DELAY);
+  s_stats.requests++;
+  http_host_t *h = host_get(req->url);
+  if (h)
+    h->refs++;
+  xSemaphoreGive(s_http_mux);
+  if (!h || !h->rx) {
+    xSemaphoreTake(s_http_mux, portMAX_DELAY);
+    s_stats.failures++;
+    if (h)
+      h->refs--;
+    xSemaphoreGive(s_http_mux);
+    ESP_LOGE(TAG, "No client slot for %s", req->url);
+    return ESP_ERR_NO_MEM;
+  }
+
+  xSemaphoreTake(h->lock, portMAX_DELAY);
+  esp_err_t err = ESP_ERR_INVALID_ARG;
+  bool stale = false;
+  for (int attempt = 0; h->client && attempt < 2; attempt++) {
+    if (h->connected &&
+        esp_timer_get_time() - h->last_used_us > HTTP_IDLE_CLOSE_MS * 1000LL)
+      host_close(h);
+
+    bool was_connected = h->connected;
+    bool body_started = false;
+    memset(res, 0, sizeof(*res));
+    h->res = res;
+    err = do_request(h, req, res, &body_started);
+    h->res = NULL;
+    h->last_used_us = esp_timer_get_time();
+    if (err == ESP_OK)
+      break;
+
+    if (host_fallback_to_bundle(h, req->url)) {
+      attempt--; // the redial on the bundle is not a stale retry
+      continue;
+    }
+    host_close(h);
+    // A kept-alive connection the server already dropped fails before the
+    // first body byte. Redial once; anything else is a real failure.
+    if (!was_connected || body_started ||
+        err == ESP_ERR_INVALID_RESPONSE)
+      break;
+    ESP_LOGW(TAG, "Stale connection to %s, redialing", h->origin);
+    stale = true;
+  }
+  if (err == ESP_OK && h->must_close)
+    host_close(h);
+  xSemaphoreGive(h->lock);
+
+  xSemaphoreTake(s_http_mux, portMAX_DELAY);
+  h->refs--;
+  if (stale)
+    s_stats.stale_retries++;
+  if (err == ESP_OK) {
+    switch (res->conn) {
+    case APP_HTTP_CONN_REUSED:
+      s_stats.reused++;
+      break;
+    case APP_HTTP_CONN_TICKET:
+      s_stats.ticket_offered++;
+      break;
+    case APP_HTTP_CONN_FULL:
+      s_stats.full++;
+      break;
+    }
+    ESP_LOGI(TAG, "GET %s: %d, %d bytes, %s conn, open %lu ms, total %lu ms",
+             h->origin, res->status, (int)res->body_bytes,
+             app_http_conn_name(res->conn), (unsigned long)res->open_ms,
+             (unsigned long)res->total_ms);
+  } else {
+    s_stats.failures++;
+    ESP_LOGE(TAG, "GET failed: %s", esp_err_to_name(err));
+  }
+
+  xSemaphoreGive(s_http_mux);
+  return err;
+}
+
+void app_http_prefetch(const char *url, uint32_t within_s) {
+  char origin[HTTP_ORIGIN_LEN];
+  if (!url_origin(url, origin, sizeof(origin)))
+    return;
+  char *name = strstr(origin, "://") + 3;
+  name[strcspn(name, ":")] = '\0';
+  app_dns_prefetch(name, within_s);
+}
+
+void app_http_get_stats(app_http_stats_t *stats) {
+  xSemaphoreTake(s_http_mux, portMAX_DELAY);
+  *stats = s_stats;
+  xSemaphoreGive(s_http_mux);
+}
+
+const char *app_http_conn_name(app_http_conn_t conn) {
+  switch (conn) {
+  case APP_HTTP_CONN_REUSED:
+    return "reused";
+  case APP_HTTP_CONN_TICKET:
+    return "ticket offered";
+  default:
+    return "full";
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Receives raw body bytes as they arrive. Return false to abort the request.
+typedef bool (*app_http_body_cb_t)(void *ctx, const char *data, size_t len);
+
+typedef enum {
+  APP_HTTP_CONN_REUSED, // kept-alive connection, no handshake at all
+  // New connection offering the saved session ticket. esp_http_client does
+  // not say whether the server resumed or fell back to a full handshake.
+  APP_HTTP_CONN_TICKET,
+  APP_HTTP_CONN_FULL, // new connection with a full handshake
+} app_http_conn_t;
+
+#define APP_HTTP_ETAG_LEN 48
+#define APP_HTTP_DATE_LEN 32
+
+typedef struct {
+  const char *url;
+  const char *accept_encoding; // NULL requests identity
+  // Validators from the previous response, NULL or "" when unknown. A match
+  // on the server side yields status 304 without a body.
+  const char *if_none_match;
+  const char *if_modified_since;
+  app_http_body_cb_t on_body;
+  void *ctx;
+} app_http_req_t;
+
+typedef struct {
+  int status;
+  char etag[APP_HTTP_ETAG_LEN];
+  char last_modified[APP_HTTP_DATE_LEN];
+  app_http_conn_t conn;
+  size_t body_bytes;
+  uint32_t open_ms; // connect (if any) + request sent
+  uint32_t total_ms;
+} app_http_result_t;
+
+typedef struct {
+  uint32_t requests;
+  uint32_t failures;
+  uint32_t reused;
+  uint32_t ticket_offered;
+  uint32_t full;
+  uint32_t stale_retries; // kept-alive connections found dead and redialed
+  uint32_t trust_fallbacks; // pinned CA verification failed, bundle used
+  uint32_t handshake_heap_peak; // largest internal heap use of a handshake
+} app_http_stats_t;
+
+void app_http_init(void);
+
+// Blocking GET over a long-lived client per API host. Connections are kept
+// alive between calls, and redialed offering the saved TLS session ticket
+// when the server closed them or they sat idle too long.
+esp_err_t app_http_get(const app_http_req_t *req, app_http_result_t *res);
+
+// Refreshes the cached address of the url's host if it expires within
+// `within_s` seconds. Call ahead of a scheduled request.
+void app_http_prefetch(const char *url, uint32_t within_s);
+
+void app_http_get_stats(app_http_stats_t *stats);
+const char *app_http_conn_name(app_http_conn_t conn);
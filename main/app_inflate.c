@@ -0,0 +1,311 @@
+#include "app_inflate.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "miniz.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "app_inflate";
+
+// Wrapping output window for back-references. tinfl needs the full 32 KB
+// deflate allows: with less, a longer distance silently reads stale bytes.
+#define INFLATE_DICT_SIZE TINFL_LZ_DICT_SIZE
+
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+// gzip header flags (RFC 1952)
+#define GZ_FHCRC 0x02
+#define GZ_FEXTRA 0x04
+#define GZ_FNAME 0x08
+#define GZ_FCOMMENT 0x10
+
+typedef enum {
+  ST_MAGIC,
+  ST_HEADER,
+  ST_EXTRA_LEN,
+  ST_EXTRA,
+  ST_NAME,
+  ST_COMMENT,
+  ST_HCRC,
+  ST_DEFLATE, // states above are header parsing
+  ST_RAW,
+  ST_DONE,
+  ST_ERROR,
+} inflate_state_t;
+
+struct app_inflate {
+  tinfl_decompressor decomp;
+  uint8_t dict[INFLATE_DICT_SIZE];
+  size_t dict_ofs;
+
+  app_inflate_sink_t sink;
+  void *ctx;
+
+  inflate_state_t state;
+  bool gzip;
+  uint8_t hdr[GZIP_HEADER_LEN];
+  size_t hdr_len;
+  uint8_t flags; // header fields still to skip
+  size_t skip;   // bytes left in FEXTRA / FHCRC
+
+  // The last 8 bytes seen are kept away from tinfl: at the end of the body
+  // they are the CRC32/ISIZE trailer.
+  uint8_t tail[GZIP_TRAILER_LEN];
+  size_t tail_len;
+  bool tinfl_done;
+
+  uint32_t crc;
+  uint32_t isize;
+  size_t in_bytes;
+  size_t out_bytes;
+};
+
+static uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static bool emit(app_inflate_t *inf, const uint8_t *data, size_t len) {
+  inf->out_bytes += len;
+  if (!inf->sink(inf->ctx, (const char *)data, len)) {
+    inf->state = ST_ERROR;
+    return false;
+  }
+  return true;
+}
+
+static void next_header_field(app_inflate_t *inf) {
+  if (inf->flags & GZ_FEXTRA) {
+    inf->flags &= ~GZ_FEXTRA;
+    inf->hdr_len = 0;
+    inf->skip = 0;
+    inf->state = ST_EXTRA_LEN;
+  } else if (inf->flags & GZ_FNAME) {
+    inf->flags &= ~GZ_FNAME;
+    inf->state = ST_NAME;
+  } else if (inf->flags & GZ_FCOMMENT) {
+    inf->flags &= ~GZ_FCOMMENT;
+    inf->state = ST_COMMENT;
+  } else if (inf->flags & GZ_FHCRC) {
+    inf->flags &= ~GZ_FHCRC;
+    inf->skip = 2;
+    inf->state = ST_HCRC;
+  } else {
+    tinfl_init(&inf->decomp);
+    inf->state = ST_DEFLATE;
+  }
+}
+
+// Consumes header bytes until the deflate payload starts (or the body turns
+// out not to be gzip). Advances *data / *len past what was consumed.
+static bool parse_header(app_inflate_t *inf, const uint8_t **data,
+                         size_t *len) {
+  while (*len > 0 && inf->state < ST_DEFLATE) {
+    uint8_t b = **data;
+    switch (inf->state) {
+    case ST_MAGIC:
+      if ((inf->hdr_len == 0 && b != 0x1f) ||
+          (inf->hdr_len == 1 && b != 0x8b)) {
+        // Plain body: replay what was buffered, the rest passes through
+        inf->state = ST_RAW;
+        return inf->hdr_len == 0 || emit(inf, inf->hdr, inf->hdr_len);
+      }
+      inf->hdr[inf->hdr_len++] = b;
+      if (inf->hdr_len == 2) {
+        inf->gzip = true;
+        inf->state = ST_HEADER;
+      }
+      break;
+    case ST_HEADER:
+      inf->hdr[inf->hdr_len++] = b;
+      if (inf->hdr_len == GZIP_HEADER_LEN) {
+        if (inf->hdr[2] != 8) {
+          ESP_LOGE(TAG, "Unsupported gzip method %d", inf->hdr[2]);
+          inf->state = ST_ERROR;
+          return false;
+        }
+        inf->flags = inf->hdr[3];
+        next_header_field(inf);
+      }
+      break;
+    case ST_EXTRA_LEN:
+      inf->skip |= (size_t)b << (8 * inf->hdr_len++);
+      if (inf->hdr_len == 2) {
+        if (inf->skip)
+          inf->state = ST_EXTRA;
+        else
+          next_header_field(inf);
+      }
+      break;
+    case ST_EXTRA:
+    case ST_HCRC:
+      if (--inf->skip == 0)
+        next_header_field(inf);
+      break;
+    case ST_NAME:
+    case ST_COMMENT:
+      if (b == 0)
+        next_header_field(inf);
+      break;
+    default:
+      break;
+    }
+    (*data)++;
+    (*len)--;
+  }
+  return true;
+}
+
+static bool inflate_block(app_inflate_t *inf, const uint8_t *in, size_t len) {
+  for (;;) {
+    if (inf->tinfl_done) {
+      // Concatenated gzip members are not produced by any server we talk to
+      if (len > 0)
+        ESP_LOGW(TAG, "Ignoring %u bytes after deflate end", (unsigned)len);
+      return true;
+    }
+
+    size_t in_len = len;
+    size_t out_len = INFLATE_DICT_SIZE - inf->dict_ofs;
+    uint8_t *out = inf->dict + inf->dict_ofs;
+    tinfl_status st = tinfl_decompress(&inf->decomp, in, &in_len, inf->dict,
+                                       out, &out_len, TINFL_FLAG_HAS_MORE_INPUT);
+    in += in_len;
+    len -= in_len;
+
+    if (out_len > 0) {
+      inf->crc = esp_rom_crc32_le(inf->crc, out, out_len);
+      inf->isize += out_len;
+      inf->dict_ofs = (inf->dict_ofs + out_len) & (INFLATE_DICT_SIZE - 1);
+      if (!emit(inf, out, out_len))
+        return false;
+    }
+
+    if (st == TINFL_STATUS_DONE) {
+      inf->tinfl_done = true;
+    } else if (st == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      return true;
+    } else if (st != TINFL_STATUS_HAS_MORE_OUTPUT) {
+      ESP_LOGE(TAG, "tinfl_decompress failed with status: %d", st);
+      inf->state = ST_ERROR;
+      return false;
+    }
+  }
+}
+
+static bool feed_deflate(app_inflate_t *inf, const uint8_t *data, size_t len) {
+  size_t total = inf->tail_len + len;
+  if (total <= GZIP_TRAILER_LEN) {
+    memcpy(inf->tail + inf->tail_len, data, len);
+    inf->tail_len = total;
+    return true;
+  }
+
+  // Release everything except the newest 8 bytes, oldest first
+  size_t release = total - GZIP_TRAILER_LEN;
+  size_t from_tail = release < inf->tail_len ? release : inf->tail_len;
+  if (from_tail > 0) {
+    if (!inflate_block(inf, inf->tail, from_tail))
+      return false;
+    memmove(inf->tail, inf->tail + from_tail, inf->tail_len - from_tail);
+    inf->tail_len -= from_tail;
+  }
+  size_t from_data = release - from_tail;
+  if (from_data > 0 && !inflate_block(inf, data, from_data))
+    return false;
+
+  memcpy(inf->tail + inf->tail_len, data + from_data, len - from_data);
+  inf->tail_len += len - from_data;
+  return true;
+}
+
+app_inflate_t *app_inflate_create(app_inflate_sink_t sink, void *ctx) {
+  // ~43 KB of decoder state and window, only touched sequentially: PSRAM is
+  // fast enough and internal RAM is the scarcer of the two
+  app_inflate_t *inf = heap_caps_calloc_prefer(
+      1, sizeof(app_inflate_t), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+  if (!inf)
+    return NULL;
+  app_inflate_reset(inf, sink, ctx);
+  return inf;
+}
+
+void app_inflate_reset(app_inflate_t *inf, app_inflate_sink_t sink,
+                       void *ctx) {
+  // The window is not cleared: only a corrupt stream can reach stale bytes
+  // in it, and that fails the CRC check anyway
+  memset(inf, 0, offsetof(app_inflate_t, dict));
+  memset(&inf->dict_ofs, 0,
+         sizeof(app_inflate_t) - offsetof(app_inflate_t, dict_ofs));
+  inf->sink = sink;
+  inf->ctx = ctx;
+  inf->state = ST_MAGIC;
+}
+
+void app_inflate_destroy(app_inflate_t *inf) { heap_caps_free(inf); }
+
+bool app_inflate_feed(app_inflate_t *inf, const uint8_t *data, size_t len) {
+  if (inf->state == ST_ERROR || inf->state == ST_DONE)
+    return false;
+  inf->in_bytes += len;
+
+  if (inf->state < ST_DEFLATE && !parse_header(inf, &data, &len))
+    return false;
+  if (len == 0)
+    return true;
+
+  if (inf->state == ST_RAW)
+    return emit(inf, data, len);
+  return feed_deflate(inf, data, len);
+}
+
+bool app_inflate_finish(app_inflate_t *inf) {
+  switch (inf->state) {
+  case ST_RAW:
+    inf->state = ST_DONE;
+    return true;
+  case ST_MAGIC:
+    // Body shorter than the gzip magic, it can only be plain text
+    inf->state = ST_DONE;
+    return inf->hdr_len == 0 || emit(inf, inf->hdr, inf->hdr_len);
+  case ST_DEFLATE:
+    break;
+  case ST_ERROR:
+  case ST_DONE:
+    return false;
+  default:
+    ESP_LOGE(TAG, "Truncated gzip header (%u bytes)",
+             (unsigned)inf->in_bytes);
+    inf->state = ST_ERROR;
+    return false;
+  }
+
+  if (!inf->tinfl_done || inf->tail_len != GZIP_TRAILER_LEN) {
+    ESP_LOGE(TAG, "Truncated gzip stream (%u bytes)", (unsigned)inf->in_bytes);
+    inf->state = ST_ERROR;
+    return false;
+  }
+
+  uint32_t crc = read_le32(inf->tail);
+  uint32_t isize = read_le32(inf->tail + 4);
+  if (crc != inf->crc || isize != inf->isize) {
+    ESP_LOGE(TAG, "gzip trailer mismatch: crc %08x/%08x, size %u/%u",
+             (unsigned)crc, (unsigned)inf->crc, (unsigned)isize,
+             (unsigned)inf->isize);
+    inf->state = ST_ERROR;
+    return false;
+  }
+
+  inf->state = ST_DONE;
+  return true;
+}
+
+bool app_inflate_is_gzip(const app_inflate_t *inf) { return inf->gzip; }
+
+size_t app_inflate_in_bytes(const app_inflate_t *inf) { return inf->in_bytes; }
+
+size_t app_inflate_out_bytes(const app_inflate_t *inf) {
+  return inf->out_bytes;
+}
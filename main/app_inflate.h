@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Receives decoded body bytes. Return false to abort the stream.
+typedef bool (*app_inflate_sink_t)(void *ctx, const char *data, size_t len);
+
+typedef struct app_inflate app_inflate_t;
+
+// Streaming body decoder: gzip bodies are inflated through a 32 KB wrapping
+// dictionary and verified against their CRC32/ISIZE trailer, anything else is
+// passed through to the sink untouched.
+app_inflate_t *app_inflate_create(app_inflate_sink_t sink, void *ctx);
+void app_inflate_destroy(app_inflate_t *inf);
+// Rearms a decoder for a new body, so one allocation serves every request
+void app_inflate_reset(app_inflate_t *inf, app_inflate_sink_t sink, void *ctx);
+
+bool app_inflate_feed(app_inflate_t *inf, const uint8_t *data, size_t len);
+// Call once the body is complete. Fails on truncated or corrupt gzip data.
+bool app_inflate_finish(app_inflate_t *inf);
+
+bool app_inflate_is_gzip(const app_inflate_t *inf);
+size_t app_inflate_in_bytes(const app_inflate_t *inf);
+size_t app_inflate_out_bytes(const app_inflate_t *inf);
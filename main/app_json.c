@@ -0,0 +1,384 @@
+#include "app_json.h"
+#include <string.h>
+
+enum {
+  S_VALUE,     // expecting any value
+  S_OBJ_FIRST, // after '{': key or '}'
+  S_ARR_FIRST, // after '[': value or ']'
+  S_KEY,       // after ',' inside an object
+  S_COLON,
+  S_AFTER, // after a value: ',' or closing bracket
+  S_STRING,
+  S_LITERAL,
+  S_END, // top-level value complete, only whitespace may follow
+};
+
+static bool is_ws(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_literal_char(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.';
+}
+
+static bool fail(app_json_t *js) {
+  js->error = true;
+  return false;
+}
+
+static void put_char(app_json_t *js, char c) {
+  if (js->in_key) {
+    if (js->path_len + 1 < APP_JSON_PATH_LEN)
+      js->path[js->path_len++] = c;
+    else
+      js->key_overflow = true;
+  } else if (js->value_len + 1 < APP_JSON_VALUE_LEN) {
+    js->value[js->value_len++] = c;
+  } else {
+    js->value_overflow = true;
+  }
+}
+
+static void put_codepoint(app_json_t *js, uint32_t cp) {
+  if (cp >= 0xD800 && cp <= 0xDBFF) {
+    js->high_surrogate = cp;
+    return;
+  }
+  if (cp >= 0xDC00 && cp <= 0xDFFF && js->high_surrogate) {
+    cp = 0x10000 + ((js->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+  }
+  js->high_surrogate = 0;
+
+  if (cp < 0x80) {
+    put_char(js, cp);
+  } else if (cp < 0x800) {
+    put_char(js, 0xC0 | (cp >> 6));
+    put_char(js, 0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    put_char(js, 0xE0 | (cp >> 12));
+    put_char(js, 0x80 | ((cp >> 6) & 0x3F));
+    put_char(js, 0x80 | (cp & 0x3F));
+  } else {
+    put_char(js, 0xF0 | (cp >> 18));
+    put_char(js, 0x80 | ((cp >> 12) & 0x3F));
+    put_char(js, 0x80 | ((cp >> 6) & 0x3F));
+    put_char(js, 0x80 | (cp & 0x3F));
+  }
+}
+
+// Drop a multi-byte UTF-8 sequence cut in half by value truncation
+static size_t utf8_trim(const char *s, size_t len) {
+  size_t i = len;
+  while (i > 0 && ((uint8_t)s[i - 1] & 0xC0) == 0x80)
+    i--;
+  if (i == 0)
+    return 0;
+  uint8_t lead = s[i - 1];
+  size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  return (len - (i - 1) < need) ? i - 1 : len;
+}
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// A literal ends at the first delimiter, so "tru" or "1." only fail here. A
+// value cut at APP_JSON_VALUE_LEN - 1 bytes only has to be a valid prefix.
+static bool literal_valid(const char *s, size_t len, bool cut) {
+  static const char *const words[] = {"true", "false", "null"};
+  for (size_t i = 0; i < 3; i++) {
+    if (len == strlen(words[i]) && memcmp(s, words[i], len) == 0)
+      return true;
+  }
+  const char *p = s, *end = s + len;
+  if (p < end && *p == '-')
+    p++;
+  if (p == end || !is_digit(*p))
+    return false;
+  if (*p++ == '0' && p < end && is_digit(*p))
+    return false; // no leading zeros
+  while (p < end && is_digit(*p))
+    p++;
+  if (p < end && *p == '.') {
+    if (++p == end)
+      return cut;
+    if (!is_digit(*p))
+      return false;
+    while (p < end && is_digit(*p))
+      p++;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    if (++p < end && (*p == '+' || *p == '-'))
+      p++;
+    if (p == end)
+      return cut;
+    while (p < end && is_digit(*p))
+      p++;
+  }
+  return p == end;
+}
+
+static int current_index(const app_json_t *js) {
+  for (int i = js->depth - 1; i >= 0; i--) {
+    if (js->stack[i] == '[')
+      return js->index[i];
+  }
+  return -1;
+}
+
+static void emit_value(app_json_t *js) {
+  if (js->value_overflow)
+    js->value_len = utf8_trim(js->value, js->value_len);
+  js->value[js->value_len] = '\0';
+  if (js->mute_depth == 0 && js->on_value) {
+    js->path[js->path_len] = '\0';
+    js->on_value(js->ctx, js->path, js->value, current_index(js));
+  }
+  js->value_len = 0;
+  js->value_overflow = false;
+}
+
+static bool end_literal(app_json_t *js) {
+  if (!literal_valid(js->value, js->value_len, js->value_overflow))
+    return fail(js);
+  emit_value(js);
+  return true;
+}
+
+static void value_done(app_json_t *js) {
+  if (js->depth == 0) {
+    js->done = true;
+    js->state = S_END;
+  } else {
+    js->state = S_AFTER;
+  }
+}
+
+static bool push(app_json_t *js, char type) {
+  if (js->depth >= APP_JSON_MAX_DEPTH)
+    return fail(js);
+  js->stack[js->depth] = type;
+  js->mark[js->depth] = js->path_len;
+  js->index[js->depth] = 0;
+  js->depth++;
+  js->state = type == '{' ? S_OBJ_FIRST : S_ARR_FIRST;
+  return true;
+}
+
+static bool pop(app_json_t *js, char close) {
+  if (js->depth == 0 || js->stack[js->depth - 1] != (close == '}' ? '{' : '['))
+    return fail(js);
+  js->depth--;
+  js->path_len = js->mark[js->depth];
+  if (js->depth < js->mute_depth)
+    js->mute_depth = 0;
+  value_done(js);
+  return true;
+}
+
+static void element_path(app_json_t *js) {
+  if (js->mute_depth == js->depth)
+    js->mute_depth = 0;
+  js->path_len = js->mark[js->depth - 1];
+  if (js->path_len + 2 < APP_JSON_PATH_LEN) {
+    js->path[js->path_len++] = '[';
+    js->path[js->path_len++] = ']';
+  } else if (js->mute_depth == 0) {
+    js->mute_depth = js->depth;
+  }
+}
+
+static void begin_key(app_json_t *js) {
+  js->path_len = js->mark[js->depth - 1];
+  js->in_key = true;
+  js->key_overflow = false;
+  if (js->path_len > 0)
+    put_char(js, '.');
+  js->state = S_STRING;
+}
+
+static void end_key(app_json_t *js) {
+  js->in_key = false;
+  if (js->mute_depth == js->depth)
+    js->mute_depth = 0;
+  if (js->key_overflow && js->mute_depth == 0)
+    js->mute_depth = js->depth;
+  js->state = S_COLON;
+}
+
+static bool begin_value(app_json_t *js, char c) {
+  if (c == '{' || c == '[')
+    return push(js, c);
+  js->value_len = 0;
+  js->value_overflow = false;
+  if (c == '"') {
+    js->in_key = false;
+    js->state = S_STRING;
+    return true;
+  }
+  if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' ||
+      c == 'n') {
+    put_char(js, c);
+    js->state = S_LITERAL;
+    return true;
+  }
+  return fail(js);
+}
+
+static bool string_char(app_json_t *js, char c) {
+  if (js->esc == 1) {
+    js->esc = 0;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      put_char(js, c);
+      break;
+    case 'b':
+      put_char(js, '\b');
+      break;
+    case 'f':
+      put_char(js, '\f');
+      break;
+    case 'n':
+      put_char(js, '\n');
+      break;
+    case 'r':
+      put_char(js, '\r');
+      break;
+    case 't':
+      put_char(js, '\t');
+      break;
+    case 'u':
+      js->esc = 2;
+      js->codepoint = 0;
+      break;
+    default:
+      return fail(js);
+    }
+  } else if (js->esc >= 2) {
+    int v;
+    if (c >= '0' && c <= '9')
+      v = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      v = c - 'A' + 10;
+    else
+      return fail(js);
+    js->codepoint = (js->codepoint << 4) | v;
+    if (++js->esc == 6) {
+      js->esc = 0;
+      put_codepoint(js, js->codepoint);
+    }
+  } else if (c == '\\') {
+    js->esc = 1;
+  } else if (c == '"') {
+    if (js->in_key) {
+      end_key(js);
+    } else {
+      emit_value(js);
+      value_done(js);
+    }
+  } else if ((uint8_t)c < 0x20) {
+    return fail(js);
+  } else {
+    put_char(js, c);
+  }
+  return true;
+}
+
+void app_json_init(app_json_t *js, app_json_value_cb_t on_value, void *ctx) {
+  memset(js, 0, sizeof(*js));
+  js->on_value = on_value;
+  js->ctx = ctx;
+  js->state = S_VALUE;
+}
+
+bool app_json_feed(app_json_t *js, const char *data, size_t len) {
+  if (js->error)
+    return false;
+
+  size_t i = 0;
+  while (i < len) {
+    char c = data[i];
+    switch (js->state) {
+    case S_STRING:
+      if (!string_char(js, c))
+        return false;
+      break;
+    case S_LITERAL:
+      if (is_literal_char(c)) {
+        put_char(js, c);
+        break;
+      }
+      // Delimiter ends the literal, re-examine it as punctuation
+      if (!end_literal(js))
+        return false;
+      value_done(js);
+      continue;
+    case S_VALUE:
+      if (!is_ws(c) && !begin_value(js, c))
+        return false;
+      break;
+    case S_ARR_FIRST:
+      if (is_ws(c))
+        break;
+      if (c == ']') {
+        if (!pop(js, c))
+          return false;
+      } else {
+        element_path(js);
+        if (!begin_value(js, c))
+          return false;
+      }
+      break;
+    case S_OBJ_FIRST:
+    case S_KEY:
+      if (is_ws(c))
+        break;
+      if (c == '"')
+        begin_key(js);
+      else if (c != '}' || js->state != S_OBJ_FIRST || !pop(js, c))
+        return fail(js);
+      break;
+    case S_COLON:
+      if (c == ':')
+        js->state = S_VALUE;
+      else if (!is_ws(c))
+        return fail(js);
+      break;
+    case S_AFTER:
+      if (is_ws(c))
+        break;
+      if (c == ',') {
+        if (js->stack[js->depth - 1] == '{') {
+          js->state = S_KEY;
+        } else {
+          js->index[js->depth - 1]++;
+          element_path(js);
+          js->state = S_VALUE;
+        }
+      } else if (c == '}' || c == ']') {
+        if (!pop(js, c))
+          return false;
+      } else {
+        return fail(js);
+      }
+      break;
+    case S_END:
+      if (!is_ws(c))
+        return fail(js);
+      break;
+    }
+    i++;
+  }
+  return true;
+}
+
+bool app_json_finish(app_json_t *js) {
+  // A bare top-level number has no delimiter after it
+  if (!js->error && js->state == S_LITERAL && js->depth == 0 &&
+      end_literal(js))
+    value_done(js);
+  return !js->error && js->done;
+}
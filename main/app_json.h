@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define APP_JSON_MAX_DEPTH 8
+#define APP_JSON_PATH_LEN 64
+#define APP_JSON_VALUE_LEN 48
+
+// Called for every scalar value. `path` is the dotted key path with "[]" for
+// array elements, e.g. "now.temp" or "hourly[].fxTime". `value` is the
+// unescaped string or the literal text of a number / true / false / null,
+// truncated to APP_JSON_VALUE_LEN - 1 bytes. `index` is the position inside
+// the innermost enclosing array, or -1 outside of arrays.
+typedef void (*app_json_value_cb_t)(void *ctx, const char *path,
+                                    const char *value, int index);
+
+// Pull tokenizer that walks a JSON document once, chunk by chunk, without
+// touching the heap. All state lives in this struct.
+typedef struct {
+  app_json_value_cb_t on_value;
+  void *ctx;
+
+  uint8_t state;
+  uint8_t depth;
+  uint8_t mute_depth; // != 0 while inside a key whose path did not fit
+  bool in_key;
+  bool key_overflow;
+  bool value_overflow;
+  bool done;
+  bool error;
+
+  char stack[APP_JSON_MAX_DEPTH];     // '{' or '['
+  uint8_t mark[APP_JSON_MAX_DEPTH];   // path length of the container itself
+  int16_t index[APP_JSON_MAX_DEPTH];  // element index for arrays
+  char path[APP_JSON_PATH_LEN];
+  size_t path_len;
+
+  char value[APP_JSON_VALUE_LEN];
+  size_t value_len;
+  uint8_t esc;        // escape sequence progress
+  uint32_t codepoint; // \uXXXX accumulator
+  uint16_t high_surrogate;
+} app_json_t;
+
+void app_json_init(app_json_t *js, app_json_value_cb_t on_value, void *ctx);
+// Returns false once the input is not valid JSON
+bool app_json_feed(app_json_t *js, const char *data, size_t len);
+// True if exactly one complete top-level value was seen
+bool app_json_finish(app_json_t *js);
@@ -0,0 +1,122 @@
+#include "app_metrics.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+static const char *TAG = "app_metrics";
+
+// Log-linear buckets: 4 per power of two from 64 us up to ~134 s, so any
+// percentile is off by at most 12.5%. Bucket 0 holds everything below 64 us.
+#define HIST_MIN_SHIFT 6
+#define HIST_OCTAVES 21
+#define HIST_SUB 4
+#define HIST_BUCKETS (1 + HIST_OCTAVES * HIST_SUB)
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint16_t buckets[HIST_BUCKETS];
+} phase_hist_t;
+
+static phase_hist_t s_hist[APP_PHASE_COUNT];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *s_phase_names[APP_PHASE_COUNT] = {
+    [APP_PHASE_DNS] = "dns",         [APP_PHASE_CONNECT] = "connect",
+    [APP_PHASE_TTFB] = "ttfb",       [APP_PHASE_BODY] = "body",
+    [APP_PHASE_INFLATE] = "inflate", [APP_PHASE_PARSE] = "parse",
+    [APP_PHASE_STORE] = "nvs_save",  [APP_PHASE_UI] = "ui_update",
+    [APP_PHASE_FETCH] = "fetch",
+};
+
+static int bucket_of(uint32_t us) {
+  if (us < (1u << HIST_MIN_SHIFT))
+    return 0;
+  int msb = 31 - __builtin_clz(us);
+  int idx = 1 + (msb - HIST_MIN_SHIFT) * HIST_SUB + ((us >> (msb - 2)) & 3);
+  return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+// Midpoint of a bucket, the value reported for percentiles that land in it
+static uint32_t bucket_mid(int idx) {
+  if (idx == 0)
+    return (1u << HIST_MIN_SHIFT) / 2;
+  int octave = (idx - 1) / HIST_SUB + HIST_MIN_SHIFT;
+  int sub = (idx - 1) % HIST_SUB;
+  uint32_t lo = (uint32_t)(HIST_SUB + sub) << (octave - 2);
+  return lo + (1u << (octave - 2)) / 2;
+}
+
+static uint32_t percentile(const phase_hist_t *h, uint32_t pct) {
+  uint32_t total = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    total += h->buckets[i];
+  uint32_t rank = (total * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank && h->buckets[i]) {
+      uint32_t v = bucket_mid(i);
+      if (v < h->min_us)
+        v = h->min_us;
+      if (v > h->max_us)
+        v = h->max_us;
+      return v;
+    }
+  }
+  return h->max_us;
+}
+
+void app_metrics_record(app_phase_t phase, uint32_t us) {
+  if (phase >= APP_PHASE_COUNT)
+    return;
+  phase_hist_t *h = &s_hist[phase];
+  int idx = bucket_of(us);
+
+  portENTER_CRITICAL(&s_lock);
+  if (h->count == 0 || us < h->min_us)
+    h->min_us = us;
+  if (us > h->max_us)
+    h->max_us = us;
+  h->count++;
+  if (h->buckets[idx] == UINT16_MAX) {
+    // Halve everything rather than saturate, keeps the shape intact
+    for (int i = 0; i < HIST_BUCKETS; i++)
+      h->buckets[i] /= 2;
+  }
+  h->buckets[idx]++;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void app_metrics_get(app_phase_t phase, app_phase_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (phase >= APP_PHASE_COUNT)
+    return;
+
+  phase_hist_t h;
+  portENTER_CRITICAL(&s_lock);
+  h = s_hist[phase];
+  portEXIT_CRITICAL(&s_lock);
+
+  stats->count = h.count;
+  if (h.count == 0)
+    return;
+  stats->min_us = h.min_us;
+  stats->max_us = h.max_us;
+  stats->p50_us = percentile(&h, 50);
+  stats->p95_us = percentile(&h, 95);
+}
+
+void app_metrics_dump(void) {
+  for (int p = 0; p < APP_PHASE_COUNT; p++) {
+    app_phase_stats_t st;
+    app_metrics_get(p, &st);
+    if (st.count == 0)
+      continue;
+    ESP_LOGI(TAG, "%-9s n=%-5lu min=%lu p50=%lu p95=%lu max=%lu us",
+             s_phase_names[p], (unsigned long)st.count,
+             (unsigned long)st.min_us, (unsigned long)st.p50_us,
+             (unsigned long)st.p95_us, (unsigned long)st.max_us);
+  }
+}
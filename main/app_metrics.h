@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Phases of a weather fetch, each with its own latency histogram
+typedef enum {
+  APP_PHASE_DNS,
+  APP_PHASE_CONNECT, // TCP connect + TLS handshake, new connections only
+  APP_PHASE_TTFB,    // request sent to response headers parsed
+  APP_PHASE_BODY,    // body transfer, excluding inflate/parse time
+  APP_PHASE_INFLATE,
+  APP_PHASE_PARSE,
+  APP_PHASE_STORE, // NVS save
+  APP_PHASE_UI,    // LVGL widget updates
+  APP_PHASE_FETCH, // whole batch of endpoint jobs
+  APP_PHASE_COUNT,
+} app_phase_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t p50_us;
+  uint32_t p95_us;
+  uint32_t max_us;
+} app_phase_stats_t;
+
+void app_metrics_record(app_phase_t phase, uint32_t us);
+void app_metrics_get(app_phase_t phase, app_phase_stats_t *stats);
+
+// One line per phase, written to the log (serial console)
+void app_metrics_dump(void);
@@ -1,17 +1,25 @@
 #include "app_net.h"
-#include "app_store.h"
+#include "app_city.h"
+#include "app_config.h"
 #include "app_ui.h"
+#include "app_weather.h"
 #include "esp_event.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_wifi.h"
 #include "lwip/inet.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 static const char *TAG = "app_net";
 static bool s_is_connected = false;
 static httpd_handle_t s_server = NULL;
+static TaskHandle_t s_reconnect_task = NULL;
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data) {
@@ -29,27 +37,176 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
     s_is_connected = true;
     app_ui_update_net_state(true);
+    // Don't leave stale weather on screen until the next scheduled poll
+    app_weather_update(NULL, NULL);
   }
 }
 
 static esp_err_t index_get_handler(httpd_req_t *req) {
   const char *html =
-      "<!DOCTYPE html><html><body>"
+      "<!DOCTYPE html><html><head><meta charset=\"utf-8\"></head><body>"
       "<h2>WiFi Config</h2>"
       "<form action=\"/save\" method=\"post\">"
       "SSID:<br><input type=\"text\" name=\"ssid\"><br>"
       "Password:<br><input type=\"password\" name=\"password\"><br>"
-      "City Name or Location ID:<br><input type=\"text\" name=\"location\"><br>"
+      "City Name, Location ID or lon,lat:<br><input type=\"text\" "
+      "name=\"location\" id=\"loc\" list=\"cl\" autocomplete=\"off\">"
+      "<datalist id=\"cl\"></datalist><br>"
+      "More Cities (up to 7, separated by ;, or nearby):<br>"
+      "<input type=\"text\" name=\"cities\"><br>"
       "Unit (C or F):<br><input type=\"text\" name=\"unit\" "
       "value=\"C\"><br><br>"
-      "<input type=\"submit\" value=\"Save and Restart\">"
-      "</form></body></html>";
+      "<input type=\"submit\" value=\"Save\">"
+      "</form>"
+      // Suggestions from /cities, one request per pause in typing
+      "<script>"
+      "var t,a,l=document.getElementById('cl');"
+      "document.getElementById('loc').oninput=function(){"
+      "var q=this.value;clearTimeout(t);if(a)a.abort();if(!q)return;"
+      "t=setTimeout(function(){a=new AbortController();"
+      "fetch('/cities?q='+encodeURIComponent(q),{signal:a.signal})"
+      ".then(function(r){return r.json()}).then(function(c){"
+      "l.innerHTML='';c.forEach(function(x){var o=new Option("
+      "x.name+' '+x.en+' '+x.adm1+' '+x.adm2,x.id);l.appendChild(o)})"
+      "}).catch(function(){})},150)};"
+      "</script></body></html>";
   httpd_resp_send(req, html, HTTPD_RESP_USE_STRLEN);
   return ESP_OK;
 }
 
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c |= 0x20;
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// In place, form encoding: '+' is a space
+static void url_decode(char *s) {
+  char *out = s;
+  for (; *s; s++) {
+    int hi, lo;
+    if (*s == '%' && (hi = hex_digit(s[1])) >= 0 &&
+        (lo = hex_digit(s[2])) >= 0) {
+      *out++ = (char)(hi << 4 | lo);
+      s += 2;
+    } else {
+      *out++ = *s == '+' ? ' ' : *s;
+    }
+  }
+  *out = '\0';
+}
+
+// Typed coordinates this close to a listed city become its Location ID
+#define NEAREST_SNAP_M 25000
+
+// "lon,lat" as QWeather takes it, into 1e-5 degrees
+static bool parse_lon_lat(const char *text, int32_t *lat, int32_t *lon) {
+  char *end;
+  double x = strtod(text, &end);
+  if (end == text || *end != ',')
+    return false;
+  const char *second = end + 1;
+  double y = strtod(second, &end);
+  if (end == second || *end != '\0' || y < -90 || y > 90 || x < -180 ||
+      x > 180)
+    return false;
+  *lat = (int32_t)lround(y * 1e5);
+  *lon = (int32_t)lround(x * 1e5);
+  return true;
+}
+
+// A form field as sent: every byte of a city name may be %XX encoded, so a
+// Chinese name takes up to nine bytes a character before decoding
+#define FIELD_ENCODED_MAX (3 * APP_CITY_KEY_MAX)
+
+// Turns what the user typed, still URL-encoded, into something the
+// providers take and stores it in `loc`: list names and coordinates near a
+// listed city become its Location ID, other coordinates and IDs pass.
+// Without the city index the text is kept encoded as before. False for an
+// unknown name or one that does not fit.
+static bool resolve_location(const char *encoded, char *loc, size_t len) {
+  if (!app_city_ready())
+    return snprintf(loc, len, "%s", encoded) < (int)len;
+  char text[FIELD_ENCODED_MAX];
+  if (snprintf(text, sizeof(text), "%s", encoded) >= (int)sizeof(text))
+    return false;
+  url_decode(text);
+  int32_t lat, lon;
+  if (parse_lon_lat(text, &lat, &lon)) {
+    app_city_near_t near;
+    if (app_city_nearest(lat, lon, &near, 1) &&
+        near.meters <= NEAREST_SNAP_M)
+      snprintf(loc, len, "%s", near.city.id);
+    else if (snprintf(loc, len, "%s", text) >= (int)len)
+      return false;
+    return true;
+  }
+  app_city_t city;
+  if (app_city_lookup(text, &city)) {
+    snprintf(loc, len, "%s", city.id);
+    return true;
+  }
+  // IDs of places outside the list
+  for (const char *p = text; *p; p++) {
+    if (!isalnum((unsigned char)*p))
+      return false;
+  }
+  return text[0] != '\0' && snprintf(loc, len, "%s", text) < (int)len;
+}
+
+// Resolves each entry of the still URL-encoded "a;b;c" list into
+// cfg->extra. False if one of them is unknown.
+static bool parse_cities(const char *list, app_config_t *cfg) {
+  cfg->extra_count = 0;
+  while (*list && cfg->extra_count < APP_MAX_LOCATIONS - 1) {
+    size_t n = 0;
+    while (list[n] && list[n] != ';' && strncasecmp(list + n, "%3B", 3) != 0)
+      n++;
+    if (n > 0) {
+      char entry[FIELD_ENCODED_MAX];
+      if (n >= sizeof(entry))
+        return false;
+      memcpy(entry, list, n);
+      entry[n] = '\0';
+      if (!resolve_location(entry, cfg->extra[cfg->extra_count],
+                            APP_LOCATION_LEN))
+        return false;
+      cfg->extra_count++;
+    }
+    list += n;
+    if (*list)
+      list += *list == ';' ? 1 : 3;
+  }
+  return true;
+}
+
+// "nearby" in the cities field: the cities closest to the primary one
+static void fill_nearby(app_config_t *cfg) {
+  cfg->extra_count = 0;
+  int32_t lat, lon;
+  app_city_t primary;
+  if (app_city_lookup(cfg->location, &primary)) {
+    lat = primary.lat;
+    lon = primary.lon;
+  } else if (!parse_lon_lat(cfg->location, &lat, &lon)) {
+    return;
+  }
+  app_city_near_t near[APP_MAX_LOCATIONS];
+  size_t n = app_city_nearest(lat, lon, near, APP_MAX_LOCATIONS);
+  for (size_t i = 0; i < n && cfg->extra_count < APP_MAX_LOCATIONS - 1;
+       i++) {
+    if (strcmp(near[i].city.id, cfg->location) != 0)
+      snprintf(cfg->extra[cfg->extra_count++], APP_LOCATION_LEN, "%s",
+               near[i].city.id);
+  }
+}
+
+// Fits the longest form the page sends: credentials and every city encoded
+#define FORM_MAX 1536
+
 static esp_err_t save_post_handler(httpd_req_t *req) {
-  char buf[256];
+  char buf[FORM_MAX];
   int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
   if (ret <= 0)
     return ESP_FAIL;
@@ -64,9 +221,30 @@ static esp_err_t save_post_handler(httpd_req_t *req) {
   if (httpd_query_key_value(buf, "password", cfg.password,
                             sizeof(cfg.password)) != ESP_OK)
     return ESP_FAIL;
-  if (httpd_query_key_value(buf, "location", cfg.location,
-                            sizeof(cfg.location)) != ESP_OK)
+  // Read encoded into room for the longest name, resolved to an ID that
+  // fits the config
+  char location[FIELD_ENCODED_MAX];
+  esp_err_t err =
+      httpd_query_key_value(buf, "location", location, sizeof(location));
+  if (err == ESP_ERR_NOT_FOUND)
     return ESP_FAIL;
+  bool ok = err == ESP_OK &&
+            resolve_location(location, cfg.location, sizeof(cfg.location));
+
+  char cities[(APP_MAX_LOCATIONS - 1) * (FIELD_ENCODED_MAX + 3)];
+  err = httpd_query_key_value(buf, "cities", cities, sizeof(cities));
+  if (err == ESP_OK && strcasecmp(cities, "nearby") == 0)
+    fill_nearby(&cfg);
+  else if (err == ESP_OK)
+    ok = ok && parse_cities(cities, &cfg);
+  else if (err != ESP_ERR_NOT_FOUND)
+    ok = false;
+  if (!ok) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Unknown city. Use a name from the city list, a "
+                        "Location ID or lon,lat");
+    return ESP_FAIL;
+  }
 
   char unit_val[4] = {0};
   if (httpd_query_key_value(buf, "unit", unit_val, sizeof(unit_val)) ==
@@ -75,20 +253,53 @@ static esp_err_t save_post_handler(httpd_req_t *req) {
   }
 
   // Replace '+' with ' ' or decode URL properly in a real product
-  app_store_save_config(&cfg);
+  if (!app_config_set(&cfg)) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Save failed");
+    return ESP_FAIL;
+  }
 
-  const char *html = "Saved. Device will restart.";
+  // The config subscriber takes the device back to station mode
+  const char *html = "Saved. Connecting...";
   httpd_resp_send(req, html, HTTPD_RESP_USE_STRLEN);
-
-  vTaskDelay(pdMS_TO_TICKS(1000));
-  esp_restart();
   return ESP_OK;
 }
 
+// GET /cities?q=<prefix>[&limit=n]: cities whose Location ID, pinyin or
+// Chinese name starts with q, as a JSON array. Streamed in chunks from the
+// mapped index, so a request needs no heap.
+static esp_err_t cities_get_handler(httpd_req_t *req) {
+  char query[128];
+  char q[APP_CITY_KEY_MAX * 3] = {0}; // still encoded
+  char limit_val[4] = {0};
+  int limit = APP_CITY_JSON_LIMIT_DEFAULT;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "q", q, sizeof(q));
+    if (httpd_query_key_value(query, "limit", limit_val,
+                              sizeof(limit_val)) == ESP_OK)
+      limit = atoi(limit_val);
+  }
+  url_decode(q);
+
+  httpd_resp_set_type(req, "application/json");
+  char buf[1024];
+  app_city_json_t j;
+  app_city_json_begin(&j, q, limit);
+  size_t len;
+  while ((len = app_city_json_next(&j, buf, sizeof(buf))) > 0) {
+    if (httpd_resp_send_chunk(req, buf, len) != ESP_OK)
+      return ESP_FAIL;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 static const httpd_uri_t index_uri = {.uri = "/",
                                       .method = HTTP_GET,
                                       .handler = index_get_handler,
                                       .user_ctx = NULL};
+static const httpd_uri_t cities_uri = {.uri = "/cities",
+                                       .method = HTTP_GET,
+                                       .handler = cities_get_handler,
+                                       .user_ctx = NULL};
 static const httpd_uri_t save_uri = {.uri = "/save",
                                      .method = HTTP_POST,
                                      .handler = save_post_handler,
@@ -115,14 +326,58 @@ void app_net_start_provisioning(void) {
   ESP_ERROR_CHECK(esp_wifi_start());
 
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  // The save handler holds the encoded form and its fields on the stack
+  config.stack_size = 8192;
   if (httpd_start(&s_server, &config) == ESP_OK) {
     httpd_register_uri_handler(s_server, &index_uri);
+    httpd_register_uri_handler(s_server, &cities_uri);
     httpd_register_uri_handler(s_server, &save_uri);
   }
 }
 
 bool app_net_is_connected(void) { return s_is_connected; }
 
+static bool start_sta(void) {
+  app_config_t app_cfg;
+  if (!app_config_get(&app_cfg, NULL) || strlen(app_cfg.ssid) == 0)
+    return false;
+  wifi_config_t wifi_config = {0};
+  strncpy((char *)wifi_config.sta.ssid, app_cfg.ssid,
+          sizeof(wifi_config.sta.ssid));
+  strncpy((char *)wifi_config.sta.password, app_cfg.password,
+          sizeof(wifi_config.sta.password));
+
+  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+  ESP_ERROR_CHECK(esp_wifi_start());
+  return true;
+}
+
+// Leaves provisioning or rejoins with new credentials, no restart needed
+static void reconnect_task(void *arg) {
+  vTaskDelay(pdMS_TO_TICKS(1000)); // let the portal's reply go out
+  if (s_server) {
+    httpd_stop(s_server);
+    s_server = NULL;
+  }
+  ESP_LOGI(TAG, "WiFi settings changed, reconnecting");
+  s_is_connected = false;
+  app_ui_update_net_state(false);
+  esp_wifi_stop();
+  if (start_sta())
+    app_ui_show_main();
+  else
+    app_net_start_provisioning();
+  s_reconnect_task = NULL;
+  vTaskDelete(NULL);
+}
+
+static void on_config_change(uint32_t changed, void *arg) {
+  if ((changed & APP_CONFIG_WIFI) && !s_reconnect_task)
+    xTaskCreate(reconnect_task, "app_reconnect", 4096, NULL, 5,
+                &s_reconnect_task);
+}
+
 void app_net_init(void) {
   ESP_LOGI(TAG, "Initializing Network...");
 
@@ -144,18 +399,8 @@ void app_net_init(void) {
       IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL,
       &instance_got_ip));
 
-  app_config_t app_cfg = {0};
-  if (app_store_load_config(&app_cfg) && strlen(app_cfg.ssid) > 0) {
-    wifi_config_t wifi_config = {0};
-    strncpy((char *)wifi_config.sta.ssid, app_cfg.ssid,
-            sizeof(wifi_config.sta.ssid));
-    strncpy((char *)wifi_config.sta.password, app_cfg.password,
-            sizeof(wifi_config.sta.password));
-
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-  } else {
+  app_config_subscribe(on_config_change, NULL);
+  if (!start_sta()) {
     // Automatically start AP if no SSID is configured
     app_net_start_provisioning();
   }
@@ -0,0 +1,34 @@
+#include "app_provider.h"
+#include <stdlib.h>
+#include <string.h>
+
+// QWeather sends integers as strings, Open-Meteo decimals as numbers
+static int round_int(double v) { return (int)(v < 0 ? v - 0.5 : v + 0.5); }
+
+void app_provider_store(const json_field_t *f, char *dst, const char *value,
+                        bool fahrenheit) {
+  switch (f->type) {
+  case FIELD_INT:
+    *(int *)dst = round_int(strtod(value, NULL));
+    break;
+  case FIELD_TEMP: {
+    double t = strtod(value, NULL);
+    *(int *)dst = round_int(fahrenheit ? t * 9 / 5 + 32 : t);
+    break;
+  }
+  case FIELD_STR:
+    strncpy(dst, value, f->size - 1);
+    break;
+  case FIELD_HHMM: {
+    const char *t = strchr(value, 'T');
+    if (t && strlen(t + 1) >= 5) {
+      memcpy(dst, t + 1, 5);
+      dst[5] = '\0';
+    }
+    break;
+  }
+  case FIELD_CONV:
+    f->convert(value, dst, f->size);
+    break;
+  }
+}
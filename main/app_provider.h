@@ -0,0 +1,122 @@
+#pragma once
+
+#include "app_http.h"
+#include "app_store.h"
+#include "weather_data.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef enum {
+  FIELD_INT,
+  FIELD_TEMP, // Celsius, converted when the unit is Fahrenheit
+  FIELD_STR,
+  FIELD_HHMM, // "HH:MM" taken from an ISO-8601 timestamp
+  FIELD_CONV, // string written by the field's convert()
+} field_type_t;
+
+// Maps a JSON key path onto a member of the job's target struct. Numbers may
+// come with decimals and are rounded. Several fields may share one path.
+typedef struct {
+  const char *path;
+  field_type_t type;
+  uint16_t offset;
+  uint16_t size;
+  void (*convert)(const char *value, char *dst, size_t size);
+} json_field_t;
+
+#define FIELD(t, type, p, m)                                                   \
+  {p, t, offsetof(type, m), sizeof(((type *)0)->m), NULL}
+#define FIELD_FN(fn, type, p, m)                                               \
+  {p, FIELD_CONV, offsetof(type, m), sizeof(((type *)0)->m), fn}
+
+// One API endpoint: where it lives, how often it is refreshed and which
+// region of weather_model_t its field table fills in.
+typedef struct {
+  const char *name;
+  const char *host;     // NULL: the provider's host
+  const char *endpoint; // path on the host, before the query string
+  const char *query;    // appended to the provider's query string, or NULL
+  const char *stamp_path; // provider update time, NULL: body hash decides
+  uint32_t interval_s;    // 0: every time the scheduler wakes the task
+  const json_field_t *fields;
+  size_t field_count;
+  size_t base; // region inside weather_model_t
+  size_t size;
+  size_t stride;   // element size when the region is an array
+  int max_items;   // 0 for a single object
+  size_t count_at; // uint8_t item count (arrays) or bool is_valid (objects)
+
+  // Change detection: validators and fingerprint of the last good response
+  char etag[APP_HTTP_ETAG_LEN];
+  char last_modified[APP_HTTP_DATE_LEN];
+  char update_time[32];
+  uint32_t body_hash;
+
+  // Runtime state and counters
+  int64_t last_ok_us;
+  bool ever_ok;
+  uint32_t fetches;
+  uint32_t failures;
+  uint32_t unchanged;
+  uint32_t last_ms;
+  size_t wire_bytes;
+  size_t json_bytes;
+} weather_job_t;
+
+// Trailing arguments are extra designated initializers, e.g. .query = "..."
+#define OBJECT_JOB(n, ep, mins, f, m, ...)                                     \
+  {.name = n,                                                                  \
+   .endpoint = ep,                                                             \
+   .interval_s = (mins) * 60,                                                  \
+   .fields = f,                                                                \
+   .field_count = ARRAY_SIZE(f),                                               \
+   .base = offsetof(weather_model_t, m),                                       \
+   .size = sizeof(((weather_model_t *)0)->m),                                  \
+   .count_at = offsetof(weather_model_t, m.is_valid),                          \
+   __VA_ARGS__}
+
+#define ARRAY_JOB(n, ep, mins, f, m, max, ...)                                 \
+  {.name = n,                                                                  \
+   .endpoint = ep,                                                             \
+   .interval_s = (mins) * 60,                                                  \
+   .fields = f,                                                                \
+   .field_count = ARRAY_SIZE(f),                                               \
+   .base = offsetof(weather_model_t, m),                                       \
+   .size = sizeof(((weather_model_t *)0)->m),                                  \
+   .stride = sizeof(((weather_model_t *)0)->m[0]),                             \
+   .max_items = max,                                                           \
+   .count_at = offsetof(weather_model_t, m##_count),                           \
+   __VA_ARGS__}
+
+// A weather API backend: how to build its requests and where its fields are.
+// The engine streams every response through the job's field table, so a
+// provider is data plus one URL builder.
+typedef struct {
+  const char *name;
+  const char *host;   // "https://host[:port]"
+  bool metered;       // calls count against CONFIG_WEATHER_DAILY_QUOTA
+  bool zoned_stamps;  // stamps carry a UTC offset, usable for scheduling
+  const char *status_path; // body status code, NULL: HTTP status only
+  const char *status_ok;
+  weather_job_t *jobs; // "now" first
+  size_t job_count;
+  // Cost factor applied to the latency score in percent, > 100 makes the
+  // provider a fallback that only wins when clearly faster
+  uint32_t preference_pct;
+
+  // Writes the request URL of `job`. Returns false if the provider cannot
+  // serve the configured location yet, e.g. without coordinates.
+  bool (*build_url)(const weather_job_t *job, const app_config_t *cfg,
+                    const weather_model_t *model, char *url, size_t len);
+} app_provider_t;
+
+// Writes a JSON value into the field's member at `dst`, the start of the
+// member inside the job's region
+void app_provider_store(const json_field_t *f, char *dst, const char *value,
+                        bool fahrenheit);
+
+extern const app_provider_t app_provider_qweather;
+extern const app_provider_t app_provider_open_meteo;
@@ -0,0 +1,140 @@
+#include "app_provider.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// WMO weather interpretation code -> QWeather icon code and text, so the UI
+// keeps a single icon set. Texts stay within the glyphs of the CJK font.
+typedef struct {
+  uint8_t wmo;
+  const char *icon;
+  const char *text;
+} wmo_map_t;
+
+static const wmo_map_t s_wmo[] = {
+    {0, "100", "晴"},      {1, "100", "晴"},      {2, "101", "多云"},
+    {3, "104", "阴"},      {45, "501", "雾"},     {48, "501", "雾"},
+    {51, "305", "小雨"},   {53, "305", "小雨"},   {55, "305", "小雨"},
+    {56, "313", "冻雨"},   {57, "313", "冻雨"},   {61, "305", "小雨"},
+    {63, "306", "中雨"},   {65, "307", "大雨"},   {66, "313", "冻雨"},
+    {67, "313", "冻雨"},   {71, "400", "小雪"},   {73, "401", "中雪"},
+    {75, "402", "大雪"},   {77, "400", "小雪"},   {80, "300", "阵雨"},
+    {81, "300", "阵雨"},   {82, "310", "暴雨"},   {85, "407", "阵雪"},
+    {86, "407", "阵雪"},   {95, "302", "雷阵雨"}, {96, "304", "雷阵雨"},
+    {99, "304", "雷阵雨"},
+};
+
+static const wmo_map_t *wmo_find(const char *value) {
+  int code = atoi(value);
+  for (size_t i = 0; i < ARRAY_SIZE(s_wmo); i++) {
+    if (s_wmo[i].wmo == code)
+      return &s_wmo[i];
+  }
+  return &s_wmo[3]; // unknown: overcast
+}
+
+static void wmo_icon(const char *value, char *dst, size_t size) {
+  strncpy(dst, wmo_find(value)->icon, size - 1);
+}
+
+static void wmo_text(const char *value, char *dst, size_t size) {
+  strncpy(dst, wmo_find(value)->text, size - 1);
+}
+
+static const json_field_t s_now_fields[] = {
+    FIELD(FIELD_TEMP, weather_info_t, "current.temperature_2m", temp),
+    FIELD(FIELD_TEMP, weather_info_t, "current.apparent_temperature",
+          feels_like),
+    FIELD_FN(wmo_text, weather_info_t, "current.weather_code", description),
+    FIELD_FN(wmo_icon, weather_info_t, "current.weather_code", icon),
+    FIELD(FIELD_INT, weather_info_t, "current.wind_speed_10m", wind_speed),
+    FIELD(FIELD_INT, weather_info_t, "current.relative_humidity_2m",
+          humidity),
+};
+
+// Open-Meteo returns columns, one array per variable
+static const json_field_t s_hourly_fields[] = {
+    FIELD(FIELD_HHMM, weather_hourly_t, "hourly.time[]", time),
+    FIELD(FIELD_TEMP, weather_hourly_t, "hourly.temperature_2m[]", temp),
+    FIELD(FIELD_INT, weather_hourly_t, "hourly.precipitation_probability[]",
+          pop),
+    FIELD_FN(wmo_icon, weather_hourly_t, "hourly.weather_code[]", icon),
+};
+
+static const json_field_t s_daily_fields[] = {
+    FIELD(FIELD_STR, weather_daily_t, "daily.time[]", date),
+    FIELD(FIELD_TEMP, weather_daily_t, "daily.temperature_2m_max[]", temp_max),
+    FIELD(FIELD_TEMP, weather_daily_t, "daily.temperature_2m_min[]", temp_min),
+    FIELD_FN(wmo_icon, weather_daily_t, "daily.weather_code[]", icon_day),
+    FIELD_FN(wmo_text, weather_daily_t, "daily.weather_code[]", text_day),
+};
+
+// US AQI, the only index it has. No category text, the UI shows the number.
+static const json_field_t s_air_fields[] = {
+    FIELD(FIELD_INT, weather_air_t, "current.us_aqi", aqi),
+};
+
+// No warnings endpoint: the last QWeather warnings stay on screen
+static weather_job_t s_jobs[] = {
+    OBJECT_JOB("now", "/v1/forecast", 0, s_now_fields, now,
+               .query = "&current=temperature_2m,apparent_temperature,"
+                        "relative_humidity_2m,wind_speed_10m,weather_code",
+               .stamp_path = "current.time"),
+    ARRAY_JOB("24h", "/v1/forecast", 60, s_hourly_fields, hourly,
+              WEATHER_HOURLY_MAX,
+              .query = "&hourly=temperature_2m,precipitation_probability,"
+                       "weather_code&forecast_hours=6"),
+    ARRAY_JOB("3d", "/v1/forecast", 180, s_daily_fields, daily,
+              WEATHER_DAILY_MAX,
+              .query = "&daily=weather_code,temperature_2m_max,"
+                       "temperature_2m_min&forecast_days=3"),
+    OBJECT_JOB("air", "/v1/air-quality", 60, s_air_fields, air,
+               .host = CONFIG_WEATHER_OPEN_METEO_AIR_HOST,
+               .query = "&current=us_aqi", .stamp_path = "current.time"),
+};
+
+// "lon,lat" as QWeather accepts it in the location field
+static bool parse_coords(const char *location, char *lat, char *lon,
+                         size_t len) {
+  char *end;
+  strtod(location, &end);
+  if (end == location || *end != ',')
+    return false;
+  const char *second = end + 1;
+  strtod(second, &end);
+  if (end == second || *end != '\0')
+    return false;
+  snprintf(lon, len, "%.*s", (int)(second - 1 - location), location);
+  snprintf(lat, len, "%s", second);
+  return true;
+}
+
+static bool build_url(const weather_job_t *job, const app_config_t *cfg,
+                      const weather_model_t *model, char *url, size_t len) {
+  char lat[16], lon[16];
+  if (!parse_coords(cfg->location, lat, lon, sizeof(lat))) {
+    // City names and IDs need the coordinates QWeather's lookup found
+    const weather_place_t *place = &model->place;
+    if (!place->is_valid || strcmp(place->location, cfg->location) != 0)
+      return false;
+    snprintf(lat, sizeof(lat), "%s", place->lat);
+    snprintf(lon, sizeof(lon), "%s", place->lon);
+  }
+  int n = snprintf(url, len, "%s%s?latitude=%s&longitude=%s&timezone=auto%s",
+                   job->host ? job->host : CONFIG_WEATHER_OPEN_METEO_HOST,
+                   job->endpoint, lat, lon, job->query ? job->query : "");
+  return n > 0 && (size_t)n < len;
+}
+
+// Free and keyless. Errors come back as HTTP status with a "reason" body.
+const app_provider_t app_provider_open_meteo = {
+    .name = "open-meteo",
+    .host = CONFIG_WEATHER_OPEN_METEO_HOST,
+    .metered = false,
+    .zoned_stamps = false, // local time without offset
+    .jobs = s_jobs,
+    .job_count = ARRAY_SIZE(s_jobs),
+    .preference_pct = 200,
+    .build_url = build_url,
+};
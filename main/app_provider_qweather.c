@@ -0,0 +1,85 @@
+#include "app_provider.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+
+static const json_field_t s_now_fields[] = {
+    FIELD(FIELD_TEMP, weather_info_t, "now.temp", temp),
+    FIELD(FIELD_TEMP, weather_info_t, "now.feelsLike", feels_like),
+    FIELD(FIELD_STR, weather_info_t, "now.text", description),
+    FIELD(FIELD_STR, weather_info_t, "now.icon", icon),
+    FIELD(FIELD_INT, weather_info_t, "now.windSpeed", wind_speed),
+    FIELD(FIELD_INT, weather_info_t, "now.humidity", humidity),
+};
+
+static const json_field_t s_hourly_fields[] = {
+    FIELD(FIELD_HHMM, weather_hourly_t, "hourly[].fxTime", time),
+    FIELD(FIELD_TEMP, weather_hourly_t, "hourly[].temp", temp),
+    FIELD(FIELD_INT, weather_hourly_t, "hourly[].pop", pop),
+    FIELD(FIELD_STR, weather_hourly_t, "hourly[].icon", icon),
+};
+
+static const json_field_t s_daily_fields[] = {
+    FIELD(FIELD_STR, weather_daily_t, "daily[].fxDate", date),
+    FIELD(FIELD_TEMP, weather_daily_t, "daily[].tempMax", temp_max),
+    FIELD(FIELD_TEMP, weather_daily_t, "daily[].tempMin", temp_min),
+    FIELD(FIELD_STR, weather_daily_t, "daily[].iconDay", icon_day),
+    FIELD(FIELD_STR, weather_daily_t, "daily[].textDay", text_day),
+};
+
+static const json_field_t s_air_fields[] = {
+    FIELD(FIELD_INT, weather_air_t, "now.aqi", aqi),
+    FIELD(FIELD_STR, weather_air_t, "now.category", category),
+};
+
+static const json_field_t s_warning_fields[] = {
+    FIELD(FIELD_STR, weather_warning_t, "warning[].type", type),
+    FIELD(FIELD_STR, weather_warning_t, "warning[].severityColor",
+          severity_color),
+};
+
+// Only the best match, its coordinates let coordinate-only providers take
+// over when QWeather is down
+static const json_field_t s_place_fields[] = {
+    FIELD(FIELD_STR, weather_place_t, "location[].lat", lat),
+    FIELD(FIELD_STR, weather_place_t, "location[].lon", lon),
+};
+
+// Stamped by QWeather right after "code", so an unchanged response is
+// recognized before its fields are decoded
+#define STAMP .stamp_path = "updateTime"
+
+// Run back to back over the same kept-alive connection, "now" first. The poll
+// cadence itself comes from app_sched, aligned to the provider's updates.
+static weather_job_t s_jobs[] = {
+    OBJECT_JOB("now", "/v7/weather/now", 0, s_now_fields, now, STAMP),
+    ARRAY_JOB("24h", "/v7/weather/24h", 60, s_hourly_fields, hourly,
+              WEATHER_HOURLY_MAX, STAMP),
+    ARRAY_JOB("3d", "/v7/weather/3d", 180, s_daily_fields, daily,
+              WEATHER_DAILY_MAX, STAMP),
+    OBJECT_JOB("air", "/v7/air/now", 60, s_air_fields, air, STAMP),
+    ARRAY_JOB("warning", "/v7/warning/now", 30, s_warning_fields, warning,
+              WEATHER_WARNING_MAX, STAMP),
+    OBJECT_JOB("geo", "/geo/v2/city/lookup", 24 * 60, s_place_fields, place,
+               .query = "&number=1"),
+};
+
+static bool build_url(const weather_job_t *job, const app_config_t *cfg,
+                      const weather_model_t *model, char *url, size_t len) {
+  int n = snprintf(url, len, "%s%s?location=%s&key=%s&lang=zh%s",
+                   CONFIG_WEATHER_QWEATHER_HOST, job->endpoint, cfg->location,
+                   CONFIG_WEATHER_QWEATHER_KEY, job->query ? job->query : "");
+  return n > 0 && (size_t)n < len;
+}
+
+const app_provider_t app_provider_qweather = {
+    .name = "qweather",
+    .host = CONFIG_WEATHER_QWEATHER_HOST,
+    .metered = true,
+    .zoned_stamps = true,
+    .status_path = "code",
+    .status_ok = "200",
+    .jobs = s_jobs,
+    .job_count = ARRAY_SIZE(s_jobs),
+    .preference_pct = 100,
+    .build_url = build_url,
+};
@@ -0,0 +1,168 @@
+#include "app_record.h"
+#include "esp_rom_crc.h"
+#include <math.h>
+#include <string.h>
+
+#define RECORD_MAGIC 0xB7
+#define CRC_LEN 4
+
+static const double s_pow10[] = {1, 10, 100, 1e3, 1e4, 1e5, 1e6, 1e7};
+#define MAX_DECIMALS (sizeof(s_pow10) / sizeof(s_pow10[0]) - 1)
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void put_byte(app_record_writer_t *w, uint8_t b) {
+  if (w->len < w->size)
+    w->buf[w->len++] = b;
+  else
+    w->overflow = true;
+}
+
+static void put_varint(app_record_writer_t *w, uint32_t v) {
+  while (v >= 0x80) {
+    put_byte(w, (uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  put_byte(w, (uint8_t)v);
+}
+
+static bool get_varint(app_record_reader_t *r, uint32_t *v) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (r->pos >= r->len)
+      return false;
+    uint8_t b = r->buf[r->pos++];
+    out |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *v = out;
+      return true;
+    }
+  }
+  return false; // longer than 32 bits
+}
+
+void app_record_begin(app_record_writer_t *w, void *buf, size_t size,
+                      uint8_t schema) {
+  w->buf = buf;
+  w->size = size;
+  w->len = 0;
+  w->overflow = false;
+  put_byte(w, RECORD_MAGIC);
+  put_byte(w, schema);
+}
+
+void app_record_put_uint(app_record_writer_t *w, uint32_t tag,
+                         uint32_t value) {
+  put_varint(w, tag << 2 | APP_RECORD_VARINT);
+  put_varint(w, value);
+}
+
+void app_record_put_int(app_record_writer_t *w, uint32_t tag, int32_t value) {
+  app_record_put_uint(w, tag, zigzag(value));
+}
+
+void app_record_put_fixed(app_record_writer_t *w, uint32_t tag, double value,
+                          uint8_t decimals) {
+  if (decimals > MAX_DECIMALS)
+    decimals = MAX_DECIMALS;
+  app_record_put_int(w, tag, (int32_t)lround(value * s_pow10[decimals]));
+}
+
+void app_record_put_str(app_record_writer_t *w, uint32_t tag, const char *s) {
+  if (s[0])
+    app_record_put_bytes(w, tag, s, strlen(s));
+}
+
+void app_record_put_bytes(app_record_writer_t *w, uint32_t tag,
+                          const void *data, size_t len) {
+  put_varint(w, tag << 2 | APP_RECORD_BYTES);
+  put_varint(w, (uint32_t)len);
+  if (w->len + len > w->size) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+}
+
+size_t app_record_end(app_record_writer_t *w) {
+  uint32_t crc = esp_rom_crc32_le(0, w->buf, w->len);
+  for (int i = 0; i < CRC_LEN; i++)
+    put_byte(w, (uint8_t)(crc >> (8 * i)));
+  return w->overflow ? 0 : w->len;
+}
+
+bool app_record_open(app_record_reader_t *r, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  if (len < APP_RECORD_OVERHEAD || p[0] != RECORD_MAGIC)
+    return false;
+  size_t body = len - CRC_LEN;
+  uint32_t crc = 0;
+  for (int i = 0; i < CRC_LEN; i++)
+    crc |= (uint32_t)p[body + i] << (8 * i);
+  if (crc != esp_rom_crc32_le(0, p, body))
+    return false;
+  r->buf = p;
+  r->len = body;
+  r->pos = 2;
+  r->schema = p[1];
+  return true;
+}
+
+bool app_record_next(app_record_reader_t *r, app_record_field_t *f) {
+  uint32_t key;
+  if (r->pos >= r->len || !get_varint(r, &key))
+    return false;
+  f->tag = key >> 2;
+  f->wire = key & 3;
+  switch (f->wire) {
+  case APP_RECORD_VARINT:
+    return get_varint(r, &f->value);
+  case APP_RECORD_BYTES: {
+    uint32_t n;
+    if (!get_varint(r, &n) || n > r->len - r->pos)
+      return false;
+    f->data = r->buf + r->pos;
+    f->len = n;
+    r->pos += n;
+    return true;
+  }
+  default: {
+    size_t n = f->wire == APP_RECORD_FIXED32 ? 4 : 8;
+    if (n > r->len - r->pos)
+      return false;
+    f->data = r->buf + r->pos;
+    f->len = n;
+    f->value = 0;
+    for (int i = 0; i < 4; i++)
+      f->value |= (uint32_t)f->data[i] << (8 * i);
+    r->pos += n;
+    return true;
+  }
+  }
+}
+
+int32_t app_record_int(const app_record_field_t *f) {
+  return unzigzag(f->value);
+}
+
+double app_record_fixed(const app_record_field_t *f, uint8_t decimals) {
+  if (decimals > MAX_DECIMALS)
+    decimals = MAX_DECIMALS;
+  return app_record_int(f) / s_pow10[decimals];
+}
+
+void app_record_str(const app_record_field_t *f, char *dst, size_t size) {
+  size_t n = f->wire == APP_RECORD_BYTES ? f->len : 0;
+  if (n > size - 1)
+    n = size - 1;
+  if (n)
+    memcpy(dst, f->data, n);
+  dst[n] = '\0';
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact tagged records for NVS blobs:
+//
+//   magic  schema  field...  crc32
+//
+// Each field is a varint key (tag << 2 | wire type) followed by its value.
+// Every wire type has a length a reader can tell, so readers skip tags they
+// do not know and defaults cover tags that are missing: fields can be added
+// or retired without a format break. The schema version is for the rare
+// change that needs an explicit migration, a reader refuses newer ones.
+
+typedef enum {
+  APP_RECORD_VARINT = 0,  // unsigned, zigzag signed or fixed-point
+  APP_RECORD_BYTES = 1,   // length varint, then the bytes
+  APP_RECORD_FIXED32 = 2, // 4 bytes, little endian
+  APP_RECORD_FIXED64 = 3, // 8 bytes, little endian
+  // Nothing writes the fixed types yet, they are defined so that readers
+  // today skip them when a later writer does
+} app_record_wire_t;
+
+// Header and CRC
+#define APP_RECORD_OVERHEAD 6
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+  bool overflow;
+} app_record_writer_t;
+
+void app_record_begin(app_record_writer_t *w, void *buf, size_t size,
+                      uint8_t schema);
+void app_record_put_uint(app_record_writer_t *w, uint32_t tag,
+                         uint32_t value);
+void app_record_put_int(app_record_writer_t *w, uint32_t tag, int32_t value);
+// `value` with `decimals` decimal places, e.g. coordinates
+void app_record_put_fixed(app_record_writer_t *w, uint32_t tag, double value,
+                          uint8_t decimals);
+// Empty strings are left out, a missing tag reads back as ""
+void app_record_put_str(app_record_writer_t *w, uint32_t tag, const char *s);
+void app_record_put_bytes(app_record_writer_t *w, uint32_t tag,
+                          const void *data, size_t len);
+// Appends the CRC. Returns the record size, 0 if it did not fit.
+size_t app_record_end(app_record_writer_t *w);
+
+typedef struct {
+  const uint8_t *buf;
+  size_t len; // up to the CRC
+  size_t pos;
+  uint8_t schema;
+} app_record_reader_t;
+
+typedef struct {
+  uint32_t tag;
+  app_record_wire_t wire;
+  uint32_t value;      // APP_RECORD_VARINT, low half of the fixed types
+  const uint8_t *data; // APP_RECORD_BYTES and the fixed types
+  size_t len;
+} app_record_field_t;
+
+// False if `buf` is not a record or its CRC does not match, e.g. a legacy
+// raw struct
+bool app_record_open(app_record_reader_t *r, const void *buf, size_t len);
+// False at the end, or at a malformed field
+bool app_record_next(app_record_reader_t *r, app_record_field_t *f);
+
+int32_t app_record_int(const app_record_field_t *f);
+double app_record_fixed(const app_record_field_t *f, uint8_t decimals);
+// Copies a BYTES field as a NUL-terminated string, truncated to `size`
+void app_record_str(const app_record_field_t *f, char *dst, size_t size);
@@ -0,0 +1,142 @@
+#include "app_sched.h"
+#include <string.h>
+
+#define SCHED_DEFAULT_CADENCE_S (15 * 60)
+#define SCHED_MIN_CADENCE_S (5 * 60)
+#define SCHED_MAX_CADENCE_S (3 * 60 * 60)
+// Time between the provider's updateTime and the data being served everywhere
+#define SCHED_PUBLISH_MARGIN_S 60
+#define SCHED_JITTER_S 90
+#define SCHED_MIN_DELAY_S 60
+// First re-check when the expected publish did not show up, doubled after
+// every further unchanged poll
+#define SCHED_RECHECK_S 120
+#define SCHED_MAX_DELAY_S (30 * 60)
+#define SCHED_URGENT_MAX_S (10 * 60)
+#define SCHED_FAIL_BASE_S 60
+#define SCHED_FAIL_MAX_S (15 * 60)
+
+static uint32_t next_rand(app_sched_t *s) {
+  // xorshift32, plenty for spreading a fleet over a jitter window
+  uint32_t x = s->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  s->rng = x;
+  return x;
+}
+
+static int64_t backoff(int64_t base, uint32_t steps, int64_t max) {
+  while (steps-- > 0 && base < max)
+    base *= 2;
+  return base < max ? base : max;
+}
+
+void app_sched_init(app_sched_t *s, uint32_t seed) {
+  memset(s, 0, sizeof(*s));
+  s->cadence_s = SCHED_DEFAULT_CADENCE_S;
+  s->rng = seed ? seed : 0x9E3779B9u;
+}
+
+void app_sched_on_success(app_sched_t *s, int64_t update_s, bool changed,
+                          bool urgent) {
+  s->urgent = urgent;
+  s->unchanged_streak = changed ? 0 : s->unchanged_streak + 1;
+
+  if (update_s > s->last_update_s) {
+    int64_t interval = update_s - s->last_update_s;
+    // An interval spanning failed polls may cover several publishes
+    if (s->last_update_s > 0 && !s->missed &&
+        interval >= SCHED_MIN_CADENCE_S && interval <= SCHED_MAX_CADENCE_S)
+      s->cadence_s = (3 * s->cadence_s + (int32_t)interval) / 4;
+    s->last_update_s = update_s;
+    s->missed = false;
+  }
+  s->failures = 0;
+  s->fail_delay_s = 0;
+}
+
+void app_sched_on_failure(app_sched_t *s) {
+  s->failures++;
+  s->missed = true;
+  // Decorrelated jitter: random between the base and three times the last
+  // delay, so devices failing together do not retry in lockstep
+  uint32_t hi = s->fail_delay_s * 3;
+  if (hi <= SCHED_FAIL_BASE_S)
+    hi = SCHED_FAIL_BASE_S + 1;
+  uint32_t delay = SCHED_FAIL_BASE_S + next_rand(s) % (hi - SCHED_FAIL_BASE_S);
+  s->fail_delay_s = delay < SCHED_FAIL_MAX_S ? delay : SCHED_FAIL_MAX_S;
+}
+
+uint32_t app_sched_next_delay_s(app_sched_t *s, int64_t now_s) {
+  if (s->failures > 0)
+    return s->fail_delay_s; // already jittered
+
+  int64_t delay;
+  if (s->last_update_s > 0) {
+    int64_t due = s->last_update_s + s->cadence_s + SCHED_PUBLISH_MARGIN_S;
+    delay = due - now_s;
+    if (delay < SCHED_MIN_DELAY_S) {
+      // Expected publish already passed without new data: back off
+      uint32_t steps = s->unchanged_streak ? s->unchanged_streak - 1 : 0;
+      delay = backoff(SCHED_RECHECK_S, steps, SCHED_MAX_DELAY_S);
+    }
+  } else {
+    delay = SCHED_DEFAULT_CADENCE_S;
+  }
+
+  if (s->urgent && delay > SCHED_URGENT_MAX_S)
+    delay = SCHED_URGENT_MAX_S;
+  if (delay > SCHED_MAX_DELAY_S)
+    delay = SCHED_MAX_DELAY_S;
+  if (delay < SCHED_MIN_DELAY_S)
+    delay = SCHED_MIN_DELAY_S;
+  return (uint32_t)delay + next_rand(s) % SCHED_JITTER_S;
+}
+
+static bool read_num(const char **p, int digits, int *out) {
+  int v = 0;
+  for (int i = 0; i < digits; i++) {
+    char c = (*p)[i];
+    if (c < '0' || c > '9')
+      return false;
+    v = v * 10 + (c - '0');
+  }
+  *p += digits;
+  *out = v;
+  return true;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t days_from_civil(int y, int m, int d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+int64_t app_sched_parse_time(const char *iso) {
+  int y, mo, d, h, mi, sec = 0;
+  const char *p = iso;
+  if (!read_num(&p, 4, &y) || *p++ != '-' || !read_num(&p, 2, &mo) ||
+      *p++ != '-' || !read_num(&p, 2, &d) || *p++ != 'T' ||
+      !read_num(&p, 2, &h) || *p++ != ':' || !read_num(&p, 2, &mi))
+    return 0;
+  if (*p == ':' && !(p++, read_num(&p, 2, &sec)))
+    return 0;
+
+  int64_t t = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec;
+  if (*p == '+' || *p == '-') {
+    int sign = *p++ == '-' ? -1 : 1;
+    int oh, om = 0;
+    if (!read_num(&p, 2, &oh))
+      return 0;
+    if (*p == ':')
+      p++;
+    read_num(&p, 2, &om);
+    t -= sign * (oh * 3600 + om * 60);
+  }
+  return t;
+}
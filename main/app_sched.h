@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Poll scheduler for the weather task. It learns how often the provider
+// publishes new data from consecutive updateTime stamps and aims the next poll
+// just after the next publish is expected. Pure logic on wall-clock seconds,
+// no RTOS dependencies.
+typedef struct {
+  int64_t last_update_s; // provider timestamp of the newest data seen
+  int32_t cadence_s;     // learned publish period
+  uint32_t unchanged_streak;
+  uint32_t failures;
+  uint32_t fail_delay_s; // last retry delay after a failure
+  bool missed; // polls failed since last_update_s, next interval unreliable
+  bool urgent; // precipitation or active warnings
+  uint32_t rng;
+} app_sched_t;
+
+void app_sched_init(app_sched_t *s, uint32_t seed);
+
+// `update_s` is the provider's updateTime of the response (0 if unknown),
+// `changed` whether the poll produced new data.
+void app_sched_on_success(app_sched_t *s, int64_t update_s, bool changed,
+                          bool urgent);
+void app_sched_on_failure(app_sched_t *s);
+
+// Seconds to sleep before the next poll, jitter included
+uint32_t app_sched_next_delay_s(app_sched_t *s, int64_t now_s);
+
+// Parses "2026-10-16T10:05+08:00" (seconds and offset optional) to Unix time.
+// Returns 0 when the text is not a timestamp.
+int64_t app_sched_parse_time(const char *iso);
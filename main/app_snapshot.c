@@ -0,0 +1,252 @@
+#include "app_snapshot.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+static const char *TAG = "app_snapshot";
+
+#define OP_INDEX 0x00 // 00iiiiii: table[i]
+#define OP_RUN 0x40   // 01nnnnnn: n + 1 more of the previous pixel
+#define OP_PIXEL 0x80 // then the pixel, low byte first
+#define OP_MASK 0xC0
+#define MAX_RUN 64
+
+// Two slots on the partition, the newer valid header wins
+#define SNAPSHOT_LABEL "snapshot"
+#define SNAPSHOT_MAGIC 0x50414E53 // "SNAP"
+#define SECTOR_SIZE 4096
+#define HEADER_SIZE 32
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint16_t width;
+  uint16_t height;
+  uint32_t size; // encoded bytes after the header
+  uint32_t crc;  // of the encoded bytes
+  uint32_t header_crc;
+} snap_header_t;
+
+_Static_assert(sizeof(snap_header_t) <= HEADER_SIZE, "header too large");
+
+static const esp_partition_t *s_part;
+static size_t s_slot_size;
+// Encoded by app_snapshot_stage, freed once app_snapshot_write is done
+static uint8_t *s_staged;
+static size_t s_staged_len;
+static uint16_t s_staged_w, s_staged_h;
+
+static inline uint32_t hash(uint16_t p) { return (p * 40503u >> 10) & 63; }
+
+size_t app_snapshot_encode(const uint16_t *px, size_t count, uint8_t *out,
+                           size_t cap) {
+  uint16_t table[64] = {0};
+  uint16_t prev = 0;
+  size_t run = 0;
+  size_t o = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t p = px[i];
+    if (p == prev) {
+      run++;
+      if (run < MAX_RUN && i < count - 1)
+        continue;
+    }
+    // Room for a pending run plus one literal
+    if (o + 4 > cap)
+      return 0;
+    if (run) {
+      out[o++] = OP_RUN | (run - 1);
+      run = 0;
+      if (p == prev)
+        continue;
+    }
+    uint32_t h = hash(p);
+    if (table[h] == p) {
+      out[o++] = OP_INDEX | h;
+    } else {
+      table[h] = p;
+      out[o++] = OP_PIXEL;
+      out[o++] = p & 0xFF;
+      out[o++] = p >> 8;
+    }
+    prev = p;
+  }
+  return o;
+}
+
+void app_snapshot_dec_init(app_snapshot_dec_t *d, const uint8_t *in,
+                           size_t len) {
+  memset(d, 0, sizeof(*d));
+  d->in = in;
+  d->len = len;
+}
+
+size_t app_snapshot_dec_read(app_snapshot_dec_t *d, uint16_t *px,
+                             size_t count) {
+  size_t n = 0;
+  while (n < count) {
+    if (d->run) {
+      size_t k = d->run < count - n ? d->run : count - n;
+      for (size_t i = 0; i < k; i++)
+        px[n++] = d->prev;
+      d->run -= k;
+      continue;
+    }
+    if (d->pos >= d->len)
+      break;
+    uint8_t op = d->in[d->pos++];
+    switch (op & OP_MASK) {
+    case OP_INDEX:
+      d->prev = d->table[op & 63];
+      px[n++] = d->prev;
+      break;
+    case OP_RUN:
+      d->run = (op & 63) + 1;
+      break;
+    default:
+      if (op != OP_PIXEL || d->pos + 2 > d->len) {
+        d->pos = d->len; // corrupt, stop here
+        break;
+      }
+      d->prev = d->in[d->pos] | d->in[d->pos + 1] << 8;
+      d->pos += 2;
+      d->table[hash(d->prev)] = d->prev;
+      px[n++] = d->prev;
+      break;
+    }
+  }
+  return n;
+}
+
+static uint32_t header_crc(const snap_header_t *h) {
+  return esp_rom_crc32_le(0, (const uint8_t *)h,
+                          offsetof(snap_header_t, header_crc));
+}
+
+// Slot holding the newest frame, -1 if none
+static int find_current(snap_header_t *out) {
+  int best = -1;
+  for (int slot = 0; slot < 2; slot++) {
+    snap_header_t h;
+    if (esp_partition_read(s_part, slot * s_slot_size, &h, sizeof(h)) !=
+            ESP_OK ||
+        h.magic != SNAPSHOT_MAGIC || h.header_crc != header_crc(&h) ||
+        h.size > s_slot_size - HEADER_SIZE)
+      continue;
+    if (best < 0 || h.seq > out->seq) {
+      *out = h;
+      best = slot;
+    }
+  }
+  return best;
+}
+
+void app_snapshot_init(void) {
+  s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                    ESP_PARTITION_SUBTYPE_ANY, SNAPSHOT_LABEL);
+  if (!s_part) {
+    ESP_LOGW(TAG, "No \"%s\" partition, boot snapshot disabled",
+             SNAPSHOT_LABEL);
+    return;
+  }
+  s_slot_size = s_part->size / 2 / SECTOR_SIZE * SECTOR_SIZE;
+}
+
+bool app_snapshot_stage(const uint16_t *frame, uint16_t w, uint16_t h) {
+  if (!s_part)
+    return false;
+  size_t cap = s_slot_size - HEADER_SIZE;
+  if (!s_staged)
+    s_staged = heap_caps_malloc_prefer(cap, 2, MALLOC_CAP_SPIRAM,
+                                       MALLOC_CAP_DEFAULT);
+  if (!s_staged)
+    return false;
+  s_staged_len = app_snapshot_encode(frame, (size_t)w * h, s_staged, cap);
+  s_staged_w = w;
+  s_staged_h = h;
+  if (s_staged_len == 0) {
+    ESP_LOGW(TAG, "Frame does not fit a %u B slot", (unsigned)cap);
+    heap_caps_free(s_staged);
+    s_staged = NULL;
+  }
+  return s_staged != NULL;
+}
+
+bool app_snapshot_write(void) {
+  if (!s_staged)
+    return false;
+  const uint8_t *buf = s_staged;
+  size_t len = s_staged_len;
+  uint16_t w = s_staged_w, h = s_staged_h;
+  bool ok;
+  snap_header_t cur;
+  int slot = find_current(&cur);
+  snap_header_t hdr = {
+      .magic = SNAPSHOT_MAGIC,
+      .seq = slot < 0 ? 1 : cur.seq + 1,
+      .width = w,
+      .height = h,
+      .size = len,
+      .crc = esp_rom_crc32_le(0, buf, len),
+  };
+  hdr.header_crc = header_crc(&hdr);
+
+  if (slot >= 0 && cur.size == len && cur.crc == hdr.crc && cur.width == w &&
+      cur.height == h) {
+    ok = true; // same picture, spare the flash
+  } else {
+    // Data first, header last: a cut off save leaves no valid header
+    size_t base = (slot == 0 ? 1 : 0) * s_slot_size;
+    size_t erase = (HEADER_SIZE + len + SECTOR_SIZE - 1) / SECTOR_SIZE *
+                   SECTOR_SIZE;
+    ok = esp_partition_erase_range(s_part, base, erase) == ESP_OK &&
+         esp_partition_write(s_part, base + HEADER_SIZE, buf, len) ==
+             ESP_OK &&
+         esp_partition_write(s_part, base, &hdr, sizeof(hdr)) == ESP_OK;
+    ESP_LOGI(TAG, "Saved %ux%u frame: %u B (%u%% of raw)", w, h,
+             (unsigned)len, (unsigned)(len * 100 / ((size_t)w * h * 2)));
+  }
+  heap_caps_free(s_staged);
+  s_staged = NULL;
+  return ok;
+}
+
+bool app_snapshot_save(const uint16_t *frame, uint16_t w, uint16_t h) {
+  return app_snapshot_stage(frame, w, h) && app_snapshot_write();
+}
+
+bool app_snapshot_show(uint16_t w, uint16_t h, uint16_t *band, int band_rows,
+                       app_snapshot_draw_t draw, void *arg) {
+  snap_header_t hdr;
+  int slot = s_part ? find_current(&hdr) : -1;
+  if (slot < 0 || hdr.width != w || hdr.height != h)
+    return false;
+  uint8_t *data = heap_caps_malloc_prefer(hdr.size, 2, MALLOC_CAP_SPIRAM,
+                                          MALLOC_CAP_DEFAULT);
+  if (!data)
+    return false;
+
+  size_t base = slot * s_slot_size + HEADER_SIZE;
+  bool ok = esp_partition_read(s_part, base, data, hdr.size) == ESP_OK &&
+            esp_rom_crc32_le(0, data, hdr.size) == hdr.crc;
+  app_snapshot_dec_t dec;
+  app_snapshot_dec_init(&dec, data, hdr.size);
+  for (int y = 0; ok && y < h; y += band_rows) {
+    int rows = h - y < band_rows ? h - y : band_rows;
+    size_t count = (size_t)rows * w;
+    ok = app_snapshot_dec_read(&dec, band, count) == count;
+    if (ok)
+      draw(y, y + rows, band, arg);
+  }
+  heap_caps_free(data);
+  return ok;
+}
+
+void app_snapshot_clear(void) {
+  if (!s_part)
+    return;
+  for (int slot = 0; slot < 2; slot++)
+    esp_partition_erase_range(s_part, slot * s_slot_size, SECTOR_SIZE);
+}
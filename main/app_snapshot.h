@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Last rendered frame kept on the "snapshot" partition, shown at boot before
+// LVGL runs. Pixels are opaque 16-bit words in panel byte order.
+
+// QOI-like codec for RGB565: runs of the previous pixel, a 64 entry table
+// of recently seen pixels, literal pixels otherwise. UI frames are mostly
+// flat color plus anti-aliased text with few distinct shades.
+size_t app_snapshot_encode(const uint16_t *px, size_t count, uint8_t *out,
+                           size_t cap); // 0 if it did not fit
+
+typedef struct {
+  const uint8_t *in;
+  size_t len;
+  size_t pos;
+  uint16_t table[64];
+  uint16_t prev;
+  uint32_t run;
+} app_snapshot_dec_t;
+
+void app_snapshot_dec_init(app_snapshot_dec_t *d, const uint8_t *in,
+                           size_t len);
+// Decodes up to `count` pixels, returns how many. Less at the end of input.
+size_t app_snapshot_dec_read(app_snapshot_dec_t *d, uint16_t *px,
+                             size_t count);
+
+typedef void (*app_snapshot_draw_t)(int y0, int y1, const uint16_t *px,
+                                    void *arg);
+
+void app_snapshot_init(void);
+// Stores a w x h frame in the slot not holding the current one, so a cut
+// off write leaves the previous frame intact. Same as stage, then write.
+bool app_snapshot_save(const uint16_t *frame, uint16_t w, uint16_t h);
+// Encodes the frame into a buffer of its own, a few ms of CPU, so `frame`
+// may change as soon as this returns
+bool app_snapshot_stage(const uint16_t *frame, uint16_t w, uint16_t h);
+// Erases and programs the staged frame, up to a second of flash time. Not
+// for the LVGL task, see app_hal.c. One stage per write, never both at once.
+bool app_snapshot_write(void);
+// Decodes the stored frame into `band`, `band_rows` rows at a time, and
+// hands each band to `draw`. False if there is no frame of that size.
+bool app_snapshot_show(uint16_t w, uint16_t h, uint16_t *band, int band_rows,
+                       app_snapshot_draw_t draw, void *arg);
+// Forgets the stored frame, e.g. on factory reset
+void app_snapshot_clear(void);
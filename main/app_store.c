@@ -1,60 +1,501 @@
 #include "app_store.h"
+#include "app_record.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char *TAG = "app_store";
 static const char *NVS_NAMESPACE = "weather_cfg";
 
+#define RTC_MAGIC 0x57544852 // "WTHR"
+#define FLASH_MIN_INTERVAL_US                                                  \
+  ((int64_t)CONFIG_WEATHER_FLASH_MIN_INTERVAL_MIN * 60 * 1000000)
+// Smaller moves are not worth a flash page on their own, they ride along
+// with the next material write or the flush before a restart
+#define MATERIAL_TEMP 2
+#define MATERIAL_WIND 5
+#define MATERIAL_HUMIDITY 10
+
+// Records are written with app_record, the schema only changes for a
+// migration that skipping or defaulting fields cannot express
+#define STORE_SCHEMA 1
+#define CONFIG_RECORD_MAX 512
+#define WEATHER_RECORD_MAX 96
+#define PLACE_RECORD_MAX 64
+#define COORD_DECIMALS 5
+
+// Field tags. Never reuse a number, retire it instead.
+enum {
+  CFG_SSID = 1,
+  CFG_PASSWORD = 2,
+  CFG_LOCATION = 3,
+  CFG_FAHRENHEIT = 4,
+  CFG_EXTRA = 5, // repeated, one per further city
+};
+
+enum {
+  WX_TEXT = 1,
+  WX_TEMP = 2,
+  WX_FEELS_LIKE = 3,
+  WX_WIND = 4,
+  WX_HUMIDITY = 5,
+  WX_ICON = 6,
+  WX_VALID = 7,
+  WX_WRITES = 8,
+};
+
+enum {
+  PLACE_LOCATION = 1,
+  PLACE_LAT = 2,
+  PLACE_LON = 3,
+  PLACE_VALID = 4,
+};
+
+// Raw structs written by firmware before the record format, read once and
+// rewritten as records. Frozen, unlike the live structs.
+typedef struct {
+  char ssid[32];
+  char password[64];
+  char location[32];
+  bool is_fahrenheit;
+  uint8_t extra_count;
+  char extra[7][32];
+} legacy_config_t;
+
+// Before multi-location support the config ended after is_fahrenheit
+#define LEGACY_CONFIG_V1_LEN offsetof(legacy_config_t, extra_count)
+
+typedef struct {
+  char description[32];
+  int temp;
+  int feels_like;
+  int wind_speed;
+  int humidity;
+  char icon[8];
+  bool is_valid;
+} legacy_weather_t;
+
+typedef struct {
+  legacy_weather_t info;
+  uint32_t writes;
+} legacy_weather_record_t;
+
+typedef struct {
+  char location[32];
+  char lat[12];
+  char lon[12];
+  bool is_valid;
+} legacy_place_t;
+
+// The weather plus the lifetime count of its flash writes
+typedef struct {
+  weather_info_t info;
+  uint32_t writes;
+} weather_record_t;
+
+// Staged in RTC slow memory, which keeps its contents across soft resets
+// (esp_restart, panic, watchdog) but not power loss.
+typedef struct {
+  uint32_t magic;
+  uint32_t crc; // over everything after this field
+  weather_record_t latest;
+  weather_info_t flashed; // what NVS holds
+  bool dirty;             // latest differs from flashed
+} rtc_weather_t;
+
+static RTC_NOINIT_ATTR rtc_weather_t s_rtc;
+static bool s_rtc_ok;
+static int64_t s_last_flash_us = INT64_MIN;
+static app_store_stats_t s_stats;
+
+static uint32_t rtc_crc(void) {
+  const uint8_t *p = (const uint8_t *)&s_rtc.latest;
+  return esp_rom_crc32_le(0, p,
+                          sizeof(s_rtc) - offsetof(rtc_weather_t, latest));
+}
+
+static void rtc_seal(void) {
+  s_rtc.magic = RTC_MAGIC;
+  s_rtc.crc = rtc_crc();
+  s_rtc_ok = true;
+}
+
+// True if `a` and `b` differ in text or icon, or by at least the given step
+// in one of the numbers. Steps of 1 detect any change.
+static bool differs(const weather_info_t *a, const weather_info_t *b, int temp,
+                    int wind, int humidity) {
+  return a->is_valid != b->is_valid || strcmp(a->icon, b->icon) != 0 ||
+         strcmp(a->description, b->description) != 0 ||
+         abs(a->temp - b->temp) >= temp ||
+         abs(a->feels_like - b->feels_like) >= temp ||
+         abs(a->wind_speed - b->wind_speed) >= wind ||
+         abs(a->humidity - b->humidity) >= humidity;
+}
+
+static bool save_record(const char *key, app_record_writer_t *w) {
+  size_t len = app_record_end(w);
+  if (len == 0) {
+    ESP_LOGE(TAG, "Record %s does not fit its buffer", key);
+    return false;
+  }
+  return app_store_save_blob(key, w->buf, len);
+}
+
+static bool save_weather_record(const weather_record_t *rec) {
+  uint8_t buf[WEATHER_RECORD_MAX];
+  app_record_writer_t w;
+  app_record_begin(&w, buf, sizeof(buf), STORE_SCHEMA);
+  app_record_put_str(&w, WX_TEXT, rec->info.description);
+  app_record_put_int(&w, WX_TEMP, rec->info.temp);
+  app_record_put_int(&w, WX_FEELS_LIKE, rec->info.feels_like);
+  app_record_put_int(&w, WX_WIND, rec->info.wind_speed);
+  app_record_put_int(&w, WX_HUMIDITY, rec->info.humidity);
+  app_record_put_str(&w, WX_ICON, rec->info.icon);
+  app_record_put_uint(&w, WX_VALID, rec->info.is_valid);
+  app_record_put_uint(&w, WX_WRITES, rec->writes);
+  return save_record("weather", &w);
+}
+
+// A newer schema is a migration this firmware does not know, its fields
+// could mean something else: the record reads as missing
+static bool schema_known(const app_record_reader_t *r, const char *key) {
+  if (r->schema <= STORE_SCHEMA)
+    return true;
+  ESP_LOGW(TAG, "%s: record schema %u is newer than %u, ignored", key,
+           r->schema, STORE_SCHEMA);
+  return false;
+}
+
+static bool load_weather_record(weather_record_t *rec) {
+  uint8_t buf[WEATHER_RECORD_MAX];
+  size_t len = sizeof(buf);
+  memset(rec, 0, sizeof(*rec));
+  if (!app_store_load_blob("weather", buf, &len))
+    return false;
+
+  app_record_reader_t r;
+  if (app_record_open(&r, buf, len)) {
+    if (!schema_known(&r, "weather"))
+      return false;
+    app_record_field_t f;
+    weather_info_t *info = &rec->info;
+    while (app_record_next(&r, &f)) {
+      switch (f.tag) {
+      case WX_TEXT:
+        app_record_str(&f, info->description, sizeof(info->description));
+        break;
+      case WX_TEMP:
+        info->temp = app_record_int(&f);
+        break;
+      case WX_FEELS_LIKE:
+        info->feels_like = app_record_int(&f);
+        break;
+      case WX_WIND:
+        info->wind_speed = app_record_int(&f);
+        break;
+      case WX_HUMIDITY:
+        info->humidity = app_record_int(&f);
+        break;
+      case WX_ICON:
+        app_record_str(&f, info->icon, sizeof(info->icon));
+        break;
+      case WX_VALID:
+        info->is_valid = f.value != 0;
+        break;
+      case WX_WRITES:
+        rec->writes = f.value;
+        break;
+      }
+    }
+    return true;
+  }
+
+  if (len != sizeof(legacy_weather_t) &&
+      len != sizeof(legacy_weather_record_t))
+    return false;
+  legacy_weather_record_t old = {0};
+  memcpy(&old, buf, len);
+  snprintf(rec->info.description, sizeof(rec->info.description), "%.*s",
+           (int)sizeof(old.info.description) - 1, old.info.description);
+  snprintf(rec->info.icon, sizeof(rec->info.icon), "%.*s",
+           (int)sizeof(old.info.icon) - 1, old.info.icon);
+  rec->info.temp = old.info.temp;
+  rec->info.feels_like = old.info.feels_like;
+  rec->info.wind_speed = old.info.wind_speed;
+  rec->info.humidity = old.info.humidity;
+  rec->info.is_valid = old.info.is_valid;
+  rec->writes = old.writes;
+  ESP_LOGI(TAG, "Migrating cached weather to the record format");
+  save_weather_record(rec);
+  return true;
+}
+
+// First use after a power-on: the staging copy starts from the flash copy
+static void rtc_seed(void) {
+  weather_record_t rec;
+  load_weather_record(&rec);
+  memset(&s_rtc, 0, sizeof(s_rtc));
+  s_rtc.latest = rec;
+  s_rtc.flashed = rec.info;
+  rtc_seal();
+  s_stats.flash_writes = rec.writes;
+}
+
+static bool write_weather(void) {
+  weather_record_t rec = s_rtc.latest;
+  rec.writes++;
+  if (!save_weather_record(&rec))
+    return false;
+  s_rtc.latest.writes = rec.writes;
+  s_rtc.flashed = rec.info;
+  s_rtc.dirty = false;
+  rtc_seal();
+  s_last_flash_us = esp_timer_get_time();
+  s_stats.flash_writes = rec.writes;
+  s_stats.boot_writes++;
+  return true;
+}
+
+// Runs from esp_restart(), before the soft reset
+static void flush_on_restart(void) { app_store_flush_weather(); }
+
 void app_store_init(void) {
   ESP_LOGI(TAG, "Initializing NVS Store...");
   // NVS init is already called in main.c
+  memset(&s_stats, 0, sizeof(s_stats));
+  s_last_flash_us = INT64_MIN;
+  s_rtc_ok = s_rtc.magic == RTC_MAGIC && s_rtc.crc == rtc_crc();
+  if (s_rtc_ok) {
+    s_stats.flash_writes = s_rtc.latest.writes;
+    s_stats.rtc_restored = true;
+    ESP_LOGI(TAG, "Weather staged in RTC memory survived the reset");
+  }
+  esp_register_shutdown_handler(flush_on_restart);
 }
 
 bool app_store_save_config(const app_config_t *cfg) {
-  nvs_handle_t h;
-  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
-    return false;
-  esp_err_t err = nvs_set_blob(h, "app_cfg", cfg, sizeof(app_config_t));
-  if (err == ESP_OK)
-    nvs_commit(h);
-  nvs_close(h);
-  return err == ESP_OK;
+  uint8_t buf[CONFIG_RECORD_MAX];
+  app_record_writer_t w;
+  app_record_begin(&w, buf, sizeof(buf), STORE_SCHEMA);
+  app_record_put_str(&w, CFG_SSID, cfg->ssid);
+  app_record_put_str(&w, CFG_PASSWORD, cfg->password);
+  app_record_put_str(&w, CFG_LOCATION, cfg->location);
+  app_record_put_uint(&w, CFG_FAHRENHEIT, cfg->is_fahrenheit);
+  for (int i = 0; i < cfg->extra_count; i++)
+    app_record_put_str(&w, CFG_EXTRA, cfg->extra[i]);
+  return save_record("app_cfg", &w);
+}
+
+static void load_legacy_config(app_config_t *cfg, const uint8_t *buf,
+                               size_t len) {
+  legacy_config_t old = {0};
+  memcpy(&old, buf, len);
+  snprintf(cfg->ssid, sizeof(cfg->ssid), "%.*s", (int)sizeof(old.ssid) - 1,
+           old.ssid);
+  snprintf(cfg->password, sizeof(cfg->password), "%.*s",
+           (int)sizeof(old.password) - 1, old.password);
+  snprintf(cfg->location, sizeof(cfg->location), "%.*s",
+           (int)sizeof(old.location) - 1, old.location);
+  cfg->is_fahrenheit = old.is_fahrenheit;
+  cfg->extra_count = 0;
+  for (int i = 0; i < old.extra_count && i < APP_MAX_LOCATIONS - 1; i++)
+    snprintf(cfg->extra[cfg->extra_count++], APP_LOCATION_LEN, "%.*s",
+             (int)sizeof(old.extra[i]) - 1, old.extra[i]);
 }
 
 bool app_store_load_config(app_config_t *cfg) {
-  nvs_handle_t h;
-  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+  uint8_t buf[CONFIG_RECORD_MAX];
+  size_t len = sizeof(buf);
+  if (!app_store_load_blob("app_cfg", buf, &len))
     return false;
-  size_t len = sizeof(app_config_t);
-  esp_err_t err = nvs_get_blob(h, "app_cfg", cfg, &len);
-  nvs_close(h);
-  return err == ESP_OK && len == sizeof(app_config_t);
+  memset(cfg, 0, sizeof(*cfg));
+
+  app_record_reader_t r;
+  if (app_record_open(&r, buf, len)) {
+    if (!schema_known(&r, "app_cfg"))
+      return false;
+    app_record_field_t f;
+    while (app_record_next(&r, &f)) {
+      switch (f.tag) {
+      case CFG_SSID:
+        app_record_str(&f, cfg->ssid, sizeof(cfg->ssid));
+        break;
+      case CFG_PASSWORD:
+        app_record_str(&f, cfg->password, sizeof(cfg->password));
+        break;
+      case CFG_LOCATION:
+        app_record_str(&f, cfg->location, sizeof(cfg->location));
+        break;
+      case CFG_FAHRENHEIT:
+        cfg->is_fahrenheit = f.value != 0;
+        break;
+      case CFG_EXTRA:
+        if (cfg->extra_count < APP_MAX_LOCATIONS - 1)
+          app_record_str(&f, cfg->extra[cfg->extra_count++], APP_LOCATION_LEN);
+        break;
+      }
+    }
+    return true;
+  }
+
+  if (len != LEGACY_CONFIG_V1_LEN && len != sizeof(legacy_config_t))
+    return false;
+  load_legacy_config(cfg, buf, len);
+  ESP_LOGI(TAG, "Migrating config to the record format");
+  app_store_save_config(cfg);
+  return true;
+}
+
+bool app_store_stage_weather(const weather_info_t *info) {
+  if (!s_rtc_ok)
+    rtc_seed();
+  bool changed = differs(info, &s_rtc.latest.info, 1, 1, 1);
+  if (changed) {
+    s_rtc.latest.info = *info;
+    s_rtc.dirty = true;
+    rtc_seal();
+  }
+  if (!s_rtc.dirty)
+    return true;
+
+  // Also unchanged updates: a material change held back by the interval
+  // goes out once it has passed, not with the next move
+  int64_t now = esp_timer_get_time();
+  if (!differs(&s_rtc.latest.info, &s_rtc.flashed, MATERIAL_TEMP,
+               MATERIAL_WIND, MATERIAL_HUMIDITY) ||
+      (s_last_flash_us != INT64_MIN &&
+       now - s_last_flash_us < FLASH_MIN_INTERVAL_US)) {
+    s_stats.coalesced += changed;
+    return true;
+  }
+  return write_weather();
 }
 
-bool app_store_save_weather(const weather_info_t *info) {
+bool app_store_flush_weather(void) {
+  if (!s_rtc_ok || !s_rtc.dirty)
+    return true;
+  return write_weather();
+}
+
+bool app_store_load_weather(weather_info_t *info) {
+  if (!s_rtc_ok)
+    rtc_seed();
+  *info = s_rtc.latest.info;
+  return info->is_valid;
+}
+
+void app_store_get_stats(app_store_stats_t *stats) { *stats = s_stats; }
+
+// Coordinates as the provider wrote them: no trailing zeros
+static void format_coord(double v, char *dst, size_t size) {
+  int n = snprintf(dst, size, "%.*f", COORD_DECIMALS, v);
+  while (n > 0 && dst[n - 1] == '0')
+    dst[--n] = '\0';
+  if (n > 0 && dst[n - 1] == '.')
+    dst[--n] = '\0';
+}
+
+bool app_store_save_place(const weather_place_t *place) {
+  uint8_t buf[PLACE_RECORD_MAX];
+  app_record_writer_t w;
+  app_record_begin(&w, buf, sizeof(buf), STORE_SCHEMA);
+  app_record_put_str(&w, PLACE_LOCATION, place->location);
+  if (place->lat[0] && place->lon[0]) {
+    app_record_put_fixed(&w, PLACE_LAT, strtod(place->lat, NULL),
+                         COORD_DECIMALS);
+    app_record_put_fixed(&w, PLACE_LON, strtod(place->lon, NULL),
+                         COORD_DECIMALS);
+  }
+  app_record_put_uint(&w, PLACE_VALID, place->is_valid);
+  return save_record("place", &w);
+}
+
+bool app_store_load_place(weather_place_t *place) {
+  uint8_t buf[PLACE_RECORD_MAX];
+  size_t len = sizeof(buf);
+  if (!app_store_load_blob("place", buf, &len))
+    return false;
+  memset(place, 0, sizeof(*place));
+
+  app_record_reader_t r;
+  if (app_record_open(&r, buf, len)) {
+    if (!schema_known(&r, "place"))
+      return false;
+    app_record_field_t f;
+    while (app_record_next(&r, &f)) {
+      switch (f.tag) {
+      case PLACE_LOCATION:
+        app_record_str(&f, place->location, sizeof(place->location));
+        break;
+      case PLACE_LAT:
+        format_coord(app_record_fixed(&f, COORD_DECIMALS), place->lat,
+                     sizeof(place->lat));
+        break;
+      case PLACE_LON:
+        format_coord(app_record_fixed(&f, COORD_DECIMALS), place->lon,
+                     sizeof(place->lon));
+        break;
+      case PLACE_VALID:
+        place->is_valid = f.value != 0;
+        break;
+      }
+    }
+    return true;
+  }
+
+  if (len != sizeof(legacy_place_t))
+    return false;
+  legacy_place_t old;
+  memcpy(&old, buf, len);
+  snprintf(place->location, sizeof(place->location), "%.*s",
+           (int)sizeof(old.location) - 1, old.location);
+  snprintf(place->lat, sizeof(place->lat), "%.*s", (int)sizeof(old.lat) - 1,
+           old.lat);
+  snprintf(place->lon, sizeof(place->lon), "%.*s", (int)sizeof(old.lon) - 1,
+           old.lon);
+  place->is_valid = old.is_valid;
+  app_store_save_place(place);
+  return true;
+}
+
+bool app_store_save_blob(const char *key, const void *data, size_t len) {
+  int64_t start = esp_timer_get_time();
   nvs_handle_t h;
   if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
     return false;
-  esp_err_t err = nvs_set_blob(h, "weather", info, sizeof(weather_info_t));
+  esp_err_t err = nvs_set_blob(h, key, data, len);
   if (err == ESP_OK)
     nvs_commit(h);
   nvs_close(h);
+  uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+  if (us > s_stats.max_write_us)
+    s_stats.max_write_us = us;
+  if (err == ESP_OK)
+    s_stats.bytes_written += len;
   return err == ESP_OK;
 }
 
-bool app_store_load_weather(weather_info_t *info) {
+bool app_store_load_blob(const char *key, void *data, size_t *len) {
   nvs_handle_t h;
   if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
     return false;
-  size_t len = sizeof(weather_info_t);
-  esp_err_t err = nvs_get_blob(h, "weather", info, &len);
+  esp_err_t err = nvs_get_blob(h, key, data, len);
   nvs_close(h);
-  return err == ESP_OK && len == sizeof(weather_info_t);
+  return err == ESP_OK;
 }
 
 void app_store_factory_reset(void) {
+  // Keep the restart that follows from writing the weather back
+  s_rtc.magic = 0;
+  s_rtc_ok = false;
   nvs_handle_t h;
   if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h) == ESP_OK) {
     nvs_erase_all(h);
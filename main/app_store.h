@@ -2,12 +2,20 @@
 
 #include "weather_data.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define APP_MAX_LOCATIONS 8
+#define APP_LOCATION_LEN 32
 
 typedef struct {
   char ssid[32];
   char password[64];
-  char location[32];
+  char location[APP_LOCATION_LEN]; // primary city, with forecast
   bool is_fahrenheit;
+  // Further cities, current conditions only, shown in rotation
+  uint8_t extra_count;
+  char extra[APP_MAX_LOCATIONS - 1][APP_LOCATION_LEN];
 } app_config_t;
 
 void app_store_init(void);
@@ -15,7 +23,37 @@ void app_store_init(void);
 bool app_store_save_config(const app_config_t *cfg);
 bool app_store_load_config(app_config_t *cfg);
 
-bool app_store_save_weather(const weather_info_t *info);
+typedef struct {
+  uint32_t flash_writes; // weather writes over the device's life (wear)
+  uint32_t boot_writes;  // of those, since this boot
+  uint32_t coalesced;    // changes kept in RTC memory only
+  uint32_t bytes_written; // all records and blobs, since this boot
+  uint32_t max_write_us;  // slowest NVS write and commit since this boot
+  bool rtc_restored;     // weather came back from RTC memory at boot
+} app_store_stats_t;
+
+// Stages the weather in RTC memory. It reaches flash only when it changed
+// materially and CONFIG_WEATHER_FLASH_MIN_INTERVAL_MIN has passed since the
+// last write, or on the flush before a restart.
+bool app_store_stage_weather(const weather_info_t *info);
+// Writes staged weather that flash does not have yet. Also runs from
+// esp_restart() through a shutdown handler.
+bool app_store_flush_weather(void);
+// Prefers the RTC copy, which survives soft resets, over the flash copy
 bool app_store_load_weather(weather_info_t *info);
+void app_store_get_stats(app_store_stats_t *stats);
+
+// Coordinates of the primary location, looked up by QWeather
+bool app_store_save_place(const weather_place_t *place);
+bool app_store_load_place(weather_place_t *place);
+
+// Config, weather and place are stored as app_record records, so they
+// survive firmware updates that change the structs. Raw blobs written by
+// older firmware are migrated on first load.
+
+// Raw blobs for modules that own their record layout
+bool app_store_save_blob(const char *key, const void *data, size_t len);
+// `len` holds the buffer size on entry and the stored size on return
+bool app_store_load_blob(const char *key, void *data, size_t *len);
 
 void app_store_factory_reset(void);
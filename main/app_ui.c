@@ -1,8 +1,11 @@
 #include "app_ui.h"
+#include "app_clock.h"
 #include "app_hal.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "lvgl.h"
 #include <stdio.h>
+#include <string.h>
 
 static const char *TAG = "app_ui";
 
@@ -16,13 +19,47 @@ static lv_obj_t *s_scr_main;
 static lv_obj_t *s_scr_prov;
 
 // Main Screen Widgets
-static lv_obj_t *s_label_time;
+static lv_obj_t *s_clock;
 static lv_obj_t *s_label_date;
 static lv_obj_t *s_label_wifi;
 static lv_obj_t *s_label_weather_icon;
 static lv_obj_t *s_label_weather_temp;
 static lv_obj_t *s_label_weather_desc;
 static lv_obj_t *s_label_weather_humidity;
+static lv_obj_t *s_label_forecast;
+
+// What the clock and date show, -1: placeholder. Setting a label's text
+// redraws and flushes its whole area, even for the same text.
+static int s_shown_minute = -1; // hour * 60 + minute
+static int s_shown_date = -1;   // (month * 32 + day) * 8 + weekday
+
+// The weather panel shows each city for this long
+#define UI_ROTATE_MS 8000
+#define UI_CITY_NAME_LEN 16
+
+// What the panel shows per city, copied so rotation never waits on the
+// weather task
+typedef struct {
+  int temp;
+  int humidity;
+  char desc[WEATHER_TEXT_LEN];
+  char name[UI_CITY_NAME_LEN];
+  bool is_valid;
+} ui_city_t;
+
+static weather_info_t s_primary;
+static char s_forecast_text[32];
+static ui_city_t s_cities[WEATHER_CITY_MAX];
+static int s_city_count = 0;
+static int s_shown = 0; // 0: primary, i: s_cities[i - 1]
+
+// Boot snapshots show the primary city, saved at most this often
+#define UI_SNAPSHOT_MIN_US (15LL * 60 * 1000 * 1000)
+static bool s_snapshot_due;
+static int64_t s_snapshot_us; // last request, 0: none yet
+
+#define UI_COLOR_BG 0x111111
+#define UI_COLOR_TIME 0x00E5FF // Cyan
 
 // Styles
 static lv_style_t s_style_bg;
@@ -33,13 +70,13 @@ static lv_style_t s_style_cjk_36;
 
 static void create_styles(void) {
   lv_style_init(&s_style_bg);
-  lv_style_set_bg_color(&s_style_bg, lv_color_hex(0x111111));
+  lv_style_set_bg_color(&s_style_bg, lv_color_hex(UI_COLOR_BG));
   lv_style_set_bg_opa(&s_style_bg, LV_OPA_COVER);
   lv_style_set_text_color(&s_style_bg, lv_color_white());
 
   lv_style_init(&s_style_time);
   lv_style_set_text_font(&s_style_time, &lv_font_montserrat_48);
-  lv_style_set_text_color(&s_style_time, lv_color_hex(0x00E5FF)); // Cyan
+  lv_style_set_text_color(&s_style_time, lv_color_hex(UI_COLOR_TIME));
 
   lv_style_init(&s_style_normal);
   lv_style_set_text_font(&s_style_normal, &lv_font_montserrat_16);
@@ -58,17 +95,18 @@ static void create_main_screen(void) {
   s_scr_main = lv_obj_create(NULL);
   lv_obj_add_style(s_scr_main, &s_style_bg, 0);
 
-  // Time Label (Center Top)
-  s_label_time = lv_label_create(s_scr_main);
-  lv_obj_add_style(s_label_time, &s_style_time, 0);
-  lv_label_set_text(s_label_time, "--:--");
-  lv_obj_align(s_label_time, LV_ALIGN_TOP_MID, 0, 30);
+  // Time (Center Top), drawn from pre-rendered digits
+  s_clock = app_clock_create(s_scr_main, &lv_font_montserrat_48,
+                             lv_color_hex(UI_COLOR_TIME),
+                             lv_color_hex(UI_COLOR_BG));
+  app_clock_set_text(s_clock, "--:--");
+  lv_obj_align(s_clock, LV_ALIGN_TOP_MID, 0, 30);
 
   // Date Label (Below Time)
   s_label_date = lv_label_create(s_scr_main);
   lv_obj_add_style(s_label_date, &s_style_cjk, 0);
   lv_label_set_text(s_label_date, "----/--/--");
-  lv_obj_align_to(s_label_date, s_label_time, LV_ALIGN_OUT_BOTTOM_MID, 0, 10);
+  lv_obj_align_to(s_label_date, s_clock, LV_ALIGN_OUT_BOTTOM_MID, 0, 10);
 
   // WiFi Icon (Top Right)
   s_label_wifi = lv_label_create(s_scr_main);
@@ -109,6 +147,11 @@ static void create_main_screen(void) {
   s_label_weather_humidity = lv_label_create(weather_cont);
   lv_obj_add_style(s_label_weather_humidity, &s_style_cjk, 0);
   lv_label_set_text(s_label_weather_humidity, "");
+
+  // Today's range and air quality (ASCII only, the CJK font is a subset)
+  s_label_forecast = lv_label_create(weather_cont);
+  lv_obj_add_style(s_label_forecast, &s_style_cjk, 0);
+  lv_label_set_text(s_label_forecast, "");
 }
 
 static void create_prov_screen(void) {
@@ -130,6 +173,73 @@ static void create_prov_screen(void) {
   lv_obj_align(label, LV_ALIGN_CENTER, 0, 40);
 }
 
+static void show_weather(const weather_info_t *weather_info) {
+  if (weather_info && weather_info->is_valid) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d°", weather_info->temp);
+    lv_label_set_text(s_label_weather_temp, buf);
+    lv_label_set_text(s_label_weather_desc, weather_info->description);
+
+    snprintf(buf, sizeof(buf), "湿度%d%%", weather_info->humidity);
+    lv_label_set_text(s_label_weather_humidity, buf);
+  } else {
+    lv_label_set_text(s_label_weather_temp, "--°");
+    lv_label_set_text(s_label_weather_desc, "离线或过期");
+    lv_label_set_text(s_label_weather_humidity, "");
+  }
+}
+
+static void show_city(int index) {
+  const ui_city_t *c = &s_cities[index];
+  char buf[16];
+  if (c->is_valid) {
+    snprintf(buf, sizeof(buf), "%d°", c->temp);
+    lv_label_set_text(s_label_weather_temp, buf);
+    lv_label_set_text(s_label_weather_desc, c->desc);
+    snprintf(buf, sizeof(buf), "湿度%d%%", c->humidity);
+    lv_label_set_text(s_label_weather_humidity, buf);
+  } else {
+    lv_label_set_text(s_label_weather_temp, "--°");
+    lv_label_set_text(s_label_weather_desc, "查询中");
+    lv_label_set_text(s_label_weather_humidity, "");
+  }
+  // Position and name in place of the primary city's forecast line
+  char line[32];
+  snprintf(line, sizeof(line), "%d/%d %s", index + 2, s_city_count + 1,
+           c->name);
+  lv_label_set_text(s_label_forecast, line);
+}
+
+// Asks for a boot snapshot once the primary city's weather changed. With
+// other cities in rotation only at the start of the primary's turn, so the
+// save lands before the panel moves on.
+static void maybe_snapshot(bool turn_start) {
+  if (!s_snapshot_due || s_shown != 0 || lv_scr_act() != s_scr_main)
+    return;
+  if (s_city_count > 0 && !turn_start)
+    return;
+  int64_t now = esp_timer_get_time();
+  if (s_snapshot_us && now - s_snapshot_us < UI_SNAPSHOT_MIN_US)
+    return;
+  s_snapshot_due = false;
+  s_snapshot_us = now;
+  app_hal_snapshot_request();
+}
+
+// Runs inside lv_timer_handler(), the LVGL lock is already held
+static void rotate_cb(lv_timer_t *timer) {
+  if (s_city_count == 0 && s_shown == 0)
+    return;
+  s_shown = s_shown >= s_city_count ? 0 : s_shown + 1;
+  if (s_shown == 0) {
+    show_weather(&s_primary);
+    lv_label_set_text(s_label_forecast, s_forecast_text);
+    maybe_snapshot(true);
+  } else {
+    show_city(s_shown - 1);
+  }
+}
+
 void app_ui_init(void) {
   ESP_LOGI(TAG, "Initializing UI...");
   app_hal_lvgl_lock();
@@ -139,39 +249,102 @@ void app_ui_init(void) {
   create_prov_screen();
 
   lv_scr_load(s_scr_main);
+  lv_timer_create(rotate_cb, UI_ROTATE_MS, NULL);
 
   app_hal_lvgl_unlock();
 }
 
 void app_ui_update_time(const time_info_t *time_info) {
   app_hal_lvgl_lock();
-  if (time_info && s_label_time && s_label_date) {
+  if (time_info && s_clock && s_label_date) {
+    // Called every second, the text changes once a minute
     char buf[16];
-    snprintf(buf, sizeof(buf), "%02d:%02d", time_info->hour, time_info->minute);
-    lv_label_set_text(s_label_time, buf);
+    int minute = time_info->hour * 60 + time_info->minute;
+    if (minute != s_shown_minute) {
+      s_shown_minute = minute;
+      snprintf(buf, sizeof(buf), "%02d:%02d", time_info->hour,
+               time_info->minute);
+      app_clock_set_text(s_clock, buf);
+    }
 
-    const char *weekdays[] = {"日", "一", "二", "三", "四", "五", "六"};
-    snprintf(buf, sizeof(buf), "%02d/%02d 星期%s", time_info->month,
-             time_info->day, weekdays[time_info->dow % 7]);
-    lv_label_set_text(s_label_date, buf);
+    int date = (time_info->month * 32 + time_info->day) * 8 + time_info->dow;
+    if (date != s_shown_date) {
+      s_shown_date = date;
+      const char *weekdays[] = {"日", "一", "二", "三", "四", "五", "六"};
+      snprintf(buf, sizeof(buf), "%02d/%02d 星期%s", time_info->month,
+               time_info->day, weekdays[time_info->dow % 7]);
+      lv_label_set_text(s_label_date, buf);
+    }
+    // The clock is live, LVGL takes over from the boot snapshot
+    app_hal_splash_done();
+    maybe_snapshot(false);
   }
   app_hal_lvgl_unlock();
 }
 
 void app_ui_update_weather(const weather_info_t *weather_info) {
   app_hal_lvgl_lock();
+  if (weather_info)
+    s_primary = *weather_info;
+  else
+    s_primary.is_valid = false;
+  if (s_shown == 0)
+    show_weather(weather_info);
   if (weather_info && weather_info->is_valid) {
-    char buf[16];
-    snprintf(buf, sizeof(buf), "%d°", weather_info->temp);
-    lv_label_set_text(s_label_weather_temp, buf);
-    lv_label_set_text(s_label_weather_desc, weather_info->description);
+    s_snapshot_due = true;
+    maybe_snapshot(false);
+  }
+  app_hal_lvgl_unlock();
+}
 
-    snprintf(buf, sizeof(buf), "湿度%d%%", weather_info->humidity);
-    lv_label_set_text(s_label_weather_humidity, buf);
-  } else {
-    lv_label_set_text(s_label_weather_temp, "--°");
-    lv_label_set_text(s_label_weather_desc, "离线或过期");
-    lv_label_set_text(s_label_weather_humidity, "");
+void app_ui_update_forecast(const weather_model_t *model) {
+  app_hal_lvgl_lock();
+  if (model && s_label_forecast) {
+    int len = 0;
+    if (model->daily_count > 0)
+      len += snprintf(s_forecast_text + len, sizeof(s_forecast_text) - len,
+                      "%d°/%d°", model->daily[0].temp_max,
+                      model->daily[0].temp_min);
+    if (model->air.is_valid)
+      len += snprintf(s_forecast_text + len, sizeof(s_forecast_text) - len,
+                      "%sAQI %d", len ? "  " : "", model->air.aqi);
+    s_forecast_text[len] = '\0';
+    if (s_shown == 0)
+      lv_label_set_text(s_label_forecast, s_forecast_text);
+    s_snapshot_due = true;
+    maybe_snapshot(false);
+  }
+  app_hal_lvgl_unlock();
+}
+
+void app_ui_update_cities(const weather_model_t *model,
+                          const char *const *names) {
+  app_hal_lvgl_lock();
+  s_city_count = model->city_count;
+  for (int i = 0; i < s_city_count; i++) {
+    const weather_city_t *src = &model->city[i];
+    ui_city_t *c = &s_cities[i];
+    c->is_valid = src->is_valid;
+    c->temp = src->temp;
+    c->humidity = src->humidity;
+    strncpy(c->desc, model->texts[src->text], sizeof(c->desc) - 1);
+    // The CJK font is a subset, names outside ASCII show as the position
+    // only. Location IDs and pinyin names pass.
+    c->name[0] = '\0';
+    const char *n = names[i];
+    size_t len = strlen(n);
+    bool ascii = len < sizeof(c->name);
+    for (size_t k = 0; k < len && ascii; k++)
+      ascii = n[k] >= 0x20 && n[k] < 0x7f && n[k] != '%';
+    if (ascii)
+      strcpy(c->name, n);
+  }
+  if (s_shown > s_city_count) {
+    s_shown = 0;
+    show_weather(&s_primary);
+    lv_label_set_text(s_label_forecast, s_forecast_text);
+  } else if (s_shown > 0) {
+    show_city(s_shown - 1);
   }
   app_hal_lvgl_unlock();
 }
@@ -190,8 +363,17 @@ void app_ui_update_net_state(bool is_connected) {
 
 void app_ui_show_provisioning(void) {
   app_hal_lvgl_lock();
+  app_hal_splash_done();
   if (lv_scr_act() != s_scr_prov) {
     lv_scr_load_anim(s_scr_prov, LV_SCR_LOAD_ANIM_FADE_ON, 500, 0, false);
   }
   app_hal_lvgl_unlock();
 }
+
+void app_ui_show_main(void) {
+  app_hal_lvgl_lock();
+  if (lv_scr_act() != s_scr_main) {
+    lv_scr_load_anim(s_scr_main, LV_SCR_LOAD_ANIM_FADE_ON, 500, 0, false);
+  }
+  app_hal_lvgl_unlock();
+}
@@ -5,5 +5,11 @@
 void app_ui_init(void);
 void app_ui_update_time(const time_info_t *time_info);
 void app_ui_update_weather(const weather_info_t *weather_info);
+void app_ui_update_forecast(const weather_model_t *model);
+// Extra cities the weather panel rotates through after the primary one.
+// names[i] is the configured location of model->city[i].
+void app_ui_update_cities(const weather_model_t *model,
+                          const char *const *names);
 void app_ui_update_net_state(bool is_connected);
 void app_ui_show_provisioning(void);
+void app_ui_show_main(void);
@@ -1,285 +1,1390 @@
 #include "app_weather.h"
+#include "app_budget.h"
+#include "app_city.h"
+#include "app_config.h"
+#include "app_hal.h"
+#include "app_history.h"
+#include "app_http.h"
+#include "app_inflate.h"
+#include "app_json.h"
+#include "app_metrics.h"
+#include "app_provider.h"
+#include "app_sched.h"
 #include "app_net.h"
 #include "app_store.h"
 #include "app_time.h"
 #include "app_ui.h"
-#include "cJSON.h"
-#include "esp_crt_bundle.h"
-#include "esp_http_client.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
-#include "miniz.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static const char *TAG = "app_weather";
 
-// User should replace this with their QWeather API Key
-#define WEATHER_API_KEY "ec368e1ae8524e9cb298bbd1823a65be"
+// Forced refreshes never run closer together than this
+#define REFRESH_MIN_INTERVAL_MS (30 * 1000)
+// Window in which a burst of refresh requests collapses into one fetch
+#define REFRESH_DEBOUNCE_MS 500
+#define MAX_PENDING_CALLBACKS 4
+// Latency percentiles go to the serial log every this many polls
+#define METRICS_DUMP_EVERY 16
+// The deepest frame is the TLS handshake inside app_http_get(). Large
+// buffers live in PSRAM, the stack itself cannot: the task writes NVS, which
+// disables the cache. Headroom is logged after every poll.
+#define WEATHER_TASK_STACK 12288
+// The API host is re-resolved this long before a scheduled poll if its DNS
+// entry would expire before the poll is through
+#define DNS_PREFETCH_LEAD_MS 15000
+#define DNS_PREFETCH_SLACK_S 60
+#define WEATHER_STACK_WARN 1536
 
-// Buffer for HTTP response
-#define MAX_HTTP_RECV_BUFFER 4096
+// Provider scoring: latency of successful requests and success rate, both
+// as moving averages over roughly the last four requests
+#define SCORE_SAMPLES 16
+#define SCORE_PRIOR_MS 800
+#define SCORE_MIN_SUCCESS 50 // per mille, keeps a failing score finite
 
-static bool fetch_weather_and_parse(void) {
-  app_config_t cfg = {0};
-  if (!app_store_load_config(&cfg)) {
-    ESP_LOGE(TAG, "Failed to load config, cannot fetch weather");
-    return false;
+// Regions of weather_model_t, one bit each
+enum {
+  REGION_NOW = 1u << 0,
+  REGION_HOURLY = 1u << 1,
+  REGION_DAILY = 1u << 2,
+  REGION_AIR = 1u << 3,
+  REGION_WARNING = 1u << 4,
+  REGION_PLACE = 1u << 5,
+  REGION_FORECAST = REGION_HOURLY | REGION_DAILY | REGION_AIR | REGION_WARNING,
+};
+
+typedef struct {
+  const app_provider_t *p;
+  uint32_t ewma_ms;
+  uint32_t success; // per mille
+  uint16_t lat_ms[SCORE_SAMPLES];
+  uint8_t lat_next;
+  uint8_t lat_count;
+} provider_state_t;
+
+// In order of preference when nothing has been measured yet
+static provider_state_t s_providers[] = {
+    {.p = &app_provider_qweather},
+    {.p = &app_provider_open_meteo},
+};
+#define PROVIDER_COUNT ARRAY_SIZE(s_providers)
+
+static weather_model_t s_model;
+static SemaphoreHandle_t s_model_mux = NULL;
+static app_inflate_t *s_inflate = NULL; // body decoder reused across polls
+static app_budget_t s_budget;           // only touched by the weather task
+static portMUX_TYPE s_score_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef enum {
+  JOB_FAILED,
+  JOB_UNCHANGED, // same data as last time, nothing to store or redraw
+  JOB_UPDATED,
+} job_result_t;
+
+// What one request cost and how it failed
+typedef struct {
+  bool attempted; // a request went out
+  bool reached;   // the provider answered with an HTTP status
+  uint32_t ms;
+  app_fetch_err_t err;
+} job_run_t;
+
+typedef struct {
+  const app_provider_t *provider;
+  const weather_job_t *job;
+  app_json_t json;
+  char *region; // job region inside the draft model
+  bool fahrenheit;
+  char status[8];
+  char update_time[32];
+  bool unchanged; // stamp matches the last good response
+  uint32_t hash;  // FNV-1a over the decoded body
+  int fields_seen;
+  int items;
+  app_inflate_t *inf;
+  const volatile bool *cancel; // set when the response is no longer wanted
+  int64_t sink_us;  // inflate + parse
+  int64_t parse_us; // parse alone
+} job_parse_t;
+
+static void job_on_value(void *ctx, const char *path, const char *value,
+                         int index) {
+  job_parse_t *parse = ctx;
+  const weather_job_t *job = parse->job;
+  const app_provider_t *p = parse->provider;
+  if (p->status_path && strcmp(path, p->status_path) == 0) {
+    strncpy(parse->status, value, sizeof(parse->status) - 1);
+    return;
   }
+  // Both providers send the stamp ahead of the data: once it matches the last
+  // good response, the remaining fields are skipped rather than decoded again.
+  if (job->stamp_path && strcmp(path, job->stamp_path) == 0) {
+    strncpy(parse->update_time, value, sizeof(parse->update_time) - 1);
+    parse->unchanged = job->update_time[0] &&
+                       strcmp(parse->update_time, job->update_time) == 0;
+    return;
+  }
+  if (parse->unchanged)
+    return;
 
-  if (strlen(cfg.location) == 0) {
-    ESP_LOGE(TAG, "Location is empty in config");
+  for (size_t i = 0; i < job->field_count; i++) {
+    const json_field_t *f = &job->fields[i];
+    if (strcmp(path, f->path) != 0)
+      continue;
+
+    char *dst = parse->region;
+    if (job->max_items > 0) {
+      if (index < 0 || index >= job->max_items)
+        return;
+      dst += index * job->stride;
+      if (index + 1 > parse->items)
+        parse->items = index + 1;
+    }
+    app_provider_store(f, dst + f->offset, value, parse->fahrenheit);
+    parse->fields_seen++;
+  }
+}
+
+static bool body_sink(void *ctx, const char *data, size_t len) {
+  job_parse_t *parse = ctx;
+  if (parse->cancel && *parse->cancel)
     return false;
+  int64_t start = esp_timer_get_time();
+  bool ok = app_inflate_feed(parse->inf, (const uint8_t *)data, len);
+  parse->sink_us += esp_timer_get_time() - start;
+  return ok;
+}
+
+static bool json_sink(void *ctx, const char *data, size_t len) {
+  job_parse_t *parse = ctx;
+  int64_t start = esp_timer_get_time();
+  for (size_t i = 0; i < len; i++) {
+    parse->hash ^= (uint8_t)data[i];
+    parse->hash *= 16777619u;
+  }
+  bool ok = app_json_feed(&parse->json, data, len);
+  parse->parse_us += esp_timer_get_time() - start;
+  return ok;
+}
+
+static bool job_is_due(const weather_job_t *job, int64_t now_us) {
+  return !job->ever_ok ||
+         now_us - job->last_ok_us >= (int64_t)job->interval_s * 1000000;
+}
+
+static uint32_t region_bit(const weather_job_t *job) {
+  static const size_t bases[] = {
+      offsetof(weather_model_t, now),     offsetof(weather_model_t, hourly),
+      offsetof(weather_model_t, daily),   offsetof(weather_model_t, air),
+      offsetof(weather_model_t, warning), offsetof(weather_model_t, place),
+  };
+  for (size_t i = 0; i < ARRAY_SIZE(bases); i++) {
+    if (bases[i] == job->base)
+      return 1u << i;
   }
+  return 0;
+}
 
+// Both providers report errors as HTTP status, QWeather also as the "code"
+// field of the body
+static app_fetch_err_t provider_err(int code) {
+  switch (code) {
+  case 402:
+    return APP_FETCH_QUOTA;
+  case 429:
+    return APP_FETCH_RATE_LIMIT;
+  default:
+    return APP_FETCH_PROVIDER;
+  }
+}
+
+// Fetches one endpoint straight into its region of `draft`. Unless the result
+// is JOB_UPDATED the region is left zeroed and the caller restores it.
+static job_result_t run_job(const app_provider_t *p, weather_job_t *job,
+                            const app_config_t *cfg, weather_model_t *draft,
+                            app_inflate_t *inf, const volatile bool *cancel,
+                            job_run_t *run) {
+  memset(run, 0, sizeof(*run));
   char url[256];
-  snprintf(url, sizeof(url),
-           "https://pd2tupjbcu.re.qweatherapi.com/v7/weather/"
-           "now?location=%s&key=" WEATHER_API_KEY "&lang=zh",
-           cfg.location);
+  if (!p->build_url(job, cfg, draft, url, sizeof(url))) {
+    ESP_LOGE(TAG, "[%s %s] Cannot build request", p->name, job->name);
+    return JOB_FAILED;
+  }
 
-  ESP_LOGI(TAG, "Fetching URL: %s", url);
+  job_parse_t parse = {
+      .provider = p,
+      .job = job,
+      .region = (char *)draft + job->base,
+      .fahrenheit = cfg->is_fahrenheit,
+      .hash = 2166136261u,
+      .inf = inf,
+      .cancel = cancel,
+  };
+  memset(parse.region, 0, job->size);
+  app_json_init(&parse.json, job_on_value, &parse);
+  app_inflate_reset(inf, json_sink, &parse);
 
-  esp_http_client_config_t config = {
+  // 请求 GZIP 压缩，响应体按块流式解压，峰值内存与响应大小无关
+  app_http_req_t req = {
       .url = url,
-      .crt_bundle_attach = esp_crt_bundle_attach,
-      .timeout_ms = 10000,
+      .accept_encoding = "gzip",
+      .if_none_match = job->etag,
+      .if_modified_since = job->last_modified,
+      .on_body = body_sink,
+      .ctx = &parse,
   };
+  app_http_result_t res;
+  esp_err_t err = app_http_get(&req, &res);
+  run->attempted = true;
+  run->reached = res.status != 0;
+  run->ms = res.total_ms;
+  int64_t start = esp_timer_get_time();
+  bool body_ok = err == ESP_OK && app_inflate_finish(inf);
+  parse.sink_us += esp_timer_get_time() - start;
+  if (res.body_bytes > 0) {
+    app_metrics_record(APP_PHASE_INFLATE, parse.sink_us - parse.parse_us);
+    app_metrics_record(APP_PHASE_PARSE, parse.parse_us);
+  }
 
-  esp_http_client_handle_t client = esp_http_client_init(&config);
+  job->fetches++;
+  job->last_ms = res.total_ms;
+  job->wire_bytes += res.body_bytes;
+  job->json_bytes += app_inflate_out_bytes(inf);
+  ESP_LOGI(TAG,
+           "[%s %s] HTTP %d, %d bytes%s -> %d, %lu ms (%s), total %u/%u B",
+           p->name, job->name, res.status, (int)res.body_bytes,
+           app_inflate_is_gzip(inf) ? " gzip" : "",
+           (int)app_inflate_out_bytes(inf), (unsigned long)res.total_ms,
+           app_http_conn_name(res.conn), (unsigned)job->wire_bytes,
+           (unsigned)job->json_bytes);
 
-  // 明确要求服务器不使用 GZIP 压缩，直接返回纯 JSON
-  esp_http_client_set_header(client, "Accept-Encoding", "identity");
+  if (err == ESP_OK && res.status == 304 && job->ever_ok) {
+    job->unchanged++;
+    return JOB_UNCHANGED;
+  }
 
-  esp_err_t err = esp_http_client_open(client, 0);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "HTTP open failed: %s", esp_err_to_name(err));
-    esp_http_client_cleanup(client);
-    return false;
+  // Transport and HTTP failures are already logged
+  app_fetch_err_t fail = APP_FETCH_OK;
+  if (err == ESP_ERR_INVALID_RESPONSE) {
+    fail = APP_FETCH_PROVIDER; // body rejected while streaming
+  } else if (err != ESP_OK) {
+    fail = APP_FETCH_NETWORK;
+  } else if (res.status != 200) {
+    fail = provider_err(res.status);
+  } else if (!body_ok) {
+    fail = APP_FETCH_NETWORK; // truncated or corrupted on the way
+  } else if (!app_json_finish(&parse.json)) {
+    ESP_LOGE(TAG, "[%s %s] Failed to parse JSON", p->name, job->name);
+    fail = APP_FETCH_PROVIDER;
+  } else if (p->status_path && strcmp(parse.status, p->status_ok) != 0) {
+    ESP_LOGE(TAG, "[%s %s] API error code: %s", p->name, job->name,
+             parse.status[0] ? parse.status : "null");
+    fail = provider_err(atoi(parse.status));
+  } else if (!parse.unchanged && job->max_items == 0 &&
+             parse.fields_seen == 0) {
+    ESP_LOGE(TAG, "[%s %s] No fields in response", p->name, job->name);
+    fail = APP_FETCH_PROVIDER;
   }
 
-  int content_length = esp_http_client_fetch_headers(client);
-  ESP_LOGI(TAG, "Content-Length: %d", content_length);
+  if (fail != APP_FETCH_OK) {
+    run->err = fail;
+    job->failures++;
+    return JOB_FAILED;
+  }
 
-  char *buf = malloc(MAX_HTTP_RECV_BUFFER);
-  if (!buf) {
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    return false;
+  strcpy(job->etag, res.etag);
+  strcpy(job->last_modified, res.last_modified);
+
+  // Without a stamp the body fingerprint decides
+  bool unchanged = parse.update_time[0]
+                       ? parse.unchanged
+                       : job->ever_ok && parse.hash == job->body_hash;
+  strcpy(job->update_time, parse.update_time);
+  job->body_hash = parse.hash;
+  if (unchanged && job->ever_ok) {
+    job->unchanged++;
+    return JOB_UNCHANGED;
   }
 
-  int total_read = 0;
-  int read_len;
-  while ((read_len = esp_http_client_read(client, buf + total_read,
-                                          MAX_HTTP_RECV_BUFFER - total_read -
-                                              1)) > 0) {
-    total_read += read_len;
+  char *count = (char *)draft + job->count_at;
+  if (job->max_items > 0)
+    *(uint8_t *)count = parse.items;
+  else
+    *(bool *)count = true;
+  return JOB_UPDATED;
+}
+
+static void score_sample(provider_state_t *ps, const job_run_t *run, bool ok) {
+  if (!run->attempted)
+    return;
+  portENTER_CRITICAL(&s_score_lock);
+  ps->success = (3 * ps->success + (ok ? 1000 : 0)) / 4;
+  if (ok) {
+    ps->ewma_ms = (3 * ps->ewma_ms + run->ms) / 4;
+    ps->lat_ms[ps->lat_next] = run->ms < UINT16_MAX ? run->ms : UINT16_MAX;
+    ps->lat_next = (ps->lat_next + 1) % SCORE_SAMPLES;
+    if (ps->lat_count < SCORE_SAMPLES)
+      ps->lat_count++;
   }
-  buf[total_read] = '\0';
+  portEXIT_CRITICAL(&s_score_lock);
+}
 
-  int status = esp_http_client_get_status_code(client);
-  ESP_LOGI(TAG, "HTTP status: %d, body(%d bytes)", status, total_read);
+// A provider left alone recovers its success rate slowly, so one that failed
+// gets probed again instead of being written off for good
+static void score_idle(provider_state_t *ps) {
+  portENTER_CRITICAL(&s_score_lock);
+  ps->success += (1000 - ps->success) / 8;
+  portEXIT_CRITICAL(&s_score_lock);
+}
 
-  esp_http_client_close(client);
-  esp_http_client_cleanup(client);
+// Expected cost of a request, lower is better
+static uint64_t score(provider_state_t *ps) {
+  portENTER_CRITICAL(&s_score_lock);
+  uint32_t ms = ps->ewma_ms;
+  uint32_t success = ps->success;
+  portEXIT_CRITICAL(&s_score_lock);
+  if (success < SCORE_MIN_SUCCESS)
+    success = SCORE_MIN_SUCCESS;
+  return (uint64_t)ms * ps->p->preference_pct * 1000 / success;
+}
 
-  if (status != 200 || total_read == 0) {
-    free(buf);
-    return false;
+// 95th percentile of recent successful latencies, 0 until enough samples
+static uint32_t score_p95(provider_state_t *ps, int min_samples) {
+  uint16_t v[SCORE_SAMPLES];
+  portENTER_CRITICAL(&s_score_lock);
+  int n = ps->lat_count;
+  memcpy(v, ps->lat_ms, sizeof(v));
+  portEXIT_CRITICAL(&s_score_lock);
+  if (n == 0 || n < min_samples)
+    return 0;
+  for (int i = 1; i < n; i++) {
+    uint16_t x = v[i];
+    int j = i;
+    for (; j > 0 && v[j - 1] > x; j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+  return v[(n * 95 + 99) / 100 - 1];
+}
+
+// Provider indices, best score first
+static void rank_providers(size_t *order) {
+  uint64_t s[PROVIDER_COUNT];
+  for (size_t i = 0; i < PROVIDER_COUNT; i++) {
+    s[i] = score(&s_providers[i]);
+    size_t j = i;
+    for (; j > 0 && s[order[j - 1]] > s[i]; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
   }
+}
+
+static void log_providers(void) {
+  for (size_t i = 0; i < PROVIDER_COUNT; i++) {
+    provider_state_t *ps = &s_providers[i];
+    ESP_LOGI(TAG, "Provider %s: %lu ms avg, %lu ms p95, %lu%% ok",
+             ps->p->name, (unsigned long)ps->ewma_ms,
+             (unsigned long)score_p95(ps, 1),
+             (unsigned long)ps->success / 10);
+  }
+}
+
+static void log_http(void) {
+  app_http_stats_t st;
+  app_http_get_stats(&st);
+  ESP_LOGI(TAG,
+           "HTTP: %lu requests, %lu failed, conns %lu reused / %lu ticket "
+           "offered / "
+           "%lu full, %lu stale retries, %lu trust fallbacks",
+           (unsigned long)st.requests, (unsigned long)st.failures,
+           (unsigned long)st.reused, (unsigned long)st.ticket_offered,
+           (unsigned long)st.full, (unsigned long)st.stale_retries,
+           (unsigned long)st.trust_fallbacks);
+  ESP_LOGI(TAG, "TLS handshake heap peak: %lu B",
+           (unsigned long)st.handshake_heap_peak);
+}
+
+static void log_store(void) {
+  app_store_stats_t st;
+  app_store_get_stats(&st);
+  ESP_LOGI(TAG, "Weather flash writes: %lu total, %lu this boot, %lu coalesced",
+           (unsigned long)st.flash_writes, (unsigned long)st.boot_writes,
+           (unsigned long)st.coalesced);
+  ESP_LOGI(TAG, "NVS: %lu B written this boot, slowest write %lu us",
+           (unsigned long)st.bytes_written, (unsigned long)st.max_write_us);
+  app_history_stats_t hs;
+  app_history_get_stats(&hs);
+  if (hs.sectors)
+    ESP_LOGI(TAG,
+             "History: %lu appends, %lu B, %lu erases this boot, "
+             "%lu erases per sector in total, slowest append %lu us",
+             (unsigned long)hs.appends, (unsigned long)hs.bytes_written,
+             (unsigned long)hs.erases,
+             (unsigned long)(hs.lifetime_erases / hs.sectors),
+             (unsigned long)hs.max_write_us);
+}
+
+static void log_display(void) {
+  app_hal_display_stats_t st;
+  app_hal_get_display_stats(&st);
+  unsigned long up_s = esp_timer_get_time() / 1000000;
+  ESP_LOGI(TAG,
+           "Display: %lu px/s now, %lu peak, %lu avg, %lu flushes, "
+           "render %lu ms total",
+           (unsigned long)st.pixels_per_s, (unsigned long)st.peak_per_s,
+           up_s ? (unsigned long)(st.pixels / up_s) : 0,
+           (unsigned long)st.flushes, (unsigned long)(st.render_us / 1000));
+}
+
+// Whether `p` can serve the configured location right now
+static bool provider_usable(const app_provider_t *p, const app_config_t *cfg,
+                            const weather_model_t *model, bool metered_ok) {
+  char url[256];
+  return (metered_ok || !p->metered) &&
+         p->build_url(&p->jobs[0], cfg, model, url, sizeof(url));
+}
+
+#if CONFIG_WEATHER_HEDGE_REQUESTS
+// The hedge never goes out sooner than this, a fast provider's p95 is mostly
+// noise
+#define HEDGE_MIN_MS 300
+#define HEDGE_MIN_SAMPLES 8
+
+typedef enum {
+  HEDGE_IDLE,
+  HEDGE_ARMED,   // timer running
+  HEDGE_RUNNING, // hedge task fetching
+  HEDGE_DONE,    // finished, not joined yet
+} hedge_state_t;
+
+// A second "now" request to an unmetered provider, sent when the preferred
+// one is slower than its own p95. Whichever answers first is shown.
+static struct {
+  portMUX_TYPE lock;
+  hedge_state_t state;
+  TaskHandle_t task;
+  esp_timer_handle_t timer;
+  SemaphoreHandle_t done;
+  app_inflate_t *inf;
+  provider_state_t *target;
+  app_config_t cfg;
+  volatile bool cancel;
+  bool primary_done; // under s_model_mux
+  bool won;
+} s_hedge = {.lock = portMUX_INITIALIZER_UNLOCKED};
 
-  // 自动检测 GZIP 魔数（0x1f 0x8b），如果是则解压
-  char *json_str = NULL;
-  bool json_allocated = false;
-  if (total_read > 10 && (uint8_t)buf[0] == 0x1f && (uint8_t)buf[1] == 0x8b) {
-    uint8_t flags = (uint8_t)buf[3];
-    int header_len = 10;
+static void hedge_task(void *arg) {
+  static weather_model_t draft;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    provider_state_t *ps = s_hedge.target;
+    weather_job_t *job = &ps->p->jobs[0];
+    ESP_LOGI(TAG, "Hedging [now] to %s", ps->p->name);
+
+    // The screen may hold another provider's data: ask for a full response
+    job->etag[0] = '\0';
+    job->last_modified[0] = '\0';
+    job->update_time[0] = '\0';
+    job->body_hash = 0;
+    xSemaphoreTake(s_model_mux, portMAX_DELAY);
+    draft = s_model;
+    xSemaphoreGive(s_model_mux);
 
-    // 跳过 FEXTRA
-    if (flags & 0x04) {
-      if (total_read > header_len + 2) {
-        int xlen =
-            (uint8_t)buf[header_len] | ((uint8_t)buf[header_len + 1] << 8);
-        header_len += 2 + xlen;
+    job_run_t run;
+    job_result_t result = run_job(ps->p, job, &s_hedge.cfg, &draft,
+                                  s_hedge.inf, &s_hedge.cancel, &run);
+    if (!s_hedge.cancel)
+      score_sample(ps, &run, result != JOB_FAILED);
+    bool won = false;
+    if (result == JOB_UPDATED) {
+      job->ever_ok = true;
+      job->last_ok_us = esp_timer_get_time();
+      xSemaphoreTake(s_model_mux, portMAX_DELAY);
+      if (!s_hedge.primary_done) {
+        s_model.now = draft.now;
+        s_model.version++;
+        won = true;
       }
+      xSemaphoreGive(s_model_mux);
     }
-    // 跳过 FNAME
-    if (flags & 0x08) {
-      while (header_len < total_read && buf[header_len] != 0)
-        header_len++;
-      header_len++; // Skip the null byte
-    }
-    // 跳过 FCOMMENT
-    if (flags & 0x10) {
-      while (header_len < total_read && buf[header_len] != 0)
-        header_len++;
-      header_len++;
-    }
-    // 跳过 FHCRC
-    if (flags & 0x02) {
-      header_len += 2;
+    if (won) {
+      ESP_LOGI(TAG, "Hedge to %s answered first", ps->p->name);
+      app_ui_update_weather(&draft.now);
     }
 
-    if (header_len < total_read) {
-      const uint8_t *deflate_data = (const uint8_t *)buf + header_len;
-      size_t deflate_len = total_read - header_len;
+    portENTER_CRITICAL(&s_hedge.lock);
+    s_hedge.won = won;
+    s_hedge.state = HEDGE_DONE;
+    portEXIT_CRITICAL(&s_hedge.lock);
+    xSemaphoreGive(s_hedge.done);
+  }
+}
 
-      // ESP32 miniz doesn't auto discard gzip footer, so subtract 8 bytes for
-      // CRC and ISIZE
-      if (deflate_len > 8) {
-        deflate_len -= 8;
-      }
+static void hedge_fire(void *arg) {
+  bool fire = false;
+  portENTER_CRITICAL(&s_hedge.lock);
+  if (s_hedge.state == HEDGE_ARMED) {
+    s_hedge.state = HEDGE_RUNNING;
+    fire = true;
+  }
+  portEXIT_CRITICAL(&s_hedge.lock);
+  if (fire)
+    xTaskNotifyGive(s_hedge.task);
+}
+
+// Waits for a hedge in flight, so its provider's jobs are free again
+static void hedge_join(void) {
+  portENTER_CRITICAL(&s_hedge.lock);
+  bool busy = s_hedge.state == HEDGE_RUNNING || s_hedge.state == HEDGE_DONE;
+  portEXIT_CRITICAL(&s_hedge.lock);
+  if (busy)
+    xSemaphoreTake(s_hedge.done, portMAX_DELAY);
+  portENTER_CRITICAL(&s_hedge.lock);
+  s_hedge.state = HEDGE_IDLE;
+  portEXIT_CRITICAL(&s_hedge.lock);
+}
+
+static bool hedge_init(void) {
+  const esp_timer_create_args_t args = {.callback = hedge_fire,
+                                        .name = "hedge"};
+  s_hedge.done = xSemaphoreCreateBinary();
+  s_hedge.inf = app_inflate_create(NULL, NULL);
+  if (!s_hedge.done || !s_hedge.inf ||
+      esp_timer_create(&args, &s_hedge.timer) != ESP_OK)
+    return false;
+  return xTaskCreate(hedge_task, "app_hedge", WEATHER_TASK_STACK, NULL, 4,
+                     &s_hedge.task) == pdPASS;
+}
+
+// Arms a hedge for the "now" request about to go to `primary`, aimed at the
+// next usable unmetered provider in `order`
+static bool hedge_arm(provider_state_t *primary, const size_t *order,
+                      const bool *usable, const app_config_t *cfg) {
+  if (!s_hedge.task)
+    return false;
+  hedge_join();
+  provider_state_t *target = NULL;
+  for (size_t k = 0; k < PROVIDER_COUNT && !target; k++) {
+    provider_state_t *ps = &s_providers[order[k]];
+    if (ps != primary && usable[order[k]] && !ps->p->metered)
+      target = ps;
+  }
+  uint32_t p95 = score_p95(primary, HEDGE_MIN_SAMPLES);
+  if (!target || p95 == 0)
+    return false;
+  if (p95 < HEDGE_MIN_MS)
+    p95 = HEDGE_MIN_MS;
+
+  s_hedge.target = target;
+  s_hedge.cfg = *cfg;
+  s_hedge.cancel = false;
+  s_hedge.won = false;
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  s_hedge.primary_done = false;
+  xSemaphoreGive(s_model_mux);
+  portENTER_CRITICAL(&s_hedge.lock);
+  s_hedge.state = HEDGE_ARMED;
+  portEXIT_CRITICAL(&s_hedge.lock);
+  esp_timer_start_once(s_hedge.timer, (uint64_t)p95 * 1000);
+  return true;
+}
+
+// Settles the hedge once the primary request is through. Returns true if the
+// primary failed and the hedge published "now" instead.
+static bool hedge_finish(bool primary_ok) {
+  if (primary_ok) {
+    // From here on the primary's data wins, a late hedge is dropped
+    xSemaphoreTake(s_model_mux, portMAX_DELAY);
+    s_hedge.primary_done = true;
+    xSemaphoreGive(s_model_mux);
+  }
+  esp_timer_stop(s_hedge.timer);
+  portENTER_CRITICAL(&s_hedge.lock);
+  hedge_state_t state = s_hedge.state;
+  if (state == HEDGE_ARMED)
+    s_hedge.state = HEDGE_IDLE;
+  else if (primary_ok)
+    s_hedge.cancel = true;
+  portEXIT_CRITICAL(&s_hedge.lock);
+  if (state == HEDGE_ARMED || primary_ok)
+    return false;
+  hedge_join();
+  return s_hedge.won;
+}
+#else
+static bool hedge_init(void) { return true; }
+static void hedge_join(void) {}
+static bool hedge_arm(provider_state_t *primary, const size_t *order,
+                      const bool *usable, const app_config_t *cfg) {
+  return false;
+}
+static bool hedge_finish(bool primary_ok) { return false; }
+#endif
 
-      size_t out_len = 4096;
-      json_str = (char *)malloc(out_len);
-      if (json_str) {
-        tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
-        if (decomp) {
-          tinfl_init(decomp);
-          size_t inbytes = deflate_len;
-          size_t outbytes = out_len - 1;
-
-          int st = tinfl_decompress(decomp, deflate_data, &inbytes,
-                                    (uint8_t *)json_str, (uint8_t *)json_str,
-                                    &outbytes,
-                                    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
-          free(decomp);
-
-          if (st >= 0 || st == -1) {
-            json_str[outbytes] = '\0';
-            json_allocated = true;
-          } else {
-            ESP_LOGE(TAG,
-                     "tinfl_decompress failed with status: %d (header_len=%d)",
-                     st, header_len);
-            free(json_str);
-            json_str = NULL;
-          }
-        } else {
-          free(json_str);
-          json_str = NULL;
+typedef struct {
+  bool now_changed;
+  int64_t update_s;    // provider updateTime of the "now" data, 0 if unknown
+  bool urgent;         // precipitation now or active warnings
+  uint32_t calls;      // metered requests that reached the provider
+  app_fetch_err_t err; // worst metered error of the batch
+  bool fallback;       // an unmetered provider can serve the location
+  bool held;           // nothing usable, no request went out
+} fetch_outcome_t;
+
+static void note_err(fetch_outcome_t *out, app_fetch_err_t err) {
+  if (err > out->err)
+    out->err = err;
+}
+
+// Keeps the last good data of a region the draft did not get new data for
+static void restore_region(weather_model_t *draft, const weather_job_t *job) {
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  memcpy((char *)draft + job->base, (const char *)&s_model + job->base,
+         job->size);
+  xSemaphoreGive(s_model_mux);
+}
+
+// QWeather icon codes 300-499 are rain, sleet and snow
+static bool is_precipitation(const weather_info_t *now) {
+  int icon = atoi(now->icon);
+  return now->is_valid && icon >= 300 && icon < 500;
+}
+
+static int clamp(int v, int lo, int hi) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// One observation per served poll, the log keeps one per 15 minutes
+static void record_history(const weather_model_t *m, bool fahrenheit) {
+  app_history_rec_t rec = {
+      .time = (uint32_t)time(NULL),
+      .temp = clamp(m->now.temp, INT8_MIN, INT8_MAX),
+      .feels_like = clamp(m->now.feels_like, INT8_MIN, INT8_MAX),
+      .humidity = clamp(m->now.humidity, 0, 100),
+      .wind_speed = clamp(m->now.wind_speed, 0, UINT8_MAX),
+      .aqi = m->air.is_valid ? clamp(m->air.aqi, 0, APP_HISTORY_NO_AQI - 1)
+                             : APP_HISTORY_NO_AQI,
+      .icon = clamp(atoi(m->now.icon), 0, UINT16_MAX),
+      .flags = fahrenheit ? APP_HISTORY_FAHRENHEIT : 0,
+  };
+  app_history_append(&rec);
+}
+
+// Coordinates from the offline city list, spares the metered geo lookup
+static bool local_place(const char *location, weather_place_t *place) {
+  app_city_t city;
+  if (!app_city_lookup(location, &city))
+    return false;
+  snprintf(place->location, sizeof(place->location), "%s", location);
+  snprintf(place->lat, sizeof(place->lat), "%.4f", city.lat / 1e5);
+  snprintf(place->lon, sizeof(place->lon), "%.4f", city.lon / 1e5);
+  place->is_valid = true;
+  return true;
+}
+
+// Runs every due endpoint job of the best scored provider back to back. When
+// its "now" request fails, the next usable provider takes over the regions
+// not served yet. The result is published as one new model version. Returns
+// false if no provider delivered "now".
+static bool fetch_weather_and_parse(fetch_outcome_t *out, bool metered_ok) {
+  app_config_t cfg;
+  if (!app_config_get(&cfg, NULL)) {
+    ESP_LOGE(TAG, "No config yet, cannot fetch weather");
+    return false;
+  }
+
+  if (strlen(cfg.location) == 0) {
+    ESP_LOGE(TAG, "Location is empty in config");
+    return false;
+  }
+
+  // Only this task fetches, so the draft can live outside its stack
+  static weather_model_t draft;
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  draft = s_model;
+  xSemaphoreGive(s_model_mux);
+
+  // A new location needs its coordinates looked up again. Listed cities
+  // have them on flash, also for a coordinate-only provider.
+  bool place_stale = !draft.place.is_valid ||
+                     strcmp(draft.place.location, cfg.location) != 0;
+  weather_place_t local;
+  bool place_local = local_place(cfg.location, &local);
+  bool place_set = place_local && place_stale;
+  if (place_set) {
+    draft.place = local;
+    place_stale = false;
+  }
+
+  size_t order[PROVIDER_COUNT];
+  bool usable[PROVIDER_COUNT];
+  bool any_usable = false;
+  rank_providers(order);
+  for (size_t i = 0; i < PROVIDER_COUNT; i++) {
+    const app_provider_t *p = s_providers[i].p;
+    usable[i] = provider_usable(p, &cfg, &draft, metered_ok);
+    any_usable |= usable[i];
+    if (!p->metered && usable[i])
+      out->fallback = true;
+  }
+  if (!any_usable) {
+    out->held = true;
+    return false;
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  uint32_t updated = place_set ? REGION_PLACE : 0; // REGION_* bits
+  uint32_t served = 0;  // regions a provider answered in this batch
+  bool tried[PROVIDER_COUNT] = {0};
+  bool failing_over = false;
+  for (size_t k = 0; k < PROVIDER_COUNT; k++) {
+    provider_state_t *ps = &s_providers[order[k]];
+    const app_provider_t *p = ps->p;
+    if (!usable[order[k]])
+      continue;
+    if (failing_over)
+      ESP_LOGW(TAG, "Failing over to %s", p->name);
+    hedge_join();
+    tried[order[k]] = true;
+    failing_over = false;
+
+    for (size_t i = 0; i < p->job_count; i++) {
+      weather_job_t *job = &p->jobs[i];
+      uint32_t region = region_bit(job);
+      if ((served & region) || (region == REGION_PLACE && place_local) ||
+          !(job_is_due(job, now_us) || (region == REGION_PLACE && place_stale)))
+        continue;
+      // Leave the rest of the batch for later once the budget is spent
+      if (p->metered &&
+          out->calls >= app_budget_remaining(&s_budget, time(NULL)))
+        break;
+
+      bool hedged =
+          region == REGION_NOW && hedge_arm(ps, order, usable, &cfg);
+      job_run_t run;
+      job_result_t result =
+          run_job(p, job, &cfg, &draft, s_inflate, NULL, &run);
+      score_sample(ps, &run, result != JOB_FAILED);
+      if (p->metered) {
+        out->calls += run.reached;
+        note_err(out, run.err);
+      }
+      if (hedged && hedge_finish(result != JOB_FAILED)) {
+        served |= REGION_NOW;
+        updated |= REGION_NOW;
+      }
+      if (result != JOB_UPDATED)
+        restore_region(&draft, job);
+      if (result == JOB_FAILED) {
+        // Retried on the next batch. Without "now" the next provider takes
+        // over, and every further request would hit the same limit.
+        if (region == REGION_NOW) {
+          failing_over = true;
+          break;
         }
+        if (run.err >= APP_FETCH_RATE_LIMIT)
+          break;
+        continue;
       }
 
-      if (!json_allocated) {
-        free(buf);
-        return false;
+      job->ever_ok = true;
+      job->last_ok_us = esp_timer_get_time();
+      served |= region;
+      // Coordinates are kept together with the location they belong to
+      if (region == REGION_PLACE &&
+          strcmp(draft.place.location, cfg.location) != 0) {
+        strcpy(draft.place.location, cfg.location);
+        result = JOB_UPDATED;
       }
-    } else {
-      ESP_LOGE(TAG, "Invalid GZIP header length");
-      free(buf);
-      return false;
+      if (region == REGION_NOW) {
+        out->now_changed = result == JOB_UPDATED;
+        if (p->zoned_stamps)
+          out->update_s = app_sched_parse_time(job->update_time);
+      }
+      if (result == JOB_UPDATED)
+        updated |= region;
+      else
+        ESP_LOGI(TAG, "[%s %s] Unchanged, skipping store and redraw", p->name,
+                 job->name);
     }
-  } else {
-    // 未压缩，直接使用
-    json_str = buf;
-  }
-
-  // Note: buf/json_str may not be fully null-terminated if it was decompressed
-  // or read exactly to its length
-  ESP_LOGI(TAG, "JSON: %.*s", 100,
-           json_str ? json_str : ""); // 打印前100字符用于调试
-
-  bool parser_success = false;
-  cJSON *root = cJSON_Parse(json_str);
-  if (root) {
-    cJSON *code = cJSON_GetObjectItem(root, "code");
-    if (code && code->valuestring && strcmp(code->valuestring, "200") == 0) {
-      cJSON *now = cJSON_GetObjectItem(root, "now");
-      if (now) {
-        cJSON *temp = cJSON_GetObjectItem(now, "temp");
-        cJSON *feelsLike = cJSON_GetObjectItem(now, "feelsLike");
-        cJSON *text = cJSON_GetObjectItem(now, "text");
-        cJSON *icon = cJSON_GetObjectItem(now, "icon");
-        cJSON *windSpeed = cJSON_GetObjectItem(now, "windSpeed");
-        cJSON *humidity = cJSON_GetObjectItem(now, "humidity");
-
-        weather_info_t winfo = {0};
-        if (text && text->valuestring)
-          strncpy(winfo.description, text->valuestring,
-                  sizeof(winfo.description) - 1);
-        if (temp && temp->valuestring)
-          winfo.temp = atoi(temp->valuestring);
-        if (feelsLike && feelsLike->valuestring)
-          winfo.feels_like = atoi(feelsLike->valuestring);
-        if (windSpeed && windSpeed->valuestring)
-          winfo.wind_speed = atoi(windSpeed->valuestring);
-        if (humidity && humidity->valuestring)
-          winfo.humidity = atoi(humidity->valuestring);
-        if (icon && icon->valuestring)
-          strncpy(winfo.icon, icon->valuestring, sizeof(winfo.icon) - 1);
-
-        winfo.is_valid = true;
-
-        if (cfg.is_fahrenheit) {
-          winfo.temp = (winfo.temp * 9 / 5) + 32;
-          winfo.feels_like = (winfo.feels_like * 9 / 5) + 32;
-        }
+    if (!failing_over)
+      break;
+  }
+  for (size_t i = 0; i < PROVIDER_COUNT; i++) {
+    if (!tried[i])
+      score_idle(&s_providers[i]);
+  }
+
+  bool now_ok = served & REGION_NOW;
+  if (now_ok)
+    record_history(&draft, cfg.is_fahrenheit);
+  out->urgent = is_precipitation(&draft.now) || draft.warning_count > 0;
+  if (!updated)
+    return now_ok;
+
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  draft.version = s_model.version + 1;
+  s_model = draft;
+  xSemaphoreGive(s_model_mux);
+
+  // Only touch flash and LVGL for the parts that actually changed
+  if (updated & (REGION_NOW | REGION_PLACE)) {
+    int64_t start = esp_timer_get_time();
+    if (updated & REGION_NOW)
+      app_store_stage_weather(&draft.now);
+    if (updated & REGION_PLACE)
+      app_store_save_place(&draft.place);
+    app_metrics_record(APP_PHASE_STORE, esp_timer_get_time() - start);
+  }
+  int64_t start = esp_timer_get_time();
+  if (updated & REGION_NOW)
+    app_ui_update_weather(&draft.now);
+  if (updated & REGION_FORECAST)
+    app_ui_update_forecast(&draft);
+  app_metrics_record(APP_PHASE_UI, esp_timer_get_time() - start);
+  return now_ok;
+}
+
+// Validators of an extra city's "now" request. They belong to one provider
+// and one location and are dropped when either changes.
+typedef struct {
+  char location[APP_LOCATION_LEN];
+  const app_provider_t *provider;
+  char etag[APP_HTTP_ETAG_LEN];
+  char last_modified[APP_HTTP_DATE_LEN];
+  char update_time[32];
+  uint32_t body_hash;
+  bool ever_ok;
+  weather_place_t place; // for coordinate-only providers
+  bool place_tried;      // one lookup per location and boot
+} city_state_t;
+
+static city_state_t *s_cities = NULL; // WEATHER_CITY_MAX, in PSRAM
+static size_t s_next_city = 0;
+// Metered calls of city fetches, booked with the next poll so the budget
+// sees whole rounds
+static fetch_outcome_t s_city_out;
+
+static void update_ui_cities(const weather_model_t *model,
+                             const app_config_t *cfg) {
+  const char *names[WEATHER_CITY_MAX];
+  for (size_t i = 0; i < model->city_count; i++) {
+    // Location IDs read better as the city name, flash resident
+    app_city_t city;
+    names[i] = app_city_lookup(cfg->extra[i], &city) ? city.name_en
+                                                     : cfg->extra[i];
+  }
+  app_ui_update_cities(model, names);
+}
+
+// Index of `text` in the shared table. Reuses a slot only city `self` or no
+// valid city refers to, there is always one since slots equal cities.
+static uint8_t intern_text(weather_model_t *m, size_t self, const char *text) {
+  for (size_t t = 0; t < WEATHER_CITY_MAX; t++) {
+    if (m->texts[t][0] && strcmp(m->texts[t], text) == 0)
+      return t;
+  }
+  for (size_t t = 0; t < WEATHER_CITY_MAX; t++) {
+    bool used = false;
+    for (size_t i = 0; i < m->city_count && !used; i++)
+      used = i != self && m->city[i].is_valid && m->city[i].text == t;
+    if (!used) {
+      strncpy(m->texts[t], text, WEATHER_TEXT_LEN - 1);
+      m->texts[t][WEATHER_TEXT_LEN - 1] = '\0';
+      return t;
+    }
+  }
+  return 0;
+}
 
-        app_store_save_weather(&winfo);
-        app_ui_update_weather(&winfo);
-        parser_success = true;
+static void copy_job_state(weather_job_t *job, const city_state_t *cs) {
+  strcpy(job->etag, cs->etag);
+  strcpy(job->last_modified, cs->last_modified);
+  strcpy(job->update_time, cs->update_time);
+  job->body_hash = cs->body_hash;
+  job->ever_ok = cs->ever_ok;
+}
+
+static void clear_job_state(weather_job_t *job) {
+  job->etag[0] = '\0';
+  job->last_modified[0] = '\0';
+  job->update_time[0] = '\0';
+  job->body_hash = 0;
+  job->ever_ok = false;
+}
+
+static void save_job_state(city_state_t *cs, const weather_job_t *job) {
+  strcpy(cs->etag, job->etag);
+  strcpy(cs->last_modified, job->last_modified);
+  strcpy(cs->update_time, job->update_time);
+  cs->body_hash = job->body_hash;
+  cs->ever_ok = job->ever_ok;
+}
+
+// Looks up the coordinates of an extra city through the first provider that
+// has a place job, so a coordinate-only fallback can serve it later. Returns
+// false if no request could go out.
+static bool fetch_city_place(city_state_t *cs, const app_config_t *cfg,
+                             weather_model_t *scratch, bool metered_ok) {
+  for (size_t k = 0; k < PROVIDER_COUNT; k++) {
+    provider_state_t *ps = &s_providers[k];
+    const app_provider_t *p = ps->p;
+    if (p->metered && !metered_ok)
+      continue;
+    for (size_t i = 0; i < p->job_count; i++) {
+      if (region_bit(&p->jobs[i]) != REGION_PLACE)
+        continue;
+      weather_job_t job = p->jobs[i];
+      clear_job_state(&job);
+      job_run_t run;
+      job_result_t result =
+          run_job(p, &job, cfg, scratch, s_inflate, NULL, &run);
+      score_sample(ps, &run, result != JOB_FAILED);
+      if (p->metered) {
+        s_city_out.calls += run.reached;
+        note_err(&s_city_out, run.err);
       }
-    } else {
-      ESP_LOGE(TAG, "API error code: %s", code ? code->valuestring : "null");
+      if (result == JOB_UPDATED) {
+        cs->place = scratch->place;
+        strcpy(cs->place.location, cs->location);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Fetches the current conditions of extra city `i`: one request on the best
+// usable provider, the next one only if it fails
+static void fetch_city(size_t i, const app_config_t *cfg, bool metered_ok) {
+  city_state_t *cs = &s_cities[i];
+  if (strcmp(cs->location, cfg->extra[i]) != 0) {
+    memset(cs, 0, sizeof(*cs));
+    strcpy(cs->location, cfg->extra[i]);
+    xSemaphoreTake(s_model_mux, portMAX_DELAY);
+    s_model.city[i].is_valid = false;
+    xSemaphoreGive(s_model_mux);
+  }
+  hedge_join(); // a late hedge may still hold a provider's "now" job
+  // Same request path as the primary city, only the location differs
+  static app_config_t ccfg;
+  ccfg = *cfg;
+  strcpy(ccfg.location, cfg->extra[i]);
+  static weather_model_t scratch;
+  memset(&scratch, 0, sizeof(scratch));
+  bool needs_place = false;
+  for (size_t k = 0; k < PROVIDER_COUNT; k++)
+    needs_place |= !provider_usable(s_providers[k].p, &ccfg, &scratch, true);
+  if (needs_place && !cs->place_tried)
+    cs->place_tried = local_place(cs->location, &cs->place) ||
+                      fetch_city_place(cs, &ccfg, &scratch, metered_ok);
+  scratch.place = cs->place;
+
+  size_t order[PROVIDER_COUNT];
+  rank_providers(order);
+  job_result_t result = JOB_FAILED;
+  for (size_t k = 0; k < PROVIDER_COUNT && result == JOB_FAILED; k++) {
+    provider_state_t *ps = &s_providers[order[k]];
+    const app_provider_t *p = ps->p;
+    if (!provider_usable(p, &ccfg, &scratch, metered_ok))
+      continue;
+    if (p->metered && s_city_out.calls >=
+                          app_budget_remaining(&s_budget, time(NULL)))
+      continue;
+    weather_job_t job = p->jobs[0];
+    if (cs->provider == p)
+      copy_job_state(&job, cs);
+    else
+      clear_job_state(&job);
+    job_run_t run;
+    result = run_job(p, &job, &ccfg, &scratch, s_inflate, NULL, &run);
+    score_sample(ps, &run, result != JOB_FAILED);
+    if (p->metered) {
+      s_city_out.calls += run.reached;
+      note_err(&s_city_out, run.err);
+    }
+    if (result != JOB_FAILED) {
+      job.ever_ok = true;
+      cs->provider = p;
+      save_job_state(cs, &job);
+    }
+  }
+  if (result != JOB_UPDATED)
+    return;
+
+  const weather_info_t *now = &scratch.now;
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  weather_city_t *city = &s_model.city[i];
+  city->temp = now->temp;
+  city->feels_like = now->feels_like;
+  city->wind_speed = now->wind_speed;
+  city->humidity = now->humidity;
+  strncpy(city->icon, now->icon, sizeof(city->icon) - 1);
+  city->text = intern_text(&s_model, i, now->description);
+  city->is_valid = true;
+  s_model.version++;
+  scratch = s_model;
+  xSemaphoreGive(s_model_mux);
+  ESP_LOGI(TAG, "City %s: %d, %s", cfg->extra[i], now->temp,
+           now->description);
+  update_ui_cities(&scratch, cfg);
+}
+
+typedef struct {
+  app_weather_done_cb_t cb;
+  void *arg;
+} done_cb_t;
+
+static TaskHandle_t s_weather_task = NULL;
+static portMUX_TYPE s_cb_lock = portMUX_INITIALIZER_UNLOCKED;
+static done_cb_t s_pending_cbs[MAX_PENDING_CALLBACKS];
+static int s_pending_cb_count = 0;
+static int64_t s_last_fetch_us = 0;
+
+static int take_pending_callbacks(done_cb_t *out) {
+  portENTER_CRITICAL(&s_cb_lock);
+  int count = s_pending_cb_count;
+  memcpy(out, s_pending_cbs, count * sizeof(done_cb_t));
+  s_pending_cb_count = 0;
+  portEXIT_CRITICAL(&s_cb_lock);
+  return count;
+}
+
+// Sleeps until the next scheduled poll or until app_weather_update() asks for
+// a refresh. Requests are rate-limited against the last fetch, and every
+// request arriving in the meantime is folded into the same fetch.
+// Returns true if the wait was cut short by a refresh request
+static bool wait_for_poll(uint32_t delay_ms) {
+  uint32_t notified;
+  if (delay_ms > DNS_PREFETCH_LEAD_MS) {
+    notified = ulTaskNotifyTake(
+        pdTRUE, pdMS_TO_TICKS(delay_ms - DNS_PREFETCH_LEAD_MS));
+    if (!notified) {
+      // Resolve the preferred provider now rather than inside the fetch
+      size_t order[PROVIDER_COUNT];
+      rank_providers(order);
+      app_http_prefetch(s_providers[order[0]].p->host,
+                        DNS_PREFETCH_LEAD_MS / 1000 + DNS_PREFETCH_SLACK_S);
+      notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DNS_PREFETCH_LEAD_MS));
     }
-    cJSON_Delete(root);
   } else {
-    ESP_LOGE(TAG, "Failed to parse JSON");
+    notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay_ms));
   }
+  if (!notified)
+    return false;
 
-  if (json_allocated)
-    free(json_str);
-  free(buf);
-  return parser_success;
+  int64_t since_ms = (esp_timer_get_time() - s_last_fetch_us) / 1000;
+  int64_t hold_ms = REFRESH_MIN_INTERVAL_MS - since_ms;
+  if (hold_ms < REFRESH_DEBOUNCE_MS)
+    hold_ms = REFRESH_DEBOUNCE_MS;
+  ESP_LOGI(TAG, "Refresh requested, fetching in %d ms", (int)hold_ms);
+  vTaskDelay(pdMS_TO_TICKS(hold_ms));
+  ulTaskNotifyTake(pdTRUE, 0);
+  return true;
 }
 
-static void weather_task(void *arg) {
-  // Wait for the time to be synchronized before making HTTPS requests
-  // Otherwise, MBEDTLS will fail the certificate validation due to the time
-  // being 1970
-  while (!app_time_is_synced()) {
-    vTaskDelay(pdMS_TO_TICKS(1000));
+// Waits `delay_s` for the next poll of the primary city. Extra cities are
+// fetched one per slice in between, so a round of N cities costs the heap
+// and the radio one request at a time instead of N back to back.
+static void wait_with_cities(uint32_t delay_s) {
+  app_config_t cfg;
+  size_t n = 0;
+  if (app_config_get(&cfg, NULL) && s_cities)
+    n = cfg.extra_count;
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  bool resized = s_model.city_count != n;
+  if (resized) {
+    // Cities past the end were removed, later ones start out empty
+    for (size_t i = n; i < WEATHER_CITY_MAX; i++)
+      s_model.city[i].is_valid = false;
+    s_model.city_count = n;
+    s_model.version++;
+  }
+  xSemaphoreGive(s_model_mux);
+  if (resized) {
+    static weather_model_t model;
+    app_weather_get_model(&model);
+    update_ui_cities(&model, &cfg);
+  }
+
+  uint32_t slice_ms = delay_s * 1000 / (n + 1);
+  for (size_t k = 0; k < n; k++) {
+    if (wait_for_poll(slice_ms))
+      return;
+    if (!app_net_is_connected())
+      continue;
+    s_next_city %= n;
+    bool metered_ok = !app_budget_blocked(&s_budget, time(NULL));
+    fetch_city(s_next_city++, &cfg, metered_ok);
+  }
+  wait_for_poll(delay_s * 1000 - slice_ms * n);
+}
+
+static uint32_t s_cfg_changed = 0; // APP_CONFIG_* bits, under s_cb_lock
+
+static void on_config_change(uint32_t changed, void *arg) {
+  if (!(changed &
+        (APP_CONFIG_LOCATION | APP_CONFIG_UNIT | APP_CONFIG_CITIES)))
+    return;
+  portENTER_CRITICAL(&s_cb_lock);
+  s_cfg_changed |= changed;
+  portEXIT_CRITICAL(&s_cb_lock);
+  app_weather_update(NULL, NULL);
+}
+
+// Drops what was fetched for the old settings. Kept validators would turn the
+// first request for a new location or unit into a 304 for the old one.
+static void apply_config_change(void) {
+  portENTER_CRITICAL(&s_cb_lock);
+  uint32_t changed = s_cfg_changed;
+  s_cfg_changed = 0;
+  portEXIT_CRITICAL(&s_cb_lock);
+  if (!(changed & (APP_CONFIG_LOCATION | APP_CONFIG_UNIT)))
+    return; // extra cities reset themselves by location
+
+  ESP_LOGI(TAG, "Location or unit changed, refetching everything");
+  hedge_join();
+  for (size_t k = 0; k < PROVIDER_COUNT; k++) {
+    for (size_t i = 0; i < s_providers[k].p->job_count; i++)
+      clear_job_state(&s_providers[k].p->jobs[i]);
   }
+  if (s_cities)
+    memset(s_cities, 0, WEATHER_CITY_MAX * sizeof(city_state_t));
+
+  // Nothing of the old location stays on screen as if it were the new one
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  s_model.now.is_valid = false;
+  s_model.hourly_count = 0;
+  s_model.daily_count = 0;
+  s_model.air.is_valid = false;
+  s_model.warning_count = 0;
+  for (size_t i = 0; i < WEATHER_CITY_MAX; i++)
+    s_model.city[i].is_valid = false;
+  s_model.version++;
+  static weather_model_t model;
+  model = s_model;
+  xSemaphoreGive(s_model_mux);
+  app_ui_update_weather(&model.now);
+  app_ui_update_forecast(&model);
+}
+
+// The budget is staged in RTC memory like the weather in app_store, so a
+// soft reset keeps every call. Flash only sees it on a new day, a quota
+// lockout or hourly, a power cut loses at most an hour of counts.
+#define BUDGET_RTC_MAGIC 0x42554447 // "BUDG"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t crc; // over rec
+  app_budget_record_t rec;
+} rtc_budget_t;
+
+static RTC_NOINIT_ATTR rtc_budget_t s_rtc_budget;
+static app_budget_record_t s_budget_flashed; // what NVS holds
+static int64_t s_budget_flashed_s;           // seconds since boot
+
+static uint32_t rtc_budget_crc(void) {
+  return esp_rom_crc32_le(0, (const uint8_t *)&s_rtc_budget.rec,
+                          sizeof(s_rtc_budget.rec));
+}
+
+static void load_budget(void) {
+  app_budget_init(&s_budget, CONFIG_WEATHER_DAILY_QUOTA, esp_random());
+  size_t len = sizeof(s_budget_flashed);
+  if (!app_store_load_blob("budget", &s_budget_flashed, &len) ||
+      len != sizeof(s_budget_flashed))
+    memset(&s_budget_flashed, 0, sizeof(s_budget_flashed));
+  app_budget_record_t rec = s_budget_flashed;
+  // The RTC copy is newer unless it is from an older day than flash
+  if (s_rtc_budget.magic == BUDGET_RTC_MAGIC &&
+      s_rtc_budget.crc == rtc_budget_crc() &&
+      (s_rtc_budget.rec.day > rec.day ||
+       (s_rtc_budget.rec.day == rec.day && s_rtc_budget.rec.used >= rec.used)))
+    rec = s_rtc_budget.rec;
+  app_budget_restore(&s_budget, &rec);
+}
+
+static void save_budget(void) {
+  app_budget_save(&s_budget, &s_rtc_budget.rec);
+  s_rtc_budget.magic = BUDGET_RTC_MAGIC;
+  s_rtc_budget.crc = rtc_budget_crc();
+
+  int64_t now_s = esp_timer_get_time() / 1000000;
+  if (!app_budget_should_persist(&s_budget, &s_budget_flashed,
+                                 s_budget_flashed_s, now_s))
+    return;
+  if (app_store_save_blob("budget", &s_rtc_budget.rec,
+                          sizeof(s_rtc_budget.rec))) {
+    s_budget_flashed = s_rtc_budget.rec;
+    s_budget_flashed_s = now_s;
+  }
+}
+
+static void log_stack_headroom(void) {
+  // ESP-IDF reports the high-water mark in bytes
+  unsigned free_b = uxTaskGetStackHighWaterMark(NULL);
+  if (free_b < WEATHER_STACK_WARN)
+    ESP_LOGW(TAG, "Stack headroom low: %u of %d B unused", free_b,
+             WEATHER_TASK_STACK);
+  else
+    ESP_LOGI(TAG, "Stack: %u of %d B never used", free_b, WEATHER_TASK_STACK);
+}
 
-  // Attempt to load cached weather at startup
+static void weather_task(void *arg) {
+  // Cached weather goes up right away, the network and clock come later.
+  // RTC memory first.
   weather_info_t cached = {0};
   if (app_store_load_weather(&cached) && cached.is_valid) {
     cached.is_valid = false; // Mark as cached/offline for UI visually if needed
     app_ui_update_weather(&cached);
+    xSemaphoreTake(s_model_mux, portMAX_DELAY);
+    s_model.now = cached;
+    xSemaphoreGive(s_model_mux);
+  }
+  weather_place_t place;
+  if (app_store_load_place(&place)) {
+    xSemaphoreTake(s_model_mux, portMAX_DELAY);
+    s_model.place = place;
+    xSemaphoreGive(s_model_mux);
+  }
+
+  // Wait for the time to be synchronized before making HTTPS requests
+  // Otherwise, MBEDTLS will fail the certificate validation due to the time
+  // being 1970
+  while (!app_time_is_synced()) {
+    vTaskDelay(pdMS_TO_TICKS(1000));
   }
 
-  int retry_delay_min = 1;
+  load_budget();
+  app_sched_t sched;
+  app_sched_init(&sched, esp_random());
+  uint32_t polls = 0;
   while (1) {
-    if (app_net_is_connected()) {
-      if (fetch_weather_and_parse()) {
-        // Success, wait 15 minutes before next update
-        ESP_LOGI(TAG, "Weather fetched successfully. Sleep 15m.");
-        retry_delay_min = 1; // reset delay
-        vTaskDelay(pdMS_TO_TICKS(15 * 60 * 1000));
-        continue;
+    if (!app_net_is_connected()) {
+      // Not connected, sleep briefly and check again. Pending refresh
+      // requests stay queued until a fetch can run.
+      vTaskDelay(pdMS_TO_TICKS(5000));
+      continue;
+    }
+
+    // Requests made up to this point are served by this fetch
+    ulTaskNotifyTake(pdTRUE, 0);
+    apply_config_change();
+    done_cb_t done[MAX_PENDING_CALLBACKS];
+    int done_count = take_pending_callbacks(done);
+
+    // QWeather's budget only holds back QWeather, others may still serve
+    bool metered_ok = app_budget_allow(&s_budget, time(NULL));
+    s_last_fetch_us = esp_timer_get_time();
+    fetch_outcome_t out = {0};
+    bool ok = fetch_weather_and_parse(&out, metered_ok);
+    if (out.held) {
+      ESP_LOGW(TAG, "Poll held back: %s",
+               s_budget.state == APP_BREAKER_OPEN ? "circuit breaker open"
+                                                  : "daily quota used up");
+    } else {
+      app_metrics_record(APP_PHASE_FETCH,
+                         esp_timer_get_time() - s_last_fetch_us);
+      if (++polls % METRICS_DUMP_EVERY == 0) {
+        app_metrics_dump();
+        log_providers();
+        log_http();
+        log_store();
+        log_display();
+      }
+      out.calls += s_city_out.calls;
+      note_err(&out, s_city_out.err);
+      memset(&s_city_out, 0, sizeof(s_city_out));
+      if (out.calls > 0 || out.err != APP_FETCH_OK) {
+        app_budget_on_result(&s_budget, time(NULL), out.calls, out.err);
+        save_budget();
+      }
+      if (out.err != APP_FETCH_OK)
+        ESP_LOGW(TAG, "Poll error: %s, %lu calls", app_budget_err_name(out.err),
+                 (unsigned long)out.calls);
+      if (ok) {
+        app_sched_on_success(&sched, out.update_s, out.now_changed,
+                             out.urgent);
       } else {
-        ESP_LOGW(TAG, "Weather fetch failed. Retry in %d min.",
-                 retry_delay_min);
-        vTaskDelay(pdMS_TO_TICKS(retry_delay_min * 60 * 1000));
-        retry_delay_min *= 2; // exponential backoff
-        if (retry_delay_min > 15)
-          retry_delay_min = 15;
+        app_sched_on_failure(&sched);
       }
-    } else {
-      // Not connected, sleep briefly and check again
-      vTaskDelay(pdMS_TO_TICKS(5000));
     }
+    for (int i = 0; i < done_count; i++)
+      done[i].cb(ok, done[i].arg);
+
+    int64_t now_s = time(NULL);
+    uint32_t delay_s = app_sched_next_delay_s(&sched, now_s);
+    // While QWeather is held back a fallback keeps the normal cadence
+    if (!out.fallback || !app_budget_blocked(&s_budget, now_s))
+      delay_s = app_budget_next_delay_s(&s_budget, now_s, delay_s);
+    ESP_LOGI(TAG,
+             "Next poll in %lu s (cadence %d s, unchanged %lu, %lu calls "
+             "left today%s%s)",
+             (unsigned long)delay_s, (int)sched.cadence_s,
+             (unsigned long)sched.unchanged_streak,
+             (unsigned long)app_budget_remaining(&s_budget, now_s),
+             sched.urgent ? ", urgent" : "",
+             sched.failures ? ", failing" : "");
+    log_stack_headroom();
+    wait_with_cities(delay_s);
   }
 }
 
 void app_weather_init(void) {
-  xTaskCreate(weather_task, "app_weather", 40960, NULL, 4, NULL);
+  app_http_init();
+  s_model_mux = xSemaphoreCreateMutex();
+  // One decoder reused by every job, allocated once in PSRAM
+  s_inflate = app_inflate_create(NULL, NULL);
+  if (!s_inflate) {
+    ESP_LOGE(TAG, "No memory for the body decoder");
+    return;
+  }
+  for (size_t i = 0; i < PROVIDER_COUNT; i++) {
+    s_providers[i].ewma_ms = SCORE_PRIOR_MS;
+    s_providers[i].success = 1000;
+  }
+  s_cities = heap_caps_calloc_prefer(WEATHER_CITY_MAX, sizeof(city_state_t),
+                                     2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+  if (!s_cities)
+    ESP_LOGE(TAG, "No memory for extra cities, showing the primary only");
+  if (!hedge_init())
+    ESP_LOGE(TAG, "Hedged requests unavailable");
+  xTaskCreate(weather_task, "app_weather", WEATHER_TASK_STACK, NULL, 4,
+              &s_weather_task);
+  app_config_subscribe(on_config_change, NULL);
+}
+
+void app_weather_get_model(weather_model_t *model) {
+  xSemaphoreTake(s_model_mux, portMAX_DELAY);
+  *model = s_model;
+  xSemaphoreGive(s_model_mux);
 }
 
-void app_weather_update(void) {
-  // If we wanted to force update immediately, we could use a FreeRTOS event
-  // group or task notify. For simplicity, we just let the polling loop handle
-  // it.
+void app_weather_update(app_weather_done_cb_t done_cb, void *arg) {
+  if (!s_weather_task)
+    return;
+
+  if (done_cb) {
+    bool queued = false;
+    portENTER_CRITICAL(&s_cb_lock);
+    if (s_pending_cb_count < MAX_PENDING_CALLBACKS) {
+      s_pending_cbs[s_pending_cb_count++] = (done_cb_t){done_cb, arg};
+      queued = true;
+    }
+    portEXIT_CRITICAL(&s_cb_lock);
+    if (!queued)
+      ESP_LOGW(TAG, "Too many pending refresh callbacks, dropping one");
+  }
+  xTaskNotifyGive(s_weather_task);
 }
@@ -1,5 +1,15 @@
 #pragma once
 
+#include "weather_data.h"
+#include <stdbool.h>
+
+// Called from the weather task once the requested refresh has run
+typedef void (*app_weather_done_cb_t)(bool ok, void *arg);
+
 void app_weather_init(void);
-// Force an immediate weather update attempt
-void app_weather_update(void);
+// Ask for a refresh as soon as allowed. Non-blocking; bursts of requests are
+// coalesced into one fetch, rate-limited against the previous one. done_cb
+// may be NULL.
+void app_weather_update(app_weather_done_cb_t done_cb, void *arg);
+// Copy of the latest consistent weather snapshot
+void app_weather_get_model(weather_model_t *model);
@@ -1,4 +1,7 @@
+#include "app_city.h"
+#include "app_config.h"
 #include "app_hal.h"
+#include "app_history.h"
 #include "app_net.h"
 #include "app_store.h"
 #include "app_time.h"
@@ -25,6 +28,9 @@ void app_main(void) {
 
   // Initialize Submodules
   app_store_init();
+  app_config_init(); // Config read once, served from RAM afterwards
+  app_history_init(); // Observation log on the "history" partition
+  app_city_init();    // Offline city list on the "cities" partition
   app_hal_init(); // Display, Button, PWM, LVGL tick/task
   app_ui_init();  // Create UI screens
 
@@ -13,6 +13,78 @@ typedef struct {
   bool is_valid;        // True if data was successfully fetched
 } weather_info_t;
 
+#define WEATHER_HOURLY_MAX 6
+#define WEATHER_DAILY_MAX 3
+#define WEATHER_WARNING_MAX 2
+
+typedef struct {
+  char time[6]; // "HH:MM" local forecast time
+  int temp;
+  int pop; // Probability of precipitation in %
+  char icon[8];
+} weather_hourly_t;
+
+typedef struct {
+  char date[11]; // "YYYY-MM-DD"
+  int temp_max;
+  int temp_min;
+  char icon_day[8];
+  char text_day[32];
+} weather_daily_t;
+
+typedef struct {
+  int aqi;
+  char category[16]; // e.g. "良"
+  bool is_valid;
+} weather_air_t;
+
+typedef struct {
+  char type[8];           // QWeather warning type code
+  char severity_color[8]; // "Blue" .. "Red"
+} weather_warning_t;
+
+// Coordinates of the configured location, for providers that only take
+// latitude and longitude
+typedef struct {
+  char location[32]; // config location these coordinates belong to
+  char lat[12];
+  char lon[12];
+  bool is_valid;
+} weather_place_t;
+
+#define WEATHER_CITY_MAX 7 // besides the primary location
+#define WEATHER_TEXT_LEN 24
+
+// Current conditions of one extra city. Its name stays in the config, its
+// description is an index into the text table the cities share.
+typedef struct {
+  int16_t temp;
+  int16_t feels_like;
+  uint16_t wind_speed;
+  uint8_t humidity;
+  uint8_t text;
+  char icon[4];
+  bool is_valid;
+} weather_city_t;
+
+// Everything the fetch engine knows, published as one consistent snapshot.
+// `version` increases each time a batch of endpoint jobs changes the model.
+typedef struct {
+  uint32_t version;
+  weather_info_t now;
+  weather_hourly_t hourly[WEATHER_HOURLY_MAX];
+  uint8_t hourly_count;
+  weather_daily_t daily[WEATHER_DAILY_MAX];
+  uint8_t daily_count;
+  weather_air_t air;
+  weather_warning_t warning[WEATHER_WARNING_MAX];
+  uint8_t warning_count;
+  weather_place_t place;
+  weather_city_t city[WEATHER_CITY_MAX]; // app_config_t.extra[i]
+  uint8_t city_count;
+  char texts[WEATHER_CITY_MAX][WEATHER_TEXT_LEN];
+} weather_model_t;
+
 typedef struct {
   int year, month, day;
   int hour, minute, second;
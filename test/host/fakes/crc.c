@@ -0,0 +1,18 @@
+#include "esp_rom_crc.h"
+#include <zlib.h>
+
+// The ROM's crc32_le is zlib's CRC-32
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+  return crc32(crc, buf, len);
+}
+
+// Reflected CRC-8, polynomial 0x07 as the ROM computes it
+uint8_t esp_rom_crc8_le(uint8_t crc, uint8_t const *buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? (crc >> 1) ^ 0xE0 : crc >> 1;
+  }
+  return ~crc;
+}
@@ -0,0 +1,8 @@
+#include "esp_err.h"
+#include <stdio.h>
+
+const char *esp_err_to_name(esp_err_t err) {
+  static char buf[16];
+  snprintf(buf, sizeof(buf), "0x%x", err);
+  return buf;
+}
@@ -0,0 +1,59 @@
+#include "esp_heap_caps.h"
+#include "host_test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Every block carries its size in front, caps are ignored
+typedef union {
+  size_t size;
+  max_align_t align;
+} block_t;
+
+static size_t s_used, s_peak, s_allocs;
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  (void)caps;
+  block_t *b = malloc(sizeof(block_t) + size);
+  if (!b)
+    return NULL;
+  b->size = size;
+  s_used += size;
+  s_allocs++;
+  if (s_used > s_peak)
+    s_peak = s_used;
+  return b + 1;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  void *p = heap_caps_malloc(n * size, caps);
+  if (p)
+    memset(p, 0, n * size);
+  return p;
+}
+
+void *heap_caps_malloc_prefer(size_t size, size_t num, ...) {
+  (void)num;
+  return heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+void *heap_caps_calloc_prefer(size_t n, size_t size, size_t num, ...) {
+  (void)num;
+  return heap_caps_calloc(n, size, MALLOC_CAP_DEFAULT);
+}
+
+void heap_caps_free(void *ptr) {
+  if (!ptr)
+    return;
+  block_t *b = (block_t *)ptr - 1;
+  s_used -= b->size;
+  free(b);
+}
+
+size_t host_heap_used(void) { return s_used; }
+size_t host_heap_peak(void) { return s_peak; }
+size_t host_heap_allocs(void) { return s_allocs; }
+void host_heap_reset_peak(void) { s_peak = s_used; }
+
+// Internal RAM as the modules see it, the tests do not model pressure
+size_t heap_caps_get_free_size(uint32_t caps) { return 200 * 1024; }
+size_t heap_caps_get_minimum_free_size(uint32_t caps) { return 150 * 1024; }
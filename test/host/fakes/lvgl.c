@@ -0,0 +1,387 @@
+#include "host_test.h"
+#include "lvgl.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Colors and letters as LVGL 8.3 computes them with the software renderer,
+// objects as plain structs. Invalidated areas are kept for the test.
+
+#define INVALID_MAX 32
+// The panel, for screens
+#define HOR_RES 135
+#define VER_RES 240
+
+static lv_area_t s_invalid[INVALID_MAX];
+static size_t s_invalid_count;
+static lv_obj_t *s_act_scr;
+
+lv_color_t lv_color_make(uint8_t r, uint8_t g, uint8_t b) {
+  lv_color_t c;
+  c.ch.red = r >> 3;
+  c.ch.green_h = g >> 5;
+  c.ch.green_l = (g >> 2) & 7;
+  c.ch.blue = b >> 3;
+  return c;
+}
+
+lv_color_t lv_color_hex(uint32_t c) {
+  return lv_color_make(c >> 16, c >> 8, c);
+}
+
+static uint16_t swap16(uint16_t v) { return (uint16_t)(v << 8 | v >> 8); }
+
+// lv_color_mix() for 16 bpp: 5 bit mix on all channels at once
+lv_color_t lv_color_mix(lv_color_t c1, lv_color_t c2, uint8_t mix) {
+  uint32_t m = ((uint32_t)mix + 4) >> 3;
+  uint32_t fg = swap16(c1.full), bg = swap16(c2.full);
+  bg = (bg | bg << 16) & 0x7E0F81F;
+  fg = (fg | fg << 16) & 0x7E0F81F;
+  uint32_t r = ((((fg - bg) * m) >> 5) + bg) & 0x7E0F81F;
+  lv_color_t ret;
+  ret.full = swap16((uint16_t)(r >> 16 | r));
+  return ret;
+}
+
+lv_color_t lv_color_white(void) { return lv_color_make(0xFF, 0xFF, 0xFF); }
+
+bool _lv_area_intersect(lv_area_t *res, const lv_area_t *a1,
+                        const lv_area_t *a2) {
+  res->x1 = LV_MAX(a1->x1, a2->x1);
+  res->y1 = LV_MAX(a1->y1, a2->y1);
+  res->x2 = LV_MIN(a1->x2, a2->x2);
+  res->y2 = LV_MIN(a1->y2, a2->y2);
+  return res->x1 <= res->x2 && res->y1 <= res->y2;
+}
+
+lv_coord_t lv_area_get_width(const lv_area_t *area) {
+  return (lv_coord_t)(area->x2 - area->x1 + 1);
+}
+
+lv_coord_t lv_area_get_height(const lv_area_t *area) {
+  return (lv_coord_t)(area->y2 - area->y1 + 1);
+}
+
+bool lv_font_get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *dsc,
+                           uint32_t letter, uint32_t letter_next) {
+  return font->get_glyph_dsc(font, dsc, letter, letter_next);
+}
+
+const uint8_t *lv_font_get_glyph_bitmap(const lv_font_t *font,
+                                        uint32_t letter) {
+  return font->get_glyph_bitmap(font, letter);
+}
+
+uint16_t lv_font_get_glyph_width(const lv_font_t *font, uint32_t letter,
+                                 uint32_t letter_next) {
+  lv_font_glyph_dsc_t g;
+  return lv_font_get_glyph_dsc(font, &g, letter, letter_next) ? g.adv_w : 0;
+}
+
+void lv_draw_label_dsc_init(lv_draw_label_dsc_t *dsc) {
+  memset(dsc, 0, sizeof(*dsc));
+  dsc->opa = LV_OPA_COVER;
+}
+
+// lv_draw_sw_letter(): the glyph's coverage, scaled by the opacity, mixed
+// into the buffer pixel by pixel
+void lv_draw_letter(lv_draw_ctx_t *draw_ctx, const lv_draw_label_dsc_t *dsc,
+                    const lv_point_t *pos_p, uint32_t letter) {
+  const lv_font_t *font = dsc->font;
+  lv_font_glyph_dsc_t g;
+  if (dsc->opa <= LV_OPA_MIN || !lv_font_get_glyph_dsc(font, &g, letter, 0))
+    return;
+  const uint8_t *bmp = lv_font_get_glyph_bitmap(font, letter);
+  if (!bmp)
+    return;
+  lv_coord_t gx = pos_p->x + g.ofs_x;
+  lv_coord_t gy = pos_p->y + (font->line_height - font->base_line) -
+                  g.box_h - g.ofs_y;
+  lv_area_t area = {gx, gy, gx + g.box_w - 1, gy + g.box_h - 1};
+  lv_area_t clip;
+  if (!_lv_area_intersect(&clip, &area, draw_ctx->clip_area) ||
+      !_lv_area_intersect(&clip, &clip, draw_ctx->buf_area))
+    return;
+
+  lv_color_t *buf = draw_ctx->buf;
+  lv_coord_t buf_w = lv_area_get_width(draw_ctx->buf_area);
+  uint32_t mask = (1u << g.bpp) - 1;
+  for (lv_coord_t y = clip.y1; y <= clip.y2; y++) {
+    for (lv_coord_t x = clip.x1; x <= clip.x2; x++) {
+      uint32_t bit = (uint32_t)((y - gy) * g.box_w + (x - gx)) * g.bpp;
+      uint32_t v = (bmp[bit >> 3] >> (8 - g.bpp - (bit & 7))) & mask;
+      lv_opa_t a = (lv_opa_t)(v * 255 / mask);
+      if (dsc->opa < LV_OPA_MAX)
+        a = (lv_opa_t)((a * dsc->opa) >> 8);
+      if (a <= LV_OPA_MIN)
+        continue;
+      lv_color_t *d = &buf[(y - draw_ctx->buf_area->y1) * buf_w +
+                           (x - draw_ctx->buf_area->x1)];
+      *d = a >= LV_OPA_MAX ? dsc->color : lv_color_mix(dsc->color, *d, a);
+    }
+  }
+}
+
+void lv_style_init(lv_style_t *style) { memset(style, 0, sizeof(*style)); }
+
+void lv_style_set_text_font(lv_style_t *style, const lv_font_t *value) {
+  style->text_font = value;
+}
+
+void lv_style_set_text_color(lv_style_t *style, lv_color_t value) {
+  style->text_color = value;
+}
+
+void lv_style_set_bg_color(lv_style_t *style, lv_color_t value) {
+  style->bg_color = value;
+}
+
+void lv_style_set_bg_opa(lv_style_t *style, lv_opa_t value) {
+  style->bg_opa = value;
+}
+
+lv_obj_t *lv_obj_create(lv_obj_t *parent) {
+  lv_obj_t *obj = calloc(1, sizeof(lv_obj_t));
+  CHECK(obj);
+  obj->parent = parent;
+  obj->opa = LV_OPA_COVER;
+  if (!parent) {
+    obj->coords = (lv_area_t){0, 0, HOR_RES - 1, VER_RES - 1};
+    if (!s_act_scr)
+      s_act_scr = obj;
+  }
+  return obj;
+}
+
+void lv_obj_del(lv_obj_t *obj) { free(obj); }
+
+void lv_obj_remove_style_all(lv_obj_t *obj) { obj->opa = LV_OPA_COVER; }
+
+void lv_obj_clear_flag(lv_obj_t *obj, uint32_t f) { obj->flags &= ~f; }
+
+// Where lv_obj_align() puts an object of its size in the parent
+static void realign(lv_obj_t *obj) {
+  if (obj->align == LV_ALIGN_DEFAULT || !obj->parent)
+    return;
+  const lv_area_t *p = &obj->parent->coords;
+  lv_coord_t w = lv_area_get_width(&obj->coords);
+  lv_coord_t h = lv_area_get_height(&obj->coords);
+  lv_coord_t x = p->x1, y = p->y1;
+  if (obj->align == LV_ALIGN_TOP_MID || obj->align == LV_ALIGN_BOTTOM_MID ||
+      obj->align == LV_ALIGN_CENTER)
+    x += (lv_area_get_width(p) - w) / 2;
+  else if (obj->align == LV_ALIGN_TOP_RIGHT)
+    x = p->x2 + 1 - w;
+  if (obj->align == LV_ALIGN_BOTTOM_MID)
+    y = p->y2 + 1 - h;
+  else if (obj->align == LV_ALIGN_CENTER)
+    y += (lv_area_get_height(p) - h) / 2;
+  x += obj->align_x;
+  y += obj->align_y;
+  obj->coords = (lv_area_t){x, y, x + w - 1, y + h - 1};
+}
+
+// Size changes and moves redraw the old and the new area
+static void resize(lv_obj_t *obj, lv_coord_t w, lv_coord_t h) {
+  if (w == LV_SIZE_CONTENT)
+    w = 0;
+  if (h == LV_SIZE_CONTENT)
+    h = 0;
+  lv_area_t old = obj->coords;
+  obj->coords.x2 = obj->coords.x1 + w - 1;
+  obj->coords.y2 = obj->coords.y1 + h - 1;
+  realign(obj);
+  if (memcmp(&old, &obj->coords, sizeof(old)) == 0)
+    return;
+  lv_obj_invalidate_area(obj->parent ? obj->parent : obj, &old);
+  lv_obj_invalidate(obj);
+}
+
+void lv_obj_set_size(lv_obj_t *obj, lv_coord_t w, lv_coord_t h) {
+  resize(obj, w, h);
+}
+
+// Keeps the alignment, or else the left edge
+void lv_obj_set_width(lv_obj_t *obj, lv_coord_t w) {
+  resize(obj, w, lv_area_get_height(&obj->coords));
+}
+
+void lv_obj_align(lv_obj_t *obj, lv_align_t align, lv_coord_t x_ofs,
+                  lv_coord_t y_ofs) {
+  obj->align = align;
+  obj->align_x = x_ofs;
+  obj->align_y = y_ofs;
+  resize(obj, lv_area_get_width(&obj->coords),
+         lv_area_get_height(&obj->coords));
+}
+
+// Once, as LVGL: the object stays there when `base` moves, and keeps its
+// left edge when it grows
+void lv_obj_align_to(lv_obj_t *obj, const lv_obj_t *base, lv_align_t align,
+                     lv_coord_t x_ofs, lv_coord_t y_ofs) {
+  CHECK(align == LV_ALIGN_OUT_BOTTOM_MID);
+  lv_coord_t w = lv_area_get_width(&obj->coords);
+  lv_coord_t h = lv_area_get_height(&obj->coords);
+  lv_coord_t x = base->coords.x1 +
+                 (lv_area_get_width(&base->coords) - w) / 2 + x_ofs;
+  lv_coord_t y = base->coords.y2 + 1 + y_ofs;
+  lv_area_t old = obj->coords;
+  obj->align = LV_ALIGN_DEFAULT;
+  obj->coords = (lv_area_t){x, y, x + w - 1, y + h - 1};
+  lv_obj_invalidate_area(obj->parent, &old);
+  lv_obj_invalidate(obj);
+}
+
+void lv_obj_set_style_opa(lv_obj_t *obj, lv_opa_t value, uint32_t selector) {
+  obj->opa = value;
+}
+
+// The object's and its parents' opacity multiplied, as a layer would
+lv_opa_t lv_obj_get_style_opa_recursive(const lv_obj_t *obj, lv_part_t part) {
+  lv_opa_t opa = LV_OPA_COVER;
+  for (; obj; obj = obj->parent) {
+    if (obj->opa <= LV_OPA_MIN)
+      return LV_OPA_TRANSP;
+    if (obj->opa < LV_OPA_MAX)
+      opa = (lv_opa_t)((opa * obj->opa) >> 8);
+  }
+  return opa;
+}
+
+// Visible parts only: on the active screen, not hidden, within the
+// parents
+void lv_obj_invalidate_area(const lv_obj_t *obj, const lv_area_t *area) {
+  lv_area_t a = *area;
+  const lv_obj_t *o = obj;
+  for (; o; o = o->parent) {
+    if ((o->flags & LV_OBJ_FLAG_HIDDEN) ||
+        !_lv_area_intersect(&a, &a, &o->coords))
+      return;
+    if (!o->parent && o != s_act_scr)
+      return;
+  }
+  // Already covered, LVGL joins areas the same way
+  for (size_t i = 0; i < s_invalid_count; i++) {
+    const lv_area_t *b = &s_invalid[i];
+    if (a.x1 >= b->x1 && a.y1 >= b->y1 && a.x2 <= b->x2 && a.y2 <= b->y2)
+      return;
+  }
+  if (s_invalid_count < INVALID_MAX)
+    s_invalid[s_invalid_count++] = a;
+}
+
+void lv_obj_invalidate(const lv_obj_t *obj) {
+  lv_obj_invalidate_area(obj, &obj->coords);
+}
+
+void *lv_obj_add_event_cb(lv_obj_t *obj, lv_event_cb_t event_cb,
+                          lv_event_code_t filter, void *user_data) {
+  for (int i = 0; i < HOST_LV_EVENT_CBS; i++) {
+    if (!obj->event_cb[i]) {
+      obj->event_cb[i] = event_cb;
+      obj->event_filter[i] = filter;
+      return &obj->event_cb[i];
+    }
+  }
+  return NULL;
+}
+
+lv_res_t lv_event_send(lv_obj_t *obj, lv_event_code_t event_code,
+                       void *param) {
+  lv_event_t e = {obj, event_code, param};
+  for (int i = 0; i < HOST_LV_EVENT_CBS; i++) {
+    if (obj->event_cb[i] && obj->event_filter[i] == event_code)
+      obj->event_cb[i](&e);
+  }
+  return LV_RES_OK;
+}
+
+lv_obj_t *lv_event_get_target(lv_event_t *e) { return e->target; }
+
+lv_draw_ctx_t *lv_event_get_draw_ctx(lv_event_t *e) { return e->param; }
+
+void lv_obj_add_flag(lv_obj_t *obj, uint32_t f) {
+  lv_obj_invalidate(obj);
+  obj->flags |= f;
+}
+
+void lv_obj_set_flex_flow(lv_obj_t *obj, uint32_t flow) {}
+void lv_obj_set_flex_align(lv_obj_t *obj, uint32_t main_place,
+                           uint32_t cross_place, uint32_t track_place) {}
+void lv_obj_set_style_pad_row(lv_obj_t *obj, lv_coord_t value,
+                              uint32_t selector) {}
+void lv_obj_set_style_pad_column(lv_obj_t *obj, lv_coord_t value,
+                                 uint32_t selector) {}
+void lv_obj_set_style_text_align(lv_obj_t *obj, uint32_t value,
+                                 uint32_t selector) {}
+void lv_label_set_long_mode(lv_obj_t *obj, uint32_t long_mode) {}
+
+// A label's size: the widest line and the lines' height
+static void label_refresh(lv_obj_t *obj) {
+  lv_coord_t w = 0, line_w = 0, lines = 1;
+  for (const uint8_t *c = (const uint8_t *)obj->text; *c;) {
+    uint32_t letter = *c++;
+    if (letter == '\n') {
+      lines++;
+      line_w = 0;
+      continue;
+    }
+    // UTF-8 lead byte and continuation bytes
+    int more = letter >= 0xF0 ? 3 : letter >= 0xE0 ? 2 : letter >= 0xC0;
+    letter &= more ? 0x3F >> more : 0x7F;
+    for (; more && (*c & 0xC0) == 0x80; more--)
+      letter = letter << 6 | (*c++ & 0x3F);
+    if (obj->font)
+      line_w += lv_font_get_glyph_width(obj->font, letter, 0);
+    w = LV_MAX(w, line_w);
+  }
+  resize(obj, w, obj->font ? obj->font->line_height * lines : 0);
+}
+
+void lv_obj_add_style(lv_obj_t *obj, const lv_style_t *style,
+                      uint32_t selector) {
+  if (style->text_font)
+    obj->font = style->text_font;
+  if (obj->is_label)
+    label_refresh(obj);
+}
+
+lv_obj_t *lv_label_create(lv_obj_t *parent) {
+  lv_obj_t *obj = lv_obj_create(parent);
+  obj->is_label = true;
+  lv_label_set_text(obj, "Text");
+  return obj;
+}
+
+void lv_label_set_text(lv_obj_t *obj, const char *text) {
+  CHECK(strlen(text) < sizeof(obj->text));
+  strcpy(obj->text, text);
+  label_refresh(obj);
+  lv_obj_invalidate(obj);
+}
+
+lv_obj_t *lv_scr_act(void) { return s_act_scr; }
+
+void lv_scr_load(lv_obj_t *scr) {
+  s_act_scr = scr;
+  lv_obj_invalidate(scr);
+}
+
+void lv_scr_load_anim(lv_obj_t *scr, uint32_t anim_type, uint32_t time,
+                      uint32_t delay, bool auto_del) {
+  lv_scr_load(scr);
+}
+
+lv_timer_t *lv_timer_create(lv_timer_cb_t timer_xcb, uint32_t period,
+                            void *user_data) {
+  lv_timer_t *t = calloc(1, sizeof(lv_timer_t));
+  CHECK(t);
+  *t = (lv_timer_t){timer_xcb, period, user_data};
+  return t;
+}
+
+size_t host_lv_take_invalidated(lv_area_t *areas, size_t max) {
+  size_t n = LV_MIN(s_invalid_count, max);
+  memcpy(areas, s_invalid, n * sizeof(lv_area_t));
+  s_invalid_count = 0;
+  return n;
+}
@@ -0,0 +1,460 @@
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "host_test.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <string.h>
+
+// NVS on the "nvs" partition, laid out the way the real library does it so
+// wear and power cuts behave alike:
+//
+// - 4 KB pages, a header in slot 0, then 32 byte entries. A blob is a
+//   header entry followed by its data, rounded up to whole entries.
+// - Writes only append to the active page, the newest one. Replacing a key
+//   appends the new entry first, then clears bits in the old one's state.
+// - One page is always kept free. When the others are full, the full page
+//   with the most superseded entries has its live entries copied to the
+//   free page and is erased.
+// - Mounting (nvs_flash_init) rebuilds the index from flash: the newest
+//   copy of a key wins, torn entries fail their CRC and are skipped, pages
+//   with a torn header are erased.
+//
+// Namespaces are a CRC8 of the name in each entry rather than entries of
+// their own, and blobs are not split across pages.
+
+#define PAGE 4096
+#define ENTRY 32
+#define SLOTS (PAGE / ENTRY) // slot 0 is the page header
+#define MAX_PAGES 32
+#define MAX_ITEMS 64
+#define PAGE_MAGIC 0x4653564E // "NVSF"
+
+enum {
+  STATE_ACTIVE = 0xFE, // page header
+  STATE_FULL = 0xFC,
+  ENTRY_WRITTEN = 0xFE,
+  ENTRY_ERASED = 0xFC,
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t crc; // over magic and seq
+  uint8_t state;
+  uint8_t reserved[19];
+} page_header_t;
+
+typedef struct {
+  uint8_t state;
+  uint8_t ns; // CRC8 of the namespace name
+  uint8_t span; // entries, this one included
+  uint8_t reserved;
+  uint32_t len;
+  uint32_t data_crc;
+  uint32_t crc; // over the entry with state and crc erased
+  char key[NVS_KEY_NAME_MAX_SIZE];
+} entry_t;
+
+_Static_assert(sizeof(page_header_t) == ENTRY, "header fills slot 0");
+_Static_assert(sizeof(entry_t) == ENTRY, "entry header is one slot");
+
+typedef enum { PAGE_FREE, PAGE_ACTIVE, PAGE_FULL } page_state_t;
+
+typedef struct {
+  page_state_t state;
+  uint32_t seq;
+  uint16_t used;   // next free slot
+  uint16_t erased; // slots of superseded or torn entries
+} page_t;
+
+typedef struct {
+  uint8_t ns;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  uint16_t page;
+  uint16_t slot;
+  uint8_t span;
+  uint32_t len;
+} item_t;
+
+static const esp_partition_t *s_part;
+static uint32_t s_page_count;
+static page_t s_pages[MAX_PAGES];
+static item_t s_items[MAX_ITEMS];
+static int s_item_count;
+static int s_active = -1;
+static uint32_t s_next_seq;
+static host_nvs_stats_t s_stats;
+
+static size_t addr(uint32_t page, uint32_t slot) {
+  return (size_t)page * PAGE + (size_t)slot * ENTRY;
+}
+
+static uint32_t header_crc(const page_header_t *h) {
+  return esp_rom_crc32_le(0, (const uint8_t *)h, offsetof(page_header_t, crc));
+}
+
+static uint32_t entry_crc(const entry_t *e) {
+  entry_t copy = *e;
+  copy.state = 0xFF;
+  copy.crc = 0xFFFFFFFF;
+  return esp_rom_crc32_le(0, (const uint8_t *)&copy, sizeof(copy));
+}
+
+static uint8_t ns_hash(const char *name) {
+  return esp_rom_crc8_le(0, (const uint8_t *)name, strlen(name));
+}
+
+static item_t *find(uint8_t ns, const char *key) {
+  for (int i = 0; i < s_item_count; i++) {
+    if (s_items[i].ns == ns && strcmp(s_items[i].key, key) == 0)
+      return &s_items[i];
+  }
+  return NULL;
+}
+
+static void forget(item_t *it) { *it = s_items[--s_item_count]; }
+
+// Clears bits in the entry's state, the only in-place write NVS makes
+static esp_err_t mark_erased(const item_t *it) {
+  uint8_t state = ENTRY_ERASED;
+  s_pages[it->page].erased += it->span;
+  return esp_partition_write(s_part, addr(it->page, it->slot), &state, 1);
+}
+
+static esp_err_t open_page(uint32_t page) {
+  page_header_t h;
+  memset(&h, 0xFF, sizeof(h));
+  h.magic = PAGE_MAGIC;
+  h.seq = s_next_seq++;
+  h.crc = header_crc(&h);
+  h.state = STATE_ACTIVE;
+  s_pages[page] = (page_t){PAGE_ACTIVE, h.seq, 1, 0};
+  s_active = page;
+  return esp_partition_write(s_part, addr(page, 0), &h, sizeof(h));
+}
+
+static esp_err_t write_entry(const entry_t *e, const void *data) {
+  uint8_t buf[PAGE];
+  size_t size = (size_t)e->span * ENTRY;
+  memset(buf, 0xFF, size);
+  memcpy(buf, e, sizeof(*e));
+  memcpy(buf + ENTRY, data, e->len);
+  page_t *p = &s_pages[s_active];
+  size_t at = addr(s_active, p->used);
+  // A failed write may have left bits behind, the slots are not reused
+  p->used += e->span;
+  return esp_partition_write(s_part, at, buf, size);
+}
+
+static int free_pages(void) {
+  int n = 0;
+  for (uint32_t i = 0; i < s_page_count; i++)
+    n += s_pages[i].state == PAGE_FREE;
+  return n;
+}
+
+// Compacts the full page with the most superseded entries into the spare
+// page, which becomes the active one
+static esp_err_t collect_garbage(void) {
+  int victim = -1, spare = -1;
+  for (uint32_t i = 0; i < s_page_count; i++) {
+    const page_t *p = &s_pages[i];
+    if (p->state == PAGE_FREE && spare < 0)
+      spare = i;
+    if (p->state == PAGE_FULL && p->erased > 0 &&
+        (victim < 0 || p->erased > s_pages[victim].erased ||
+         (p->erased == s_pages[victim].erased &&
+          p->seq < s_pages[victim].seq)))
+      victim = i;
+  }
+  if (victim < 0 || spare < 0)
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  s_stats.collecting = true;
+  esp_err_t err = open_page(spare);
+  for (int i = 0; err == ESP_OK && i < s_item_count; i++) {
+    item_t *it = &s_items[i];
+    if (it->page != victim)
+      continue;
+    uint8_t buf[PAGE];
+    err = esp_partition_read(s_part, addr(it->page, it->slot), buf,
+                             (size_t)it->span * ENTRY);
+    if (err != ESP_OK)
+      break;
+    uint16_t slot = s_pages[spare].used;
+    err = write_entry((const entry_t *)buf, buf + ENTRY);
+    it->page = spare;
+    it->slot = slot;
+  }
+  if (err == ESP_OK)
+    err = esp_partition_erase_range(s_part, addr(victim, 0), PAGE);
+  if (err == ESP_OK) {
+    s_pages[victim] = (page_t){PAGE_FREE, 0, 0, 0};
+    s_stats.gc_pages++;
+    s_stats.collecting = false;
+  }
+  return err;
+}
+
+// Makes room for `span` entries on the active page
+static esp_err_t reserve(uint8_t span) {
+  for (uint32_t tries = 0; tries <= s_page_count; tries++) {
+    page_t *p = &s_pages[s_active];
+    if (p->used + span <= SLOTS)
+      return ESP_OK;
+    uint8_t state = STATE_FULL;
+    p->state = PAGE_FULL;
+    esp_err_t err = esp_partition_write(
+        s_part, addr(s_active, 0) + offsetof(page_header_t, state), &state, 1);
+    if (err != ESP_OK)
+      return err;
+    if (free_pages() > 1) {
+      // Next free page in ring order, so pages take turns
+      uint32_t next = s_active;
+      do
+        next = (next + 1) % s_page_count;
+      while (s_pages[next].state != PAGE_FREE);
+      err = open_page(next);
+    } else {
+      err = collect_garbage();
+    }
+    if (err != ESP_OK)
+      return err;
+  }
+  return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+static bool is_erased(const uint8_t *p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != 0xFF)
+      return false;
+  }
+  return true;
+}
+
+// Indexes one page's entries. Pages come in sequence order, so a key seen
+// again is a newer copy and the older one is marked superseded.
+static esp_err_t scan_page(uint32_t page, const uint8_t *mem) {
+  page_t *p = &s_pages[page];
+  uint32_t slot = 1;
+  while (slot < SLOTS && !is_erased(mem + slot * ENTRY, ENTRY)) {
+    const entry_t *e = (const entry_t *)(mem + slot * ENTRY);
+    bool whole = e->crc == entry_crc(e) && e->span >= 1 &&
+                 slot + e->span <= SLOTS &&
+                 e->len <= (uint32_t)(e->span - 1) * ENTRY;
+    if (!whole) {
+      p->erased++; // torn header, the span cannot be trusted
+      slot++;
+      continue;
+    }
+    bool live = e->state == ENTRY_WRITTEN &&
+                e->data_crc ==
+                    esp_rom_crc32_le(0, mem + (slot + 1) * ENTRY, e->len);
+    if (live) {
+      item_t *old = find(e->ns, e->key);
+      if (old) {
+        esp_err_t err = mark_erased(old);
+        if (err != ESP_OK)
+          return err;
+        forget(old);
+      }
+      CHECK(s_item_count < MAX_ITEMS);
+      item_t *it = &s_items[s_item_count++];
+      it->ns = e->ns;
+      memcpy(it->key, e->key, sizeof(it->key));
+      it->page = page;
+      it->slot = slot;
+      it->span = e->span;
+      it->len = e->len;
+    } else {
+      p->erased += e->span;
+    }
+    slot += e->span;
+  }
+  p->used = slot;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void) {
+  s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                    ESP_PARTITION_SUBTYPE_ANY, "nvs");
+  if (!s_part)
+    return ESP_ERR_NOT_FOUND;
+  s_page_count = s_part->size / PAGE;
+  CHECK(s_page_count >= 2 && s_page_count <= MAX_PAGES);
+  s_item_count = 0;
+  s_active = -1;
+  s_next_seq = 1;
+  s_stats.collecting = false;
+
+  static uint8_t mem[MAX_PAGES][PAGE];
+  uint32_t order[MAX_PAGES];
+  uint32_t valid = 0;
+  for (uint32_t i = 0; i < s_page_count; i++) {
+    esp_err_t err = esp_partition_read(s_part, addr(i, 0), mem[i], PAGE);
+    if (err != ESP_OK)
+      return err;
+    const page_header_t *h = (const page_header_t *)mem[i];
+    s_pages[i] = (page_t){PAGE_FREE, 0, 0, 0};
+    if (h->magic == PAGE_MAGIC && h->crc == header_crc(h)) {
+      s_pages[i].state = h->state == STATE_ACTIVE ? PAGE_ACTIVE : PAGE_FULL;
+      s_pages[i].seq = h->seq;
+      if (h->seq >= s_next_seq)
+        s_next_seq = h->seq + 1;
+      // Insertion sort by sequence number, there are a handful of pages
+      uint32_t k = valid++;
+      while (k > 0 && s_pages[order[k - 1]].seq > h->seq) {
+        order[k] = order[k - 1];
+        k--;
+      }
+      order[k] = i;
+    } else if (!is_erased(mem[i], PAGE)) {
+      // Cut off while being erased or opened
+      err = esp_partition_erase_range(s_part, addr(i, 0), PAGE);
+      if (err != ESP_OK)
+        return err;
+    }
+  }
+  for (uint32_t k = 0; k < valid; k++) {
+    esp_err_t err = scan_page(order[k], mem[order[k]]);
+    if (err != ESP_OK)
+      return err;
+  }
+  // Appends continue on the newest page, a full one makes reserve() move on
+  if (valid > 0) {
+    s_active = order[valid - 1];
+    return ESP_OK;
+  }
+  return open_page(0);
+}
+
+esp_err_t nvs_flash_erase(void) {
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "nvs");
+  if (!part)
+    return ESP_ERR_NOT_FOUND;
+  s_part = NULL;
+  return esp_partition_erase_range(part, 0, part->size);
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *out_handle) {
+  if (!s_part)
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+  if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE)
+    return ESP_ERR_NVS_INVALID_NAME;
+  // Namespace hash and the mode, never 0
+  *out_handle = 0x10000 | (mode == NVS_READWRITE) << 8 | ns_hash(name);
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key,
+                       const void *value, size_t length) {
+  if (!s_part || !(handle & 0x10000))
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  if (!(handle & 0x100))
+    return ESP_ERR_NVS_READ_ONLY;
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    return ESP_ERR_NVS_KEY_TOO_LONG;
+  size_t span = 1 + (length + ENTRY - 1) / ENTRY;
+  if (span >= SLOTS)
+    return ESP_ERR_NVS_VALUE_TOO_LONG;
+  uint8_t ns = handle & 0xFF;
+  item_t *old = find(ns, key);
+  if (!old && s_item_count == MAX_ITEMS)
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+
+  esp_err_t err = reserve(span);
+  if (err != ESP_OK)
+    return err;
+  entry_t e;
+  memset(&e, 0xFF, sizeof(e));
+  e.state = ENTRY_WRITTEN;
+  e.ns = ns;
+  e.span = span;
+  e.len = length;
+  e.data_crc = esp_rom_crc32_le(0, value, length);
+  memset(e.key, 0, sizeof(e.key));
+  strcpy(e.key, key);
+  e.crc = entry_crc(&e);
+  uint16_t page = s_active, slot = s_pages[s_active].used;
+  err = write_entry(&e, value);
+  if (err != ESP_OK)
+    return err;
+  s_stats.sets++;
+
+  // GC may have moved the old copy, look it up again
+  old = find(ns, key);
+  if (old) {
+    err = mark_erased(old);
+    forget(old);
+  }
+  item_t *it = &s_items[s_item_count++];
+  it->ns = ns;
+  memcpy(it->key, e.key, sizeof(it->key));
+  it->page = page;
+  it->slot = slot;
+  it->span = span;
+  it->len = length;
+  return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+  if (!s_part || !(handle & 0x10000))
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  const item_t *it = find(handle & 0xFF, key);
+  if (!it)
+    return ESP_ERR_NVS_NOT_FOUND;
+  if (!out_value) {
+    *length = it->len;
+    return ESP_OK;
+  }
+  if (*length < it->len)
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  *length = it->len;
+  return esp_partition_read(s_part, addr(it->page, it->slot + 1), out_value,
+                            it->len);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  if (!s_part || !(handle & 0x10000))
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  item_t *it = find(handle & 0xFF, key);
+  if (!it)
+    return ESP_ERR_NVS_NOT_FOUND;
+  esp_err_t err = mark_erased(it);
+  forget(it);
+  return err;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+  if (!s_part || !(handle & 0x10000))
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  esp_err_t err = ESP_OK;
+  for (int i = s_item_count - 1; i >= 0 && err == ESP_OK; i--) {
+    if (s_items[i].ns == (handle & 0xFF)) {
+      err = mark_erased(&s_items[i]);
+      forget(&s_items[i]);
+    }
+  }
+  return err;
+}
+
+// Entries are on flash once nvs_set_blob returns, as with the real library
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+void nvs_close(nvs_handle_t handle) {}
+
+void host_nvs_stats(host_nvs_stats_t *stats) {
+  *stats = s_stats;
+  stats->live_entries = 0;
+  for (int i = 0; i < s_item_count; i++)
+    stats->live_entries += s_items[i].span;
+  stats->free_entries = 0;
+  for (uint32_t i = 0; i < s_page_count; i++) {
+    if (s_pages[i].state == PAGE_FREE)
+      stats->free_entries += SLOTS - 1;
+    else if ((int)i == s_active)
+      stats->free_entries += SLOTS - s_pages[i].used;
+  }
+}
@@ -0,0 +1,231 @@
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// NOR flash in a file mapped into memory: erase sets a whole 4 KB sector to
+// 0xFF, a write can only clear bits, like the real chip. The file outlives
+// app restarts within a test, a test "reboots" by calling the module's init
+// again.
+//
+// Every program and erase advances the fake clock by the time the chip
+// would be busy, typical SPI NOR datasheet figures, and can be the one a
+// power cut tears.
+
+#define SECTOR 4096
+#define PAGE 256
+#define MAX_PARTS 4
+#define WRITE_BASE_US 30
+#define WRITE_NS_PER_BYTE 2300 // ~0.6 ms per 256 byte page
+#define ERASE_US 45000
+#define READ_NS_PER_BYTE 50
+
+typedef struct {
+  esp_partition_t part;
+  uint8_t *mem;
+  uint32_t *sector_erases;
+  int64_t busy_ns;
+  host_flash_stats_t stats;
+} host_part_t;
+
+static host_part_t s_parts[MAX_PARTS];
+static size_t s_count;
+static uint32_t s_ops;    // programs and erases, all partitions
+static uint32_t s_cut_at; // op number that loses power, 0: none
+static bool s_off;        // power is gone until host_flash_power_on()
+static uint32_t s_rng = 2463534242u;
+
+static uint32_t next_rand(void) {
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return s_rng;
+}
+
+static host_part_t *find(const char *label) {
+  for (size_t i = 0; i < s_count; i++) {
+    if (strcmp(s_parts[i].part.label, label) == 0)
+      return &s_parts[i];
+  }
+  return NULL;
+}
+
+static host_part_t *of(const esp_partition_t *part) {
+  return (host_part_t *)((char *)part - offsetof(host_part_t, part));
+}
+
+static bool in_range(const esp_partition_t *part, size_t offset,
+                     size_t size) {
+  return offset <= part->size && size <= part->size - offset;
+}
+
+static void busy(host_part_t *p, int64_t ns) {
+  p->busy_ns += ns;
+  host_time_set_us(esp_timer_get_time() + ns / 1000);
+}
+
+// Counts a program or erase. False when power is already gone or this is
+// the op that loses it, in which case `torn` is set.
+static bool power_op(bool *torn) {
+  *torn = false;
+  if (s_off)
+    return false;
+  s_ops++;
+  if (s_cut_at && s_ops == s_cut_at) {
+    s_off = true;
+    *torn = true;
+    return false;
+  }
+  return true;
+}
+
+const esp_partition_t *host_partition_add(const char *label, size_t size) {
+  CHECK(size % SECTOR == 0);
+  host_part_t *p = find(label);
+  if (p && p->part.size != size) {
+    // Same label, another size: a new file in the same place
+    munmap(p->mem, p->part.size);
+    free(p->sector_erases);
+  } else if (!p) {
+    CHECK(s_count < MAX_PARTS);
+    p = &s_parts[s_count++];
+    p->part.address = 0x400000 + (s_count - 1) * 0x100000;
+  }
+  if (p->part.size != size) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s.bin", label);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0 && ftruncate(fd, size) == 0);
+    p->mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK(p->mem != MAP_FAILED);
+    close(fd);
+    p->sector_erases = calloc(size / SECTOR, sizeof(uint32_t));
+    CHECK(p->sector_erases);
+    p->part.type = ESP_PARTITION_TYPE_DATA;
+    p->part.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    p->part.size = size;
+    p->part.erase_size = SECTOR;
+    snprintf(p->part.label, sizeof(p->part.label), "%s", label);
+  }
+  // A new chip: erased, counters at zero
+  memset(p->mem, 0xFF, size);
+  memset(p->sector_erases, 0, size / SECTOR * sizeof(uint32_t));
+  memset(&p->stats, 0, sizeof(p->stats));
+  p->busy_ns = 0;
+  return &p->part;
+}
+
+uint8_t *host_partition_data(const char *label) {
+  host_part_t *p = find(label);
+  CHECK(p);
+  return p->mem;
+}
+
+void host_partition_stats(const char *label, host_flash_stats_t *stats) {
+  host_part_t *p = find(label);
+  CHECK(p);
+  *stats = p->stats;
+  stats->busy_us = p->busy_ns / 1000;
+  uint32_t sectors = p->part.size / SECTOR;
+  uint64_t sum = 0;
+  stats->max_sector_erases = 0;
+  for (uint32_t i = 0; i < sectors; i++) {
+    sum += p->sector_erases[i];
+    if (p->sector_erases[i] > stats->max_sector_erases)
+      stats->max_sector_erases = p->sector_erases[i];
+  }
+  stats->mean_sector_erases = (double)sum / sectors;
+}
+
+uint32_t host_flash_ops(void) { return s_ops; }
+
+void host_flash_cut_at(uint32_t op) { s_cut_at = op; }
+
+bool host_flash_powered(void) { return !s_off; }
+
+void host_flash_power_on(void) {
+  s_off = false;
+  s_cut_at = 0;
+}
+
+void host_flash_seed(uint32_t seed) { s_rng = seed ? seed : 1; }
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t sub,
+                                                const char *label) {
+  host_part_t *p = label ? find(label) : NULL;
+  return p && p->part.type == type ? &p->part : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                             void *dst, size_t size) {
+  if (!in_range(part, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  host_part_t *p = of(part);
+  memcpy(dst, p->mem + offset, size);
+  p->stats.reads++;
+  p->stats.read_bytes += size;
+  busy(p, (int64_t)size * READ_NS_PER_BYTE);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset,
+                              const void *src, size_t size) {
+  if (!in_range(part, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  host_part_t *p = of(part);
+  bool torn;
+  bool on = power_op(&torn);
+  // Bytes go out in order, a cut leaves a prefix programmed
+  size_t n = on ? size : torn && size ? next_rand() % size : 0;
+  const uint8_t *in = src;
+  for (size_t i = 0; i < n; i++)
+    p->mem[offset + i] &= in[i];
+  if (!on)
+    return ESP_FAIL;
+  p->stats.writes++;
+  p->stats.written_bytes += size;
+  busy(p, WRITE_BASE_US * 1000 + (int64_t)size * WRITE_NS_PER_BYTE);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part,
+                                    size_t offset, size_t size) {
+  if (offset % SECTOR || size % SECTOR)
+    return ESP_ERR_INVALID_ARG;
+  if (!in_range(part, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  host_part_t *p = of(part);
+  for (size_t at = offset; at < offset + size; at += SECTOR) {
+    bool torn;
+    if (!power_op(&torn)) {
+      // A cut erase leaves some pages of the sector erased, in no order
+      for (size_t pg = 0; torn && pg < SECTOR; pg += PAGE) {
+        if (next_rand() & 1)
+          memset(p->mem + at + pg, 0xFF, PAGE);
+      }
+      return ESP_FAIL;
+    }
+    memset(p->mem + at, 0xFF, SECTOR);
+    p->sector_erases[at / SECTOR]++;
+    p->stats.erases++;
+    busy(p, (int64_t)ERASE_US * 1000);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *part, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+  if (!in_range(part, offset, size))
+    return ESP_ERR_INVALID_ARG;
+  *out_ptr = of(part)->mem + offset;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {}
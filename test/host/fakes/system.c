@@ -0,0 +1,50 @@
+#include "esp_system.h"
+#include "host_test.h"
+#include <string.h>
+
+// Bounds of the RTC_NOINIT_ATTR section, set by the linker when a test has
+// one
+extern uint8_t __start_rtc_noinit[] __attribute__((weak));
+extern uint8_t __stop_rtc_noinit[] __attribute__((weak));
+
+#define MAX_HANDLERS 8
+
+static shutdown_handler_t s_handlers[MAX_HANDLERS];
+static int s_handler_count;
+static uint32_t s_rng = 88172645u;
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) {
+  if (s_handler_count == MAX_HANDLERS)
+    return ESP_ERR_NO_MEM;
+  s_handlers[s_handler_count++] = handler;
+  return ESP_OK;
+}
+
+void esp_restart(void) {
+  for (int i = 0; i < s_handler_count; i++)
+    s_handlers[i]();
+}
+
+void host_soft_reset(void) {
+  esp_restart();
+  // The modules register again from their init
+  s_handler_count = 0;
+  host_time_set_us(0);
+}
+
+void host_panic_reset(void) {
+  s_handler_count = 0;
+  host_time_set_us(0);
+}
+
+void host_power_cycle(void) {
+  s_handler_count = 0;
+  for (uint8_t *p = __start_rtc_noinit; p && p < __stop_rtc_noinit; p++) {
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    *p = (uint8_t)s_rng;
+  }
+  host_flash_power_on();
+  host_time_set_us(0);
+}
@@ -0,0 +1,9 @@
+#include "esp_timer.h"
+#include "host_test.h"
+
+static int64_t s_now_us;
+
+int64_t esp_timer_get_time(void) { return s_now_us; }
+
+void host_time_set_us(int64_t us) { s_now_us = us; }
+void host_time_advance_ms(int64_t ms) { s_now_us += ms * 1000; }
@@ -0,0 +1,67 @@
+#include "miniz.h"
+#include <zlib.h>
+
+// Decoders get memset and freed without telling the fake, so the zlib
+// streams live here, one per decoder address
+#define MAX_STREAMS 4
+
+static struct {
+  const tinfl_decompressor *owner;
+  z_stream zs;
+} s_streams[MAX_STREAMS];
+
+static z_stream *stream_for(const tinfl_decompressor *r) {
+  for (int i = 0; i < MAX_STREAMS; i++) {
+    if (s_streams[i].owner == r)
+      return &s_streams[i].zs;
+  }
+  for (int i = 0; i < MAX_STREAMS; i++) {
+    if (!s_streams[i].owner && inflateInit2(&s_streams[i].zs, -15) == Z_OK) {
+      s_streams[i].owner = r;
+      return &s_streams[i].zs;
+    }
+  }
+  return NULL;
+}
+
+// tinfl_decompress on top of zlib's raw inflate. zlib keeps its own 32 KB
+// history, so the fake is stricter than tinfl about the output buffer
+// instead: in wrapping mode it must be the whole TINFL_LZ_DICT_SIZE window,
+// where a smaller one would make tinfl resolve long distances to stale
+// bytes.
+tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                              const mz_uint8 *pIn_buf_next,
+                              size_t *pIn_buf_size, mz_uint8 *pOut_buf_start,
+                              mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+  if (!(decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) &&
+      (pOut_buf_next < pOut_buf_start ||
+       (size_t)(pOut_buf_next - pOut_buf_start) + *pOut_buf_size !=
+           TINFL_LZ_DICT_SIZE)) {
+    *pIn_buf_size = *pOut_buf_size = 0;
+    return TINFL_STATUS_BAD_PARAM;
+  }
+
+  z_stream *zs = stream_for(r);
+  if (!zs)
+    return TINFL_STATUS_FAILED;
+  if (r->m_state == 0) {
+    inflateReset(zs);
+    r->m_state = 1;
+  }
+
+  zs->next_in = (Bytef *)pIn_buf_next;
+  zs->avail_in = *pIn_buf_size;
+  zs->next_out = pOut_buf_next;
+  zs->avail_out = *pOut_buf_size;
+  int rc = inflate(zs, Z_NO_FLUSH);
+  *pIn_buf_size -= zs->avail_in;
+  *pOut_buf_size -= zs->avail_out;
+
+  if (rc == Z_STREAM_END)
+    return TINFL_STATUS_DONE;
+  if (rc != Z_OK && rc != Z_BUF_ERROR)
+    return TINFL_STATUS_FAILED;
+  return zs->avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT
+                            : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// Shared by the host tests: a failing CHECK ends the test with the line,
+// the fakes in fakes/ expose their counters here.
+
+#include "esp_partition.h"
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,      \
+              #cond);                                                        \
+      exit(1);                                                               \
+    }                                                                        \
+  } while (0)
+
+static inline int64_t host_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// fakes/heap.c: bytes currently held and the high-water mark since reset
+size_t host_heap_used(void);
+size_t host_heap_peak(void);
+size_t host_heap_allocs(void);
+void host_heap_reset_peak(void);
+
+// fakes/timer.c: esp_timer_get_time() only moves when a test moves it
+void host_time_set_us(int64_t us);
+void host_time_advance_ms(int64_t ms);
+
+// fakes/partition.c: NOR flash partitions in files in the working directory
+typedef struct {
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t erases; // sectors
+  uint64_t read_bytes;
+  uint64_t written_bytes;
+  int64_t busy_us; // modeled chip time, also added to the fake clock
+  uint32_t max_sector_erases;
+  double mean_sector_erases;
+} host_flash_stats_t;
+
+// Adds partition `label`, or wipes it if it exists, resized if `size`
+// differs: erased, counters cleared
+const esp_partition_t *host_partition_add(const char *label, size_t size);
+// The raw contents, to inspect or corrupt
+uint8_t *host_partition_data(const char *label);
+void host_partition_stats(const char *label, host_flash_stats_t *stats);
+
+// Power cuts. Programs and erases on every partition are numbered from 1.
+// Operation `op` is torn, a write leaves a random prefix programmed and an
+// erase a random subset of pages erased, and every later one fails until
+// host_flash_power_on(). 0 disarms.
+uint32_t host_flash_ops(void);
+void host_flash_cut_at(uint32_t op);
+bool host_flash_powered(void);
+void host_flash_power_on(void);
+void host_flash_seed(uint32_t seed);
+
+// fakes/system.c: esp_restart() runs the shutdown handlers and returns, the
+// test then runs the modules' init again. A soft reset keeps RTC memory, a
+// panic reset too but skips the handlers, a power cycle scrambles it and
+// turns flash back on.
+void host_soft_reset(void);
+void host_panic_reset(void);
+void host_power_cycle(void);
+
+// fakes/nvs.c: NVS laid out like the real thing on the "nvs" partition,
+// pages of 32 byte entries with a spare page for garbage collection
+typedef struct {
+  uint32_t sets;
+  uint32_t gc_pages; // pages compacted to make room
+  uint32_t live_entries;
+  uint32_t free_entries;
+  bool collecting; // power went during garbage collection
+} host_nvs_stats_t;
+
+void host_nvs_stats(host_nvs_stats_t *stats);
+
+// fakes/lvgl.c: the areas objects invalidated since the last call, at most
+// `max`. Clipped to what shows on the active screen, areas inside an
+// earlier one are dropped.
+size_t host_lv_take_invalidated(lv_area_t *areas, size_t max);
@@ -0,0 +1,7 @@
+#pragma once
+
+// RTC memory is a section of its own, fakes/system.c scrambles it to model
+// a power cut and leaves it alone across a soft reset
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
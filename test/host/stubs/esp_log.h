@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdio.h>
+
+// Warnings and errors go to stderr so ctest shows them on failure
+#define ESP_LOGE(tag, fmt, ...)                                              \
+  fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)                                              \
+  fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+// Info and debug are compiled, for the format checks, but not printed
+#define ESP_LOGI(tag, fmt, ...)                                              \
+  do {                                                                       \
+    if (0)                                                                   \
+      printf("%s: " fmt "\n", tag, ##__VA_ARGS__);                           \
+  } while (0)
+#define ESP_LOGD(tag, fmt, ...) ESP_LOGI(tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "esp_err.h"
+
+// fakes/system.c: esp_restart() runs the shutdown handlers, the test then
+// restarts the modules itself, see host_test.h
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+void esp_restart(void);
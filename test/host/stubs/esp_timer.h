@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// fakes/timer.c: a clock the tests set, see host_test.h
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// fakes/lvgl.c: the LVGL 8.3 calls app_clock and app_ui make, see
+// host_test.h. Objects keep a font as their only style, labels are sized
+// by their text and alignment is kept, other layout is ignored. Colors are
+// RGB565 with the bytes swapped as CONFIG_LV_COLOR_16_SWAP sets them.
+
+#define LV_COLOR_DEPTH 16
+#define LV_COLOR_16_SWAP 1
+
+#define LV_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define LV_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef int16_t lv_coord_t;
+typedef uint8_t lv_opa_t;
+typedef uint32_t lv_part_t;
+typedef uint8_t lv_res_t;
+
+#define LV_RES_OK 1
+#define LV_PART_MAIN 0
+#define LV_OPA_TRANSP 0
+#define LV_OPA_50 127
+#define LV_OPA_COVER 255
+#define LV_OPA_MIN 2
+#define LV_OPA_MAX 253
+#define LV_SIZE_CONTENT 0x27D1 // LV_COORD_SET_SPEC(2001), sized as 0
+
+typedef union {
+  struct {
+    uint16_t green_h : 3;
+    uint16_t red : 5;
+    uint16_t blue : 5;
+    uint16_t green_l : 3;
+  } ch;
+  uint16_t full;
+} lv_color_t;
+
+typedef struct {
+  lv_coord_t x;
+  lv_coord_t y;
+} lv_point_t;
+
+typedef struct {
+  lv_coord_t x1;
+  lv_coord_t y1;
+  lv_coord_t x2;
+  lv_coord_t y2;
+} lv_area_t;
+
+lv_color_t lv_color_make(uint8_t r, uint8_t g, uint8_t b);
+lv_color_t lv_color_hex(uint32_t c);
+lv_color_t lv_color_mix(lv_color_t c1, lv_color_t c2, uint8_t mix);
+lv_color_t lv_color_white(void);
+
+bool _lv_area_intersect(lv_area_t *res, const lv_area_t *a1,
+                        const lv_area_t *a2);
+lv_coord_t lv_area_get_width(const lv_area_t *area);
+lv_coord_t lv_area_get_height(const lv_area_t *area);
+
+// Fonts
+
+typedef struct {
+  uint16_t adv_w;
+  uint16_t box_w;
+  uint16_t box_h;
+  int16_t ofs_x;
+  int16_t ofs_y;
+  uint8_t bpp;
+} lv_font_glyph_dsc_t;
+
+typedef struct _lv_font_t {
+  bool (*get_glyph_dsc)(const struct _lv_font_t *, lv_font_glyph_dsc_t *,
+                        uint32_t letter, uint32_t letter_next);
+  const uint8_t *(*get_glyph_bitmap)(const struct _lv_font_t *, uint32_t);
+  lv_coord_t line_height;
+  lv_coord_t base_line;
+  const void *dsc;
+} lv_font_t;
+
+#define LV_FONT_DECLARE(name) extern const lv_font_t name;
+#define LV_SYMBOL_WIFI "\xEF\x87\xAB"
+
+bool lv_font_get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *dsc,
+                           uint32_t letter, uint32_t letter_next);
+const uint8_t *lv_font_get_glyph_bitmap(const lv_font_t *font,
+                                        uint32_t letter);
+uint16_t lv_font_get_glyph_width(const lv_font_t *font, uint32_t letter,
+                                 uint32_t letter_next);
+
+// Drawing into a buffer covering buf_area, within clip_area
+
+typedef struct _lv_draw_ctx_t {
+  void *buf;
+  lv_area_t *buf_area;
+  const lv_area_t *clip_area;
+} lv_draw_ctx_t;
+
+typedef struct {
+  const lv_font_t *font;
+  lv_color_t color;
+  lv_opa_t opa;
+} lv_draw_label_dsc_t;
+
+void lv_draw_label_dsc_init(lv_draw_label_dsc_t *dsc);
+void lv_draw_letter(lv_draw_ctx_t *draw_ctx, const lv_draw_label_dsc_t *dsc,
+                    const lv_point_t *pos_p, uint32_t letter);
+
+// Styles, only the text font is used
+
+typedef struct {
+  const lv_font_t *text_font;
+  lv_color_t text_color;
+  lv_color_t bg_color;
+  lv_opa_t bg_opa;
+} lv_style_t;
+
+void lv_style_init(lv_style_t *style);
+void lv_style_set_text_font(lv_style_t *style, const lv_font_t *value);
+void lv_style_set_text_color(lv_style_t *style, lv_color_t value);
+void lv_style_set_bg_color(lv_style_t *style, lv_color_t value);
+void lv_style_set_bg_opa(lv_style_t *style, lv_opa_t value);
+
+// Objects and events
+
+typedef enum {
+  LV_EVENT_DRAW_MAIN = 21,
+} lv_event_code_t;
+
+typedef struct _lv_event_t lv_event_t;
+typedef void (*lv_event_cb_t)(lv_event_t *e);
+
+enum {
+  LV_OBJ_FLAG_HIDDEN = 1 << 0,
+  LV_OBJ_FLAG_CLICKABLE = 1 << 1,
+  LV_OBJ_FLAG_SCROLLABLE = 1 << 4,
+};
+
+typedef enum {
+  LV_ALIGN_DEFAULT = 0,
+  LV_ALIGN_TOP_MID = 2,
+  LV_ALIGN_TOP_RIGHT = 3,
+  LV_ALIGN_BOTTOM_MID = 5,
+  LV_ALIGN_CENTER = 9,
+  LV_ALIGN_OUT_BOTTOM_MID = 14,
+} lv_align_t;
+
+enum { LV_FLEX_FLOW_ROW = 0, LV_FLEX_FLOW_COLUMN = 1 << 0 };
+enum { LV_FLEX_ALIGN_CENTER = 2 };
+enum { LV_TEXT_ALIGN_CENTER = 2 };
+enum { LV_LABEL_LONG_WRAP = 0 };
+enum { LV_SCR_LOAD_ANIM_FADE_ON = 9 };
+
+#define HOST_LV_EVENT_CBS 4
+#define HOST_LV_TEXT_MAX 96
+
+typedef struct _lv_obj_t {
+  struct _lv_obj_t *parent;
+  lv_area_t coords;
+  lv_opa_t opa; // style opa, what a fade animates
+  uint32_t flags;
+  lv_event_cb_t event_cb[HOST_LV_EVENT_CBS];
+  lv_event_code_t event_filter[HOST_LV_EVENT_CBS];
+  const lv_font_t *font;
+  lv_align_t align; // from lv_obj_align(), kept when the size changes
+  lv_coord_t align_x;
+  lv_coord_t align_y;
+  bool is_label;
+  char text[HOST_LV_TEXT_MAX];
+} lv_obj_t;
+
+struct _lv_event_t {
+  lv_obj_t *target;
+  lv_event_code_t code;
+  void *param;
+};
+
+lv_obj_t *lv_obj_create(lv_obj_t *parent);
+void lv_obj_del(lv_obj_t *obj);
+void lv_obj_remove_style_all(lv_obj_t *obj);
+void lv_obj_clear_flag(lv_obj_t *obj, uint32_t f);
+void lv_obj_set_size(lv_obj_t *obj, lv_coord_t w, lv_coord_t h);
+void lv_obj_set_width(lv_obj_t *obj, lv_coord_t w);
+void lv_obj_set_style_opa(lv_obj_t *obj, lv_opa_t value, uint32_t selector);
+lv_opa_t lv_obj_get_style_opa_recursive(const lv_obj_t *obj, lv_part_t part);
+void lv_obj_invalidate(const lv_obj_t *obj);
+void lv_obj_invalidate_area(const lv_obj_t *obj, const lv_area_t *area);
+void *lv_obj_add_event_cb(lv_obj_t *obj, lv_event_cb_t event_cb,
+                          lv_event_code_t filter, void *user_data);
+lv_res_t lv_event_send(lv_obj_t *obj, lv_event_code_t event_code,
+                       void *param);
+lv_obj_t *lv_event_get_target(lv_event_t *e);
+lv_draw_ctx_t *lv_event_get_draw_ctx(lv_event_t *e);
+
+void lv_obj_add_style(lv_obj_t *obj, const lv_style_t *style,
+                      uint32_t selector);
+void lv_obj_add_flag(lv_obj_t *obj, uint32_t f);
+void lv_obj_align(lv_obj_t *obj, lv_align_t align, lv_coord_t x_ofs,
+                  lv_coord_t y_ofs);
+void lv_obj_align_to(lv_obj_t *obj, const lv_obj_t *base, lv_align_t align,
+                     lv_coord_t x_ofs, lv_coord_t y_ofs);
+void lv_obj_set_flex_flow(lv_obj_t *obj, uint32_t flow);
+void lv_obj_set_flex_align(lv_obj_t *obj, uint32_t main_place,
+                           uint32_t cross_place, uint32_t track_place);
+void lv_obj_set_style_pad_row(lv_obj_t *obj, lv_coord_t value,
+                              uint32_t selector);
+void lv_obj_set_style_pad_column(lv_obj_t *obj, lv_coord_t value,
+                                 uint32_t selector);
+void lv_obj_set_style_text_align(lv_obj_t *obj, uint32_t value,
+                                 uint32_t selector);
+
+// Labels: the whole label is invalidated on every lv_label_set_text(),
+// the same text too, as LVGL does
+lv_obj_t *lv_label_create(lv_obj_t *parent);
+void lv_label_set_text(lv_obj_t *obj, const char *text);
+void lv_label_set_long_mode(lv_obj_t *obj, uint32_t long_mode);
+
+// Screens: the first one created is active, only its objects invalidate
+lv_obj_t *lv_scr_act(void);
+void lv_scr_load(lv_obj_t *scr);
+void lv_scr_load_anim(lv_obj_t *scr, uint32_t anim_type, uint32_t time,
+                      uint32_t delay, bool auto_del);
+
+typedef struct _lv_timer_t lv_timer_t;
+typedef void (*lv_timer_cb_t)(lv_timer_t *);
+struct _lv_timer_t {
+  lv_timer_cb_t timer_cb;
+  uint32_t period;
+  void *user_data;
+};
+
+lv_timer_t *lv_timer_create(lv_timer_cb_t timer_xcb, uint32_t period,
+                            void *user_data);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+
+// fakes/nvs.c: mounts the "nvs" partition the test added
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
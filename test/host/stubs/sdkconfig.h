@@ -0,0 +1,12 @@
+#pragma once
+
+// Defaults of main/Kconfig.projbuild and the IDF options the modules test
+#define CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS 1
+#define CONFIG_WEATHER_DAILY_QUOTA 1000
+#define CONFIG_WEATHER_FLASH_MIN_INTERVAL_MIN 60
+
+// Providers point at local mock servers, as a debug build would
+#define CONFIG_WEATHER_QWEATHER_HOST "http://127.0.0.1:8081"
+#define CONFIG_WEATHER_QWEATHER_KEY "test-key"
+#define CONFIG_WEATHER_OPEN_METEO_HOST "http://127.0.0.1:8082"
+#define CONFIG_WEATHER_OPEN_METEO_AIR_HOST "http://127.0.0.1:8083"
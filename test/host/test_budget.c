@@ -0,0 +1,198 @@
+#include "app_budget.h"
+#include "app_sched.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_budget and app_sched driven like the weather task through a replayed
+// day against a mock provider: a network outage, an hour of 5xx, a burst of
+// 429 and a key whose real quota runs out in the evening, then the next
+// UTC morning. Also counts the flash writes the persistence policy makes.
+
+#define MIN 60
+#define HOUR (60 * MIN)
+#define DAY (24 * HOUR)
+#define T0 ((int64_t)20000 * DAY) // 00:00 UTC
+#define PUBLISH (20 * MIN)
+#define LIMIT 1000    // what the device is configured with
+#define KEY_QUOTA 180 // what the provider really allows, key shared
+#define JOBS 3        // now, daily, air per poll
+
+typedef struct {
+  uint32_t seen; // calls today, as the provider counts them
+  uint32_t day;
+  uint32_t in_5xx, in_429; // calls during those windows
+} server_t;
+
+// The provider's answer to a poll at `t`, seconds since T0, and how many
+// calls it saw. Network failures never reach it.
+static app_fetch_err_t serve(server_t *srv, int64_t t, uint32_t *calls) {
+  uint32_t day = t / DAY;
+  if (day != srv->day) {
+    srv->day = day;
+    srv->seen = 0;
+  }
+  int64_t tod = t % DAY;
+  *calls = 0;
+  if (tod >= 6 * HOUR && tod < 8 * HOUR)
+    return APP_FETCH_NETWORK;
+  *calls = 1;
+  srv->seen++;
+  if (srv->seen > KEY_QUOTA)
+    return APP_FETCH_QUOTA;
+  if (tod >= 10 * HOUR && tod < 11 * HOUR) {
+    srv->in_5xx++;
+    return APP_FETCH_PROVIDER;
+  }
+  if (tod >= 13 * HOUR && tod < 13 * HOUR + 10 * MIN) {
+    srv->in_429++;
+    return APP_FETCH_RATE_LIMIT;
+  }
+  *calls = JOBS;
+  srv->seen += JOBS - 1;
+  return APP_FETCH_OK;
+}
+
+typedef struct {
+  int64_t first_ok_after[4]; // first good poll after each outage window
+  int64_t lockout_at, resumed_at;
+  int polls, held, writes, result_writes;
+  uint32_t max_lost; // calls a power cut would have forgotten
+} replay_t;
+
+static const int64_t OUTAGE_END[4] = {8 * HOUR, 11 * HOUR,
+                                      13 * HOUR + 10 * MIN, DAY};
+
+static void replay(uint32_t seed, replay_t *r) {
+  memset(r, 0, sizeof(*r));
+  for (int i = 0; i < 4; i++)
+    r->first_ok_after[i] = -1;
+  r->lockout_at = r->resumed_at = -1;
+  server_t srv = {0};
+  app_budget_t b;
+  app_sched_t s;
+  app_budget_init(&b, LIMIT, seed);
+  app_sched_init(&s, seed);
+  app_budget_record_t flashed = {0};
+  int64_t flashed_s = 0;
+
+  int64_t t = 3 * MIN;
+  while (t < DAY + 3 * HOUR) {
+    int64_t now = T0 + t;
+    if (!app_budget_allow(&b, now)) {
+      r->held++;
+      // Nothing may reach the provider while the breaker is open
+    } else {
+      r->polls++;
+      uint32_t calls;
+      app_fetch_err_t err = serve(&srv, t, &calls);
+      app_budget_on_result(&b, now, calls, err);
+      if (calls) {
+        r->result_writes++; // what writing after every poll cost
+        if (app_budget_should_persist(&b, &flashed, flashed_s, t)) {
+          app_budget_save(&b, &flashed);
+          flashed_s = t;
+          r->writes++;
+        }
+        if (flashed.day == b.day && b.used - flashed.used > r->max_lost)
+          r->max_lost = b.used - flashed.used;
+      }
+      if (err == APP_FETCH_OK) {
+        for (int i = 0; i < 4; i++) {
+          if (t >= OUTAGE_END[i] && r->first_ok_after[i] < 0)
+            r->first_ok_after[i] = t;
+        }
+        app_sched_on_success(&s, T0 + t / PUBLISH * PUBLISH, true, false);
+      } else {
+        if (err == APP_FETCH_QUOTA && r->lockout_at < 0) {
+          r->lockout_at = t;
+          // The lockout reaches flash right away
+          CHECK(flashed.used == LIMIT);
+        }
+        app_sched_on_failure(&s);
+      }
+    }
+    CHECK(b.used <= LIMIT);
+    uint32_t delay = app_sched_next_delay_s(&s, now);
+    delay = app_budget_next_delay_s(&b, now, delay);
+    t += delay;
+  }
+  r->resumed_at = r->first_ok_after[3];
+  CHECK(srv.seen > 0); // the next day started
+}
+
+int main(void) {
+  replay_t r;
+  int64_t worst[4] = {0}, worst_lost = 0;
+  int max_writes = 0, min_saved = 1 << 30;
+  uint32_t max_5xx = 0, max_429 = 0;
+  for (uint32_t seed = 1; seed <= 200; seed++) {
+    replay(seed, &r);
+    // Quota ran out in the evening and held until the next UTC day, within
+    // the spread after midnight plus the first poll's own delay
+    CHECK(r.lockout_at > 14 * HOUR && r.lockout_at < DAY);
+    CHECK(r.resumed_at >= DAY && r.resumed_at < DAY + 45 * MIN);
+    for (int i = 0; i < 4; i++) {
+      CHECK(r.first_ok_after[i] >= OUTAGE_END[i]);
+      if (r.first_ok_after[i] - OUTAGE_END[i] > worst[i])
+        worst[i] = r.first_ok_after[i] - OUTAGE_END[i];
+    }
+    if (r.writes > max_writes)
+      max_writes = r.writes;
+    if (r.result_writes - r.writes < min_saved)
+      min_saved = r.result_writes - r.writes;
+    if (r.max_lost > worst_lost)
+      worst_lost = r.max_lost;
+  }
+  // Recovery: the scheduler's 15 minute failure cap, the breaker's open
+  // periods and the 2 minute 429 hold
+  CHECK(worst[0] <= 16 * MIN);
+  CHECK(worst[1] <= 2 * HOUR);
+  CHECK(worst[2] <= 30 * MIN);
+  // About one write an hour plus the day roll and the lockout, a power cut
+  // forgets the calls of an hour and the poll that ends it
+  CHECK(max_writes <= 30);
+  CHECK(min_saved > 50);
+  CHECK(worst_lost <= 2 * HOUR / (15 * MIN) * JOBS);
+
+  // Breaker: the 5xx hour and the 429 burst see a handful of probes
+  for (uint32_t seed = 1; seed <= 200; seed++) {
+    server_t srv = {0};
+    app_budget_t b;
+    app_sched_t s;
+    app_budget_init(&b, LIMIT, seed);
+    app_sched_init(&s, seed);
+    for (int64_t t = 9 * HOUR + 50 * MIN; t < 14 * HOUR;) {
+      int64_t now = T0 + t;
+      if (app_budget_allow(&b, now)) {
+        uint32_t calls;
+        app_fetch_err_t err = serve(&srv, t, &calls);
+        app_budget_on_result(&b, now, calls, err);
+        if (err == APP_FETCH_OK)
+          app_sched_on_success(&s, T0 + t / PUBLISH * PUBLISH, true, false);
+        else
+          app_sched_on_failure(&s);
+      }
+      t += app_budget_next_delay_s(&b, now, app_sched_next_delay_s(&s, now));
+    }
+    if (srv.in_5xx > max_5xx)
+      max_5xx = srv.in_5xx;
+    if (srv.in_429 > max_429)
+      max_429 = srv.in_429;
+  }
+  CHECK(max_5xx <= 10);
+  CHECK(max_429 <= 3);
+
+  replay(42, &r);
+  printf("budget: 27 h replay, %d polls, %d held, %d flash writes instead of "
+         "%d, power cut loses <= %lld calls\n",
+         r.polls, r.held, r.writes, r.result_writes, (long long)worst_lost);
+  printf("budget: back after outage %lld s, 5xx %lld s, 429 %lld s (worst "
+         "of 200), quota from %02lld:%02lld to 00:%02lld UTC\n",
+         (long long)worst[0], (long long)worst[1], (long long)worst[2],
+         (long long)(r.lockout_at / HOUR),
+         (long long)(r.lockout_at % HOUR / MIN),
+         (long long)((r.resumed_at - DAY) / MIN));
+  printf("budget: at most %u calls in the 5xx hour, %u in the 429 burst\n",
+         (unsigned)max_5xx, (unsigned)max_429);
+  return 0;
+}
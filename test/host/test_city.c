@@ -0,0 +1,381 @@
+#include "app_city.h"
+#include "app_store.h"
+#include "host_test.h"
+#include <math.h>
+#include <string.h>
+
+// app_city on the index tools/gen_city_index.py builds from the city list
+// in the repo, mapped from the partition fake: exact lookups by every key,
+// what the portal stores, nearest cities against brute force, then lookup
+// latency, and the portal's /cities answers. A small Pacific list puts the
+// antimeridian inside a grid and has a name to escape.
+
+#define PART_SIZE (320 * 1024)
+#define MAX_CITIES 4096
+#define DEG 100000 // 1e-5 degrees
+
+static void load_index(const char *path) {
+  host_partition_add("cities", PART_SIZE);
+  FILE *f = fopen(path, "rb");
+  CHECK(f);
+  size_t n = fread(host_partition_data("cities"), 1, PART_SIZE, f);
+  CHECK(n > 0 && feof(f));
+  fclose(f);
+  CHECK(app_city_init());
+}
+
+static void test_lookup(void) {
+  app_city_t c;
+  const char *beijing[] = {"101010100", "Beijing", "beijing", "北京"};
+  for (int i = 0; i < 4; i++) {
+    CHECK(app_city_lookup(beijing[i], &c));
+    CHECK(strcmp(c.id, "101010100") == 0 && strcmp(c.name_zh, "北京") == 0);
+  }
+  CHECK(!app_city_lookup("Nowhere", &c));
+  CHECK(!app_city_lookup("Beijin", &c)); // prefixes are not names
+  CHECK(!app_city_lookup("", &c));
+
+  // Every city by its ID, and its name finds a city of that name
+  app_city_cursor_t cur;
+  size_t count = 0, long_names = 0;
+  app_city_find(&cur, APP_CITY_BY_ID, "");
+  while (app_city_next(&cur, &c)) {
+    app_city_t got;
+    CHECK(app_city_lookup(c.id, &got) && strcmp(got.id, c.id) == 0);
+    CHECK(app_city_lookup(c.name_zh, &got));
+    CHECK(strcmp(got.name_zh, c.name_zh) == 0 ||
+          strcmp(got.id, c.name_zh) == 0);
+    // The portal reads a name as sent, each byte %XX encoded, into
+    // 3 * APP_CITY_KEY_MAX and stores the ID, which fits the config. Many
+    // encoded names would not.
+    CHECK(3 * strlen(c.name_zh) + 1 <= 3 * APP_CITY_KEY_MAX);
+    CHECK(strlen(c.id) < APP_LOCATION_LEN);
+    long_names += 3 * strlen(c.name_zh) >= APP_LOCATION_LEN;
+    count++;
+  }
+  CHECK(count == app_city_count() && count > 3000);
+  CHECK(long_names > 0);
+}
+
+#define JSON_MAX (APP_CITY_JSON_LIMIT_MAX * APP_CITY_JSON_ENTRY_MAX)
+
+// A /cities answer with chunks of at most `cap`, joined into `out`.
+// Returns the number of chunks.
+static int cities_json(const char *q, int limit, size_t cap, char *out) {
+  static char buf[JSON_MAX];
+  CHECK(cap <= sizeof(buf));
+  app_city_json_t j;
+  app_city_json_begin(&j, q, limit);
+  size_t len, total = 0;
+  int chunks = 0;
+  while ((len = app_city_json_next(&j, buf, cap)) > 0) {
+    CHECK(len <= cap && total + len < JSON_MAX);
+    memcpy(out + total, buf, len);
+    total += len;
+    chunks++;
+  }
+  out[total] = '\0';
+  CHECK(app_city_json_next(&j, buf, cap) == 0);
+  return chunks;
+}
+
+// The answer lists the cities the cursor finds by `key`, in order
+static size_t check_json_ids(const char *json, app_city_key_t key,
+                             const char *q, int limit) {
+  CHECK(json[0] == '[' && json[strlen(json) - 1] == ']');
+  app_city_cursor_t cur;
+  app_city_t c;
+  app_city_find(&cur, key, q);
+  size_t n = 0;
+  const char *p = json;
+  char id[APP_CITY_KEY_MAX + 8];
+  for (; (int)n < limit && app_city_next(&cur, &c); n++) {
+    snprintf(id, sizeof(id), "{\"id\":\"%s\",", c.id);
+    p = strstr(p, id);
+    CHECK(p);
+  }
+  // No more entries than that
+  size_t entries = 0;
+  for (p = json; (p = strstr(p, "{\"id\":")); p++)
+    entries++;
+  CHECK(entries == n);
+  return n;
+}
+
+static void test_cities_json(void) {
+  static char json[JSON_MAX], chunked[JSON_MAX];
+  cities_json("", 10, 1024, json);
+  CHECK(strcmp(json, "[]") == 0);
+  cities_json("Atlantis", 10, 1024, json);
+  CHECK(strcmp(json, "[]") == 0);
+
+  // A digit picks IDs, a letter pinyin in any case, anything else Chinese
+  cities_json("10101", 30, 1024, json);
+  CHECK(check_json_ids(json, APP_CITY_BY_ID, "10101", 30) > 1);
+  cities_json("bei", 30, 1024, json);
+  CHECK(check_json_ids(json, APP_CITY_BY_EN, "bei", 30) > 1);
+  cities_json("BEI", 30, 1024, chunked);
+  CHECK(strcmp(json, chunked) == 0);
+  cities_json("北", 30, 1024, json);
+  CHECK(check_json_ids(json, APP_CITY_BY_ZH, "北", 30) > 1);
+  CHECK(strstr(json, "{\"id\":\"101010100\",\"name\":\"北京\",\"en\":"
+                     "\"Beijing\",\"adm1\":\"北京市\",\"adm2\":\"北京市\"}"));
+
+  // Limits outside 1 .. 30 fall back to 10
+  const struct {
+    int limit;
+    int entries;
+  } limits[] = {{1, 1}, {7, 7}, {30, 30}, {0, 10}, {-1, 10}, {31, 10},
+                {999, 10}};
+  for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+    cities_json("h", limits[i].limit, 1024, json);
+    CHECK(check_json_ids(json, APP_CITY_BY_EN, "h", limits[i].entries) ==
+          (size_t)limits[i].entries);
+  }
+
+  // The same answer however it is chunked. The smallest buffer takes one
+  // entry per chunk, the bracket last.
+  int one = cities_json("h", 30, sizeof(json) - 1, json);
+  CHECK(one == 1);
+  CHECK(cities_json("h", 30, 1024, chunked) > 1);
+  CHECK(strcmp(json, chunked) == 0);
+  CHECK(cities_json("h", 30, APP_CITY_JSON_ENTRY_MAX + 2, chunked) == 31);
+  CHECK(strcmp(json, chunked) == 0);
+
+  // No heap per request
+  size_t used = host_heap_used(), allocs = host_heap_allocs();
+  cities_json("h", 30, 1024, json);
+  cities_json("北", 30, 1024, json);
+  CHECK(host_heap_used() == used && host_heap_allocs() == allocs);
+}
+
+static app_city_t s_all[MAX_CITIES];
+static size_t s_count;
+static int32_t s_lat_min, s_lat_max, s_lon_min, s_lon_max;
+static uint32_t s_rng = 2463534242u;
+
+static void load_all(void) {
+  app_city_cursor_t cur;
+  s_count = 0;
+  s_lat_min = s_lon_min = INT32_MAX;
+  s_lat_max = s_lon_max = INT32_MIN;
+  app_city_find(&cur, APP_CITY_BY_ID, "");
+  while (app_city_next(&cur, &s_all[s_count])) {
+    const app_city_t *c = &s_all[s_count++];
+    CHECK(s_count < MAX_CITIES);
+    s_lat_min = c->lat < s_lat_min ? c->lat : s_lat_min;
+    s_lat_max = c->lat > s_lat_max ? c->lat : s_lat_max;
+    s_lon_min = c->lon < s_lon_min ? c->lon : s_lon_min;
+    s_lon_max = c->lon > s_lon_max ? c->lon : s_lon_max;
+  }
+  CHECK(s_count == app_city_count());
+}
+
+static int32_t uniform(int32_t lo, int32_t hi) {
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return lo + (int32_t)(s_rng % ((uint32_t)(hi - lo) + 1));
+}
+
+// The `n` smallest distances in meters, by the module's metric:
+// equirectangular at the query's latitude, longitude wrapped
+static void brute(int32_t lat, int32_t lon, uint32_t *meters, size_t n) {
+  float lon_scale = cosf((float)lat * (float)(M_PI / 180 / 100000));
+  float best[APP_CITY_NEAR_MAX];
+  size_t found = 0;
+  for (size_t i = 0; i < s_count; i++) {
+    float dlat = (float)(s_all[i].lat - lat);
+    int32_t d = s_all[i].lon - lon;
+    if (d > 180 * DEG)
+      d -= 360 * DEG;
+    else if (d < -180 * DEG)
+      d += 360 * DEG;
+    float dlon = (float)d * lon_scale;
+    float d2 = dlat * dlat + dlon * dlon;
+    if (found == n && d2 >= best[n - 1])
+      continue;
+    size_t k = found < n ? found++ : n - 1;
+    for (; k > 0 && best[k - 1] > d2; k--)
+      best[k] = best[k - 1];
+    best[k] = d2;
+  }
+  for (size_t k = 0; k < found; k++)
+    meters[k] = (uint32_t)(sqrtf(best[k]) * 1.11195f);
+}
+
+static void check_nearest(int32_t lat, int32_t lon, size_t n) {
+  app_city_near_t near[APP_CITY_NEAR_MAX];
+  uint32_t want[APP_CITY_NEAR_MAX];
+  size_t got = app_city_nearest(lat, lon, near, n);
+  CHECK(got == (n < s_count ? n : s_count));
+  brute(lat, lon, want, got);
+  for (size_t k = 0; k < got; k++) {
+    if (near[k].meters != want[k]) {
+      fprintf(stderr, "nearest(%d, %d, %zu)[%zu]: %u m, brute force %u m\n",
+              (int)lat, (int)lon, n, k, (unsigned)near[k].meters,
+              (unsigned)want[k]);
+      CHECK(near[k].meters == want[k]);
+    }
+  }
+}
+
+// A random query: inside the cities' bounding box, close to a city, on a
+// cell boundary, where the ring search exits early or not, or anywhere on
+// the globe, which clamps to the grid's edges
+static void random_query(int32_t *lat, int32_t *lon) {
+  uint32_t kind = (uint32_t)uniform(0, 99);
+  if (kind < 40) {
+    *lat = uniform(s_lat_min, s_lat_max);
+    *lon = uniform(s_lon_min, s_lon_max);
+  } else if (kind < 60) {
+    const app_city_t *c = &s_all[uniform(0, s_count - 1)];
+    *lat = c->lat + uniform(-DEG / 2, DEG / 2);
+    *lon = c->lon + uniform(-DEG / 2, DEG / 2);
+  } else if (kind < 75) {
+    *lat = uniform(s_lat_min / DEG, s_lat_max / DEG) * DEG + uniform(-9, 9);
+    *lon = uniform(s_lon_min / DEG, s_lon_max / DEG) * DEG + uniform(-9, 9);
+  } else {
+    *lat = uniform(-90 * DEG, 90 * DEG);
+    *lon = uniform(-180 * DEG, 180 * DEG - 1);
+  }
+  if (*lat > 90 * DEG)
+    *lat = 90 * DEG;
+  if (*lat < -90 * DEG)
+    *lat = -90 * DEG;
+  if (*lon >= 180 * DEG)
+    *lon -= 360 * DEG;
+  if (*lon < -180 * DEG)
+    *lon += 360 * DEG;
+}
+
+static void test_nearest(void) {
+  load_all();
+  app_city_near_t near[APP_CITY_NEAR_MAX];
+  CHECK(app_city_nearest(3990500, 11640530, near, 1) == 1);
+  CHECK(strcmp(near[0].city.id, "101010100") == 0 && near[0].meters < 100);
+  CHECK(app_city_nearest(3990500, 11640530, near, 0) == 0);
+  CHECK(app_city_nearest(3990500, 11640530, near, 100) == APP_CITY_NEAR_MAX);
+
+  // Corners of the globe and of the grid
+  const int32_t fixed[][2] = {
+      {90 * DEG, 0},           {-90 * DEG, 0},
+      {0, -180 * DEG},         {0, 180 * DEG - 1},
+      {s_lat_min, s_lon_min},  {s_lat_max, s_lon_max},
+      {s_lat_min - 1, s_lon_min - 1}, {s_lat_max + 1, s_lon_max + 1},
+  };
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+    check_nearest(fixed[i][0], fixed[i][1], 1);
+    check_nearest(fixed[i][0], fixed[i][1], APP_CITY_NEAR_MAX);
+  }
+
+  const int points = 20000;
+  int64_t t_grid = 0;
+  for (int i = 0; i < points; i++) {
+    int32_t lat, lon;
+    random_query(&lat, &lon);
+    size_t n = i % 4 == 0 ? 8 : 1;
+    int64_t t0 = host_now_us();
+    app_city_nearest(lat, lon, near, n);
+    t_grid += host_now_us() - t0;
+    check_nearest(lat, lon, n);
+  }
+  printf("city: nearest matches brute force at %d points, %.2f us each\n",
+         points, (double)t_grid / points);
+
+  // Where the device is, against scanning every city
+  const int rounds = 2000;
+  int64_t t0 = host_now_us();
+  for (int i = 0; i < rounds; i++)
+    app_city_nearest(3990500 + i, 11640530, near, 1);
+  double grid_us = (double)(host_now_us() - t0) / rounds;
+  uint32_t m;
+  t0 = host_now_us();
+  for (int i = 0; i < rounds / 10; i++)
+    brute(3990500 + i, 11640530, &m, 1);
+  double brute_us = (double)(host_now_us() - t0) / (rounds / 10);
+  printf("city: nearest in Beijing   %6.2f us, brute force %.0f us\n",
+         grid_us, brute_us);
+}
+
+// The Pacific list's grid runs from 177 W to 179 E, cities on both sides
+// of the antimeridian are neighbours
+static void test_antimeridian(void) {
+  load_index(PACIFIC_INDEX);
+  load_all();
+  app_city_near_t near[2];
+  CHECK(app_city_nearest(-1685000, -17999000, near, 1) == 1);
+  CHECK(strcmp(near[0].city.name_en, "Taveuni") == 0 &&
+        near[0].meters < 5000);
+  CHECK(app_city_nearest(-1814000, 17999000, near, 2) == 2);
+  CHECK(strcmp(near[0].city.name_en, "Lakeba") == 0);
+  const int points = 5000;
+  for (int i = 0; i < points; i++) {
+    int32_t lat, lon;
+    if (i % 2) {
+      lat = uniform(-50 * DEG, 70 * DEG);
+      lon = uniform(170 * DEG, 190 * DEG);
+      if (lon >= 180 * DEG)
+        lon -= 360 * DEG;
+    } else {
+      random_query(&lat, &lon);
+    }
+    check_nearest(lat, lon, i % 3 ? 1 : 4);
+  }
+  printf("city: Pacific grid matches brute force at %d points\n", points);
+}
+
+typedef struct {
+  const char *name;
+  const char *text;
+  bool found;
+} lookup_case_t;
+
+static void bench(void) {
+  const lookup_case_t cases[] = {
+      {"ID", "101280601", true},
+      {"pinyin", "Shenzhen", true},
+      {"Chinese", "乌鲁木齐", true},
+      {"miss", "Atlantis", false},
+      {"miss Chinese", "不存在", false},
+  };
+  const int rounds = 20000;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    app_city_t c;
+    CHECK(app_city_lookup(cases[i].text, &c) == cases[i].found);
+    int64_t t0 = host_now_us();
+    for (int r = 0; r < rounds; r++)
+      app_city_lookup(cases[i].text, &c);
+    double us = (double)(host_now_us() - t0) / rounds;
+    printf("city: lookup %-12s  %6.2f us\n", cases[i].name, us);
+  }
+
+  // A whole /cities?q=h&limit=30 answer in the portal's 1 KiB chunks,
+  // against 10 ms per keystroke on the device
+  static char json[JSON_MAX];
+  int64_t t0 = host_now_us();
+  for (int r = 0; r < rounds / 10; r++)
+    cities_json("h", 30, 1024, json);
+  double us = (double)(host_now_us() - t0) / (rounds / 10);
+  printf("city: /cities 30 results   %6.2f us, %zu B\n", us, strlen(json));
+  CHECK(us < 10000);
+}
+
+// Names are escaped, the Pacific list has one with quotes and a backslash
+static void test_cities_escape(void) {
+  static char json[JSON_MAX];
+  cities_json("kala", 10, 1024, json);
+  CHECK(strstr(json, "\"en\":\"Kalaupapa \\\"Moloka'i\\\" \\\\ Kalawao\""));
+  CHECK(check_json_ids(json, APP_CITY_BY_EN, "kala", 10) == 1);
+}
+
+int main(void) {
+  load_index(CITY_INDEX);
+  test_lookup();
+  test_cities_json();
+  bench();
+  test_nearest();
+  test_antimeridian();
+  test_cities_escape();
+  return 0;
+}
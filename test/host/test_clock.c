@@ -0,0 +1,236 @@
+#include "app_clock.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_clock against LVGL's own letter drawing in fakes/lvgl.c, pixel for
+// pixel: full redraws, and each minute's invalidated cells redrawn band by
+// band onto the previous frame as LVGL refreshes. Then the glyph path while
+// the screen fades in, and the redraw time of both.
+
+#define W 135
+#define H 120
+#define BAND_ROWS 20
+#define CLOCK_X 8
+#define CLOCK_Y 30
+#define GLYPHS "0123456789:-"
+#define AREAS_MAX 16
+
+static uint8_t s_bitmaps[sizeof(GLYPHS) - 1][26 * 35 / 2 + 1];
+static lv_obj_t *s_scr, *s_clock;
+static lv_color_t s_fg, s_bg;
+
+static int glyph_index(uint32_t letter) {
+  const char *p = letter ? strchr(GLYPHS, (int)letter) : NULL;
+  return p ? (int)(p - GLYPHS) : -1;
+}
+
+// Metrics like Montserrat 48, 4 bpp glyphs of noise for every coverage level
+static bool get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *g,
+                          uint32_t letter, uint32_t letter_next) {
+  if (glyph_index(letter) < 0)
+    return false;
+  *g = (lv_font_glyph_dsc_t){
+      .adv_w = 28, .box_w = 26, .box_h = 35, .ofs_x = 1, .bpp = 4};
+  if (letter == '1') {
+    g->adv_w = 20;
+    g->box_w = 14;
+    g->ofs_x = 2;
+  } else if (letter == ':') {
+    g->adv_w = 12;
+    g->box_w = 8;
+    g->box_h = 26;
+    g->ofs_x = 2;
+  } else if (letter == '-') {
+    g->adv_w = 20;
+    g->box_w = 18;
+    g->box_h = 5;
+    g->ofs_y = 12;
+  }
+  return true;
+}
+
+static const uint8_t *get_glyph_bitmap(const lv_font_t *font,
+                                       uint32_t letter) {
+  int i = glyph_index(letter);
+  return i < 0 ? NULL : s_bitmaps[i];
+}
+
+static const lv_font_t s_font = {
+    .get_glyph_dsc = get_glyph_dsc,
+    .get_glyph_bitmap = get_glyph_bitmap,
+    .line_height = 49,
+    .base_line = 9,
+};
+
+static void fill(lv_color_t *buf, size_t n, lv_color_t c) {
+  for (size_t i = 0; i < n; i++)
+    buf[i] = c;
+}
+
+// The clock's draw event into a buffer of screen rows y0 .. y0 + rows - 1
+static void draw_clock(lv_color_t *buf, lv_coord_t y0, lv_coord_t rows,
+                       const lv_area_t *clip) {
+  lv_area_t buf_area = {0, y0, W - 1, y0 + rows - 1};
+  lv_draw_ctx_t ctx = {buf, &buf_area, clip};
+  lv_event_send(s_clock, LV_EVENT_DRAW_MAIN, &ctx);
+}
+
+// What a label of the same font draws onto `under`: lv_draw_letter per
+// letter
+static void draw_reference(lv_color_t *buf, const char *text,
+                           lv_color_t under, lv_opa_t opa) {
+  fill(buf, W * H, under);
+  lv_area_t area = {0, 0, W - 1, H - 1};
+  lv_draw_ctx_t ctx = {buf, &area, &area};
+  lv_draw_label_dsc_t dsc;
+  lv_draw_label_dsc_init(&dsc);
+  dsc.font = &s_font;
+  dsc.color = s_fg;
+  dsc.opa = opa;
+  lv_point_t pos = {s_clock->coords.x1, s_clock->coords.y1};
+  for (const char *c = text; *c; c++) {
+    lv_draw_letter(&ctx, &dsc, &pos, (uint8_t)*c);
+    pos.x += lv_font_get_glyph_width(&s_font, (uint8_t)*c, 0);
+  }
+}
+
+// Redraws the invalidated areas of `frame` band by band: the screen's
+// background, then the clock
+static void refresh(lv_color_t *frame, const lv_area_t *areas, size_t n) {
+  static lv_color_t band[W * BAND_ROWS];
+  for (size_t i = 0; i < n; i++) {
+    for (lv_coord_t y0 = 0; y0 < H; y0 += BAND_ROWS) {
+      lv_area_t rows = {0, y0, W - 1, y0 + BAND_ROWS - 1};
+      lv_area_t clip;
+      if (!_lv_area_intersect(&clip, &areas[i], &rows))
+        continue;
+      memcpy(band, frame + y0 * W, sizeof(band));
+      for (lv_coord_t y = clip.y1; y <= clip.y2; y++)
+        fill(band + (y - y0) * W + clip.x1, lv_area_get_width(&clip), s_bg);
+      draw_clock(band, y0, BAND_ROWS, &clip);
+      memcpy(frame + y0 * W, band, sizeof(band));
+    }
+  }
+}
+
+static void setup(void) {
+  uint8_t *bmp = &s_bitmaps[0][0];
+  uint32_t s = 7;
+  for (size_t i = 0; i < sizeof(s_bitmaps); i++) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    // Half the pixels empty, like the space around a stroke
+    bmp[i] = (uint8_t)((s & 0x10 ? s & 0x0F : 0) |
+                       (s & 0x1000 ? (s >> 4) & 0xF0 : 0));
+  }
+  s_fg = lv_color_hex(0x00E5FF);
+  s_bg = lv_color_hex(0x111111);
+  s_scr = lv_obj_create(NULL);
+  s_scr->coords = (lv_area_t){0, 0, W - 1, H - 1};
+  size_t heap = host_heap_used();
+  s_clock = app_clock_create(s_scr, &s_font, s_fg, s_bg);
+  printf("clock: sprites %zu B\n", host_heap_used() - heap);
+  CHECK(host_heap_used() > heap);
+  s_clock->coords.x1 = CLOCK_X;
+  s_clock->coords.y1 = CLOCK_Y;
+  lv_obj_set_size(s_clock, 0, s_font.line_height);
+}
+
+static void test_pixels(void) {
+  static lv_color_t frame[W * H], full[W * H], ref[W * H];
+  lv_area_t areas[AREAS_MAX];
+  fill(frame, W * H, s_bg);
+  // Same layout, a new layout with '1', fewer characters
+  const char *times[] = {"--:--", "12:34", "12:35", "12:40", "12:59",
+                         "13:00", "19:59", "20:00", "23:59", "0:00"};
+  for (size_t t = 0; t < sizeof(times) / sizeof(times[0]); t++) {
+    const char *prev = t ? times[t - 1] : "";
+    app_clock_set_text(s_clock, times[t]);
+    size_t n = host_lv_take_invalidated(areas, AREAS_MAX);
+    CHECK(n > 0 && n < AREAS_MAX);
+    draw_reference(ref, times[t], s_bg, LV_OPA_COVER);
+
+    // Whole screen in one pass
+    lv_area_t screen = {0, 0, W - 1, H - 1};
+    fill(full, W * H, s_bg);
+    draw_clock(full, 0, H, &screen);
+    CHECK(memcmp(full, ref, sizeof(ref)) == 0);
+
+    // Only what changed, onto the previous minute
+    refresh(frame, areas, n);
+    CHECK(memcmp(frame, ref, sizeof(ref)) == 0);
+
+    // One area per changed character while the layout holds
+    size_t changed = 0;
+    bool same = strlen(prev) == strlen(times[t]);
+    for (size_t i = 0; same && prev[i]; i++) {
+      same = lv_font_get_glyph_width(&s_font, (uint8_t)prev[i], 0) ==
+             lv_font_get_glyph_width(&s_font, (uint8_t)times[t][i], 0);
+      changed += prev[i] != times[t][i];
+    }
+    if (same)
+      CHECK(n == changed);
+  }
+
+  // Same text, nothing to redraw
+  app_clock_set_text(s_clock, "0:00");
+  CHECK(host_lv_take_invalidated(areas, AREAS_MAX) == 0);
+}
+
+// Fading in, the old screen shows through the new one's background: the
+// clock draws the glyphs at the screen's opacity instead of the sprites
+static void test_fade(void) {
+  static lv_color_t frame[W * H], ref[W * H];
+  lv_area_t areas[AREAS_MAX];
+  lv_color_t under = lv_color_hex(0x806040);
+  app_clock_set_text(s_clock, "08:30");
+  host_lv_take_invalidated(areas, AREAS_MAX);
+  lv_area_t screen = {0, 0, W - 1, H - 1};
+  for (int opa = LV_OPA_TRANSP; opa < LV_OPA_COVER; opa += 5) {
+    lv_obj_set_style_opa(s_scr, (lv_opa_t)opa, 0);
+    fill(frame, W * H, under);
+    draw_clock(frame, 0, H, &screen);
+    draw_reference(ref, "08:30", under,
+                   lv_obj_get_style_opa_recursive(s_clock, LV_PART_MAIN));
+    CHECK(memcmp(frame, ref, sizeof(ref)) == 0);
+  }
+  // Faded in, sprites again
+  lv_obj_set_style_opa(s_scr, LV_OPA_COVER, 0);
+  fill(frame, W * H, s_bg);
+  draw_clock(frame, 0, H, &screen);
+  draw_reference(ref, "08:30", s_bg, LV_OPA_COVER);
+  CHECK(memcmp(frame, ref, sizeof(ref)) == 0);
+}
+
+static double redraw_us(int rounds) {
+  static lv_color_t frame[W * H];
+  lv_area_t screen = {0, 0, W - 1, H - 1};
+  int64_t t0 = host_now_us();
+  for (int i = 0; i < rounds; i++)
+    draw_clock(frame, 0, H, &screen);
+  return (double)(host_now_us() - t0) / rounds;
+}
+
+static void bench(void) {
+  const int rounds = 20000;
+  lv_area_t areas[AREAS_MAX];
+  app_clock_set_text(s_clock, "23:59");
+  host_lv_take_invalidated(areas, AREAS_MAX);
+  double sprites = redraw_us(rounds);
+  // Just short of what LVGL treats as opaque: the glyphs
+  lv_obj_set_style_opa(s_scr, LV_OPA_MAX - 1, 0);
+  double glyphs = redraw_us(rounds);
+  lv_obj_set_style_opa(s_scr, LV_OPA_COVER, 0);
+  printf("clock: redraw \"23:59\" sprites %.2f us, glyph blend %.2f us "
+         "(%.1fx) on the host\n",
+         sprites, glyphs, glyphs / sprites);
+}
+
+int main(void) {
+  setup();
+  test_pixels();
+  test_fade();
+  bench();
+  return 0;
+}
@@ -0,0 +1,304 @@
+#include "app_history.h"
+#include "esp_rom_crc.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_history on a file-backed 512 KB partition: the on-flash layout and
+// CRC8, the 15 minute slot rule, the ring going around, restarts, corrupt
+// slots and a power cut at every flash operation, then append and query
+// cost in flash operations.
+
+#define PART_SIZE (512 * 1024)
+#define SECTOR 4096
+#define SLOT 16
+#define SLOTS (SECTOR / SLOT)
+#define RING_RECORDS ((PART_SIZE / SECTOR) * (SLOTS - 1))
+#define STEP (15 * 60)
+#define DAY_RECORDS (24 * 4)
+#define T0 1700000100u // inside a 15 minute slot, not at its start
+
+static app_history_rec_t make_rec(uint32_t i) {
+  app_history_rec_t rec = {
+      .time = T0 + i * STEP,
+      .temp = (int8_t)((int)(i % DAY_RECORDS) / 4 - 5),
+      .feels_like = (int8_t)((int)(i % DAY_RECORDS) / 4 - 7),
+      .humidity = 40 + i % 50,
+      .wind_speed = i % 30,
+      .aqi = i % 7 ? 20 + i % 200 : APP_HISTORY_NO_AQI,
+      .icon = i % 3 ? 101 : 305,
+  };
+  return rec;
+}
+
+typedef struct {
+  uint32_t count;
+  uint32_t first, last;
+  bool sorted;
+} collect_t;
+
+static bool collect(const app_history_rec_t *rec, void *arg) {
+  collect_t *c = arg;
+  if (c->count == 0)
+    c->first = rec->time;
+  else if (rec->time <= c->last)
+    c->sorted = false;
+  c->last = rec->time;
+  c->count++;
+  return true;
+}
+
+static collect_t query(uint32_t from, uint32_t to) {
+  collect_t c = {.sorted = true};
+  size_t n = app_history_query(from, to, collect, &c);
+  CHECK(n == c.count && c.sorted);
+  return c;
+}
+
+static void test_layout(void) {
+  host_partition_add("history", PART_SIZE);
+  app_history_init();
+  app_history_rec_t rec = make_rec(0);
+  CHECK(app_history_append(&rec));
+
+  // Slot 0: "HIST", sequence 1, the first record's time, version 1, CRC8
+  const uint8_t *flash = host_partition_data("history");
+  uint32_t word[3];
+  memcpy(word, flash, sizeof(word));
+  CHECK(word[0] == 0x54534948 && word[1] == 1 && word[2] == T0);
+  CHECK(flash[12] == 1 && flash[15] == esp_rom_crc8_le(0, flash, 15));
+
+  // Slot 1: the record as given, reserved bytes left erased, CRC8 over the
+  // first 15 bytes
+  app_history_rec_t stored;
+  memcpy(&stored, flash + SLOT, SLOT);
+  CHECK(stored.time == rec.time && stored.temp == rec.temp &&
+        stored.aqi == rec.aqi && stored.icon == rec.icon);
+  CHECK(stored.reserved[0] == 0xFF && stored.reserved[1] == 0xFF);
+  CHECK(stored.crc == esp_rom_crc8_le(0, flash + SLOT, 15));
+  for (size_t i = 2 * SLOT; i < SECTOR; i++)
+    CHECK(flash[i] == 0xFF);
+
+  // One record per 15 minute slot, never older than the last
+  app_history_rec_t same = rec;
+  same.time += 60;
+  CHECK(!app_history_append(&same));
+  rec = make_rec(1);
+  CHECK(app_history_append(&rec));
+  CHECK(!app_history_append(&rec));
+  same = make_rec(0);
+  CHECK(!app_history_append(&same));
+  CHECK(query(0, UINT32_MAX).count == 2);
+}
+
+static void test_ring(void) {
+  host_partition_add("history", PART_SIZE);
+  app_history_init();
+  // A year and a half: the ring goes around once and a half
+  const uint32_t total = 540 * DAY_RECORDS;
+  for (uint32_t i = 0; i < total; i++) {
+    app_history_rec_t rec = make_rec(i);
+    CHECK(app_history_append(&rec));
+  }
+  uint32_t last = T0 + (total - 1) * STEP;
+  collect_t all = query(0, UINT32_MAX);
+  // Everything but the sector being recycled next
+  CHECK(all.count > RING_RECORDS - SLOTS && all.count <= RING_RECORDS);
+  CHECK(all.last == last && all.first == last - (all.count - 1) * STEP);
+
+  app_history_stats_t st;
+  app_history_get_stats(&st);
+  CHECK(st.appends == total && st.sectors == PART_SIZE / SECTOR);
+  CHECK(st.erases == (total + SLOTS - 2) / (SLOTS - 1));
+  CHECK(st.lifetime_erases == st.erases);
+
+  // A restart finds the head and keeps appending after it
+  app_history_init();
+  app_history_rec_t rec = make_rec(total - 1);
+  CHECK(!app_history_append(&rec));
+  rec = make_rec(total);
+  CHECK(app_history_append(&rec));
+  CHECK(query(last, UINT32_MAX).count == 2);
+
+  // Ranges, inclusive at both ends
+  CHECK(query(last - 7 * 86400 + 1, last).count == 7 * DAY_RECORDS);
+  CHECK(query(last - STEP, last - STEP).count == 1);
+  CHECK(query(last - STEP + 1, last - 1).count == 0);
+  CHECK(query(0, all.first - 1).count == 0);
+  CHECK(query(last, last - 1).count == 0);
+
+  app_history_summary_t sum;
+  CHECK(app_history_summarize(last - 86400 + 1, last, &sum));
+  CHECK(sum.count == DAY_RECORDS && sum.temp_min == -5 && sum.temp_max == 18);
+  CHECK(!app_history_summarize(0, all.first - 1, &sum));
+}
+
+// The unit changes in the portal: the summary is in the newest record's
+// unit, the older records converted
+static void test_units(void) {
+  host_partition_add("history", PART_SIZE);
+  app_history_init();
+  const int8_t celsius[] = {10, 20, 30, 0};
+  const int8_t fahrenheit[] = {50, 95, 32};
+  uint32_t i = 0;
+  for (size_t k = 0; k < sizeof(celsius); k++, i++) {
+    app_history_rec_t rec = make_rec(i);
+    rec.temp = celsius[k];
+    CHECK(app_history_append(&rec));
+  }
+  for (size_t k = 0; k < sizeof(fahrenheit); k++, i++) {
+    app_history_rec_t rec = make_rec(i);
+    rec.temp = fahrenheit[k];
+    rec.flags = APP_HISTORY_FAHRENHEIT;
+    CHECK(app_history_append(&rec));
+  }
+  uint32_t last = T0 + (i - 1) * STEP;
+  app_history_summary_t sum;
+  CHECK(app_history_summarize(0, last, &sum));
+  // 50, 68, 86, 32 and 50, 95, 32 in Fahrenheit
+  CHECK(sum.count == 7 && (sum.flags & APP_HISTORY_FAHRENHEIT));
+  CHECK(sum.temp_min == 32 && sum.temp_max == 95 && sum.temp_avg == 59);
+
+  // Back to Celsius: 10, 20, 30, 0, 10, 35, 0
+  app_history_rec_t rec = make_rec(i);
+  rec.temp = 15;
+  CHECK(app_history_append(&rec));
+  CHECK(app_history_summarize(0, last + STEP, &sum));
+  CHECK(sum.count == 8 && !(sum.flags & APP_HISTORY_FAHRENHEIT));
+  CHECK(sum.temp_min == 0 && sum.temp_max == 35 && sum.temp_avg == 15);
+
+  // One unit only, as before
+  CHECK(app_history_summarize(0, T0 + 3 * STEP, &sum));
+  CHECK(sum.temp_min == 0 && sum.temp_max == 30 && sum.temp_avg == 15);
+}
+
+static void test_corruption(void) {
+  host_partition_add("history", PART_SIZE);
+  app_history_init();
+  for (uint32_t i = 0; i < 3 * (SLOTS - 1); i++) {
+    app_history_rec_t rec = make_rec(i);
+    CHECK(app_history_append(&rec));
+  }
+  uint8_t *flash = host_partition_data("history");
+  uint32_t total = 3 * (SLOTS - 1);
+
+  // A bit flipped in a record drops that record only
+  flash[SECTOR + 5 * SLOT + 4] ^= 0x01;
+  CHECK(query(0, UINT32_MAX).count == total - 1);
+
+  // A sector whose header was cut off is skipped, here the middle one
+  flash[SECTOR + 3] ^= 0xFF;
+  app_history_init();
+  CHECK(query(0, UINT32_MAX).count == total - (SLOTS - 1));
+
+  // A record torn by a power cut, its second half never programmed, is
+  // passed over. The next append goes after it.
+  memset(flash + 3 * SECTOR - SLOT / 2, 0xFF, SLOT / 2);
+  app_history_init();
+  app_history_rec_t torn = make_rec(total - 1);
+  CHECK(query(torn.time, torn.time).count == 0);
+  app_history_rec_t rec = make_rec(total);
+  CHECK(app_history_append(&rec));
+  CHECK(query(torn.time, rec.time).count == 1);
+}
+
+// A 4 sector ring that already went around, cut at each program and erase
+// of the next few sector changes. After the reboot the log is sorted, holds
+// every acknowledged record but those of the sector being recycled, and
+// takes appends again.
+static void test_power_cuts(void) {
+  const uint32_t sectors = 4, prefill = (sectors + 1) * (SLOTS - 1);
+  const uint32_t window = 2 * (SLOTS - 1) + 10;
+  uint32_t cut, erase_cuts = 0;
+  for (cut = 1;; cut++) {
+    host_partition_add("history", sectors * SECTOR);
+    app_history_init();
+    uint32_t n = 0;
+    for (; n < prefill; n++) {
+      app_history_rec_t rec = make_rec(n);
+      CHECK(app_history_append(&rec));
+    }
+    host_flash_seed(cut);
+    uint32_t cut_op = host_flash_ops() + cut;
+    host_flash_cut_at(cut_op);
+    for (; n < prefill + window; n++) {
+      uint32_t op = host_flash_ops();
+      app_history_rec_t rec = make_rec(n);
+      if (!app_history_append(&rec)) {
+        // The first operation of a sector change is its erase
+        erase_cuts += n % (SLOTS - 1) == 0 && op + 1 == cut_op;
+        break;
+      }
+    }
+    bool done = host_flash_powered();
+    host_power_cycle();
+
+    app_history_init();
+    collect_t all = query(0, UINT32_MAX);
+    uint32_t keep = (sectors - 2) * (SLOTS - 1);
+    app_history_rec_t lo = make_rec(n - keep), hi = make_rec(n - 1);
+    CHECK(query(lo.time, hi.time).count == keep);
+    CHECK(all.last == hi.time || all.last == hi.time + STEP);
+    app_history_rec_t rec = make_rec(n + 1);
+    CHECK(app_history_append(&rec));
+    CHECK(query(hi.time, UINT32_MAX).last == rec.time);
+    if (done)
+      break;
+  }
+  printf("history: power cut at each of %u flash operations, %u of them "
+         "erases\n",
+         (unsigned)(cut - 1), (unsigned)erase_cuts);
+}
+
+static void bench(void) {
+  host_partition_add("history", PART_SIZE);
+  app_history_init();
+  const uint32_t total = 330 * DAY_RECORDS; // nearly a full ring
+  int64_t t0 = host_now_us();
+  for (uint32_t i = 0; i < total; i++) {
+    app_history_rec_t rec = make_rec(i);
+    app_history_append(&rec);
+  }
+  double append_us = (double)(host_now_us() - t0) / total;
+  host_flash_stats_t fs;
+  host_partition_stats("history", &fs);
+  printf("history: %u appends, %.2f us each, %u erases, %llu B written "
+         "(%.2f B per record)\n",
+         (unsigned)total, append_us, (unsigned)fs.erases,
+         (unsigned long long)fs.written_bytes,
+         (double)fs.written_bytes / total);
+  CHECK(fs.written_bytes < (uint64_t)total * (SLOT + 1));
+
+  uint32_t last = T0 + (total - 1) * STEP;
+  const struct {
+    const char *name;
+    uint32_t span;
+  } ranges[] = {{"day", 86400}, {"week", 7 * 86400}, {"all", UINT32_MAX}};
+  for (size_t r = 0; r < 3; r++) {
+    uint32_t from = ranges[r].span > last ? 0 : last - ranges[r].span + 1;
+    host_partition_stats("history", &fs);
+    uint64_t bytes0 = fs.read_bytes;
+    const int rounds = r < 2 ? 2000 : 20;
+    int64_t start = host_now_us();
+    collect_t c;
+    for (int i = 0; i < rounds; i++)
+      c = query(from, last);
+    double us = (double)(host_now_us() - start) / rounds;
+    host_partition_stats("history", &fs);
+    double kb = (double)(fs.read_bytes - bytes0) / rounds / 1024;
+    printf("history: %-4s query, %5u records, %7.1f us, %6.1f KB read\n",
+           ranges[r].name, (unsigned)c.count, us, kb);
+    // The sector index keeps reads to the sectors the range touches
+    if (r == 0)
+      CHECK(kb <= 2 * SECTOR / 1024.0);
+  }
+}
+
+int main(void) {
+  test_layout();
+  test_ring();
+  test_units();
+  test_corruption();
+  test_power_cuts();
+  bench();
+  return 0;
+}
@@ -0,0 +1,322 @@
+#include "app_dns.h"
+#include "app_http.h"
+#include "app_metrics.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_http against an in-process stand-in for esp_http_client and the API
+// server: connections that stay up, that the server drops while idle or
+// closes after a response, TLS handshakes full or resumed from the session
+// the client saved. The server's own handshake counts have to agree with
+// the full/ticket offered stats app_http reports.
+
+#define API_IP "10.0.0.7"
+#define DNS_MS 40       // a lookup on the fake clock
+#define HANDSHAKE_MS 90 // a new connection
+
+typedef struct {
+  // Behavior
+  int keepalive_ms;    // idle connections are dropped silently after this
+  bool close_each;     // answers with "Connection: close"
+  bool forget_tickets; // restarted, resumption offers fall back to full
+  int status;
+  const char *etag;
+  const char *body;
+  // What it saw
+  int full, resumed, requests, conns_open;
+  char url[320];
+  char host[64];
+  char if_none_match[64];
+} server_t;
+
+static server_t s_srv;
+
+struct esp_http_client {
+  esp_http_client_config_t cfg;
+  char url[320];
+  char host[64];
+  char if_none_match[64];
+  bool tcp_up;  // as far as the client knows
+  bool dropped; // by the server, the client finds out on the next read
+  bool ticket;  // session saved from an earlier handshake
+  int64_t last_io_us;
+  int status;
+  size_t body_len, body_pos;
+};
+
+static void dispatch(esp_http_client_handle_t c, esp_http_client_event_id_t id,
+                     const char *key, const char *value) {
+  esp_http_client_event_t evt = {.event_id = id,
+                                 .client = c,
+                                 .user_data = c->cfg.user_data,
+                                 .header_key = (char *)key,
+                                 .header_value = (char *)value};
+  c->cfg.event_handler(&evt);
+}
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config) {
+  esp_http_client_handle_t c = calloc(1, sizeof(*c));
+  c->cfg = *config;
+  CHECK(config->keep_alive_enable);
+  return c;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t c,
+                                  const char *url) {
+  strcpy(c->url, url);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c,
+                                     const char *key, const char *value) {
+  if (strcmp(key, "Host") == 0)
+    strcpy(c->host, value);
+  else if (strcmp(key, "If-None-Match") == 0)
+    strcpy(c->if_none_match, value);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t c,
+                                        const char *key) {
+  if (strcmp(key, "If-None-Match") == 0)
+    c->if_none_match[0] = '\0';
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len) {
+  if (c->tcp_up && s_srv.keepalive_ms &&
+      esp_timer_get_time() - c->last_io_us > s_srv.keepalive_ms * 1000LL)
+    c->dropped = true;
+  if (!c->tcp_up) {
+    bool https = strncmp(c->url, "https:", 6) == 0;
+    if (https && c->ticket && !s_srv.forget_tickets)
+      s_srv.resumed++;
+    else if (https)
+      s_srv.full++;
+    c->ticket = https && c->cfg.save_client_session;
+    c->tcp_up = true;
+    c->dropped = false;
+    s_srv.conns_open++;
+    host_time_advance_ms(HANDSHAKE_MS);
+    dispatch(c, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+  }
+  // The request goes out even on a dropped connection, the failure shows
+  // when the response is read
+  c->last_io_us = esp_timer_get_time();
+  return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t c) {
+  if (c->dropped)
+    return ESP_FAIL;
+  s_srv.requests++;
+  strcpy(s_srv.url, c->url);
+  strcpy(s_srv.host, c->host);
+  strcpy(s_srv.if_none_match, c->if_none_match);
+
+  c->status = s_srv.status;
+  c->body_len = strlen(s_srv.body);
+  if (s_srv.etag && strcmp(c->if_none_match, s_srv.etag) == 0) {
+    c->status = 304;
+    c->body_len = 0;
+  }
+  c->body_pos = 0;
+  if (s_srv.etag)
+    dispatch(c, HTTP_EVENT_ON_HEADER, "ETag", s_srv.etag);
+  if (s_srv.close_each)
+    dispatch(c, HTTP_EVENT_ON_HEADER, "connection", "close");
+  return c->body_len;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c) {
+  return c->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buf, int len) {
+  size_t n = c->body_len - c->body_pos;
+  if (n > (size_t)len)
+    n = len;
+  memcpy(buf, s_srv.body + c->body_pos, n);
+  c->body_pos += n;
+  return n;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t c) {
+  return c->body_pos == c->body_len;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c) {
+  if (c->tcp_up) {
+    c->tcp_up = false;
+    s_srv.conns_open--;
+    dispatch(c, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c) {
+  esp_http_client_close(c);
+  free(c);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_and_clear_last_tls_error(
+    esp_http_client_handle_t c, int *esp_tls_code, int *flags) {
+  *esp_tls_code = *flags = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf) { return ESP_OK; }
+
+// app_dns: every API host resolves to the stand-in
+void app_dns_init(void) {}
+void app_dns_prefetch(const char *host, uint32_t within_s) {}
+bool app_dns_lookup(const char *host, char *ip, size_t len) {
+  host_time_advance_ms(DNS_MS);
+  snprintf(ip, len, "%s", API_IP);
+  return true;
+}
+
+typedef struct {
+  char data[256];
+  size_t len;
+  bool refuse;
+} body_t;
+
+static bool on_body(void *ctx, const char *data, size_t len) {
+  body_t *b = ctx;
+  if (b->refuse)
+    return false;
+  CHECK(b->len + len < sizeof(b->data));
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  return true;
+}
+
+static esp_err_t get(const char *url, const char *etag, app_http_result_t *res,
+                     body_t *body) {
+  memset(body->data, 0, sizeof(body->data));
+  body->len = 0;
+  app_http_req_t req = {.url = url,
+                        .accept_encoding = "gzip",
+                        .if_none_match = etag,
+                        .on_body = on_body,
+                        .ctx = body};
+  return app_http_get(&req, res);
+}
+
+#define NOW_URL "https://api.example.com/v7/weather/now?location=101010100"
+
+int main(void) {
+  app_http_result_t res;
+  app_http_stats_t st;
+  body_t body = {0};
+  host_time_set_us(1000000);
+  app_http_init();
+
+  s_srv = (server_t){.keepalive_ms = 30000,
+                     .status = 200,
+                     .etag = "\"w1\"",
+                     .body = "{\"code\":\"200\"}"};
+
+  // First call: full handshake, dialed by address, Host keeps the name
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.status == 200 && res.conn == APP_HTTP_CONN_FULL);
+  CHECK(strcmp(body.data, s_srv.body) == 0 && res.body_bytes == body.len);
+  CHECK(strcmp(res.etag, "\"w1\"") == 0);
+  CHECK(strcmp(s_srv.url, "https://" API_IP
+                          "/v7/weather/now?location=101010100") == 0);
+  CHECK(strcmp(s_srv.host, "api.example.com") == 0);
+  CHECK(s_srv.full == 1 && s_srv.conns_open == 1);
+  // The lookup before the dial is not connect time
+  CHECK(res.open_ms == HANDSHAKE_MS && res.total_ms == DNS_MS + HANDSHAKE_MS);
+
+  // Within the keep-alive: same connection, validators sent then cleared
+  host_time_advance_ms(10000);
+  CHECK(get(NOW_URL, "\"w1\"", &res, &body) == ESP_OK);
+  CHECK(res.status == 304 && res.conn == APP_HTTP_CONN_REUSED);
+  CHECK(body.len == 0 && strcmp(s_srv.if_none_match, "\"w1\"") == 0);
+  host_time_advance_ms(10000);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.status == 200 && res.conn == APP_HTTP_CONN_REUSED);
+  CHECK(s_srv.if_none_match[0] == '\0');
+
+  // The server dropped the idle connection: one redial, resumed
+  host_time_advance_ms(40000);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_TICKET && s_srv.resumed == 1);
+  app_http_get_stats(&st);
+  CHECK(st.stale_retries == 1);
+
+  // Idle past HTTP_IDLE_CLOSE_MS: closed up front, no failed attempt
+  host_time_advance_ms(60000);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_TICKET && s_srv.resumed == 2);
+  app_http_get_stats(&st);
+  CHECK(st.stale_retries == 1);
+
+  // "Connection: close" is honored, the next call dials again
+  s_srv.close_each = true;
+  host_time_advance_ms(1000);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_REUSED && s_srv.conns_open == 0);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_TICKET && s_srv.resumed == 3);
+  s_srv.close_each = false;
+
+  // A consumer abort is not a stale connection: no retry, socket closed
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_TICKET && s_srv.resumed == 4);
+  int requests = s_srv.requests;
+  body.refuse = true;
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_ERR_INVALID_RESPONSE);
+  body.refuse = false;
+  CHECK(s_srv.requests == requests + 1 && s_srv.conns_open == 0);
+
+  // A server that lost its tickets still serves the client
+  s_srv.forget_tickets = true;
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(s_srv.full == 2);
+  s_srv.forget_tickets = false;
+
+  // Plain HTTP and more hosts than slots: the least recently used client
+  // is evicted and its connection closed
+  host_time_advance_ms(1000);
+  CHECK(get("http://api.example.com/v1/a", NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_FULL && s_srv.full == 2);
+  host_time_advance_ms(1000);
+  CHECK(get("https://air.example.com:8443/v1/b", NULL, &res, &body) ==
+        ESP_OK);
+  CHECK(strcmp(s_srv.host, "air.example.com:8443") == 0);
+  CHECK(strncmp(s_srv.url, "https://" API_IP ":8443/v1/b", 28) == 0);
+  CHECK(s_srv.conns_open == 3);
+  host_time_advance_ms(1000);
+  CHECK(get("https://geo.example.com/v2/c", NULL, &res, &body) == ESP_OK);
+  CHECK(s_srv.conns_open == 3);
+  host_time_advance_ms(1000);
+  CHECK(get(NOW_URL, NULL, &res, &body) == ESP_OK);
+  CHECK(res.conn == APP_HTTP_CONN_FULL); // evicted, session gone with it
+
+  // Stats agree with what the server saw. A ticket offered is not a
+  // resumption (the server without tickets did one full handshake for it),
+  // and the plain HTTP connect counts as full
+  app_http_get_stats(&st);
+  app_phase_stats_t connect;
+  app_metrics_get(APP_PHASE_CONNECT, &connect);
+  CHECK(st.requests == 14 && st.failures == 1);
+  CHECK(st.reused == 3 && st.stale_retries == 1);
+  CHECK(st.ticket_offered == s_srv.resumed + 1);
+  CHECK(st.full + st.ticket_offered ==
+        (uint32_t)s_srv.full + s_srv.resumed + 1);
+  CHECK(connect.count == st.full + st.ticket_offered);
+  CHECK(connect.max_us == HANDSHAKE_MS * 1000);
+  printf("http: %lu requests, %lu reused, %lu ticket offered, %lu full, "
+         "%lu stale retries, %lu failures\n",
+         (unsigned long)st.requests, (unsigned long)st.reused,
+         (unsigned long)st.ticket_offered, (unsigned long)st.full,
+         (unsigned long)st.stale_retries, (unsigned long)st.failures);
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include "app_json.h"
+#include "host_test.h"
+#include <string.h>
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+// app_json: paths, values and errors, the same for every way a body can be
+// split into chunks, and parse cost next to cJSON when it is available.
+
+typedef struct {
+  char text[2048];
+  size_t len;
+} events_t;
+
+// One "path=value@index" line per value
+static void record(void *ctx, const char *path, const char *value,
+                   int index) {
+  events_t *ev = ctx;
+  ev->len += snprintf(ev->text + ev->len, sizeof(ev->text) - ev->len,
+                      "%s=%s@%d\n", path, value, index);
+  CHECK(ev->len < sizeof(ev->text));
+}
+
+static bool parse(const char *doc, size_t chunk, events_t *ev) {
+  app_json_t js;
+  memset(ev, 0, sizeof(*ev));
+  app_json_init(&js, record, ev);
+  size_t len = strlen(doc);
+  for (size_t i = 0; i < len; i += chunk) {
+    if (!app_json_feed(&js, doc + i, len - i < chunk ? len - i : chunk))
+      return false;
+  }
+  return app_json_finish(&js);
+}
+
+// Same outcome and events for every chunk size, returns the events
+static bool parse_all(const char *doc, events_t *ev) {
+  bool ok = parse(doc, strlen(doc) + 1, ev);
+  for (size_t chunk = 1; chunk <= strlen(doc); chunk++) {
+    events_t again;
+    CHECK(parse(doc, chunk, &again) == ok);
+    CHECK(strcmp(again.text, ev->text) == 0);
+  }
+  return ok;
+}
+
+static void expect(const char *doc, const char *events) {
+  events_t ev;
+  if (!parse_all(doc, &ev) || strcmp(ev.text, events) != 0) {
+    fprintf(stderr, "doc: %s\ngot:\n%s\nwant:\n%s\n", doc, ev.text, events);
+    CHECK(0);
+  }
+}
+
+static void reject(const char *doc) {
+  events_t ev;
+  if (parse_all(doc, &ev)) {
+    fprintf(stderr, "accepted: %s\n", doc);
+    CHECK(0);
+  }
+}
+
+static const char NOW_BODY[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:35+08:00\","
+    "\"fxLink\":\"https://www.qweather.com/weather/beijing-101010100.html\","
+    "\"now\":{\"obsTime\":\"2024-05-01T10:30+08:00\",\"temp\":\"24\","
+    "\"feelsLike\":\"23\",\"icon\":\"101\",\"text\":\"\\u591a\\u4e91\","
+    "\"wind360\":\"180\",\"windDir\":\"南风\",\"windScale\":\"2\","
+    "\"windSpeed\":\"9\",\"humidity\":\"33\",\"precip\":\"0.0\","
+    "\"pressure\":\"1008\",\"vis\":\"30\",\"cloud\":\"91\",\"dew\":\"7\"},"
+    "\"refer\":{\"sources\":[\"QWeather\"],\"license\":[\"CC BY-SA 4.0\"]}}";
+
+static void count_value(void *ctx, const char *path, const char *value,
+                        int index) {
+  (*(int *)ctx)++;
+}
+
+#ifdef HAVE_CJSON
+static size_t s_allocs;
+
+static void *count_malloc(size_t n) {
+  s_allocs++;
+  return malloc(n);
+}
+#endif
+
+static void bench(void) {
+  const int rounds = 20000;
+  size_t len = strlen(NOW_BODY);
+  int values = 0;
+  size_t allocs = host_heap_allocs();
+  int64_t t0 = host_now_us();
+  for (int r = 0; r < rounds; r++) {
+    app_json_t js;
+    app_json_init(&js, count_value, &values);
+    // 536 byte segments, the smallest TCP MSS
+    for (size_t i = 0; i < len; i += 536)
+      app_json_feed(&js, NOW_BODY + i, len - i < 536 ? len - i : 536);
+    CHECK(app_json_finish(&js));
+  }
+  double us = (double)(host_now_us() - t0) / rounds;
+  CHECK(values == rounds * 20);
+  CHECK(host_heap_allocs() == allocs);
+  printf("app_json: %zu B /now body in %.2f us, 0 allocations, %zu B state\n",
+         len, us, sizeof(app_json_t));
+
+#ifdef HAVE_CJSON
+  cJSON_Hooks hooks = {count_malloc, free};
+  cJSON_InitHooks(&hooks);
+  t0 = host_now_us();
+  for (int r = 0; r < rounds; r++) {
+    cJSON *root = cJSON_ParseWithLength(NOW_BODY, len);
+    CHECK(root);
+    cJSON_Delete(root);
+  }
+  us = (double)(host_now_us() - t0) / rounds;
+  printf("cJSON:    %zu B /now body in %.2f us, %zu allocations\n", len, us,
+         s_allocs / rounds);
+#else
+  printf("cJSON:    not found, comparison skipped\n");
+#endif
+}
+
+int main(void) {
+  expect(NOW_BODY, "code=200@-1\n"
+                   "updateTime=2024-05-01T10:35+08:00@-1\n"
+                   "fxLink=https://www.qweather.com/weather/"
+                   "beijing-101010@-1\n" // cut to 47 bytes
+                   "now.obsTime=2024-05-01T10:30+08:00@-1\n"
+                   "now.temp=24@-1\n"
+                   "now.feelsLike=23@-1\n"
+                   "now.icon=101@-1\n"
+                   "now.text=多云@-1\n"
+                   "now.wind360=180@-1\n"
+                   "now.windDir=南风@-1\n"
+                   "now.windScale=2@-1\n"
+                   "now.windSpeed=9@-1\n"
+                   "now.humidity=33@-1\n"
+                   "now.precip=0.0@-1\n"
+                   "now.pressure=1008@-1\n"
+                   "now.vis=30@-1\n"
+                   "now.cloud=91@-1\n"
+                   "now.dew=7@-1\n"
+                   "refer.sources[]=QWeather@0\n"
+                   "refer.license[]=CC BY-SA 4.0@0\n");
+
+  // Arrays, nesting and literals
+  expect("{\"daily\":[{\"t\":1},{\"t\":-2.5e+3}],\"x\":[[true,false],null]}",
+         "daily[].t=1@0\n"
+         "daily[].t=-2.5e+3@1\n"
+         "x[][]=true@0\n"
+         "x[][]=false@1\n"
+         "x[]=null@1\n");
+  expect("  42 ", "=42@-1\n");
+  expect("-0.5", "=-0.5@-1\n");
+  expect("{}", "");
+  expect("[ ]", "");
+
+  // Escapes, surrogate pairs, UTF-8 kept whole when a value is cut
+  expect("{\"a\\\"b\":\"x\\n\\/\\u00e9\\ud83d\\ude00\"}",
+         "a\"b=x\n/é😀@-1\n");
+  expect("{\"v\":\"0123456789012345678901234567890123456789012345é\"}",
+         "v=0123456789012345678901234567890123456789012345@-1\n");
+  expect("{\"n\":1234567890123456789012345678901234567890123456789}",
+         "n=12345678901234567890123456789012345678901234567@-1\n");
+
+  // Keys too long for the path mute their whole subtree
+  expect("{\"k012345678901234567890123456789012345678901234567890123456789"
+         "0123456789"
+         "\":{\"a\":1},\"b\":2}",
+         "b=2@-1\n");
+
+  // Truncated and misspelled literals
+  reject("tru");
+  reject("{\"ok\":tru}");
+  reject("{\"ok\":truex}");
+  reject("[fals]");
+  reject("[nul,1]");
+  reject("{\"t\":1.}");
+  reject("{\"t\":.5}");
+  reject("{\"t\":-}");
+  reject("{\"t\":01}");
+  reject("{\"t\":1e}");
+  reject("{\"t\":1e+}");
+  reject("{\"t\":0x10}");
+  reject("[1-2]");
+
+  // Structure
+  reject("");
+  reject("{");
+  reject("{\"a\":1");
+  reject("{\"a\" 1}");
+  reject("{\"a\":1,}");
+  reject("[1,]");
+  reject("[1 2]");
+  reject("{\"a\":1}}");
+  reject("{\"a\":1} x");
+  reject("{\"a\":[1}");
+  reject("{\"a\":\"\\x\"}");
+  reject("{\"a\":\"\\u12g4\"}");
+  reject("{\"a\":\"line\nbreak\"}");
+  reject("[[[[[[[[[1]]]]]]]]]"); // deeper than APP_JSON_MAX_DEPTH
+
+  bench();
+  return 0;
+}
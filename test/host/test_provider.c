@@ -0,0 +1,315 @@
+#include "app_json.h"
+#include "app_provider.h"
+#include "host_test.h"
+#include <string.h>
+
+// Provider job tables: regions and fields inside weather_model_t, request
+// URLs, and every field path found in the bodies two mock servers, one per
+// provider, return for the same weather. Both fill the model alike.
+
+static const char Q_NOW[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:35+08:00\",\"now\":{"
+    "\"obsTime\":\"2024-05-01T10:30+08:00\",\"temp\":\"24\",\"feelsLike\":"
+    "\"23\",\"icon\":\"101\",\"text\":\"多云\",\"windSpeed\":\"9\","
+    "\"humidity\":\"33\"}}";
+
+static const char Q_24H[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:35+08:00\",\"hourly\":["
+    "{\"fxTime\":\"2024-05-01T11:00+08:00\",\"temp\":\"25\",\"icon\":\"101\","
+    "\"pop\":\"7\"},"
+    "{\"fxTime\":\"2024-05-01T12:00+08:00\",\"temp\":\"26\",\"icon\":\"100\","
+    "\"pop\":\"0\"},"
+    "{\"fxTime\":\"2024-05-01T13:00+08:00\",\"temp\":\"27\",\"icon\":\"100\","
+    "\"pop\":\"0\"},"
+    "{\"fxTime\":\"2024-05-01T14:00+08:00\",\"temp\":\"27\",\"icon\":\"104\","
+    "\"pop\":\"20\"},"
+    "{\"fxTime\":\"2024-05-01T15:00+08:00\",\"temp\":\"26\",\"icon\":\"305\","
+    "\"pop\":\"55\"},"
+    "{\"fxTime\":\"2024-05-01T16:00+08:00\",\"temp\":\"24\",\"icon\":\"305\","
+    "\"pop\":\"60\"},"
+    "{\"fxTime\":\"2024-05-01T17:00+08:00\",\"temp\":\"22\",\"icon\":\"104\","
+    "\"pop\":\"10\"}]}";
+
+static const char Q_3D[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:35+08:00\",\"daily\":["
+    "{\"fxDate\":\"2024-05-01\",\"tempMax\":\"27\",\"tempMin\":\"14\","
+    "\"iconDay\":\"101\",\"textDay\":\"多云\"},"
+    "{\"fxDate\":\"2024-05-02\",\"tempMax\":\"22\",\"tempMin\":\"12\","
+    "\"iconDay\":\"305\",\"textDay\":\"小雨\"},"
+    "{\"fxDate\":\"2024-05-03\",\"tempMax\":\"-1\",\"tempMin\":\"-8\","
+    "\"iconDay\":\"400\",\"textDay\":\"小雪\"}]}";
+
+static const char Q_AIR[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:00+08:00\",\"now\":{"
+    "\"aqi\":\"55\",\"category\":\"良\",\"pm2p5\":\"30\"}}";
+
+static const char Q_WARNING[] =
+    "{\"code\":\"200\",\"updateTime\":\"2024-05-01T10:20+08:00\",\"warning\":"
+    "[{\"type\":\"1003\",\"severityColor\":\"Blue\"}]}";
+
+static const char Q_GEO[] =
+    "{\"code\":\"200\",\"location\":[{\"name\":\"北京\",\"id\":\"101010100\","
+    "\"lat\":\"39.90499\",\"lon\":\"116.40529\"}]}";
+
+static const char OM_NOW[] =
+    "{\"latitude\":39.9,\"longitude\":116.4,\"current\":{\"time\":"
+    "\"2024-05-01T10:30\",\"temperature_2m\":23.6,\"apparent_temperature\":"
+    "22.8,\"relative_humidity_2m\":33,\"wind_speed_10m\":9.4,"
+    "\"weather_code\":2}}";
+
+// Columns, one more hour than the table keeps
+static const char OM_24H[] =
+    "{\"latitude\":39.9,\"hourly\":{\"time\":[\"2024-05-01T11:00\","
+    "\"2024-05-01T12:00\",\"2024-05-01T13:00\",\"2024-05-01T14:00\","
+    "\"2024-05-01T15:00\",\"2024-05-01T16:00\",\"2024-05-01T17:00\"],"
+    "\"temperature_2m\":[25.1,26,27.2,26.5,25.6,24.4,22],"
+    "\"precipitation_probability\":[7,0,0,20,55,60,10],"
+    "\"weather_code\":[2,0,1,3,61,51,3]}}";
+
+static const char OM_3D[] =
+    "{\"daily\":{\"time\":[\"2024-05-01\",\"2024-05-02\",\"2024-05-03\"],"
+    "\"weather_code\":[2,61,71],\"temperature_2m_max\":[27.4,22,-0.6],"
+    "\"temperature_2m_min\":[14,12.2,-7.5]}}";
+
+static const char OM_AIR[] =
+    "{\"current\":{\"time\":\"2024-05-01T10:00\",\"us_aqi\":55}}";
+
+// Mock servers: the first route whose host and path prefix and query
+// fragment are all in the URL answers it
+typedef struct {
+  const char *prefix;
+  const char *query;
+  const char *body;
+  int hits;
+} route_t;
+
+static route_t s_routes[] = {
+    {"http://127.0.0.1:8081/v7/weather/now?", "location=", Q_NOW},
+    {"http://127.0.0.1:8081/v7/weather/24h?", "location=", Q_24H},
+    {"http://127.0.0.1:8081/v7/weather/3d?", "location=", Q_3D},
+    {"http://127.0.0.1:8081/v7/air/now?", "location=", Q_AIR},
+    {"http://127.0.0.1:8081/v7/warning/now?", "location=", Q_WARNING},
+    {"http://127.0.0.1:8081/geo/v2/city/lookup?", "&number=1", Q_GEO},
+    {"http://127.0.0.1:8082/v1/forecast?", "&current=", OM_NOW},
+    {"http://127.0.0.1:8082/v1/forecast?", "&hourly=", OM_24H},
+    {"http://127.0.0.1:8082/v1/forecast?", "&daily=", OM_3D},
+    {"http://127.0.0.1:8083/v1/air-quality?", "&current=us_aqi", OM_AIR},
+};
+
+static const char *serve(const char *url) {
+  for (size_t i = 0; i < ARRAY_SIZE(s_routes); i++) {
+    route_t *r = &s_routes[i];
+    if (strncmp(url, r->prefix, strlen(r->prefix)) == 0 &&
+        strstr(url, r->query)) {
+      r->hits++;
+      return r->body;
+    }
+  }
+  fprintf(stderr, "no route: %s\n", url);
+  CHECK(0);
+  return NULL;
+}
+
+// The engine's job_on_value without the stamp and cancel handling
+typedef struct {
+  const app_provider_t *provider;
+  const weather_job_t *job;
+  char *region;
+  bool fahrenheit;
+  char status[8];
+  bool stamp_seen;
+  int items;
+  uint32_t field_seen; // bit per field table entry
+} parse_t;
+
+static void on_value(void *ctx, const char *path, const char *value,
+                     int index) {
+  parse_t *p = ctx;
+  const weather_job_t *job = p->job;
+  if (p->provider->status_path && strcmp(path, p->provider->status_path) == 0)
+    snprintf(p->status, sizeof(p->status), "%s", value);
+  if (job->stamp_path && strcmp(path, job->stamp_path) == 0)
+    p->stamp_seen = true;
+  for (size_t i = 0; i < job->field_count; i++) {
+    const json_field_t *f = &job->fields[i];
+    if (strcmp(path, f->path) != 0)
+      continue;
+    char *dst = p->region;
+    if (job->max_items > 0) {
+      if (index < 0 || index >= job->max_items)
+        return;
+      dst += index * job->stride;
+      if (index + 1 > p->items)
+        p->items = index + 1;
+    }
+    app_provider_store(f, dst + f->offset, value, p->fahrenheit);
+    p->field_seen |= 1u << i;
+  }
+}
+
+static void check_tables(const app_provider_t *p) {
+  CHECK(p->job_count > 0 && strcmp(p->jobs[0].name, "now") == 0);
+  CHECK(p->jobs[0].interval_s == 0);
+  CHECK(p->preference_pct > 0 && p->build_url);
+  for (size_t j = 0; j < p->job_count; j++) {
+    const weather_job_t *job = &p->jobs[j];
+    CHECK(job->base + job->size <= sizeof(weather_model_t));
+    CHECK(job->count_at < sizeof(weather_model_t));
+    size_t elem = job->size;
+    if (job->max_items > 0) {
+      CHECK(job->stride * job->max_items == job->size);
+      elem = job->stride;
+    } else {
+      // is_valid lives inside the object
+      CHECK(job->count_at >= job->base &&
+            job->count_at < job->base + job->size);
+    }
+    CHECK(job->field_count > 0 && job->field_count <= 32);
+    for (size_t i = 0; i < job->field_count; i++) {
+      const json_field_t *f = &job->fields[i];
+      CHECK(f->path && f->offset + f->size <= elem);
+      CHECK((f->type == FIELD_CONV) == (f->convert != NULL));
+      if (f->type == FIELD_INT || f->type == FIELD_TEMP)
+        CHECK(f->size == sizeof(int));
+      if (f->type == FIELD_HHMM)
+        CHECK(f->size >= 6);
+    }
+  }
+}
+
+// Runs every job of `p` against the mock servers into `model`
+static void fetch_all(const app_provider_t *p, const app_config_t *cfg,
+                      weather_model_t *model) {
+  for (size_t j = 0; j < p->job_count; j++) {
+    const weather_job_t *job = &p->jobs[j];
+    char url[256];
+    CHECK(p->build_url(job, cfg, model, url, sizeof(url)));
+    const char *body = serve(url);
+
+    parse_t parse = {p, job, (char *)model + job->base, cfg->is_fahrenheit};
+    memset(parse.region, 0, job->size);
+    app_json_t js;
+    app_json_init(&js, on_value, &parse);
+    // 536 byte segments, the smallest TCP MSS
+    size_t len = strlen(body);
+    for (size_t i = 0; i < len; i += 536)
+      CHECK(app_json_feed(&js, body + i, len - i < 536 ? len - i : 536));
+    CHECK(app_json_finish(&js));
+
+    if (p->status_path)
+      CHECK(strcmp(parse.status, p->status_ok) == 0);
+    CHECK(!job->stamp_path || parse.stamp_seen);
+    // Every path of the table is in the body
+    if (parse.field_seen != (1u << job->field_count) - 1) {
+      fprintf(stderr, "%s %s: field mask %x\n", p->name, job->name,
+              (unsigned)parse.field_seen);
+      CHECK(0);
+    }
+    if (job->max_items > 0)
+      *((uint8_t *)model + job->count_at) = parse.items;
+    else
+      *(bool *)((char *)model + job->count_at) = true;
+  }
+}
+
+static void test_urls(void) {
+  app_config_t cfg = {0};
+  weather_model_t model = {0};
+  char url[256];
+  const app_provider_t *q = &app_provider_qweather;
+  const app_provider_t *om = &app_provider_open_meteo;
+
+  strcpy(cfg.location, "101010100");
+  CHECK(q->build_url(&q->jobs[0], &cfg, &model, url, sizeof(url)));
+  CHECK(strcmp(url, "http://127.0.0.1:8081/v7/weather/now?location=101010100"
+                    "&key=test-key&lang=zh") == 0);
+  // Cut URLs are refused rather than sent
+  CHECK(!q->build_url(&q->jobs[0], &cfg, &model, url, 40));
+
+  // Open-Meteo needs coordinates: from the config, or from the place
+  // QWeather looked up for this very location
+  CHECK(!om->build_url(&om->jobs[0], &cfg, &model, url, sizeof(url)));
+  model.place.is_valid = true;
+  strcpy(model.place.location, "101020100");
+  strcpy(model.place.lat, "31.23");
+  strcpy(model.place.lon, "121.47");
+  CHECK(!om->build_url(&om->jobs[0], &cfg, &model, url, sizeof(url)));
+  strcpy(model.place.location, "101010100");
+  CHECK(om->build_url(&om->jobs[3], &cfg, &model, url, sizeof(url)));
+  CHECK(strcmp(url, "http://127.0.0.1:8083/v1/air-quality?latitude=31.23"
+                    "&longitude=121.47&timezone=auto&current=us_aqi") == 0);
+
+  strcpy(cfg.location, "116.41,39.92");
+  CHECK(om->build_url(&om->jobs[0], &cfg, &model, url, sizeof(url)));
+  const char *want = "http://127.0.0.1:8082/v1/forecast?latitude=39.92"
+                     "&longitude=116.41&timezone=auto&current=";
+  CHECK(strncmp(url, want, strlen(want)) == 0);
+  strcpy(cfg.location, "116.41,");
+  CHECK(!om->build_url(&om->jobs[0], &cfg, &model, url, sizeof(url)));
+}
+
+static void test_same_weather(bool fahrenheit) {
+  app_config_t cfg = {0};
+  strcpy(cfg.location, "101010100");
+  cfg.is_fahrenheit = fahrenheit;
+  static weather_model_t q, om;
+  memset(&q, 0, sizeof(q));
+  memset(&om, 0, sizeof(om));
+  fetch_all(&app_provider_qweather, &cfg, &q);
+  CHECK(q.place.is_valid && strcmp(q.place.lat, "39.90499") == 0);
+  strcpy(q.place.location, cfg.location); // the engine tags the lookup
+  // Failover: Open-Meteo takes over with QWeather's coordinates
+  om.place = q.place;
+  fetch_all(&app_provider_open_meteo, &cfg, &om);
+
+  CHECK(q.now.is_valid && om.now.is_valid);
+  CHECK(q.now.temp == (fahrenheit ? 75 : 24));
+  CHECK(om.now.temp == (fahrenheit ? 74 : 24)); // 23.6 C
+  // Open-Meteo's decimals round apart from QWeather's after conversion
+  if (!fahrenheit)
+    CHECK(q.now.feels_like == om.now.feels_like);
+  CHECK(strcmp(q.now.description, "多云") == 0);
+  CHECK(strcmp(q.now.description, om.now.description) == 0);
+  CHECK(strcmp(q.now.icon, om.now.icon) == 0);
+  CHECK(q.now.wind_speed == 9 && om.now.wind_speed == 9);
+  CHECK(q.now.humidity == 33 && om.now.humidity == 33);
+
+  // Extra hours are dropped, not written past the array
+  CHECK(q.hourly_count == WEATHER_HOURLY_MAX);
+  CHECK(om.hourly_count == WEATHER_HOURLY_MAX);
+  for (int i = 0; i < WEATHER_HOURLY_MAX; i++) {
+    CHECK(strcmp(q.hourly[i].time, om.hourly[i].time) == 0);
+    CHECK(fahrenheit || q.hourly[i].temp == om.hourly[i].temp);
+    CHECK(q.hourly[i].pop == om.hourly[i].pop);
+  }
+  CHECK(strcmp(q.hourly[0].time, "11:00") == 0);
+  CHECK(strcmp(om.hourly[4].icon, "305") == 0);
+
+  CHECK(q.daily_count == 3 && om.daily_count == 3);
+  for (int i = 0; i < 3; i++) {
+    CHECK(strcmp(q.daily[i].date, om.daily[i].date) == 0);
+    CHECK(fahrenheit || q.daily[i].temp_max == om.daily[i].temp_max);
+    CHECK(fahrenheit || q.daily[i].temp_min == om.daily[i].temp_min);
+    CHECK(strcmp(q.daily[i].icon_day, om.daily[i].icon_day) == 0);
+    CHECK(strcmp(q.daily[i].text_day, om.daily[i].text_day) == 0);
+  }
+  CHECK(om.daily[2].temp_min == (fahrenheit ? 19 : -8)); // -7.5 rounds away
+
+  CHECK(q.air.aqi == 55 && om.air.aqi == 55);
+  CHECK(strcmp(q.air.category, "良") == 0 && om.air.category[0] == '\0');
+  CHECK(q.warning_count == 1 && strcmp(q.warning[0].type, "1003") == 0);
+  CHECK(om.warning_count == 0);
+}
+
+int main(void) {
+  check_tables(&app_provider_qweather);
+  check_tables(&app_provider_open_meteo);
+  test_urls();
+  test_same_weather(false);
+  test_same_weather(true);
+  for (size_t i = 0; i < ARRAY_SIZE(s_routes); i++)
+    CHECK(s_routes[i].hits == 2);
+  printf("provider: %zu + %zu jobs, every field found on both mock servers\n",
+         app_provider_qweather.job_count, app_provider_open_meteo.job_count);
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include "app_sched.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_sched: timestamp parsing, the delay bounds of each path, retry
+// spreading across a fleet, and a simulated day against a provider that
+// publishes every 20 minutes, next to a fixed 15 minute poll.
+
+#define MIN 60
+#define T0 1700000000 // any wall clock start
+
+static void test_parse_time(void) {
+  CHECK(app_sched_parse_time("1970-01-01T00:00Z") == 0);
+  CHECK(app_sched_parse_time("2026-10-16T10:05+08:00") == 1792116300);
+  CHECK(app_sched_parse_time("2026-10-16T02:05") == 1792116300);
+  CHECK(app_sched_parse_time("2026-10-16T02:05:30") == 1792116330);
+  CHECK(app_sched_parse_time("2026-10-15T21:05-0500") == 1792116300);
+  CHECK(app_sched_parse_time("2024-02-29T00:00+00:00") == 1709164800);
+  CHECK(app_sched_parse_time("") == 0);
+  CHECK(app_sched_parse_time("2026-10-16") == 0);
+  CHECK(app_sched_parse_time("2026-10-16T1:05") == 0);
+  CHECK(app_sched_parse_time("2026-10-16T10:05:3") == 0);
+  CHECK(app_sched_parse_time("2026-10-16T10:05+8") == 0);
+}
+
+// Delay without jitter falls in [lo, lo + 90)
+static void check_delay(app_sched_t *s, int64_t now, uint32_t lo) {
+  uint32_t d = app_sched_next_delay_s(s, now);
+  if (d < lo || d >= lo + 90) {
+    fprintf(stderr, "delay %u, want %u + jitter\n", (unsigned)d,
+            (unsigned)lo);
+    CHECK(0);
+  }
+}
+
+static void test_update_paths(void) {
+  app_sched_t s;
+  app_sched_init(&s, 1);
+  check_delay(&s, T0, 15 * MIN); // nothing known yet
+
+  // Aims at the next publish plus the margin, learns the cadence
+  app_sched_on_success(&s, T0, true, false);
+  check_delay(&s, T0 + 30, 15 * MIN + MIN - 30);
+  for (int i = 1; i <= 12; i++)
+    app_sched_on_success(&s, T0 + i * 20 * MIN, true, false);
+  CHECK(s.cadence_s > 19 * MIN && s.cadence_s <= 20 * MIN);
+  int64_t last = T0 + 12 * 20 * MIN;
+  check_delay(&s, last + 30, s.cadence_s + MIN - 30);
+
+  // Older or repeated stamps change nothing, implausible intervals are not
+  // learned
+  int32_t cadence = s.cadence_s;
+  app_sched_on_success(&s, last - 20 * MIN, false, false);
+  app_sched_on_success(&s, last, false, false);
+  CHECK(s.last_update_s == last && s.cadence_s == cadence);
+  app_sched_on_success(&s, last + MIN, true, false);
+  app_sched_on_success(&s, last + MIN + 6 * 60 * MIN, true, false);
+  CHECK(s.cadence_s == cadence);
+  last += MIN + 6 * 60 * MIN;
+
+  // Publish overdue: 2, 4, 8, 16 minutes, then the 30 minute cap
+  app_sched_init(&s, 7);
+  app_sched_on_success(&s, T0, true, false);
+  int64_t now = T0 + 20 * MIN;
+  const uint32_t want[] = {2, 2, 4, 8, 16, 30, 30};
+  for (size_t i = 0; i < sizeof(want) / sizeof(want[0]); i++) {
+    if (i > 0)
+      app_sched_on_success(&s, T0, false, false);
+    check_delay(&s, now, want[i] * MIN);
+  }
+
+  // Urgent caps the wait at 10 minutes, never below the 1 minute floor
+  app_sched_on_success(&s, T0, false, true);
+  check_delay(&s, now, 10 * MIN);
+  app_sched_init(&s, 3);
+  app_sched_on_success(&s, T0, true, true);
+  check_delay(&s, T0, 10 * MIN);
+  s.cadence_s = 5 * MIN;
+  check_delay(&s, T0 + 5 * MIN, MIN);
+}
+
+static void test_failures(void) {
+  // Bounds: 60 s first, then within [60, 3 * last), never past 15 minutes
+  for (uint32_t seed = 1; seed <= 1000; seed++) {
+    app_sched_t s;
+    app_sched_init(&s, seed);
+    app_sched_on_success(&s, T0, true, false);
+    uint32_t prev = 0;
+    for (int i = 0; i < 12; i++) {
+      app_sched_on_failure(&s);
+      uint32_t d = app_sched_next_delay_s(&s, T0);
+      CHECK(d >= 60 && d <= 15 * MIN);
+      CHECK(d == s.fail_delay_s); // no extra jitter on top
+      CHECK(i > 0 || d == 60);
+      CHECK(i == 0 || d < 3 * prev || d == 15 * MIN);
+      prev = d;
+    }
+    CHECK(s.missed);
+    // Success resets the backoff, the interval across the outage is not
+    // learned
+    int32_t cadence = s.cadence_s;
+    app_sched_on_success(&s, T0 + 2 * 60 * MIN, true, false);
+    CHECK(s.failures == 0 && s.fail_delay_s == 0 && !s.missed);
+    CHECK(s.cadence_s == cadence);
+  }
+
+  // 1000 devices losing the API at once do not come back in lockstep: the
+  // fourth retry lands in hundreds of different seconds
+  static uint8_t seen[4 * 15 * MIN];
+  int distinct = 0;
+  for (uint32_t seed = 1; seed <= 1000; seed++) {
+    app_sched_t s;
+    app_sched_init(&s, seed * 2654435761u);
+    uint32_t at = 0;
+    for (int i = 0; i < 4; i++) {
+      app_sched_on_failure(&s);
+      at += app_sched_next_delay_s(&s, T0);
+    }
+    CHECK(at < sizeof(seen));
+    distinct += !seen[at]++;
+  }
+  CHECK(distinct > 300);
+  printf("sched: 1000 devices, 4th retry spread over %d distinct seconds\n",
+         distinct);
+}
+
+// Provider publishing every 20 minutes, each stamp served 30-150 s later,
+// with a one hour outage in the afternoon. Returns calls made, writes the
+// mean time from a stamp being served to the device having it (or newer).
+#define DAY (24 * 60 * MIN)
+#define PUBLISH (20 * MIN)
+#define OUTAGE_FROM (14 * 60 * MIN)
+#define OUTAGE_TO (15 * 60 * MIN)
+
+static int64_t served_at(int k) {
+  return (int64_t)k * PUBLISH + 30 + (k * 37) % 121;
+}
+
+// Newest stamp index served at t, -1 before the first
+static int newest(int64_t t) {
+  int k = t / PUBLISH;
+  while (k >= 0 && served_at(k) > t)
+    k--;
+  return k;
+}
+
+static int simulate(bool fixed, double *stale_s, int *wasted) {
+  app_sched_t s;
+  app_sched_init(&s, 42);
+  int calls = 0, have = -1;
+  *wasted = 0;
+  double stale = 0;
+  int64_t t = 5 * MIN;
+  while (t < DAY) {
+    calls++;
+    bool ok = t < OUTAGE_FROM || t >= OUTAGE_TO;
+    int k = newest(t);
+    if (ok && k >= 0) {
+      // Every stamp between the last one seen and this one waited until now
+      for (int j = have + 1; j <= k; j++)
+        stale += t - served_at(j);
+      bool changed = k != have;
+      *wasted += !changed;
+      have = k;
+      app_sched_on_success(&s, T0 + (int64_t)k * PUBLISH, changed, false);
+    } else {
+      app_sched_on_failure(&s);
+      ++*wasted;
+    }
+    t += fixed ? 15 * MIN : app_sched_next_delay_s(&s, T0 + t);
+  }
+  *stale_s = stale / (newest(DAY) + 1);
+  return calls;
+}
+
+static void test_day(void) {
+  double stale_sched, stale_fixed;
+  int wasted_sched, wasted_fixed;
+  int calls_sched = simulate(false, &stale_sched, &wasted_sched);
+  int calls_fixed = simulate(true, &stale_fixed, &wasted_fixed);
+  printf("sched: one day, scheduler %d calls (%d without new data), %.0f s "
+         "mean staleness\n",
+         calls_sched, wasted_sched, stale_sched);
+  printf("sched: one day, fixed 15 min %d calls (%d without new data), "
+         "%.0f s mean staleness\n",
+         calls_fixed, wasted_fixed, stale_fixed);
+  CHECK(stale_sched < stale_fixed / 2);
+  CHECK(calls_sched < calls_fixed * 13 / 10);
+}
+
+int main(void) {
+  test_parse_time();
+  test_update_paths();
+  test_failures();
+  test_day();
+  return 0;
+}
@@ -0,0 +1,284 @@
+#include "app_snapshot.h"
+#include "host_test.h"
+#include <math.h>
+#include <string.h>
+
+// The snapshot codec on frames drawn like the UI, flat panels and
+// anti-aliased shapes in 4 bpp shades, against noise. Ratio and decode
+// speed, then save and show on the partition fake with a power cut at each
+// flash operation of a save.
+
+#define W 135
+#define H 240
+#define PX (W * H)
+#define PART_SIZE (128 * 1024)
+#define BAND_ROWS 40
+
+static uint16_t rgb565(int r, int g, int b) {
+  return (uint16_t)((r >> 3) << 11 | (g >> 2) << 5 | b >> 3);
+}
+
+static uint16_t blend(int fr, int fg, int fb, int br, int bg, int bb,
+                      int a16) {
+  // LVGL fonts are 4 bpp: 16 coverage levels
+  return rgb565(br + (fr - br) * a16 / 15, bg + (fg - bg) * a16 / 15,
+                bb + (fb - bb) * a16 / 15);
+}
+
+// Coverage of pixel (x, y) by a ring, 4x4 supersampled, in 0..15
+static int ring_cover(int x, int y, double cx, double cy, double rx,
+                      double ry, double stroke) {
+  int in = 0;
+  for (int sy = 0; sy < 4; sy++) {
+    for (int sx = 0; sx < 4; sx++) {
+      double dx = (x + (sx + 0.5) / 4 - cx) / rx;
+      double dy = (y + (sy + 0.5) / 4 - cy) / ry;
+      double d = sqrt(dx * dx + dy * dy);
+      in += d <= 1 && d >= 1 - stroke;
+    }
+  }
+  return in * 15 / 16;
+}
+
+// The main screen: status bar, large clock digits as rings, a sun icon,
+// a line of temperature "text" and a forecast strip
+static void draw_ui(uint16_t *f, int minute) {
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) {
+      uint16_t p = rgb565(16, 16, 24);
+      if (y < 16)
+        p = rgb565(40, 40, 56);
+      if (y >= 200)
+        p = rgb565(24, 32, 48);
+      // Clock digits: four rings whose shape moves with the minute
+      for (int d = 0; d < 4; d++) {
+        double cx = 17 + d * 31 + (d > 1 ? 4 : 0);
+        double ry = 18 + (minute + d * 3) % 5;
+        int a = ring_cover(x, y, cx, 60, 12, ry, 0.3);
+        if (a)
+          p = blend(255, 255, 255, 16, 16, 24, a);
+      }
+      // Sun icon
+      int a = ring_cover(x, y, 40, 130, 18, 18, 1.0);
+      if (a)
+        p = blend(255, 200, 0, 16, 16, 24, a);
+      // Temperature text, glyph-sized rings
+      for (int g = 0; g < 3; g++) {
+        a = ring_cover(x, y, 80 + g * 14, 130, 5, 8, 0.45);
+        if (a)
+          p = blend(200, 220, 255, 16, 16, 24, a);
+      }
+      // Forecast strip, three small icons and labels
+      for (int g = 0; g < 3; g++) {
+        a = ring_cover(x, y, 22 + g * 45, 215, 8, 8, 1.0);
+        if (a)
+          p = blend(120 + g * 60, 180, 255 - g * 60, 24, 32, 48, a);
+        a = ring_cover(x, y, 22 + g * 45, 231, 3, 5, 0.5);
+        if (a)
+          p = blend(220, 220, 220, 24, 32, 48, a);
+      }
+      f[y * W + x] = p;
+    }
+  }
+}
+
+static void draw_noise(uint16_t *f) {
+  uint32_t s = 1;
+  for (int i = 0; i < PX; i++) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    f[i] = (uint16_t)s;
+  }
+}
+
+// Bytes of a run-length-only encoding of the same frame, for comparison
+static size_t rle_size(const uint16_t *f) {
+  size_t n = 0;
+  for (int i = 0; i < PX;) {
+    int run = 1;
+    while (i + run < PX && f[i + run] == f[i] && run < 128)
+      run++;
+    n += 3;
+    i += run;
+  }
+  return n;
+}
+
+typedef struct {
+  uint16_t *out;
+  int bands;
+} show_t;
+
+static void draw_band(int y0, int y1, const uint16_t *px, void *arg) {
+  show_t *s = arg;
+  memcpy(s->out + y0 * W, px, (size_t)(y1 - y0) * W * sizeof(uint16_t));
+  s->bands++;
+}
+
+// Shows the stored frame into `out`, false if there is none
+static bool show(uint16_t *out) {
+  static uint16_t band[W * BAND_ROWS];
+  show_t s = {out, 0};
+  if (!app_snapshot_show(W, H, band, BAND_ROWS, draw_band, &s))
+    return false;
+  CHECK(s.bands == (H + BAND_ROWS - 1) / BAND_ROWS);
+  return true;
+}
+
+static void test_codec(void) {
+  static uint16_t frame[PX], back[PX];
+  static uint8_t enc[PX * 3];
+  draw_ui(frame, 0);
+  size_t n = app_snapshot_encode(frame, PX, enc, sizeof(enc));
+  CHECK(n > 0);
+  app_snapshot_dec_t dec;
+  app_snapshot_dec_init(&dec, enc, n);
+  CHECK(app_snapshot_dec_read(&dec, back, PX) == PX);
+  CHECK(memcmp(frame, back, sizeof(frame)) == 0);
+  CHECK(app_snapshot_dec_read(&dec, back, 1) == 0);
+
+  // Band by band, odd band sizes split runs
+  app_snapshot_dec_init(&dec, enc, n);
+  for (size_t at = 0; at < PX;) {
+    size_t k = app_snapshot_dec_read(&dec, back + at, 777);
+    CHECK(k == 777 || at + k == PX);
+    at += k;
+  }
+  CHECK(memcmp(frame, back, sizeof(frame)) == 0);
+
+  // Cut short and corrupt input stop without overrunning
+  app_snapshot_dec_init(&dec, enc, n / 2);
+  CHECK(app_snapshot_dec_read(&dec, back, PX) < PX);
+  enc[n / 3] = 0xFF;
+  app_snapshot_dec_init(&dec, enc, n);
+  CHECK(app_snapshot_dec_read(&dec, back, PX) <= PX);
+
+  // A buffer one byte short is refused rather than overrun
+  draw_ui(frame, 0);
+  n = app_snapshot_encode(frame, PX, enc, sizeof(enc));
+  CHECK(app_snapshot_encode(frame, PX, enc, n - 1) == 0);
+}
+
+static void bench(void) {
+  static uint16_t frame[PX], back[PX];
+  static uint8_t enc[PX * 3];
+  size_t raw = PX * sizeof(uint16_t);
+  size_t worst = 0;
+  for (int minute = 0; minute < 5; minute++) {
+    draw_ui(frame, minute);
+    size_t n = app_snapshot_encode(frame, PX, enc, sizeof(enc));
+    if (n > worst)
+      worst = n;
+  }
+  draw_ui(frame, 0);
+  const int rounds = 200;
+  int64_t t0 = host_now_us();
+  size_t n = 0;
+  for (int i = 0; i < rounds; i++)
+    n = app_snapshot_encode(frame, PX, enc, sizeof(enc));
+  double enc_us = (double)(host_now_us() - t0) / rounds;
+  t0 = host_now_us();
+  for (int i = 0; i < rounds; i++) {
+    app_snapshot_dec_t dec;
+    app_snapshot_dec_init(&dec, enc, n);
+    for (int y = 0; y < H; y += BAND_ROWS)
+      app_snapshot_dec_read(&dec, back + y * W, BAND_ROWS * W);
+  }
+  double dec_us = (double)(host_now_us() - t0) / rounds;
+  CHECK(memcmp(frame, back, sizeof(frame)) == 0);
+  size_t rle = rle_size(frame);
+  printf("snapshot: UI frame %zu B, %.1f%% of raw (run-length only %.1f%%), "
+         "worst of 5 %zu B\n",
+         n, 100.0 * n / raw, 100.0 * rle / raw, worst);
+  printf("snapshot: encode %.0f us, decode %.0f us per frame (%.1f Mpx/s) "
+         "on the host\n",
+         enc_us, dec_us, PX / dec_us);
+  // Small enough that a boot reads a few sectors, better than runs alone
+  CHECK(worst * 4 < raw);
+  CHECK(n < rle);
+
+  draw_noise(frame);
+  n = app_snapshot_encode(frame, PX, enc, sizeof(enc));
+  printf("snapshot: noise %zu B, %.1f%% of raw\n", n, 100.0 * n / raw);
+  CHECK(n > raw); // the literal byte is the cost of the format
+}
+
+static void test_storage(void) {
+  static uint16_t a[PX], b[PX], out[PX];
+  host_partition_add("snapshot", PART_SIZE);
+  app_snapshot_init();
+  CHECK(!show(out));
+
+  draw_ui(a, 0);
+  draw_ui(b, 1);
+  CHECK(app_snapshot_save(a, W, H));
+  CHECK(show(out) && memcmp(out, a, sizeof(a)) == 0);
+  // Another size is not shown
+  static uint16_t band[W * BAND_ROWS];
+  show_t s = {out, 0};
+  CHECK(!app_snapshot_show(W, H - 1, band, BAND_ROWS, draw_band, &s));
+
+  // The same picture again costs no flash
+  host_flash_stats_t fs0, fs;
+  host_partition_stats("snapshot", &fs0);
+  CHECK(app_snapshot_save(a, W, H));
+  host_partition_stats("snapshot", &fs);
+  CHECK(fs.writes == fs0.writes && fs.erases == fs0.erases);
+
+  // Staged then written, the source frame free to change in between
+  static uint16_t scratch[PX];
+  memcpy(scratch, b, sizeof(b));
+  CHECK(app_snapshot_stage(scratch, W, H));
+  memset(scratch, 0, sizeof(scratch));
+  CHECK(app_snapshot_write());
+  CHECK(show(out) && memcmp(out, b, sizeof(b)) == 0);
+  CHECK(!app_snapshot_write()); // nothing staged
+
+  // Noise does not fit a slot and leaves the stored frame alone
+  static uint16_t noise[PX];
+  draw_noise(noise);
+  CHECK(!app_snapshot_save(noise, W, H));
+  CHECK(show(out) && memcmp(out, b, sizeof(b)) == 0);
+
+  app_snapshot_clear();
+  CHECK(!show(out));
+}
+
+// Power goes at each program and erase of a save: the boot shows the
+// previous frame or the new one, never a broken one
+static void test_power_cuts(void) {
+  static uint16_t a[PX], b[PX], out[PX];
+  draw_ui(a, 0);
+  draw_ui(b, 1);
+  uint32_t cut;
+  for (cut = 1;; cut++) {
+    host_partition_add("snapshot", PART_SIZE);
+    host_power_cycle();
+    app_snapshot_init();
+    CHECK(app_snapshot_save(a, W, H));
+    host_flash_seed(cut);
+    host_flash_cut_at(host_flash_ops() + cut);
+    bool ok = app_snapshot_save(b, W, H);
+    bool done = host_flash_powered();
+    CHECK(ok == done);
+    host_power_cycle();
+    app_snapshot_init();
+    CHECK(show(out));
+    if (done) {
+      CHECK(memcmp(out, b, sizeof(b)) == 0);
+      break;
+    }
+    CHECK(memcmp(out, a, sizeof(a)) == 0);
+  }
+  printf("snapshot: power cut at each of %u flash operations of a save\n",
+         (unsigned)(cut - 1));
+}
+
+int main(void) {
+  test_codec();
+  bench();
+  test_storage();
+  test_power_cuts();
+  return 0;
+}
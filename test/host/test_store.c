@@ -0,0 +1,467 @@
+#include "app_record.h"
+#include "app_store.h"
+#include "host_test.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <string.h>
+
+// app_store on the NVS fake: round trips, RTC staging across panics,
+// restarts and power loss, then a power cut at every flash operation of the
+// staging writes (through NVS garbage collection) and of the migration from
+// the raw structs older firmware wrote.
+
+#define NVS_SIZE 0x6000
+#define MIN_MS (60 * 1000)
+#define PREFILL 170 // fills five of the six pages, GC starts soon after
+#define STEPS 200
+
+// Layouts older firmware wrote, frozen copies of the ones in app_store.c
+typedef struct {
+  char ssid[32];
+  char password[64];
+  char location[32];
+  bool is_fahrenheit;
+  uint8_t extra_count;
+  char extra[7][32];
+} legacy_config_t;
+
+typedef struct {
+  char description[32];
+  int temp;
+  int feels_like;
+  int wind_speed;
+  int humidity;
+  char icon[8];
+  bool is_valid;
+} legacy_weather_t;
+
+typedef struct {
+  legacy_weather_t info;
+  uint32_t writes;
+} legacy_weather_record_t;
+
+typedef struct {
+  char location[32];
+  char lat[12];
+  char lon[12];
+  bool is_valid;
+} legacy_place_t;
+
+#define LEGACY_CONFIG_V1_LEN offsetof(legacy_config_t, extra_count)
+
+static void boot(void) {
+  CHECK(nvs_flash_init() == ESP_OK);
+  app_store_init();
+}
+
+static void power_on(void) {
+  host_power_cycle();
+  boot();
+}
+
+static void fresh(void) {
+  host_partition_add("nvs", NVS_SIZE);
+  power_on();
+}
+
+// Consecutive ones always differ materially
+static weather_info_t make_weather(int i) {
+  weather_info_t w;
+  memset(&w, 0, sizeof(w));
+  snprintf(w.description, sizeof(w.description), "%s %d",
+           i % 2 ? "Cloudy" : "Clear", i);
+  snprintf(w.icon, sizeof(w.icon), "%d", i % 2 ? 101 : 100);
+  w.temp = i * 7 % 45 - 10;
+  w.feels_like = w.temp - 2;
+  w.wind_speed = i % 30;
+  w.humidity = 30 + i % 60;
+  w.is_valid = true;
+  return w;
+}
+
+static bool same_weather(const weather_info_t *a, const weather_info_t *b) {
+  return strcmp(a->description, b->description) == 0 &&
+         strcmp(a->icon, b->icon) == 0 && a->temp == b->temp &&
+         a->feels_like == b->feels_like && a->wind_speed == b->wind_speed &&
+         a->humidity == b->humidity && a->is_valid == b->is_valid;
+}
+
+static app_config_t make_config(void) {
+  app_config_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  strcpy(cfg.ssid, "home");
+  strcpy(cfg.password, "correct horse battery");
+  strcpy(cfg.location, "101010100");
+  cfg.is_fahrenheit = true;
+  cfg.extra_count = 2;
+  strcpy(cfg.extra[0], "101020100");
+  strcpy(cfg.extra[1], "101280601");
+  return cfg;
+}
+
+static bool same_config(const app_config_t *a, const app_config_t *b) {
+  if (strcmp(a->ssid, b->ssid) || strcmp(a->password, b->password) ||
+      strcmp(a->location, b->location) ||
+      a->is_fahrenheit != b->is_fahrenheit || a->extra_count != b->extra_count)
+    return false;
+  for (int i = 0; i < a->extra_count; i++) {
+    if (strcmp(a->extra[i], b->extra[i]))
+      return false;
+  }
+  return true;
+}
+
+static void test_basics(void) {
+  fresh();
+  app_config_t cfg = make_config(), got;
+  CHECK(!app_store_load_config(&got));
+  CHECK(app_store_save_config(&cfg));
+  CHECK(app_store_load_config(&got) && same_config(&cfg, &got));
+
+  weather_place_t place = {"101010100", "39.90421", "116.4074", true}, p;
+  CHECK(app_store_save_place(&place));
+  CHECK(app_store_load_place(&p));
+  CHECK(strcmp(p.location, place.location) == 0 &&
+        strcmp(p.lat, place.lat) == 0 && strcmp(p.lon, place.lon) == 0 &&
+        p.is_valid);
+
+  uint8_t blob[100], back[100];
+  for (size_t i = 0; i < sizeof(blob); i++)
+    blob[i] = i * 37;
+  CHECK(app_store_save_blob("blob", blob, sizeof(blob)));
+  size_t len = sizeof(back) - 1;
+  CHECK(!app_store_load_blob("blob", back, &len));
+  len = sizeof(back);
+  CHECK(app_store_load_blob("blob", back, &len) && len == sizeof(blob));
+  CHECK(memcmp(blob, back, len) == 0);
+
+  // Everything survives a power cycle, the factory reset nothing
+  power_on();
+  CHECK(app_store_load_config(&got) && same_config(&cfg, &got));
+  app_store_factory_reset();
+  power_on();
+  CHECK(!app_store_load_config(&got) && !app_store_load_place(&p));
+  len = sizeof(back);
+  CHECK(!app_store_load_blob("blob", back, &len));
+}
+
+static void set_blob(const char *key, const void *data, size_t len) {
+  nvs_handle_t h;
+  CHECK(nvs_open("weather_cfg", NVS_READWRITE, &h) == ESP_OK);
+  CHECK(nvs_set_blob(h, key, data, len) == ESP_OK);
+  nvs_close(h);
+}
+
+// Records written by newer firmware: fields of every wire type it added
+// are skipped, a schema it bumped reads as missing
+static void test_newer_records(void) {
+  fresh();
+  uint8_t buf[128];
+  app_record_writer_t w;
+  app_record_begin(&w, buf, sizeof(buf), 1);
+  app_record_put_str(&w, 1, "home"); // ssid
+  // Tags 20 to 23, one per wire type
+  static const uint8_t varint[] = {20 << 2 | APP_RECORD_VARINT, 0x96, 0x01};
+  static const uint8_t bytes[] = {21 << 2 | APP_RECORD_BYTES, 3, 'a', 'b',
+                                  'c'};
+  static const uint8_t fixed32[] = {22 << 2 | APP_RECORD_FIXED32, 1, 2, 3, 4};
+  static const uint8_t fixed64[] = {23 << 2 | APP_RECORD_FIXED64, 1, 2, 3, 4,
+                                    5, 6, 7, 8};
+  const struct {
+    const uint8_t *p;
+    size_t n;
+  } unknown[] = {{varint, sizeof(varint)},
+                 {bytes, sizeof(bytes)},
+                 {fixed32, sizeof(fixed32)},
+                 {fixed64, sizeof(fixed64)}};
+  for (int i = 0; i < 4; i++) {
+    memcpy(w.buf + w.len, unknown[i].p, unknown[i].n);
+    w.len += unknown[i].n;
+  }
+  app_record_put_str(&w, 3, "101280601"); // location, after them
+  size_t len = app_record_end(&w);
+  CHECK(len > 0);
+
+  app_record_reader_t r;
+  app_record_field_t f;
+  CHECK(app_record_open(&r, buf, len));
+  int fields = 0;
+  while (app_record_next(&r, &f)) {
+    if (f.tag == 20)
+      CHECK(f.value == 150);
+    if (f.tag == 22)
+      CHECK(f.wire == APP_RECORD_FIXED32 && f.value == 0x04030201);
+    if (f.tag == 23)
+      CHECK(f.wire == APP_RECORD_FIXED64 && f.len == 8 && f.data[7] == 8);
+    fields++;
+  }
+  CHECK(fields == 6 && r.pos == r.len);
+
+  set_blob("app_cfg", buf, len);
+  app_config_t cfg;
+  CHECK(app_store_load_config(&cfg));
+  CHECK(strcmp(cfg.ssid, "home") == 0 &&
+        strcmp(cfg.location, "101280601") == 0);
+
+  // A fixed field cut short is malformed
+  app_record_begin(&w, buf, sizeof(buf), 1);
+  w.buf[w.len++] = 22 << 2 | APP_RECORD_FIXED32;
+  w.buf[w.len++] = 1;
+  len = app_record_end(&w);
+  CHECK(app_record_open(&r, buf, len) && !app_record_next(&r, &f));
+
+  // Schema 2, a migration this firmware does not know
+  app_record_begin(&w, buf, sizeof(buf), 2);
+  app_record_put_str(&w, 1, "home");
+  len = app_record_end(&w);
+  set_blob("app_cfg", buf, len);
+  set_blob("place", buf, len);
+  CHECK(!app_store_load_config(&cfg));
+  weather_place_t place;
+  CHECK(!app_store_load_place(&place));
+}
+
+static void test_staging(void) {
+  fresh();
+  app_store_stats_t st;
+  weather_info_t w0 = make_weather(0), got;
+  CHECK(!app_store_load_weather(&got));
+  CHECK(app_store_stage_weather(&w0)); // the first goes straight to flash
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 1 && st.flash_writes == 1 && st.coalesced == 0);
+
+  // Small moves stay in RTC memory, material ones wait for the interval
+  weather_info_t w = w0;
+  w.temp++;
+  CHECK(app_store_stage_weather(&w));
+  host_time_advance_ms(30 * MIN_MS);
+  weather_info_t w1 = make_weather(1);
+  CHECK(app_store_stage_weather(&w1));
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 1 && st.coalesced == 2);
+  host_time_advance_ms(31 * MIN_MS);
+  weather_info_t w2 = make_weather(2);
+  CHECK(app_store_stage_weather(&w2));
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 2 && st.flash_writes == 2);
+
+  // A material change held back by the interval, then the same weather:
+  // written once the interval has passed
+  weather_info_t w3 = make_weather(3);
+  host_time_advance_ms(10 * MIN_MS);
+  CHECK(app_store_stage_weather(&w3));
+  for (int i = 0; i < 4; i++) {
+    host_time_advance_ms(15 * MIN_MS);
+    CHECK(app_store_stage_weather(&w3));
+  }
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 3 && st.flash_writes == 3 && st.coalesced == 3);
+  host_time_advance_ms(61 * MIN_MS);
+  CHECK(app_store_stage_weather(&w3)); // nothing left to write
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 3);
+
+  // A panic skips the flush, the staged change comes back from RTC memory
+  w = w3;
+  w.humidity += 3;
+  CHECK(app_store_stage_weather(&w));
+  host_panic_reset();
+  boot();
+  app_store_get_stats(&st);
+  CHECK(st.rtc_restored && st.flash_writes == 3 && st.boot_writes == 0);
+  CHECK(app_store_load_weather(&got) && same_weather(&got, &w));
+
+  // Power loss takes RTC memory, flash still has the last write
+  power_on();
+  CHECK(app_store_load_weather(&got) && same_weather(&got, &w3));
+  app_store_get_stats(&st);
+  CHECK(!st.rtc_restored && st.flash_writes == 3);
+
+  // esp_restart() flushes what only RTC memory had
+  w = w3;
+  w.humidity += 4;
+  CHECK(app_store_stage_weather(&w));
+  app_store_get_stats(&st);
+  CHECK(st.boot_writes == 0 && st.coalesced == 1);
+  host_soft_reset();
+  power_on();
+  CHECK(app_store_load_weather(&got) && same_weather(&got, &w));
+  app_store_get_stats(&st);
+  CHECK(st.flash_writes == 4);
+}
+
+typedef struct {
+  weather_info_t acked;   // last write that returned
+  weather_info_t pending; // the one in flight when power went
+  uint32_t budget;        // last budget blob that returned
+  bool done;
+} staging_run_t;
+
+static void save_budget(uint32_t i, uint32_t *acked) {
+  uint32_t rec[3] = {i / 96, i, i * 3};
+  if (app_store_save_blob("budget", rec, sizeof(rec)))
+    *acked = i;
+}
+
+// A poll an hour, each one written, the budget blob every fourth. The cut
+// is counted from the end of the prefill.
+static void run_staging(uint32_t cut, staging_run_t *r) {
+  memset(r, 0, sizeof(*r));
+  fresh();
+  app_config_t cfg = make_config();
+  CHECK(app_store_save_config(&cfg));
+  for (int i = 0; i < PREFILL + STEPS; i++) {
+    if (i == PREFILL && cut)
+      host_flash_cut_at(host_flash_ops() + cut);
+    host_time_advance_ms(61 * MIN_MS);
+    weather_info_t w = make_weather(i);
+    r->pending = w;
+    bool ok = app_store_stage_weather(&w);
+    if (!host_flash_powered())
+      return;
+    CHECK(ok);
+    r->acked = r->pending = w;
+    if (i % 4 == 0)
+      save_budget(i, &r->budget);
+    if (!host_flash_powered())
+      return;
+  }
+  r->done = true;
+}
+
+static void test_staging_power_cuts(void) {
+  staging_run_t r;
+  host_nvs_stats_t ns;
+  run_staging(0, &r);
+  host_nvs_stats(&ns);
+  CHECK(r.done && ns.gc_pages > 0);
+
+  uint32_t cut, gc_cuts = 0;
+  for (cut = 1;; cut++) {
+    host_flash_seed(cut);
+    run_staging(cut, &r);
+    if (r.done)
+      break;
+    host_nvs_stats(&ns);
+    gc_cuts += ns.collecting;
+
+    // Flash has the last acknowledged weather or the one being written,
+    // the rest is untouched
+    power_on();
+    weather_info_t got;
+    CHECK(app_store_load_weather(&got));
+    CHECK(same_weather(&got, &r.acked) || same_weather(&got, &r.pending));
+    app_config_t cfg, want = make_config();
+    CHECK(app_store_load_config(&cfg) && same_config(&cfg, &want));
+    uint32_t rec[3];
+    size_t len = sizeof(rec);
+    CHECK(app_store_load_blob("budget", rec, &len) && len == sizeof(rec));
+    CHECK(rec[1] == r.budget || rec[1] == r.budget + 4);
+
+    // And the store carries on
+    weather_info_t w = make_weather(1000);
+    CHECK(app_store_stage_weather(&w));
+    power_on();
+    CHECK(app_store_load_weather(&got) && same_weather(&got, &w));
+  }
+  printf("store: power cut at each of %u flash operations while staging, "
+         "%u of them during NVS garbage collection\n",
+         (unsigned)(cut - 1), (unsigned)gc_cuts);
+}
+
+static const legacy_config_t LEGACY_CFG = {
+    "home", "correct horse battery", "101010100", true,
+    2,      {"101020100", "101280601"},
+};
+static const legacy_weather_record_t LEGACY_WX = {
+    {"Light Rain", 17, 15, 12, 88, "305", true}, 4321};
+static const legacy_place_t LEGACY_PLACE = {"101010100", "39.90421",
+                                            "116.4074", true};
+
+static void write_legacy(size_t cfg_len) {
+  fresh();
+  nvs_handle_t h;
+  CHECK(nvs_open("weather_cfg", NVS_READWRITE, &h) == ESP_OK);
+  CHECK(nvs_set_blob(h, "app_cfg", &LEGACY_CFG, cfg_len) == ESP_OK);
+  CHECK(nvs_set_blob(h, "weather", &LEGACY_WX, sizeof(LEGACY_WX)) == ESP_OK);
+  CHECK(nvs_set_blob(h, "place", &LEGACY_PLACE, sizeof(LEGACY_PLACE)) ==
+        ESP_OK);
+  nvs_close(h);
+}
+
+static bool is_record(const char *key) {
+  uint8_t buf[512];
+  size_t len = sizeof(buf);
+  app_record_reader_t r;
+  return app_store_load_blob(key, buf, &len) && app_record_open(&r, buf, len);
+}
+
+// What the first boot of the new firmware does
+static void load_all(app_config_t *cfg, weather_info_t *wx,
+                     weather_place_t *place) {
+  CHECK(app_store_load_config(cfg));
+  CHECK(app_store_load_weather(wx));
+  CHECK(app_store_load_place(place));
+}
+
+static void check_legacy(const app_config_t *cfg, const weather_info_t *wx,
+                         const weather_place_t *place, size_t cfg_len) {
+  CHECK(strcmp(cfg->ssid, "home") == 0 &&
+        strcmp(cfg->password, "correct horse battery") == 0 &&
+        strcmp(cfg->location, "101010100") == 0 && cfg->is_fahrenheit);
+  if (cfg_len == LEGACY_CONFIG_V1_LEN) {
+    CHECK(cfg->extra_count == 0);
+  } else {
+    CHECK(cfg->extra_count == 2 && strcmp(cfg->extra[1], "101280601") == 0);
+  }
+  const legacy_weather_t *old = &LEGACY_WX.info;
+  CHECK(strcmp(wx->description, old->description) == 0 &&
+        strcmp(wx->icon, old->icon) == 0 && wx->temp == old->temp &&
+        wx->feels_like == old->feels_like &&
+        wx->wind_speed == old->wind_speed &&
+        wx->humidity == old->humidity && wx->is_valid);
+  CHECK(strcmp(place->location, "101010100") == 0 &&
+        strcmp(place->lat, "39.90421") == 0 &&
+        strcmp(place->lon, "116.4074") == 0 && place->is_valid);
+  app_store_stats_t st;
+  app_store_get_stats(&st);
+  CHECK(st.flash_writes == LEGACY_WX.writes);
+}
+
+static void test_migration_power_cuts(size_t cfg_len) {
+  app_config_t cfg;
+  weather_info_t wx;
+  weather_place_t place;
+  uint32_t cut;
+  for (cut = 1;; cut++) {
+    write_legacy(cfg_len);
+    power_on();
+    host_flash_seed(cut);
+    host_flash_cut_at(host_flash_ops() + cut);
+    // Values come back whether or not their rewrite made it
+    load_all(&cfg, &wx, &place);
+    check_legacy(&cfg, &wx, &place, cfg_len);
+    bool done = host_flash_powered();
+
+    power_on();
+    load_all(&cfg, &wx, &place);
+    check_legacy(&cfg, &wx, &place, cfg_len);
+    CHECK(is_record("app_cfg") && is_record("weather") && is_record("place"));
+    if (done)
+      break;
+  }
+  printf("store: power cut at each of %u flash operations while migrating "
+         "a %zu byte config\n",
+         (unsigned)(cut - 1), cfg_len);
+}
+
+int main(void) {
+  host_partition_add("nvs", NVS_SIZE);
+  test_basics();
+  test_newer_records();
+  test_staging();
+  test_staging_power_cuts();
+  test_migration_power_cuts(LEGACY_CONFIG_V1_LEN);
+  test_migration_power_cuts(sizeof(legacy_config_t));
+  return 0;
+}
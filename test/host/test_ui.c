@@ -0,0 +1,223 @@
+#include "app_hal.h"
+#include "app_ui.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include <string.h>
+
+// app_ui_update_time() once a second on the LVGL fake: which areas each
+// call invalidates, and the pixels a refresh of them flushes as the
+// display stats in app_hal_stats.c count them. Against the clock and date
+// labels both redrawn every second.
+
+#define AREAS_MAX 16
+#define SCR_W 135
+#define CLOCK_Y 30 // LV_ALIGN_TOP_MID, 0, 30
+#define DATE_GAP 10
+
+// app_hal.c drives the panel, these are all app_ui needs from it
+static int s_snapshots;
+void app_hal_lvgl_lock(void) {}
+void app_hal_lvgl_unlock(void) {}
+void app_hal_splash_done(void) {}
+void app_hal_snapshot_request(void) { s_snapshots++; }
+
+// Blank glyphs with Montserrat 48's digit advances, and one advance for
+// each ASCII or wide character in the small fonts
+static const uint8_t s_blank[26 * 35 / 2 + 1];
+
+static bool clock_glyph(const lv_font_t *font, lv_font_glyph_dsc_t *g,
+                        uint32_t letter, uint32_t letter_next) {
+  if (!strchr("0123456789:-", (int)letter) || !letter)
+    return false;
+  *g = (lv_font_glyph_dsc_t){
+      .adv_w = 28, .box_w = 26, .box_h = 35, .ofs_x = 1, .bpp = 4};
+  if (letter == '1')
+    g->adv_w = 20;
+  else if (letter == ':')
+    g->adv_w = 12;
+  else if (letter == '-')
+    g->adv_w = 20;
+  return true;
+}
+
+static bool text_glyph(const lv_font_t *font, lv_font_glyph_dsc_t *g,
+                       uint32_t letter, uint32_t letter_next) {
+  lv_coord_t w = letter < 0x80 ? font->line_height / 2 : font->line_height;
+  *g = (lv_font_glyph_dsc_t){.adv_w = w, .box_w = 1, .box_h = 1, .bpp = 4};
+  return true;
+}
+
+static const uint8_t *glyph_bitmap(const lv_font_t *font, uint32_t letter) {
+  return s_blank;
+}
+
+const lv_font_t lv_font_montserrat_48 = {clock_glyph, glyph_bitmap, 49, 9};
+const lv_font_t lv_font_montserrat_16 = {text_glyph, glyph_bitmap, 18, 4};
+const lv_font_t lv_font_cus_16 = {text_glyph, glyph_bitmap, 18, 4};
+const lv_font_t lv_font_cus_36 = {text_glyph, glyph_bitmap, 40, 8};
+
+// Where the clock and the date label sit for a time, laid out as app_ui
+// does. The date stays where the first clock text put it.
+static lv_area_t clock_area(const char *text) {
+  lv_coord_t w = 0;
+  for (const char *c = text; *c; c++)
+    w += lv_font_get_glyph_width(&lv_font_montserrat_48, (uint8_t)*c, 0);
+  lv_coord_t x = (SCR_W - w) / 2;
+  return (lv_area_t){x, CLOCK_Y, x + w - 1,
+                     CLOCK_Y + lv_font_montserrat_48.line_height - 1};
+}
+
+static lv_area_t date_area(void) {
+  // Placed for "----/--/--", keeps its left edge for "MM/DD 星期X": 6
+  // ASCII characters and 3 wide ones
+  lv_coord_t h = lv_font_cus_16.line_height;
+  lv_coord_t w0 = 10 * (h / 2), w = 6 * (h / 2) + 3 * h;
+  lv_area_t clock = clock_area("--:--");
+  lv_coord_t x = clock.x1 + (lv_area_get_width(&clock) - w0) / 2;
+  lv_coord_t y = clock.y2 + 1 + DATE_GAP;
+  return (lv_area_t){x, y, x + w - 1, y + h - 1};
+}
+
+static bool inside(const lv_area_t *a, const lv_area_t *b) {
+  return a->x1 >= b->x1 && a->y1 >= b->y1 && a->x2 <= b->x2 &&
+         a->y2 <= b->y2;
+}
+
+static uint32_t pixels(const lv_area_t *a) {
+  return (uint32_t)lv_area_get_width(a) * (uint32_t)lv_area_get_height(a);
+}
+
+static lv_area_t s_areas[AREAS_MAX];
+static size_t s_count;
+
+// One second: the update, then LVGL's refresh flushes what it invalidated
+static void tick(const time_info_t *t) {
+  app_ui_update_time(t);
+  s_count = host_lv_take_invalidated(s_areas, AREAS_MAX);
+  CHECK(s_count < AREAS_MAX);
+  for (size_t i = 0; i < s_count; i++)
+    app_hal_stats_flush(&s_areas[i]);
+  host_time_advance_ms(1000);
+  int64_t now = esp_timer_get_time();
+  app_hal_stats_render(now, now);
+}
+
+static void next_second(time_info_t *t) {
+  if (++t->second < 60)
+    return;
+  t->second = 0;
+  if (++t->minute < 60)
+    return;
+  t->minute = 0;
+  if (++t->hour < 24)
+    return;
+  t->hour = 0;
+  t->day++;
+  t->dow = (t->dow + 1) % 7;
+}
+
+static void test_update_time(void) {
+  lv_area_t areas[AREAS_MAX];
+  host_time_set_us(0);
+  app_ui_init();
+  host_lv_take_invalidated(areas, AREAS_MAX);
+  lv_area_t date = date_area();
+
+  // The first time sets both
+  time_info_t t = {.year = 2026, .month = 10, .day = 17, .hour = 12,
+                   .minute = 34, .second = 58, .dow = 6, .is_synced = true};
+  tick(&t);
+  CHECK(s_count > 0);
+  bool date_seen = false;
+  for (size_t i = 0; i < s_count; i++)
+    date_seen |= inside(&date, &s_areas[i]);
+  CHECK(date_seen);
+
+  // Same minute, nothing
+  next_second(&t);
+  tick(&t);
+  CHECK(s_count == 0);
+
+  // 12:34 -> 12:35: the last digit's cell of the clock only
+  next_second(&t);
+  tick(&t);
+  CHECK(t.minute == 35 && s_count == 1);
+  lv_area_t clock = clock_area("12:35");
+  lv_area_t cell = clock;
+  cell.x1 = clock.x2 + 1 - 28;
+  CHECK(inside(&s_areas[0], &cell));
+  lv_area_t overlap;
+  CHECK(!_lv_area_intersect(&overlap, &s_areas[0], &date));
+
+  // 12:59 -> 13:00, three digits
+  t.minute = 59;
+  t.second = 59;
+  tick(&t);
+  s_count = 0;
+  next_second(&t);
+  tick(&t);
+  CHECK(t.hour == 13 && s_count == 3);
+  for (size_t i = 0; i < s_count; i++) {
+    CHECK(inside(&s_areas[i], &clock));
+    CHECK(!_lv_area_intersect(&overlap, &s_areas[i], &date));
+  }
+
+  // Midnight: four digits and the date
+  t.hour = 23;
+  t.minute = 59;
+  t.second = 59;
+  tick(&t);
+  next_second(&t);
+  tick(&t);
+  CHECK(t.day == 18 && s_count == 5);
+  size_t in_date = 0;
+  for (size_t i = 0; i < s_count; i++)
+    in_date += inside(&s_areas[i], &date);
+  CHECK(in_date == 1);
+
+  // No time, no change
+  app_ui_update_time(NULL);
+  CHECK(host_lv_take_invalidated(areas, AREAS_MAX) == 0);
+}
+
+// An hour of seconds from 08:00:00, counted by the display stats
+static void test_pixels(void) {
+  time_info_t t = {.year = 2026, .month = 10, .day = 19, .hour = 7,
+                   .minute = 59, .second = 59, .dow = 1, .is_synced = true};
+  tick(&t);
+  next_second(&t);
+  app_hal_display_stats_t before, st;
+  app_hal_get_display_stats(&before);
+  uint32_t quiet_max = 0;
+  for (int s = 0; s < 3600; s++, next_second(&t)) {
+    tick(&t);
+    app_hal_get_display_stats(&st);
+    if (t.second != 0)
+      quiet_max = LV_MAX(quiet_max, st.pixels_per_s);
+  }
+  CHECK(t.hour == 9 && t.minute == 0 && t.second == 0);
+  uint64_t px = st.pixels - before.pixels;
+  uint32_t flushes = st.flushes - before.flushes;
+  // A second without a new minute flushes nothing
+  CHECK(quiet_max == 0);
+  CHECK(flushes >= 60);
+
+  // Before: both labels set every second, each invalidated whole
+  lv_area_t clock = clock_area("08:00");
+  lv_area_t date = date_area();
+  uint64_t every_second = 3600ull * (pixels(&clock) + pixels(&date));
+  double drop = (double)every_second / (double)px;
+  printf("ui: an hour of seconds flushes %llu px in %lu areas, %.1f px/s, "
+         "peak %lu px/s\n",
+         (unsigned long long)px, (unsigned long)flushes, px / 3600.0,
+         (unsigned long)st.peak_per_s);
+  printf("ui: both labels every second would flush %llu px, %.0fx more\n",
+         (unsigned long long)every_second, drop);
+  CHECK(drop >= 60);
+}
+
+int main(void) {
+  test_update_time();
+  test_pixels();
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include "app_history.h"
+#include "app_store.h"
+#include "host_test.h"
+#include "nvs_flash.h"
+#include <string.h>
+
+// Five years of the weather task's flash traffic on the NVS and history
+// fakes: a poll every 15 minutes staged through RTC memory, a history
+// record per poll, the budget blob hourly, the DNS cache a few times a day,
+// the place after each boot and the config now and then. A restart a week
+// and a power cut a month. The same run writing every change and the
+// budget every poll is the comparison. Sector erases are what wears NOR
+// flash out, typically after 100k cycles.
+
+#define NVS_SIZE 0x6000
+#define HISTORY_SIZE (512 * 1024)
+#define POLL_S (15 * 60)
+#define DAY_POLLS (24 * 4)
+#define YEARS 5
+#define ENDURANCE 100000
+#define T0 1700000000u
+
+typedef struct {
+  host_flash_stats_t nvs, history;
+  host_nvs_stats_t ns;
+  uint32_t weather_writes, max_write_us;
+} wear_t;
+
+static uint32_t s_rng = 12345;
+
+static uint32_t next_rand(void) {
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return s_rng;
+}
+
+static void boot(void) {
+  CHECK(nvs_flash_init() == ESP_OK);
+  app_store_init();
+  app_history_init();
+  weather_place_t place = {"101010100", "39.90421", "116.4074", true};
+  app_store_save_place(&place);
+}
+
+// Conditions drift a little each poll, now and then the sky changes
+static void drift(weather_info_t *w, uint32_t poll) {
+  uint32_t r = next_rand();
+  int hour = poll % DAY_POLLS / 4;
+  int target = 12 + (hour > 4 && hour < 16 ? hour - 4 : 16 - hour % 16) / 2;
+  w->temp += w->temp < target ? r % 3 == 0 : -(r % 3 == 0);
+  w->feels_like = w->temp - (int)(r >> 4) % 3;
+  w->wind_speed = (w->wind_speed + (int)(r >> 8) % 3 - 1 + 20) % 20;
+  w->humidity = 40 + (int)(r >> 12) % 5 + hour;
+  if ((r >> 16) % 24 == 0)
+    strcpy(w->icon, (r >> 20) & 1 ? "101" : "305");
+}
+
+static void simulate(bool staged, wear_t *out) {
+  s_rng = 12345;
+  host_partition_add("nvs", NVS_SIZE);
+  host_partition_add("history", HISTORY_SIZE);
+  host_power_cycle();
+  boot();
+  app_config_t cfg = {"home", "correct horse battery", "101010100"};
+  CHECK(app_store_save_config(&cfg));
+  uint8_t dns[336] = {0};
+  weather_info_t w = {"Clear", 10, 9, 5, 50, "100", true};
+  uint32_t writes = 0, max_write_us = 0;
+
+  for (uint32_t poll = 0; poll < YEARS * 365 * DAY_POLLS; poll++) {
+    host_time_advance_ms(POLL_S * 1000);
+    drift(&w, poll);
+    app_store_stage_weather(&w);
+    if (!staged)
+      app_store_flush_weather();
+    app_history_rec_t rec = {.time = T0 + poll * POLL_S,
+                             .temp = w.temp,
+                             .humidity = w.humidity,
+                             .aqi = APP_HISTORY_NO_AQI};
+    app_history_append(&rec);
+    if (!staged || poll % 4 == 0) {
+      uint32_t budget[3] = {poll / DAY_POLLS, poll % DAY_POLLS * 3, poll};
+      app_store_save_blob("budget", budget, sizeof(budget));
+    }
+    if (poll % (DAY_POLLS / 4) == 0) {
+      dns[poll % sizeof(dns)]++;
+      app_store_save_blob("dns_cache", dns, sizeof(dns));
+    }
+    if (poll % (30 * DAY_POLLS) == 0) {
+      cfg.is_fahrenheit = !cfg.is_fahrenheit;
+      app_store_save_config(&cfg);
+    }
+
+    app_store_stats_t st;
+    if (poll % (7 * DAY_POLLS) == 7 * DAY_POLLS - 1) {
+      app_store_get_stats(&st);
+      writes += st.boot_writes;
+      if (st.max_write_us > max_write_us)
+        max_write_us = st.max_write_us;
+      host_soft_reset();
+      boot();
+    } else if (poll % (30 * DAY_POLLS) == 15 * DAY_POLLS) {
+      // Power goes within the next few flash operations
+      host_flash_cut_at(host_flash_ops() + 1 + next_rand() % 8);
+      for (int i = 0; i < 4 && host_flash_powered(); i++) {
+        host_time_advance_ms(POLL_S * 1000);
+        drift(&w, poll);
+        app_store_stage_weather(&w);
+        app_store_flush_weather();
+        app_store_save_blob("budget", &poll, sizeof(poll));
+      }
+      app_store_get_stats(&st);
+      writes += st.boot_writes;
+      host_power_cycle();
+      boot();
+      // Config and weather survive every cut
+      app_config_t got;
+      CHECK(app_store_load_config(&got) && strcmp(got.ssid, "home") == 0);
+      weather_info_t last;
+      CHECK(app_store_load_weather(&last));
+    }
+  }
+  app_store_stats_t st;
+  app_store_get_stats(&st);
+  out->weather_writes = writes + st.boot_writes;
+  out->max_write_us =
+      st.max_write_us > max_write_us ? st.max_write_us : max_write_us;
+  host_partition_stats("nvs", &out->nvs);
+  host_partition_stats("history", &out->history);
+  host_nvs_stats(&out->ns);
+}
+
+static void report(const char *name, const wear_t *w) {
+  printf("wear: %-13s %6u weather writes, NVS %7.2f MB written, sectors "
+         "erased %u max %.0f mean, %.0f s busy, slowest write %u ms\n",
+         name, (unsigned)w->weather_writes,
+         w->nvs.written_bytes / 1048576.0,
+         (unsigned)w->nvs.max_sector_erases, w->nvs.mean_sector_erases,
+         w->nvs.busy_us / 1e6, (unsigned)(w->max_write_us / 1000));
+  printf("wear: %-13s history %.2f MB written, sectors erased %u max, NVS "
+         "%.0f years to %u erases\n",
+         name, w->history.written_bytes / 1048576.0,
+         (unsigned)w->history.max_sector_erases,
+         YEARS * (double)ENDURANCE / w->nvs.max_sector_erases,
+         (unsigned)ENDURANCE);
+}
+
+int main(void) {
+  wear_t staged, every;
+  simulate(true, &staged);
+  simulate(false, &every);
+  report("staged:", &staged);
+  report("every change:", &every);
+  // NVS spreads erases over its pages, GC keeps up with the churn
+  CHECK(staged.nvs.max_sector_erases <= 2 * staged.nvs.mean_sector_erases + 2);
+  CHECK(staged.ns.gc_pages > 0);
+  // Staging cuts the wear several times over and leaves a wide margin
+  CHECK(staged.nvs.max_sector_erases * 3 < every.nvs.max_sector_erases);
+  CHECK(staged.nvs.max_sector_erases * 20 < ENDURANCE);
+  // The history ring goes around about once a year
+  CHECK(staged.history.max_sector_erases <= YEARS + 2);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Builds the flash city index read by main/app_city.c from a QWeather
+city list CSV (China-City-List-latest.csv or the global list).
+
+Layout, little endian:
+
+  header   64 B   see HEADER below
+  records  count x 28 B: id, name_zh, name_en, adm1_zh, adm2_zh as
+                  offsets into the string pool, then latitude and longitude
+                  in 1e-5 degrees. Sorted by grid cell, then Location ID.
+  strings  NUL-terminated UTF-8, deduplicated
+  keys     one section per lookup key (id, lowercase English name,
+           Chinese name), each sorted by key bytes:
+             u32 block_count, u32 data_len, u32 block_offsets[]
+             blocks of BLOCK entries: varint shared, varint suffix_len,
+             suffix, varint record. The first entry of a block is whole.
+  geo      grid over the bounding box of all cities, row major from the
+           south west corner: i32 lat0, i32 lon0, u32 cell, u16 rows,
+           u16 cols, u32 first_record[rows * cols + 1]. The records of
+           cell i are first_record[i] .. first_record[i + 1] - 1.
+
+Usage: gen_city_index.py <cities.csv> <out.bin>
+"""
+import csv
+import struct
+import sys
+import zlib
+
+MAGIC = b"CIDX"
+VERSION = 2
+BLOCK = 16
+KEY_MAX = 48  # APP_CITY_KEY_MAX, including the terminator
+CELL = 100000  # 1 degree, in 1e-5 degrees
+HEADER = struct.Struct("<4sHHIIIIIIIIII16x")
+RECORD = struct.Struct("<5I2i")
+GRID = struct.Struct("<iiIHH")
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def key_section(keys):
+    """keys: list of (key bytes, record index), front coded in blocks."""
+    keys.sort()
+    data = bytearray()
+    offsets = []
+    prev = b""
+    for i, (key, rec) in enumerate(keys):
+        if len(key) >= KEY_MAX:
+            sys.exit("key too long: %r" % key)
+        if i % BLOCK == 0:
+            offsets.append(len(data))
+            prev = b""
+        shared = 0
+        while shared < min(len(prev), len(key)) and prev[shared] == key[shared]:
+            shared += 1
+        data += varint(shared) + varint(len(key) - shared) + key[shared:]
+        data += varint(rec)
+        prev = key
+    head = struct.pack("<II", len(offsets), len(data))
+    return head + struct.pack("<%dI" % len(offsets), *offsets) + data
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    with open(sys.argv[1], encoding="utf-8-sig", newline="") as f:
+        rows = list(csv.reader(f))
+    # First line is the list version, second the column names
+    cols = {name: i for i, name in enumerate(rows[1])}
+    cities = []
+    for row in rows[2:]:
+        if len(row) < len(cols) or not row[cols["Location_ID"]]:
+            continue
+        cities.append(row)
+
+    def e5(row, col):
+        return round(float(row[cols[col]]) * 100000)
+
+    coords = [(e5(r, "Latitude"), e5(r, "Longitude")) for r in cities]
+    lat0 = min(c[0] for c in coords) // CELL * CELL
+    lon0 = min(c[1] for c in coords) // CELL * CELL
+    rows = (max(c[0] for c in coords) - lat0) // CELL + 1
+    cols_n = (max(c[1] for c in coords) - lon0) // CELL + 1
+
+    def cell(c):
+        return (c[0] - lat0) // CELL * cols_n + (c[1] - lon0) // CELL
+
+    order = sorted(range(len(cities)), key=lambda i: (
+        cell(coords[i]), cities[i][cols["Location_ID"]].encode()))
+    cities = [cities[i] for i in order]
+    coords = [coords[i] for i in order]
+    starts = [0] * (rows * cols_n + 1)
+    for c in coords:
+        starts[cell(c) + 1] += 1
+    for i in range(1, len(starts)):
+        starts[i] += starts[i - 1]
+    geo = GRID.pack(lat0, lon0, CELL, rows, cols_n)
+    geo += struct.pack("<%dI" % len(starts), *starts)
+
+    pool = bytearray()
+    interned = {}
+
+    def intern(s):
+        # The portal sizes its JSON buffer on this
+        if len(s.encode()) >= KEY_MAX:
+            sys.exit("string too long: %r" % s)
+        if s not in interned:
+            interned[s] = len(pool)
+            pool.extend(s.encode() + b"\0")
+        return interned[s]
+
+    records = bytearray()
+    id_keys, en_keys, zh_keys = [], [], []
+    for i, r in enumerate(cities):
+        cid = r[cols["Location_ID"]]
+        en = r[cols["Location_Name_EN"]]
+        zh = r[cols["Location_Name_ZH"]]
+        records += RECORD.pack(intern(cid), intern(zh), intern(en),
+                               intern(r[cols["Adm1_Name_ZH"]]),
+                               intern(r[cols["Adm2_Name_ZH"]]), *coords[i])
+        id_keys.append((cid.encode(), i))
+        en_keys.append((en.lower().encode(), i))
+        zh_keys.append((zh.encode(), i))
+
+    sections = [records, pool, key_section(id_keys), key_section(en_keys),
+                key_section(zh_keys), geo]
+    offsets = []
+    pos = HEADER.size
+    for s in sections:
+        pos = (pos + 3) & ~3
+        offsets.append(pos)
+        pos += len(s)
+    body = bytearray()
+    for off, s in zip(offsets, sections):
+        body += bytes(off - HEADER.size - len(body)) + s
+    crc = zlib.crc32(body)
+    header = HEADER.pack(MAGIC, VERSION, BLOCK, len(cities), offsets[0],
+                         offsets[1], len(pool), offsets[2], offsets[3],
+                         offsets[4], HEADER.size + len(body), crc,
+                         offsets[5])
+    with open(sys.argv[2], "wb") as f:
+        f.write(header + body)
+    print("City index: %d cities, %d bytes" % (len(cities),
+                                                HEADER.size + len(body)))
+
+
+if __name__ == "__main__":
+    main()